@@ -44,6 +44,7 @@
 #include "csync_private.h"
 #include "csync_exclude.h"
 #include "csync_statedb.h"
+#include "csync_statedb_index.h"
 #include "csync_time.h"
 #include "csync_util.h"
 #include "csync_misc.h"
@@ -56,37 +57,17 @@
 
 #include "csync_log.h"
 #include "csync_rename.h"
+#include "csync_update_prefetch.h"
 #include "c_jhash.h"
 
-static int _key_cmp(const void *key, const void *data) {
-  uint64_t a;
-  csync_file_stat_t *b;
-
-  a = *(uint64_t *) (key);
-  b = (csync_file_stat_t *) data;
-
-  if (a < b->phash) {
-    return -1;
-  } else if (a > b->phash) {
-    return 1;
-  }
-
-  return 0;
+static uint64_t _data_key(const void *data) {
+  return ((const csync_file_stat_t *) data)->phash;
 }
 
-static int _data_cmp(const void *key, const void *data) {
-  csync_file_stat_t *a, *b;
-
-  a = (csync_file_stat_t *) key;
-  b = (csync_file_stat_t *) data;
-
-  if (a->phash < b->phash) {
-    return -1;
-  } else if (a->phash > b->phash) {
-    return 1;
-  }
-
-  return 0;
+/* The trees are walked in path order, parents before their children */
+static int _data_cmp(const void *a, const void *b) {
+  return strcmp(((const csync_file_stat_t *) a)->path,
+                ((const csync_file_stat_t *) b)->path);
 }
 
 void csync_create(CSYNC **csync, const char *local) {
@@ -111,6 +92,8 @@ void csync_create(CSYNC **csync, const char *local) {
 
   ctx->ignore_hidden_files = true;
 
+  ctx->local_discovery_threads = 1;
+
   *csync = ctx;
 }
 
@@ -128,8 +111,8 @@ void csync_init(CSYNC *ctx, const char *db_file) {
   SAFE_FREE(ctx->statedb.file);
   ctx->statedb.file = c_strdup(db_file);
 
-  c_rbtree_create(&ctx->local.tree, _key_cmp, _data_cmp);
-  c_rbtree_create(&ctx->remote.tree, _key_cmp, _data_cmp);
+  c_hashindex_create(&ctx->local.tree, _data_key, _data_cmp);
+  c_hashindex_create(&ctx->remote.tree, _data_key, _data_cmp);
 
   ctx->remote.root_perms = 0;
 
@@ -157,6 +140,10 @@ int csync_update(CSYNC *ctx) {
 
   ctx->status_code = CSYNC_STATUS_OK;
 
+  if (ctx->statedb_in_memory_index && !ctx->db_is_empty) {
+      csync_statedb_index_load(ctx);
+  }
+
   csync_memstat_check();
 
   if (!ctx->excludes) {
@@ -168,7 +155,9 @@ int csync_update(CSYNC *ctx) {
   ctx->current = LOCAL_REPLICA;
   ctx->replica = ctx->local.type;
 
+  csync_local_prefetch_start(ctx, ctx->local_discovery_threads);
   rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+  csync_local_prefetch_stop(ctx);
   if (rc < 0) {
     if(ctx->status_code == CSYNC_STATUS_OK) {
         ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_UPDATE_ERROR);
@@ -180,7 +169,7 @@ int csync_update(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for local replica took %.2f seconds walking %zu files.",
-            c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+            c_secdiff(finish, start), c_hashindex_size(ctx->local.tree));
   csync_memstat_check();
 
   /* update detection for remote replica */
@@ -201,7 +190,7 @@ int csync_update(CSYNC *ctx) {
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for remote replica took %.2f seconds "
             "walking %zu files.",
-            c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+            c_secdiff(finish, start), c_hashindex_size(ctx->remote.tree));
   csync_memstat_check();
 
   ctx->status |= CSYNC_STATUS_UPDATE;
@@ -240,7 +229,7 @@ int csync_reconcile(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Reconciliation for local replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+      c_secdiff(finish, start), c_hashindex_size(ctx->local.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -261,7 +250,7 @@ int csync_reconcile(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Reconciliation for remote replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+      c_secdiff(finish, start), c_hashindex_size(ctx->remote.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -286,11 +275,11 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
     int rc = 0;
     csync_file_stat_t *cur         = NULL;
     CSYNC *ctx                     = NULL;
-    c_rbtree_visit_func *visitor   = NULL;
+    csync_treewalk_visit_func *visitor = NULL;
     _csync_treewalk_context *twctx = NULL;
     TREE_WALK_FILE trav;
-    c_rbtree_t *other_tree = NULL;
-    c_rbnode_t *other_node = NULL;
+    c_hashindex_t *other_tree = NULL;
+    csync_file_stat_t *other_stat = NULL;
 
     cur = (csync_file_stat_t *) obj;
     ctx = (CSYNC *) data;
@@ -311,9 +300,9 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         break;
     }
 
-    other_node = c_rbtree_find(other_tree, &cur->phash);
+    other_stat = c_hashindex_find(other_tree, cur->phash);
 
-    if (!other_node) {
+    if (!other_stat) {
         /* Check the renamed path as well. */
         int len;
         uint64_t h = 0;
@@ -322,12 +311,12 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         if (!c_streq(renamed_path, cur->path)) {
             len = strlen( renamed_path );
             h = c_jhash64((uint8_t *) renamed_path, len, 0);
-            other_node = c_rbtree_find(other_tree, &h);
+            other_stat = c_hashindex_find(other_tree, h);
         }
         SAFE_FREE(renamed_path);
     }
 
-    if (!other_node) {
+    if (!other_stat) {
         /* Check the source path as well. */
         int len;
         uint64_t h = 0;
@@ -336,7 +325,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         if (!c_streq(renamed_path, cur->path)) {
             len = strlen( renamed_path );
             h = c_jhash64((uint8_t *) renamed_path, len, 0);
-            other_node = c_rbtree_find(other_tree, &h);
+            other_stat = c_hashindex_find(other_tree, h);
         }
         SAFE_FREE(renamed_path);
     }
@@ -358,7 +347,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         return 0;
     }
 
-    visitor = (c_rbtree_visit_func*)(twctx->user_visitor);
+    visitor = twctx->user_visitor;
     if (visitor != NULL) {
       trav.path         = cur->path;
       trav.size         = cur->size;
@@ -379,8 +368,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
       trav.checksum = cur->checksum;
       trav.checksumTypeId = cur->checksumTypeId;
 
-      if( other_node ) {
-          csync_file_stat_t *other_stat = (csync_file_stat_t*)other_node->data;
+      if( other_stat ) {
           trav.other.etag = other_stat->etag;
           trav.other.file_id = other_stat->file_id;
           trav.other.instruction = other_stat->instruction;
@@ -397,8 +385,10 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
       rc = (*visitor)(&trav, twctx->userdata);
       cur->instruction = trav.instruction;
       if (trav.etag != cur->etag) { // FIXME It would be nice to have this documented
-          SAFE_FREE(cur->etag);
-          cur->etag = c_strdup(trav.etag);
+          if (!cur->in_arena) {
+              SAFE_FREE(cur->etag);
+          }
+          cur->etag = csync_file_stat_strdup(ctx, cur, trav.etag);
       }
 
       return rc;
@@ -411,11 +401,11 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
  * treewalk function, called from its wrappers below.
  *
  * it encapsulates the user visitor function, the filter and the userdata
- * into a treewalk_context structure and calls the rb treewalk function,
+ * into a treewalk_context structure and calls the tree walk function,
  * which calls the local _csync_treewalk_visitor in this module.
  * The user visitor is called from there.
  */
-static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_func *visitor, int filter)
+static int _csync_walk_tree(CSYNC *ctx, c_hashindex_t *tree, csync_treewalk_visit_func *visitor, int filter)
 {
     _csync_treewalk_context tw_ctx;
     int rc = -1;
@@ -436,7 +426,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
 
     ctx->callbacks.userdata = &tw_ctx;
 
-    rc = c_rbtree_walk(tree, (void*) ctx, _csync_treewalk_visitor);
+    rc = c_hashindex_walk(tree, (void*) ctx, _csync_treewalk_visitor);
     if( rc < 0 ) {
       if( ctx->status_code == CSYNC_STATUS_OK )
           ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_TREE_ERROR);
@@ -451,7 +441,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
  */
 int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_hashindex_t *tree = NULL;
     int rc = -1;
 
     if(ctx != NULL) {
@@ -470,7 +460,7 @@ int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int
  */
 int csync_walk_local_tree(CSYNC *ctx, csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_hashindex_t *tree = NULL;
     int rc = -1;
 
     if (ctx != NULL) {
@@ -495,20 +485,24 @@ static void _tree_destructor(void *data) {
  * used by csync_commit and csync_destroy */
 static void _csync_clean_ctx(CSYNC *ctx)
 {
-    /* destroy the rbtrees */
-    if (c_rbtree_size(ctx->local.tree) > 0) {
-        c_rbtree_destroy(ctx->local.tree, _tree_destructor);
-    }
-
-    if (c_rbtree_size(ctx->remote.tree) > 0) {
-        c_rbtree_destroy(ctx->remote.tree, _tree_destructor);
+    /* destroy the trees, the entries in the arena go away with it below */
+    c_hashindex_destroy(ctx->local.tree, _tree_destructor);
+    c_hashindex_destroy(ctx->remote.tree, _tree_destructor);
+    if (ctx->file_stat_arena) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Releasing %zu KB of file records",
+                  c_arena_size(ctx->file_stat_arena) / 1024);
+        c_arena_free(ctx->file_stat_arena);
+        ctx->file_stat_arena = NULL;
     }
 
     csync_rename_destroy(ctx);
+    csync_statedb_index_free(ctx);
 
     /* free memory */
-    c_rbtree_free(ctx->local.tree);
-    c_rbtree_free(ctx->remote.tree);
+    c_hashindex_free(ctx->local.tree);
+    c_hashindex_free(ctx->remote.tree);
+    ctx->local.tree = NULL;
+    ctx->remote.tree = NULL;
 
     SAFE_FREE(ctx->remote.root_perms);
 }
@@ -522,6 +516,11 @@ int csync_commit(CSYNC *ctx) {
 
   ctx->status_code = CSYNC_STATUS_OK;
 
+  if (ctx->statedb.borrowed) {
+    int locked = csync_statedb_lock(ctx);
+    csync_statedb_release_connection(ctx);
+    csync_statedb_unlock(ctx, locked);
+  }
   if (ctx->statedb.db != NULL
       && csync_statedb_close(ctx) < 0) {
     CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "ERR: closing of statedb failed.");
@@ -537,8 +536,8 @@ int csync_commit(CSYNC *ctx) {
 
 
   /* Create new trees */
-  c_rbtree_create(&ctx->local.tree, _key_cmp, _data_cmp);
-  c_rbtree_create(&ctx->remote.tree, _key_cmp, _data_cmp);
+  c_hashindex_create(&ctx->local.tree, _data_key, _data_cmp);
+  c_hashindex_create(&ctx->remote.tree, _data_key, _data_cmp);
 
 
   ctx->status = CSYNC_STATUS_INIT;
@@ -557,6 +556,11 @@ int csync_destroy(CSYNC *ctx) {
   }
   ctx->status_code = CSYNC_STATUS_OK;
 
+  if (ctx->statedb.borrowed) {
+    int locked = csync_statedb_lock(ctx);
+    csync_statedb_release_connection(ctx);
+    csync_statedb_unlock(ctx, locked);
+  }
   if (ctx->statedb.db != NULL
       && csync_statedb_close(ctx) < 0) {
     CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "ERR: closing of statedb failed.");
@@ -663,9 +667,53 @@ int  csync_abort_requested(CSYNC *ctx)
   }
 }
 
-void csync_file_stat_free(csync_file_stat_t *st)
+csync_file_stat_t *csync_file_stat_new(CSYNC *ctx, size_t pathlen)
 {
+  csync_file_stat_t *st = NULL;
+  size_t size = sizeof(csync_file_stat_t) + pathlen + 1;
+
+  if (ctx == NULL) {
+    return c_malloc(size);
+  }
+
+  if (ctx->file_stat_arena == NULL) {
+    ctx->file_stat_arena = c_arena_new();
+    if (ctx->file_stat_arena == NULL) {
+      return NULL;
+    }
+  }
+  st = c_arena_alloc(ctx->file_stat_arena, size);
   if (st) {
+    st->in_arena = 1;
+  }
+  return st;
+}
+
+char *csync_file_stat_strdup(CSYNC *ctx, const csync_file_stat_t *st, const char *str)
+{
+  if (str == NULL) {
+    return NULL;
+  }
+  if (st->in_arena) {
+    return c_arena_strdup(ctx->file_stat_arena, str);
+  }
+  return c_strdup(str);
+}
+
+char *csync_file_stat_intern(CSYNC *ctx, const csync_file_stat_t *st, const char *str)
+{
+  if (str == NULL) {
+    return NULL;
+  }
+  if (st->in_arena) {
+    return (char *) c_arena_intern(ctx->file_stat_arena, str);
+  }
+  return c_strdup(str);
+}
+
+void csync_file_stat_free(csync_file_stat_t *st)
+{
+  if (st && !st->in_arena) {
     SAFE_FREE(st->directDownloadUrl);
     SAFE_FREE(st->directDownloadCookies);
     SAFE_FREE(st->etag);
@@ -212,7 +212,8 @@ bool csync_is_windows_reserved_word(const char* filename) {
   return false;
 }
 
-static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const char *path, int filetype, bool check_leading_dirs) {
+static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const csync_exclude_matcher_t *matcher,
+                                                 const char *path, int filetype, bool check_leading_dirs) {
     size_t i = 0;
     const char *bname = NULL;
     size_t blen = 0;
@@ -315,6 +316,11 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const ch
         SAFE_FREE(conflict);
     }
 
+    if (matcher) {
+        match = csync_exclude_matcher_match(matcher, path, bname, filetype, check_leading_dirs);
+        goto out;
+    }
+
     if( ! excludes ) {
         goto out;
     }
@@ -416,10 +422,18 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const ch
 }
 
 CSYNC_EXCLUDE_TYPE csync_excluded_traversal(c_strlist_t *excludes, const char *path, int filetype) {
-  return _csync_excluded_common(excludes, path, filetype, false);
+  return _csync_excluded_common(excludes, NULL, path, filetype, false);
 }
 
 CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx(c_strlist_t *excludes, const char *path, int filetype) {
-  return _csync_excluded_common(excludes, path, filetype, true);
+  return _csync_excluded_common(excludes, NULL, path, filetype, true);
+}
+
+CSYNC_EXCLUDE_TYPE csync_excluded_traversal_matcher(const csync_exclude_matcher_t *matcher, const char *path, int filetype) {
+  return _csync_excluded_common(NULL, matcher, path, filetype, false);
+}
+
+CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx_matcher(const csync_exclude_matcher_t *matcher, const char *path, int filetype) {
+  return _csync_excluded_common(NULL, matcher, path, filetype, true);
 }
 
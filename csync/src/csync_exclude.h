@@ -36,6 +36,8 @@ enum csync_exclude_type_e {
 };
 typedef enum csync_exclude_type_e CSYNC_EXCLUDE_TYPE;
 
+struct csync_exclude_matcher_s; typedef struct csync_exclude_matcher_s csync_exclude_matcher_t;
+
 #ifdef WITH_TESTING
 int OCSYNC_EXPORT _csync_exclude_add(c_strlist_t **inList, const char *string);
 #endif
@@ -75,6 +77,36 @@ CSYNC_EXCLUDE_TYPE csync_excluded_traversal(c_strlist_t *excludes, const char *p
  * @return
  */
 CSYNC_EXCLUDE_TYPE OCSYNC_EXPORT csync_excluded_no_ctx(c_strlist_t *excludes, const char *path, int filetype);
+
+/**
+ * @brief Compile an exclude list for faster matching.
+ *
+ * The matcher gives the same results as the list but does not run fnmatch
+ * for every pattern. It does not reference the list, it has to be compiled
+ * again after the list changed.
+ *
+ * @param excludes  The exclude list, can be NULL.
+ *
+ * @return  The matcher, NULL if the platform has to evaluate the list.
+ */
+csync_exclude_matcher_t OCSYNC_EXPORT *csync_exclude_matcher_new(c_strlist_t *excludes);
+
+void OCSYNC_EXPORT csync_exclude_matcher_free(csync_exclude_matcher_t *matcher);
+
+/**
+ * @brief Like csync_excluded_traversal(), with a compiled exclude list.
+ */
+CSYNC_EXCLUDE_TYPE csync_excluded_traversal_matcher(const csync_exclude_matcher_t *matcher, const char *path, int filetype);
+
+/**
+ * @brief Like csync_excluded_no_ctx(), with a compiled exclude list.
+ */
+CSYNC_EXCLUDE_TYPE OCSYNC_EXPORT csync_excluded_no_ctx_matcher(const csync_exclude_matcher_t *matcher, const char *path, int filetype);
+
+/* Evaluates the patterns of the matcher only, see _csync_excluded_common() */
+CSYNC_EXCLUDE_TYPE OCSYNC_EXPORT csync_exclude_matcher_match(const csync_exclude_matcher_t *matcher,
+                                                             const char *path, const char *bname,
+                                                             int filetype, bool check_leading_dirs);
 #endif /* _CSYNC_EXCLUDE_H */
 
 /**
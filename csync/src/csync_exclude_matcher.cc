@@ -0,0 +1,412 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+extern "C" {
+#include "config_csync.h"
+#include "c_lib.h"
+#include "csync.h"
+#include "csync_exclude.h"
+#include "csync_misc.h"
+}
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * The exclude patterns evaluated by _csync_excluded_common() in the order of
+ * the list: the first pattern that matches decides the type. The matcher
+ * sorts the patterns into structures which can answer "what is the first
+ * pattern matching this name" without running fnmatch for every pattern:
+ *
+ *  - literals ("desktop.ini") are looked up in a hash map,
+ *  - prefixes ("._*") and suffixes ("*.part") in two tries,
+ *  - other patterns made of literals and '*' by a linear glob match,
+ *  - patterns with '?', '[' or '\' still go through csync_fnmatch.
+ *
+ * Each structure returns the lowest pattern index that matches, so the
+ * result is the same as the one of the pattern loop.
+ */
+
+namespace {
+
+const size_t NoMatch = static_cast<size_t>(-1);
+
+/* A byte trie, every node remembers the first pattern that ends there. */
+class Trie {
+public:
+    Trie() : _nodes(1) {}
+
+    void insert(const std::string &key, size_t index) {
+        size_t node = 0;
+        for (size_t i = 0; i < key.size(); ++i) {
+            size_t next = child(node, key[i]);
+            if (next == 0) {
+                next = _nodes.size();
+                _nodes[node].children.push_back(std::make_pair(key[i], next));
+                _nodes.push_back(Node());
+            }
+            node = next;
+        }
+        if (index < _nodes[node].index) {
+            _nodes[node].index = index;
+        }
+    }
+
+    bool empty() const { return _nodes.size() == 1 && _nodes[0].index == NoMatch; }
+
+    /* Lowest index of a key which is a prefix of str (read backwards if reverse is set) */
+    size_t match(const char *str, size_t len, bool reverse, size_t best) const {
+        size_t node = 0;
+        size_t i = 0;
+        for (;;) {
+            if (_nodes[node].index < best) {
+                best = _nodes[node].index;
+            }
+            if (i == len) {
+                break;
+            }
+            node = child(node, reverse ? str[len - 1 - i] : str[i]);
+            if (node == 0) {
+                break;
+            }
+            ++i;
+        }
+        return best;
+    }
+
+private:
+    struct Node {
+        Node() : index(NoMatch) {}
+        std::vector<std::pair<char, size_t> > children;
+        size_t index;
+    };
+
+    size_t child(size_t node, char c) const {
+        const std::vector<std::pair<char, size_t> > &children = _nodes[node].children;
+        for (size_t i = 0; i < children.size(); ++i) {
+            if (children[i].first == c) {
+                return children[i].second;
+            }
+        }
+        return 0;
+    }
+
+    std::vector<Node> _nodes;
+};
+
+/* A pattern made of literal parts separated by '*' */
+struct Glob {
+    size_t index;
+    bool anchoredStart;
+    bool anchoredEnd;
+    std::vector<std::string> parts;
+
+    static bool hasSlash(const char *begin, const char *end) {
+        return memchr(begin, '/', end - begin) != NULL;
+    }
+
+    /* Same as fnmatch with flags 0 or FNM_PATHNAME, where '*' doesn't match '/'.
+     * Taking the leftmost occurrence of each part is enough since '*' is the
+     * only wildcard. */
+    bool match(const char *str, size_t len, bool pathname) const {
+        const char *pos = str;
+        const char *end = str + len;
+        size_t first = 0;
+        size_t last = parts.size();
+
+        if (anchoredStart) {
+            const std::string &part = parts[first++];
+            if (len < part.size() || memcmp(str, part.data(), part.size()) != 0) {
+                return false;
+            }
+            pos += part.size();
+        }
+        if (anchoredEnd && last > first) {
+            const std::string &part = parts[--last];
+            if (end - pos < static_cast<ptrdiff_t>(part.size())
+                    || memcmp(end - part.size(), part.data(), part.size()) != 0) {
+                return false;
+            }
+            end -= part.size();
+        } else if (anchoredEnd && pos != end) {
+            /* Only one part and no '*' at all, the whole string must match */
+            return false;
+        }
+
+        for (size_t i = first; i < last; ++i) {
+            const std::string &part = parts[i];
+            const char *found = NULL;
+            for (const char *p = pos; end - p >= static_cast<ptrdiff_t>(part.size()); ++p) {
+                if (memcmp(p, part.data(), part.size()) == 0) {
+                    found = p;
+                    break;
+                }
+            }
+            if (!found || (pathname && hasSlash(pos, found))) {
+                return false;
+            }
+            pos = found + part.size();
+        }
+
+        return !(pathname && hasSlash(pos, end));
+    }
+};
+
+/* A pattern csync_fnmatch has to evaluate. prefix is its leading literal part. */
+struct Fallback {
+    size_t index;
+    std::string pattern;
+    std::string prefix;
+};
+
+/* Patterns that are evaluated under the same conditions */
+class PatternSet {
+public:
+    /* Tries only answer flag-less matches, they are not used for the
+     * patterns which are also matched against whole paths with FNM_PATHNAME. */
+    explicit PatternSet(bool useTries) : _useTries(useTries) {}
+
+    void add(const std::string &pattern, size_t index) {
+        if (pattern.empty()) {
+            // Only matches an empty name
+            addLiteral(pattern, index);
+            return;
+        }
+        if (pattern.find_first_of("?[\\") != std::string::npos) {
+            Fallback fallback;
+            fallback.index = index;
+            fallback.pattern = pattern;
+            fallback.prefix = pattern.substr(0, pattern.find_first_of("*?[\\"));
+            _fallbacks.push_back(fallback);
+            return;
+        }
+
+        Glob glob;
+        glob.index = index;
+        glob.anchoredStart = pattern[0] != '*';
+        glob.anchoredEnd = pattern[pattern.size() - 1] != '*';
+        size_t start = 0;
+        for (;;) {
+            size_t star = pattern.find('*', start);
+            std::string part = pattern.substr(start, star == std::string::npos ? std::string::npos : star - start);
+            if (!part.empty()) {
+                glob.parts.push_back(part);
+            }
+            if (star == std::string::npos) {
+                break;
+            }
+            start = star + 1;
+        }
+
+        if (glob.parts.size() == 1 && glob.anchoredStart && glob.anchoredEnd) {
+            addLiteral(glob.parts[0], index);
+        } else if (_useTries && glob.parts.empty()) {
+            /* Only stars, matches everything */
+            _prefixes.insert(std::string(), index);
+        } else if (_useTries && glob.parts.size() == 1 && glob.anchoredStart) {
+            _prefixes.insert(glob.parts[0], index);
+        } else if (_useTries && glob.parts.size() == 1 && glob.anchoredEnd) {
+            _suffixes.insert(std::string(glob.parts[0].rbegin(), glob.parts[0].rend()), index);
+        } else {
+            _globs.push_back(glob);
+        }
+    }
+
+    /* Lowest index of a pattern matching str that is smaller than best */
+    size_t match(const char *str, size_t len, int flags, size_t best) const {
+        const bool pathname = flags & FNM_PATHNAME;
+        assert(!pathname || !_useTries);
+
+        if (!_literals.empty()) {
+            std::unordered_map<std::string, size_t>::const_iterator it = _literals.find(std::string(str, len));
+            if (it != _literals.end() && it->second < best) {
+                best = it->second;
+            }
+        }
+        if (!_prefixes.empty()) {
+            best = _prefixes.match(str, len, false, best);
+        }
+        if (!_suffixes.empty()) {
+            best = _suffixes.match(str, len, true, best);
+        }
+        for (size_t i = 0; i < _globs.size() && _globs[i].index < best; ++i) {
+            if (_globs[i].match(str, len, pathname)) {
+                best = _globs[i].index;
+            }
+        }
+        for (size_t i = 0; i < _fallbacks.size() && _fallbacks[i].index < best; ++i) {
+            const Fallback &fallback = _fallbacks[i];
+            if (len < fallback.prefix.size()
+                    || memcmp(str, fallback.prefix.data(), fallback.prefix.size()) != 0) {
+                continue;
+            }
+            if (csync_fnmatch(fallback.pattern.c_str(), str, flags) == 0) {
+                best = fallback.index;
+            }
+        }
+        return best;
+    }
+
+private:
+    void addLiteral(const std::string &literal, size_t index) {
+        std::pair<std::unordered_map<std::string, size_t>::iterator, bool> it =
+                _literals.insert(std::make_pair(literal, index));
+        if (!it.second && index < it.first->second) {
+            it.first->second = index;
+        }
+    }
+
+    bool _useTries;
+    std::unordered_map<std::string, size_t> _literals;
+    Trie _prefixes;
+    Trie _suffixes;
+    std::vector<Glob> _globs;
+    std::vector<Fallback> _fallbacks;
+};
+
+}
+
+struct csync_exclude_matcher_s {
+    csync_exclude_matcher_s()
+        : pathDirsOnly(false), path(false), nameDirsOnly(true), name(true) {}
+
+    /* Patterns containing a '/', with and without a trailing '/' */
+    PatternSet pathDirsOnly;
+    PatternSet path;
+    /* Patterns without a '/' */
+    PatternSet nameDirsOnly;
+    PatternSet name;
+    /* Patterns starting with ']' */
+    std::vector<bool> remove;
+
+    CSYNC_EXCLUDE_TYPE type(size_t index, int filetype) const {
+        if (index == NoMatch) {
+            return CSYNC_NOT_EXCLUDED;
+        }
+        if (remove[index] && filetype == CSYNC_FTW_TYPE_FILE) {
+            return CSYNC_FILE_EXCLUDE_AND_REMOVE;
+        }
+        return CSYNC_FILE_EXCLUDE_LIST;
+    }
+};
+
+extern "C" {
+
+csync_exclude_matcher_t *csync_exclude_matcher_new(c_strlist_t *excludes)
+{
+#ifndef HAVE_FNMATCH
+    /* PathMatchSpec has its own rules, keep evaluating the list */
+    (void) excludes;
+    return NULL;
+#else
+    csync_exclude_matcher_t *matcher = new csync_exclude_matcher_s;
+    size_t count = excludes ? excludes->count : 0;
+
+    matcher->remove.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        std::string pattern = excludes->vector[i];
+        if (pattern.empty()) {
+            continue;
+        }
+        if (pattern[0] == ']') {
+            pattern.erase(0, 1);
+            matcher->remove[i] = true;
+        }
+        bool dirsOnly = false;
+        if (!pattern.empty() && pattern[pattern.size() - 1] == '/') {
+            pattern.erase(pattern.size() - 1);
+            dirsOnly = true;
+        }
+        if (pattern.find('/') != std::string::npos) {
+            (dirsOnly ? matcher->pathDirsOnly : matcher->path).add(pattern, i);
+        } else {
+            (dirsOnly ? matcher->nameDirsOnly : matcher->name).add(pattern, i);
+        }
+    }
+    return matcher;
+#endif
+}
+
+void csync_exclude_matcher_free(csync_exclude_matcher_t *matcher)
+{
+    delete matcher;
+}
+
+CSYNC_EXCLUDE_TYPE csync_exclude_matcher_match(const csync_exclude_matcher_t *matcher,
+                                               const char *path, const char *bname,
+                                               int filetype, bool check_leading_dirs)
+{
+    size_t best = NoMatch;
+    const bool isFile = filetype == CSYNC_FTW_TYPE_FILE;
+    const bool isDir = filetype == CSYNC_FTW_TYPE_DIR;
+    const size_t pathlen = strlen(path);
+
+    /* Patterns with a '/' are compared to the whole path */
+    if (isDir) {
+        best = matcher->pathDirsOnly.match(path, pathlen, FNM_PATHNAME, best);
+    }
+    best = matcher->path.match(path, pathlen, FNM_PATHNAME, best);
+
+    if (!check_leading_dirs) {
+        const size_t blen = strlen(bname);
+        if (!isFile) {
+            best = matcher->pathDirsOnly.match(bname, blen, 0, best);
+            best = matcher->nameDirsOnly.match(bname, blen, 0, best);
+        }
+        best = matcher->path.match(bname, blen, 0, best);
+        best = matcher->name.match(bname, blen, 0, best);
+        return matcher->type(best, filetype);
+    }
+
+    /* The same components, in the same order, as _csync_excluded_common():
+     * for "/foo/bar/fi" that's 'fi', '/foo/bar', 'bar', '/foo', 'foo', ''. */
+    std::vector<std::string> components;
+    size_t segmentEnd = pathlen;
+    for (size_t i = pathlen; ; --i) {
+        if (i != 0 && path[i - 1] != '/') {
+            continue;
+        }
+        if (i < segmentEnd) {
+            components.push_back(std::string(path + i, segmentEnd - i));
+        }
+        if (i == 0) {
+            break;
+        }
+        segmentEnd = i - 1;
+        components.push_back(std::string(path, segmentEnd));
+    }
+
+    for (size_t j = 0; j < components.size(); ++j) {
+        const std::string &component = components[j];
+        // a pattern for directories only skips the first entry of a file, usually its name
+        if (j > 0 || !isFile) {
+            best = matcher->pathDirsOnly.match(component.c_str(), component.size(), 0, best);
+            best = matcher->nameDirsOnly.match(component.c_str(), component.size(), 0, best);
+        }
+        best = matcher->path.match(component.c_str(), component.size(), 0, best);
+        best = matcher->name.match(component.c_str(), component.size(), 0, best);
+    }
+    return matcher->type(best, filetype);
+}
+
+}
@@ -90,6 +90,11 @@ struct csync_s {
       /* hooks for checking the white list (uses the update_callback_userdata) */
       int (*checkSelectiveSyncBlackListHook)(void*, const char*);
       int (*checkSelectiveSyncNewFolderHook)(void*, const char* /* path */, const char* /* remotePerm */);
+      /* hook telling if a local directory has changes and must be read from disk
+       * (uses the update_callback_userdata). If it returns 0, the contents below
+       * the directory are read from the statedb. Everything is read from disk if
+       * the hook is not set. */
+      int (*checkLocalDiscoveryHook)(void*, const char* /* path */);
 
 
       csync_vio_opendir_hook remote_opendir_hook;
@@ -103,6 +108,8 @@ struct csync_s {
 
   } callbacks;
   c_strlist_t *excludes;
+  /* excludes compiled for matching, used instead of the list if set */
+  struct csync_exclude_matcher_s *exclude_matcher;
   
   struct {
     char *file;
@@ -113,17 +120,29 @@ struct csync_s {
     sqlite3_stmt* by_fileid_stmt;
     sqlite3_stmt* by_inode_stmt;
 
+    /* set if db belongs to the client, see csync_statedb_borrow_connection() */
+    int borrowed;
+    void (*lock)(void *);
+    void (*unlock)(void *);
+    void *lock_userdata;
+
+    /* the metadata table, loaded if statedb_in_memory_index is set */
+    struct csync_statedb_index_s *index;
+
     int lastReturnValue;
   } statedb;
 
   struct {
     char *uri;
-    c_rbtree_t *tree;
+    c_hashindex_t *tree;
     enum csync_replica_e type;
   } local;
 
+  /* Memory of the entries of both trees and their strings, see csync_file_stat_new() */
+  c_arena_t *file_stat_arena;
+
   struct {
-    c_rbtree_t *tree;
+    c_hashindex_t *tree;
     enum csync_replica_e type;
     int  read_from_db;
     const char *root_perms; /* Permission of the root folder. (Since the root folder is not in the db tree, we need to keep a separate entry.) */
@@ -155,6 +174,13 @@ struct csync_s {
   volatile int abort;
   void *rename_info;
 
+  /**
+   * Number of threads reading and stat'ing local directories ahead of the
+   * update walk. 0 or 1 means the local tree is walked on the calling thread only.
+   */
+  int local_discovery_threads;
+  void *local_prefetch;
+
   /**
    * Specify if it is allowed to read the remote tree from the DB (default to enabled)
    */
@@ -166,6 +192,13 @@ struct csync_s {
    */
   bool db_is_empty;
 
+  /**
+   * Read the whole metadata table into memory at the beginning of the update
+   * detection and answer the statedb lookups from there until the end of the
+   * sync, instead of running one query per file. (default is false)
+   */
+  bool statedb_in_memory_index;
+
   bool ignore_hidden_files;
 };
 
@@ -183,6 +216,7 @@ struct csync_file_stat_s {
   unsigned int type                   : 4;
   unsigned int child_modified         : 1;
   unsigned int has_ignored_files      : 1; /* specify that a directory, or child directory contains ignored files */
+  unsigned int in_arena               : 1; /* allocated by csync_file_stat_new() for the trees */
 
   char *destpath;   /* for renames */
   const char *etag;
@@ -207,6 +241,19 @@ __attribute__ ((packed))
 #endif
 ;
 
+/*
+ * The entries of the trees live in ctx->file_stat_arena until csync_commit()
+ * releases it at once. csync_file_stat_new() allocates an entry with room
+ * for a path of pathlen bytes there, csync_file_stat_strdup() copies a
+ * string into the memory of an entry and csync_file_stat_intern() returns
+ * the copy of a string that is shared by all entries, for values that
+ * repeat a lot. The strings of an entry that is not in the arena are on
+ * the heap, csync_file_stat_free() frees those; for an entry in the arena
+ * it does nothing.
+ */
+csync_file_stat_t *csync_file_stat_new(CSYNC *ctx, size_t pathlen);
+char *csync_file_stat_strdup(CSYNC *ctx, const csync_file_stat_t *st, const char *str);
+char *csync_file_stat_intern(CSYNC *ctx, const csync_file_stat_t *st, const char *str);
 OCSYNC_EXPORT void csync_file_stat_free(csync_file_stat_t *st);
 
 /*
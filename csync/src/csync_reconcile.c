@@ -20,12 +20,17 @@
 
 #include "config_csync.h"
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
 #include "csync_private.h"
 #include "csync_reconcile.h"
 #include "csync_util.h"
 #include "csync_statedb.h"
 #include "csync_rename.h"
+#include "csync_update.h"
 #include "c_jhash.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.reconciler"
@@ -35,9 +40,9 @@
 
 /* Check if a file is ignored because one parent is ignored.
  * return the node of the ignored directoy if it's the case, or NULL if it is not ignored */
-static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int pathlen) {
+static csync_file_stat_t *_csync_check_ignored(c_hashindex_t *tree, const char *path, int pathlen) {
     uint64_t h = 0;
-    c_rbnode_t *node = NULL;
+    csync_file_stat_t *node = NULL;
 
     /* compute the size of the parent directory */
     int parentlen = pathlen - 1;
@@ -49,10 +54,9 @@ static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int
     }
 
     h = c_jhash64((uint8_t *) path, parentlen, 0);
-    node = c_rbtree_find(tree, &h);
+    node = c_hashindex_find(tree, h);
     if (node) {
-        csync_file_stat_t *n = (csync_file_stat_t*)node->data;
-        if (n->instruction == CSYNC_INSTRUCTION_IGNORE) {
+        if (node->instruction == CSYNC_INSTRUCTION_IGNORE) {
             /* Yes, we are ignored */
             return node;
         } else {
@@ -65,10 +69,27 @@ static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int
     }
 }
 
+/* The has_ignored_files flag of a local directory whose contents were read
+ * from the statedb comes from the server, so look on disk before removing it. */
+static bool _csync_local_dir_has_ignored_files(CSYNC *ctx, csync_file_stat_t *cur) {
+    char *uri = NULL;
+    bool found = false;
+
+    if (ctx->current != LOCAL_REPLICA || cur->type != CSYNC_FTW_TYPE_DIR) {
+        return false;
+    }
+    if (asprintf(&uri, "%s/%s", ctx->local.uri, cur->path) < 0) {
+        return true;
+    }
+    found = csync_local_read_from_db(ctx, uri) && csync_local_has_ignored_files(ctx, uri);
+    SAFE_FREE(uri);
+    return found;
+}
+
 /**
  * The main function in the reconcile pass.
  *
- * It's called for each entry in the local and remote rbtrees by
+ * It's called for each entry in the local and remote trees by
  * csync_reconcile()
  *
  * Before the reconcile phase the trees already know about changes
@@ -100,8 +121,8 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
     int len = 0;
 
     CSYNC *ctx = NULL;
-    c_rbtree_t *tree = NULL;
-    c_rbnode_t *node = NULL;
+    c_hashindex_t *tree = NULL;
+    csync_file_stat_t *node = NULL;
 
     cur = (csync_file_stat_t *) obj;
     ctx = (CSYNC *) data;
@@ -118,7 +139,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
         break;
     }
 
-    node = c_rbtree_find(tree, &cur->phash);
+    node = c_hashindex_find(tree, cur->phash);
 
     if (!node) {
         /* Check the renamed path as well. */
@@ -126,7 +147,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
         if (!c_streq(renamed_path, cur->path)) {
             len = strlen( renamed_path );
             h = c_jhash64((uint8_t *) renamed_path, len, 0);
-            node = c_rbtree_find(tree, &h);
+            node = c_hashindex_find(tree, h);
         }
         SAFE_FREE(renamed_path);
     }
@@ -146,8 +167,9 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
             /* file has been removed on the opposite replica */
         case CSYNC_INSTRUCTION_NONE:
         case CSYNC_INSTRUCTION_UPDATE_METADATA:
-            if (cur->has_ignored_files) {
+            if (cur->has_ignored_files || _csync_local_dir_has_ignored_files(ctx, cur)) {
                 /* Do not remove a directory that has ignored files */
+                cur->has_ignored_files = true;
                 break;
             }
             if (cur->child_modified) {
@@ -176,16 +198,16 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                 if( len > 0 ) {
                     h = c_jhash64((uint8_t *) tmp->path, len, 0);
                     /* First, check that the file is NOT in our tree (another file with the same name was added) */
-                    node = c_rbtree_find(ctx->current == REMOTE_REPLICA ? ctx->remote.tree : ctx->local.tree, &h);
+                    node = c_hashindex_find(ctx->current == REMOTE_REPLICA ? ctx->remote.tree : ctx->local.tree, h);
                     if (node) {
                         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Origin found in our tree : %s", tmp->path);
                     } else {
                         /* Find the temporar file in the other tree. */
-                        node = c_rbtree_find(tree, &h);
+                        node = c_hashindex_find(tree, h);
                         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "PHash of temporary opposite (%s): %" PRIu64 " %s",
                                 tmp->path , h, node ? "found": "not found" );
                         if (node) {
-                            other = (csync_file_stat_t*)node->data;
+                            other = node;
                         } else {
                             /* the renamed file could not be found in the opposite tree. That is because it
                             * is not longer existing there, maybe because it was renamed or deleted.
@@ -201,7 +223,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                            || other->instruction == CSYNC_INSTRUCTION_UPDATE_METADATA
                            || cur->type == CSYNC_FTW_TYPE_DIR) {
                     other->instruction = CSYNC_INSTRUCTION_RENAME;
-                    other->destpath = c_strdup( cur->path );
+                    other->destpath = csync_file_stat_strdup(ctx, other, cur->path);
                     if( !c_streq(cur->file_id, "") ) {
                         csync_vio_set_file_id( other->file_id, cur->file_id );
                     }
@@ -209,7 +231,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                     cur->instruction = CSYNC_INSTRUCTION_NONE;
                 } else if (other->instruction == CSYNC_INSTRUCTION_REMOVE) {
                     other->instruction = CSYNC_INSTRUCTION_RENAME;
-                    other->destpath = c_strdup( cur->path );
+                    other->destpath = csync_file_stat_strdup(ctx, other, cur->path);
 
                     if( !c_streq(cur->file_id, "") ) {
                         csync_vio_set_file_id( other->file_id, cur->file_id );
@@ -236,7 +258,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
         /*
      * file found on the other replica
      */
-        other = (csync_file_stat_t *) node->data;
+        other = node;
 
         switch (cur->instruction) {
         case CSYNC_INSTRUCTION_UPDATE_METADATA:
@@ -362,7 +384,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
 
 int csync_reconcile_updates(CSYNC *ctx) {
   int rc;
-  c_rbtree_t *tree = NULL;
+  c_hashindex_t *tree = NULL;
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
@@ -375,7 +397,7 @@ int csync_reconcile_updates(CSYNC *ctx) {
       break;
   }
 
-  rc = c_rbtree_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
+  rc = c_hashindex_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
   if( rc < 0 ) {
     ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
   }
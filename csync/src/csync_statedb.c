@@ -36,6 +36,7 @@
 #include "c_lib.h"
 #include "csync_private.h"
 #include "csync_statedb.h"
+#include "csync_statedb_index.h"
 #include "csync_util.h"
 #include "csync_misc.h"
 #include "csync_exclude.h"
@@ -74,34 +75,28 @@ int csync_get_statedb_exists(CSYNC *ctx) {
   return ctx->statedb.exists;
 }
 
+/*
+ * The statedb is the journal of the client, which runs PRAGMA quick_check when
+ * it opens it read-write (SyncJournalDb::checkConnect). It is not repeated here,
+ * it reads the whole file and the statedb is loaded twice per sync.
+ */
 static int _csync_check_db_integrity(sqlite3 *db) {
-    c_strlist_t *result = NULL;
-    int rc = -1;
-
-    result = csync_statedb_query(db, "PRAGMA quick_check;");
-    if (result != NULL) {
-        /* There is  a result */
-        if (result->count > 0) {
-            if (c_streq(result->vector[0], "ok")) {
-                rc = 0;
-            }
-        }
-        c_strlist_destroy(result);
-    }
+    (void) db;
 
     if( sqlite3_threadsafe() == 0 ) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "* WARNING: SQLite module is not threadsafe!");
-        rc = -1;
+        return -1;
     }
 
-    return rc;
+    return 0;
 }
 
+/* Only fails if there is no metadata table, without counting its rows */
 static int _csync_statedb_is_empty(sqlite3 *db) {
   c_strlist_t *result = NULL;
   int rc = 0;
 
-  result = csync_statedb_query(db, "SELECT COUNT(phash) FROM metadata LIMIT 1 OFFSET 0;");
+  result = csync_statedb_query(db, "SELECT phash FROM metadata LIMIT 1;");
   if (result == NULL) {
     rc = 1;
   }
@@ -129,6 +124,11 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
       return -1;
   }
 
+  if (ctx->statedb.borrowed) {
+      /* The owner opened, checked and configured the connection */
+      return 0;
+  }
+
   if (ctx->statedb.db) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "ERR: DB already open");
       ctx->status_code = CSYNC_STATUS_PARAM_ERROR;
@@ -194,14 +194,8 @@ out:
   return rc;
 }
 
-int csync_statedb_close(CSYNC *ctx) {
-  int rc = 0;
-
-  if (!ctx) {
-      return -1;
-  }
-
-  /* deallocate query resources */
+/* deallocate query resources */
+static void _csync_statedb_finalize_statements(CSYNC *ctx) {
   if( ctx->statedb.by_fileid_stmt ) {
       sqlite3_finalize(ctx->statedb.by_fileid_stmt);
       ctx->statedb.by_fileid_stmt = NULL;
@@ -214,6 +208,21 @@ int csync_statedb_close(CSYNC *ctx) {
       sqlite3_finalize(ctx->statedb.by_inode_stmt);
       ctx->statedb.by_inode_stmt = NULL;
   }
+}
+
+int csync_statedb_close(CSYNC *ctx) {
+  int rc = 0;
+
+  if (!ctx) {
+      return -1;
+  }
+
+  if (ctx->statedb.borrowed) {
+      /* Keep the prepared statements, the connection is used until the end of the sync */
+      return 0;
+  }
+
+  _csync_statedb_finalize_statements(ctx);
 
   ctx->statedb.lastReturnValue = SQLITE_OK;
 
@@ -225,13 +234,57 @@ int csync_statedb_close(CSYNC *ctx) {
   return rc;
 }
 
-#define METADATA_COLUMNS "phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId"
+void csync_statedb_borrow_connection(CSYNC *ctx, sqlite3 *db,
+                                     void (*lock)(void *), void (*unlock)(void *), void *userdata) {
+  if (ctx->statedb.db) {
+      csync_statedb_release_connection(ctx);
+      csync_statedb_close(ctx);
+  }
+
+  ctx->statedb.lock = lock;
+  ctx->statedb.unlock = unlock;
+  ctx->statedb.lock_userdata = userdata;
+  ctx->statedb.db = db;
+  ctx->statedb.borrowed = (db != NULL);
+  if (db) {
+      int locked = csync_statedb_lock(ctx);
+      csync_set_statedb_exists(ctx, !_csync_statedb_is_empty(db));
+      csync_statedb_unlock(ctx, locked);
+  }
+}
+
+void csync_statedb_release_connection(CSYNC *ctx) {
+  if (!ctx->statedb.borrowed) {
+      return;
+  }
+
+  _csync_statedb_finalize_statements(ctx);
+  ctx->statedb.lastReturnValue = SQLITE_OK;
+  ctx->statedb.db = NULL;
+  ctx->statedb.borrowed = 0;
+}
+
+int csync_statedb_lock(CSYNC *ctx) {
+  if (!ctx->statedb.borrowed || !ctx->statedb.lock) {
+      return 0;
+  }
+  ctx->statedb.lock(ctx->statedb.lock_userdata);
+  return 1;
+}
+
+void csync_statedb_unlock(CSYNC *ctx, int locked) {
+  if (locked) {
+      ctx->statedb.unlock(ctx->statedb.lock_userdata);
+  }
+}
 
 // This funciton parses a line from the metadata table into the given csync_file_stat
 // structure which it is also allocating.
 // Note that this function calls laso sqlite3_step to actually get the info from db and
 // returns the sqlite return type.
-static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3_stmt *stmt )
+// With tree_ctx set the structure is allocated for the trees of that context,
+// otherwise on the heap for the caller to free.
+static int _csync_file_stat_from_metadata_table( CSYNC *tree_ctx, csync_file_stat_t **st, sqlite3_stmt *stmt )
 {
     int rc = SQLITE_ERROR;
     int column_count;
@@ -252,9 +305,10 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
 
             /* phash, pathlen, path, inode, uid, gid, mode, modtime */
             len = sqlite3_column_int(stmt, 1);
-            *st = c_malloc(sizeof(csync_file_stat_t) + len + 1);
-            /* clear the whole structure */
-            ZERO_STRUCTP(*st);
+            *st = csync_file_stat_new(tree_ctx, len);
+            if (*st == NULL) {
+                return SQLITE_NOMEM;
+            }
 
             /* The query suceeded so use the phash we pass to the function. */
             (*st)->phash = sqlite3_column_int64(stmt, 0);
@@ -271,7 +325,7 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
             }
 
             if(column_count > 9 && sqlite3_column_text(stmt, 9)) {
-                (*st)->etag = c_strdup( (char*) sqlite3_column_text(stmt, 9) );
+                (*st)->etag = csync_file_stat_strdup(tree_ctx, *st, (char*) sqlite3_column_text(stmt, 9));
             }
             if(column_count > 10 && sqlite3_column_text(stmt,10)) {
                 csync_vio_set_file_id((*st)->file_id, (char*) sqlite3_column_text(stmt, 10));
@@ -288,7 +342,7 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
                 (*st)->has_ignored_files = sqlite3_column_int(stmt, 13);
             }
             if(column_count > 15 && sqlite3_column_int(stmt, 15)) {
-                (*st)->checksum = c_strdup( (char*) sqlite3_column_text(stmt, 14));
+                (*st)->checksum = csync_file_stat_strdup(tree_ctx, *st, (char*) sqlite3_column_text(stmt, 14));
                 (*st)->checksumTypeId = sqlite3_column_int(stmt, 15);
             }
 
@@ -301,17 +355,12 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
     return rc;
 }
 
-/* caller must free the memory */
-csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
-                                                  uint64_t phash)
+static csync_file_stat_t *_csync_statedb_query_stat_by_hash(CSYNC *ctx,
+                                                             uint64_t phash)
 {
   csync_file_stat_t *st = NULL;
   int rc;
 
-  if( !ctx || ctx->db_is_empty ) {
-      return NULL;
-  }
-
   if( ctx->statedb.by_hash_stmt == NULL ) {
       const char *hash_query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE phash=?1";
 
@@ -329,7 +378,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
 
   sqlite3_bind_int64(ctx->statedb.by_hash_stmt, 1, (long long signed int)phash);
 
-  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_hash_stmt);
+  rc = _csync_file_stat_from_metadata_table(NULL, &st, ctx->statedb.by_hash_stmt);
   ctx->statedb.lastReturnValue = rc;
   if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) )  {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata: %d!", rc);
@@ -339,21 +388,34 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
   return st;
 }
 
-csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
-                                                      const char *file_id ) {
-    csync_file_stat_t *st = NULL;
-    int rc = 0;
+/* caller must free the memory */
+csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
+                                                  uint64_t phash)
+{
+  csync_file_stat_t *st = NULL;
+  int locked;
 
-    if (!file_id) {
-        return 0;
-    }
-    if (c_streq(file_id, "")) {
-        return 0;
-    }
+  if( !ctx || ctx->db_is_empty ) {
+      return NULL;
+  }
 
-    if( !ctx || ctx->db_is_empty ) {
-        return NULL;
-    }
+  if( ctx->statedb.index ) {
+      return csync_statedb_index_get_by_hash(ctx, phash);
+  }
+
+  locked = csync_statedb_lock(ctx);
+  if( ctx->statedb.db ) {
+      st = _csync_statedb_query_stat_by_hash(ctx, phash);
+  }
+  csync_statedb_unlock(ctx, locked);
+
+  return st;
+}
+
+static csync_file_stat_t *_csync_statedb_query_stat_by_file_id(CSYNC *ctx,
+                                                               const char *file_id ) {
+    csync_file_stat_t *st = NULL;
+    int rc = 0;
 
     if( ctx->statedb.by_fileid_stmt == NULL ) {
         const char *query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE fileid=?1";
@@ -369,7 +431,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
     /* bind the query value */
     sqlite3_bind_text(ctx->statedb.by_fileid_stmt, 1, file_id, -1, SQLITE_STATIC);
 
-    rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_fileid_stmt);
+    rc = _csync_file_stat_from_metadata_table(NULL, &st, ctx->statedb.by_fileid_stmt);
     ctx->statedb.lastReturnValue = rc;
     if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) ) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata: %d!", rc);
@@ -380,21 +442,41 @@ csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
     return st;
 }
 
-/* caller must free the memory */
-csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
-                                                  uint64_t inode)
+csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
+                                                      const char *file_id ) {
+    csync_file_stat_t *st = NULL;
+    int locked;
+
+    if (!file_id) {
+        return 0;
+    }
+    if (c_streq(file_id, "")) {
+        return 0;
+    }
+
+    if( !ctx || ctx->db_is_empty ) {
+        return NULL;
+    }
+
+    if( ctx->statedb.index ) {
+        return csync_statedb_index_get_by_file_id(ctx, file_id);
+    }
+
+    locked = csync_statedb_lock(ctx);
+    if( ctx->statedb.db ) {
+        st = _csync_statedb_query_stat_by_file_id(ctx, file_id);
+    }
+    csync_statedb_unlock(ctx, locked);
+
+    return st;
+}
+
+static csync_file_stat_t *_csync_statedb_query_stat_by_inode(CSYNC *ctx,
+                                                              uint64_t inode)
 {
   csync_file_stat_t *st = NULL;
   int rc;
 
-  if (!inode) {
-      return NULL;
-  }
-
-  if( !ctx || ctx->db_is_empty ) {
-      return NULL;
-  }
-
   if( ctx->statedb.by_inode_stmt == NULL ) {
       const char *inode_query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE inode=?1";
 
@@ -412,7 +494,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
 
   sqlite3_bind_int64(ctx->statedb.by_inode_stmt, 1, (long long signed int)inode);
 
-  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_inode_stmt);
+  rc = _csync_file_stat_from_metadata_table(NULL, &st, ctx->statedb.by_inode_stmt);
   ctx->statedb.lastReturnValue = rc;
   if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) ) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata by inode: %d!", rc);
@@ -422,19 +504,39 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
   return st;
 }
 
-int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
+/* caller must free the memory */
+csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
+                                                  uint64_t inode)
+{
+  csync_file_stat_t *st = NULL;
+  int locked;
+
+  if (!inode) {
+      return NULL;
+  }
+
+  if( !ctx || ctx->db_is_empty ) {
+      return NULL;
+  }
+
+  if( ctx->statedb.index ) {
+      return csync_statedb_index_get_by_inode(ctx, inode);
+  }
+
+  locked = csync_statedb_lock(ctx);
+  if( ctx->statedb.db ) {
+      st = _csync_statedb_query_stat_by_inode(ctx, inode);
+  }
+  csync_statedb_unlock(ctx, locked);
+
+  return st;
+}
+
+static int _csync_statedb_query_below_path( CSYNC *ctx, const char *path ) {
     int rc;
     sqlite3_stmt *stmt = NULL;
     int64_t cnt = 0;
 
-    if( !path ) {
-        return -1;
-    }
-
-    if( !ctx || ctx->db_is_empty ) {
-        return -1;
-    }
-
     /*  Select the entries for anything that starts with  (path+'/')
      * In other words, anything that is between  path+'/' and path+'0',
      * (because '0' follows '/' in ascii)
@@ -460,12 +562,14 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     do {
         csync_file_stat_t *st = NULL;
 
-        rc = _csync_file_stat_from_metadata_table( &st, stmt);
+        rc = _csync_file_stat_from_metadata_table(ctx, &st, stmt);
         if( st ) {
             /* Check for exclusion from the tree.
              * Note that this is only a safety net in case the ignore list changes
              * without a full remote discovery being triggered. */
-            CSYNC_EXCLUDE_TYPE excluded = csync_excluded_traversal(ctx->excludes, st->path, st->type);
+            CSYNC_EXCLUDE_TYPE excluded = ctx->exclude_matcher
+                    ? csync_excluded_traversal_matcher(ctx->exclude_matcher, st->path, st->type)
+                    : csync_excluded_traversal(ctx->excludes, st->path, st->type);
             if (excluded != CSYNC_NOT_EXCLUDED) {
                 CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded (%d)", st->path, excluded);
 
@@ -479,7 +583,7 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
             }
 
             /* store into result list. */
-            if (c_rbtree_insert(ctx->remote.tree, (void *) st) < 0) {
+            if (c_hashindex_insert(ctx->current == LOCAL_REPLICA ? ctx->local.tree : ctx->remote.tree, (void *) st) < 0) {
                 csync_file_stat_free(st);
                 ctx->status_code = CSYNC_STATUS_TREE_ERROR;
                 break;
@@ -499,6 +603,27 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     return 0;
 }
 
+int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
+    int rc = -1;
+    int locked;
+
+    if( !path ) {
+        return -1;
+    }
+
+    if( !ctx || ctx->db_is_empty ) {
+        return -1;
+    }
+
+    locked = csync_statedb_lock(ctx);
+    if( ctx->statedb.db ) {
+        rc = _csync_statedb_query_below_path(ctx, path);
+    }
+    csync_statedb_unlock(ctx, locked);
+
+    return rc;
+}
+
 /* query the statedb, caller must free the memory */
 c_strlist_t *csync_statedb_query(sqlite3 *db,
                                  const char *statement) {
@@ -40,6 +40,9 @@ extern "C" {
 #include "c_lib.h"
 #include "csync_private.h"
 
+/* The columns _csync_file_stat_from_metadata_table() and the in-memory index read, in this order */
+#define METADATA_COLUMNS "phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId"
+
 void csync_set_statedb_exists(CSYNC *ctx, int val);
 
 int csync_get_statedb_exists(CSYNC *ctx);
@@ -60,6 +63,37 @@ OCSYNC_EXPORT int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **
 
 OCSYNC_EXPORT int csync_statedb_close(CSYNC *ctx);
 
+/**
+ * @brief Use a connection to the statedb that the caller opened.
+ *
+ * csync_statedb_load() and csync_statedb_close() then neither open nor close
+ * a connection of their own, and the prepared statements are kept from the
+ * update detection to the end of the reconcile phase. The connection is used
+ * from the thread running csync_update(); lock and unlock are called around
+ * every use.
+ *
+ * @param ctx       The csync context.
+ * @param db        The connection, NULL to go back to a connection of csync.
+ * @param lock      Called before csync uses the connection.
+ * @param unlock    Called after csync used the connection.
+ * @param userdata  Passed to lock and unlock.
+ */
+OCSYNC_EXPORT void csync_statedb_borrow_connection(CSYNC *ctx, sqlite3 *db,
+                                                   void (*lock)(void *), void (*unlock)(void *), void *userdata);
+
+/**
+ * @brief Finalize the statements on a borrowed connection and forget it.
+ *
+ * The owner calls this with the lock held before it closes the connection.
+ * csync_commit() and csync_destroy() do it as well. Lookups after that find
+ * nothing.
+ */
+OCSYNC_EXPORT void csync_statedb_release_connection(CSYNC *ctx);
+
+/* Lock a borrowed connection, returns whether csync_statedb_unlock() has to unlock it */
+int csync_statedb_lock(CSYNC *ctx);
+void csync_statedb_unlock(CSYNC *ctx, int locked);
+
 OCSYNC_EXPORT csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx, uint64_t phash);
 
 OCSYNC_EXPORT csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx, uint64_t inode);
@@ -81,6 +115,8 @@ OCSYNC_EXPORT csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx, c
  * parameter path is /home/kf/test, we have /home/kf/test/file.txt in
  * the result but also /home/kf/test/homework/another_file.txt
  *
+ * The entries go into the tree of the replica that is currently walked.
+ *
  * @return   A stringlist containing a multiple of 9 entries.
  */
 int csync_statedb_get_below_path(CSYNC *ctx, const char *path);
@@ -0,0 +1,313 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+extern "C" {
+#include "c_lib.h"
+#include "c_jhash.h"
+#include "csync_private.h"
+#include "csync_statedb.h"
+#include "csync_statedb_index.h"
+#include "csync_time.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.statedb"
+#include "csync_log.h"
+}
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const uint32_t NoString = 0xffffffff;
+
+/* One row of the metadata table. Strings are offsets into csync_statedb_index_s::strings. */
+struct Row {
+    uint64_t phash;
+    uint64_t inode;
+    int64_t size;
+    int64_t modtime;
+    uint32_t pathlen;
+    uint32_t path;
+    uint32_t etag;
+    uint32_t fileId;
+    uint32_t remotePerm;
+    uint32_t checksum;
+    uint32_t mode;
+    int32_t checksumTypeId;
+    uint8_t type;
+    uint8_t hasIgnoredFiles;
+};
+
+/*
+ * Open-addressing table of row numbers. The rows themselves hold the keys,
+ * so a slot is only four bytes. The first row inserted for a key wins, like
+ * the first row sqlite3_step() returns for the lookups by inode and file id.
+ */
+class RowTable {
+public:
+    void reserve(size_t rows)
+    {
+        size_t size = 16;
+        while (size * 3 < rows * 4) {
+            size *= 2;
+        }
+        _slots.assign(size, 0);
+        _mask = size - 1;
+    }
+
+    template <class SameKey>
+    void insert(uint64_t hash, uint32_t row, SameKey sameKey)
+    {
+        size_t pos = slotOf(hash);
+        while (_slots[pos] != 0) {
+            if (sameKey(_slots[pos] - 1)) {
+                return;
+            }
+            pos = (pos + 1) & _mask;
+        }
+        _slots[pos] = row + 1;
+    }
+
+    /* Returns the row number plus one, 0 if no row matches */
+    template <class Matches>
+    uint32_t find(uint64_t hash, Matches matches) const
+    {
+        size_t pos = slotOf(hash);
+        while (_slots[pos] != 0) {
+            if (matches(_slots[pos] - 1)) {
+                return _slots[pos];
+            }
+            pos = (pos + 1) & _mask;
+        }
+        return 0;
+    }
+
+    size_t memoryUsage() const { return _slots.capacity() * sizeof(uint32_t); }
+
+private:
+    size_t slotOf(uint64_t hash) const
+    {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return static_cast<size_t>(hash) & _mask;
+    }
+
+    std::vector<uint32_t> _slots;
+    size_t _mask = 0;
+};
+
+uint64_t hashFileId(const char *fileId)
+{
+    return c_jhash64((uint8_t *)fileId, strlen(fileId), 0);
+}
+
+}
+
+struct csync_statedb_index_s {
+    std::vector<Row> rows;
+    std::vector<char> strings;
+    RowTable byHash;
+    RowTable byInode;
+    RowTable byFileId;
+
+    uint32_t addString(const char *str)
+    {
+        if (!str) {
+            return NoString;
+        }
+        uint32_t offset = strings.size();
+        strings.insert(strings.end(), str, str + strlen(str) + 1);
+        return offset;
+    }
+
+    const char *string(uint32_t offset) const
+    {
+        return offset == NoString ? nullptr : strings.data() + offset;
+    }
+
+    size_t memoryUsage() const
+    {
+        return sizeof(*this) + rows.capacity() * sizeof(Row) + strings.capacity()
+            + byHash.memoryUsage() + byInode.memoryUsage() + byFileId.memoryUsage();
+    }
+
+    /* Same fields as _csync_file_stat_from_metadata_table() fills in */
+    csync_file_stat_t *stat(uint32_t r) const
+    {
+        const Row &row = rows[r];
+        csync_file_stat_t *st = (csync_file_stat_t *)c_malloc(sizeof(csync_file_stat_t) + row.pathlen + 1);
+        ZERO_STRUCTP(st);
+
+        st->phash = row.phash;
+        st->pathlen = row.pathlen;
+        memcpy(st->path, string(row.path), row.pathlen);
+        st->path[row.pathlen] = '\0';
+        st->inode = row.inode;
+        st->mode = row.mode;
+        st->modtime = row.modtime;
+        st->type = row.type;
+        if (row.etag != NoString) {
+            st->etag = c_strdup(string(row.etag));
+        }
+        if (row.fileId != NoString) {
+            csync_vio_set_file_id(st->file_id, string(row.fileId));
+        }
+        if (row.remotePerm != NoString) {
+            strncpy(st->remotePerm, string(row.remotePerm), REMOTE_PERM_BUF_SIZE);
+        }
+        st->size = row.size;
+        st->has_ignored_files = row.hasIgnoredFiles;
+        if (row.checksumTypeId) {
+            st->checksum = c_strdup(string(row.checksum));
+            st->checksumTypeId = row.checksumTypeId;
+        }
+        return st;
+    }
+};
+
+int csync_statedb_index_load(CSYNC *ctx)
+{
+    if (ctx->statedb.index) {
+        return 0;
+    }
+
+    struct timespec start, finish;
+    csync_gettime(&start);
+
+    const char *query = "SELECT " METADATA_COLUMNS " FROM metadata";
+    sqlite3_stmt *stmt = nullptr;
+    int locked = csync_statedb_lock(ctx);
+    int rc = sqlite3_prepare_v2(ctx->statedb.db, query, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        csync_statedb_unlock(ctx, locked);
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for loading the metadata: %d", rc);
+        return -1;
+    }
+
+    csync_statedb_index_s *index = new csync_statedb_index_s;
+    // Most permissions are one of a handful of strings, store each only once.
+    std::unordered_map<std::string, uint32_t> remotePerms;
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        Row row;
+        const char *path = (const char *)sqlite3_column_text(stmt, 2);
+        const char *modtime = (const char *)sqlite3_column_text(stmt, 7);
+        const char *remotePerm = (const char *)sqlite3_column_text(stmt, 11);
+
+        row.phash = sqlite3_column_int64(stmt, 0);
+        // Never copy past the end of the stored path
+        row.pathlen = std::min<size_t>(sqlite3_column_int(stmt, 1), path ? strlen(path) : 0);
+        row.path = index->addString(path ? path : "");
+        row.inode = sqlite3_column_int64(stmt, 3);
+        row.mode = sqlite3_column_int(stmt, 6);
+        row.modtime = modtime ? strtoul(modtime, NULL, 10) : 0;
+        row.type = sqlite3_column_int(stmt, 8);
+        row.etag = index->addString((const char *)sqlite3_column_text(stmt, 9));
+        row.fileId = index->addString((const char *)sqlite3_column_text(stmt, 10));
+        row.remotePerm = NoString;
+        if (remotePerm) {
+            auto it = remotePerms.find(remotePerm);
+            if (it == remotePerms.end()) {
+                it = remotePerms.insert(std::make_pair(std::string(remotePerm), index->addString(remotePerm))).first;
+            }
+            row.remotePerm = it->second;
+        }
+        row.size = sqlite3_column_int64(stmt, 12);
+        row.hasIgnoredFiles = sqlite3_column_int(stmt, 13) != 0;
+        row.checksumTypeId = sqlite3_column_int(stmt, 15);
+        row.checksum = row.checksumTypeId ? index->addString((const char *)sqlite3_column_text(stmt, 14)) : NoString;
+        if (row.checksumTypeId && row.checksum == NoString) {
+            row.checksum = index->addString("");
+        }
+
+        index->rows.push_back(row);
+    }
+    sqlite3_finalize(stmt);
+    csync_statedb_unlock(ctx, locked);
+
+    if (rc != SQLITE_DONE) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not read the metadata: %d, using per-file queries", rc);
+        delete index;
+        return -1;
+    }
+
+    index->rows.shrink_to_fit();
+    index->strings.shrink_to_fit();
+
+    const std::vector<Row> &rows = index->rows;
+    index->byHash.reserve(rows.size());
+    index->byInode.reserve(rows.size());
+    index->byFileId.reserve(rows.size());
+    for (uint32_t r = 0; r < rows.size(); ++r) {
+        const Row &row = rows[r];
+        index->byHash.insert(row.phash, r, [&](uint32_t o) { return rows[o].phash == row.phash; });
+        if (row.inode) {
+            index->byInode.insert(row.inode, r, [&](uint32_t o) { return rows[o].inode == row.inode; });
+        }
+        if (row.fileId != NoString && index->string(row.fileId)[0]) {
+            const char *fileId = index->string(row.fileId);
+            index->byFileId.insert(hashFileId(fileId), r, [&](uint32_t o) {
+                return rows[o].fileId != NoString && strcmp(index->string(rows[o].fileId), fileId) == 0;
+            });
+        }
+    }
+
+    ctx->statedb.index = index;
+
+    csync_gettime(&finish);
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE,
+              "Loaded %zu metadata rows into memory in %.2f seconds, the index uses %zu KB",
+              rows.size(), c_secdiff(finish, start), index->memoryUsage() / 1024);
+    return 0;
+}
+
+void csync_statedb_index_free(CSYNC *ctx)
+{
+    delete ctx->statedb.index;
+    ctx->statedb.index = nullptr;
+}
+
+csync_file_stat_t *csync_statedb_index_get_by_hash(CSYNC *ctx, uint64_t phash)
+{
+    const csync_statedb_index_s *index = ctx->statedb.index;
+    uint32_t found = index->byHash.find(phash, [&](uint32_t r) { return index->rows[r].phash == phash; });
+    return found ? index->stat(found - 1) : nullptr;
+}
+
+csync_file_stat_t *csync_statedb_index_get_by_inode(CSYNC *ctx, uint64_t inode)
+{
+    const csync_statedb_index_s *index = ctx->statedb.index;
+    uint32_t found = index->byInode.find(inode, [&](uint32_t r) { return index->rows[r].inode == inode; });
+    return found ? index->stat(found - 1) : nullptr;
+}
+
+csync_file_stat_t *csync_statedb_index_get_by_file_id(CSYNC *ctx, const char *file_id)
+{
+    const csync_statedb_index_s *index = ctx->statedb.index;
+    uint32_t found = index->byFileId.find(hashFileId(file_id), [&](uint32_t r) {
+        return strcmp(index->string(index->rows[r].fileId), file_id) == 0;
+    });
+    return found ? index->stat(found - 1) : nullptr;
+}
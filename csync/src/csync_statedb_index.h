@@ -0,0 +1,59 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "csync_private.h"
+
+/**
+ * @file csync_statedb_index.h
+ *
+ * @brief In-memory copy of the metadata table of the statedb
+ *
+ * The update detection asks the statedb for every file it sees, by phash,
+ * and for new files again by inode (local) or file id (remote) to detect
+ * renames. With ctx->statedb_in_memory_index set, the whole metadata table
+ * is read with one sequential scan at the beginning of the update detection
+ * and the csync_statedb_get_stat_by_* functions answer from this index
+ * until the end of the sync (csync_commit).
+ *
+ * The rows are kept in a compact form: the strings of all rows share one
+ * buffer and the three lookup tables only store row numbers. The stat
+ * structures handed out are allocated on each lookup, like the ones read
+ * from the database, and have to be freed by the caller.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Read the metadata table of the open statedb. Does nothing if the index is loaded already.
+ * Returns -1 if the table could not be read; the lookups then keep using the database. */
+int OCSYNC_EXPORT csync_statedb_index_load(CSYNC *ctx);
+void OCSYNC_EXPORT csync_statedb_index_free(CSYNC *ctx);
+
+/* Same semantics as the csync_statedb_get_stat_by_* functions; the first row in table order wins. */
+csync_file_stat_t OCSYNC_EXPORT *csync_statedb_index_get_by_hash(CSYNC *ctx, uint64_t phash);
+csync_file_stat_t OCSYNC_EXPORT *csync_statedb_index_get_by_inode(CSYNC *ctx, uint64_t inode);
+csync_file_stat_t OCSYNC_EXPORT *csync_statedb_index_get_by_file_id(CSYNC *ctx, const char *file_id);
+
+#ifdef __cplusplus
+}
+#endif
@@ -43,10 +43,12 @@
 #include "csync_misc.h"
 
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.updater"
 #include "csync_log.h"
 #include "csync_rename.h"
+#include "csync_update_prefetch.h"
 
 /* calculate the hash of a given uri */
 static uint64_t _hash_of_file(CSYNC *ctx, const char *file) {
@@ -145,6 +147,21 @@ static bool _csync_mtime_equal(time_t a, time_t b)
     return false;
 }
 
+/* Ask the client for the checksum of file, the result is kept with st */
+static const char *_csync_checksum(CSYNC *ctx, const csync_file_stat_t *st, const char *file, uint32_t checksumTypeId)
+{
+    const char *checksum = NULL;
+    char *copy = NULL;
+
+    if (!ctx->callbacks.checksum_hook) {
+        return NULL;
+    }
+    checksum = ctx->callbacks.checksum_hook(file, checksumTypeId, ctx->callbacks.checksum_userdata);
+    copy = csync_file_stat_strdup(ctx, st, checksum);
+    SAFE_FREE(checksum);
+    return copy;
+}
+
 /**
  * The main function of the discovery/update pass.
  *
@@ -162,7 +179,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
     const csync_vio_file_stat_t *fs, const int type) {
   uint64_t h = 0;
   size_t len = 0;
-  size_t size = 0;
   const char *path = NULL;
   csync_file_stat_t *st = NULL;
   csync_file_stat_t *tmp = NULL;
@@ -189,7 +205,11 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
       excluded =CSYNC_FILE_EXCLUDE_STAT_FAILED;
   } else {
     /* Check if file is excluded */
-    excluded = csync_excluded_traversal(ctx->excludes, path, type);
+    if (ctx->exclude_matcher) {
+      excluded = csync_excluded_traversal_matcher(ctx->exclude_matcher, path, type);
+    } else {
+      excluded = csync_excluded_traversal(ctx->excludes, path, type);
+    }
   }
 
   if( excluded == CSYNC_NOT_EXCLUDED ) {
@@ -222,9 +242,11 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
   if( h == 0 ) {
     return -1;
   }
-  size = sizeof(csync_file_stat_t) + len + 1;
-
-  st = c_malloc(size);
+  st = csync_file_stat_new(ctx, len);
+  if (st == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
 
   /* Set instruction by default to none */
   st->instruction = CSYNC_INSTRUCTION_NONE;
@@ -288,11 +310,7 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
             // check #4754 #4755
             bool isEmlFile = csync_fnmatch("*.eml", file, FNM_CASEFOLD) == 0;
             if (isEmlFile && fs->size == tmp->size && tmp->checksumTypeId) {
-                if (ctx->callbacks.checksum_hook) {
-                    st->checksum = ctx->callbacks.checksum_hook(
-                                file, tmp->checksumTypeId,
-                                ctx->callbacks.checksum_userdata);
-                }
+                st->checksum = _csync_checksum(ctx, st, file, tmp->checksumTypeId);
                 bool checksumIdentical = false;
                 if (st->checksum) {
                     st->checksumTypeId = tmp->checksumTypeId;
@@ -383,9 +401,7 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
             // Verify the checksum where possible
             if (isRename && tmp->checksumTypeId && ctx->callbacks.checksum_hook
                     && fs->type == CSYNC_VIO_FILE_TYPE_REGULAR) {
-                st->checksum = ctx->callbacks.checksum_hook(
-                            file, tmp->checksumTypeId,
-                            ctx->callbacks.checksum_userdata);
+                st->checksum = _csync_checksum(ctx, st, file, tmp->checksumTypeId);
                 if (st->checksum) {
                     CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "checking checksum of potential rename %s %s <-> %s", path, st->checksum, tmp->checksum);
                     st->checksumTypeId = tmp->checksumTypeId;
@@ -490,17 +506,15 @@ out:
   st->type  = type;
   st->etag   = NULL;
   if( fs->etag ) {
-      SAFE_FREE(st->etag);
-      st->etag  = c_strdup(fs->etag);
+      st->etag  = csync_file_stat_strdup(ctx, st, fs->etag);
   }
   csync_vio_set_file_id(st->file_id, fs->file_id);
   if (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL) {
-      SAFE_FREE(st->directDownloadUrl);
-      st->directDownloadUrl = c_strdup(fs->directDownloadUrl);
+      st->directDownloadUrl = csync_file_stat_strdup(ctx, st, fs->directDownloadUrl);
   }
   if (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES) {
-      SAFE_FREE(st->directDownloadCookies);
-      st->directDownloadCookies = c_strdup(fs->directDownloadCookies);
+      /* The same cookies for all files of a server */
+      st->directDownloadCookies = csync_file_stat_intern(ctx, st, fs->directDownloadCookies);
   }
   if (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_PERM) {
       strncpy(st->remotePerm, fs->remotePerm, REMOTE_PERM_BUF_SIZE);
@@ -512,14 +526,14 @@ out:
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (c_rbtree_insert(ctx->local.tree, (void *) st) < 0) {
+      if (c_hashindex_insert(ctx->local.tree, (void *) st) < 0) {
         csync_file_stat_free(st);
         ctx->status_code = CSYNC_STATUS_TREE_ERROR;
         return -1;
       }
       break;
     case REMOTE_REPLICA:
-      if (c_rbtree_insert(ctx->remote.tree, (void *) st) < 0) {
+      if (c_hashindex_insert(ctx->remote.tree, (void *) st) < 0) {
         csync_file_stat_free(st);
         ctx->status_code = CSYNC_STATUS_TREE_ERROR;
         return -1;
@@ -611,6 +625,87 @@ static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
     return true;
 }
 
+bool csync_local_read_from_db(CSYNC *ctx, const char *uri)
+{
+    size_t len;
+
+    if (!ctx->callbacks.checkLocalDiscoveryHook || ctx->db_is_empty) {
+        return false;
+    }
+
+    len = strlen(ctx->local.uri);
+    if (strlen(uri) <= len) {
+        return false;
+    }
+    return !ctx->callbacks.checkLocalDiscoveryHook(ctx->callbacks.update_callback_userdata, uri + len + 1);
+}
+
+bool csync_local_has_ignored_files(CSYNC *ctx, const char *uri)
+{
+  csync_vio_handle_t *dh = NULL;
+  csync_vio_file_stat_t *dirent = NULL;
+  char *filename = NULL;
+  const char *path = NULL;
+  CSYNC_EXCLUDE_TYPE excluded;
+  int type;
+  bool found = false;
+
+  /* What cannot be read is not known to be free of ignored files */
+  if ((dh = csync_vio_local_opendir(uri)) == NULL) {
+    return true;
+  }
+
+  while (!found && (dirent = csync_vio_local_readdir(dh))) {
+    if (dirent->name == NULL) {
+      found = true;
+    } else if ((dirent->name[0] == '.' && dirent->name[1] == '\0')
+               || (dirent->name[0] == '.' && dirent->name[1] == '.' && dirent->name[2] == '\0')) {
+      /* skip "." and ".." */
+    } else if (asprintf(&filename, "%s/%s", uri, dirent->name) < 0) {
+      filename = NULL;
+      found = true;
+    } else if (csync_vio_stat(ctx, filename, dirent) < 0) {
+      /* csync_ftw() ignores entries it cannot stat */
+      found = true;
+    } else if (dirent->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
+      found = true;
+    } else if (dirent->type != CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE
+               && dirent->type != CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE
+               && dirent->type != CSYNC_VIO_FILE_TYPE_SOCKET
+               && dirent->type != CSYNC_VIO_FILE_TYPE_FIFO) {
+      /* The same decision as _csync_detect_update() */
+      type = dirent->type == CSYNC_VIO_FILE_TYPE_DIRECTORY ? CSYNC_FTW_TYPE_DIR : CSYNC_FTW_TYPE_FILE;
+      path = filename + strlen(ctx->local.uri) + 1;
+      if (ctx->exclude_matcher) {
+        excluded = csync_excluded_traversal_matcher(ctx->exclude_matcher, path, type);
+      } else {
+        excluded = csync_excluded_traversal(ctx->excludes, path, type);
+      }
+      if (excluded == CSYNC_NOT_EXCLUDED) {
+        if (ctx->ignore_hidden_files && dirent->name[0] == '.'
+            && strcmp(".sys.admin#recall#", dirent->name) != 0) {
+          found = true;
+        } else if (ctx->ignore_hidden_files && (dirent->flags & CSYNC_VIO_FILE_FLAGS_HIDDEN)) {
+          found = true;
+        } else if (type == CSYNC_FTW_TYPE_DIR) {
+          found = csync_local_has_ignored_files(ctx, filename);
+        }
+      } else if (excluded != CSYNC_FILE_EXCLUDE_AND_REMOVE
+                 && excluded != CSYNC_FILE_SILENTLY_EXCLUDED) {
+        found = true;
+      }
+    }
+    SAFE_FREE(filename);
+    csync_vio_file_stat_destroy(dirent);
+  }
+  csync_vio_local_closedir(dh);
+
+  if (found) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Directory has ignored files on disk: %s", uri);
+  }
+  return found;
+}
+
 /* set the current item to an ignored state.
  * If the item is set to ignored, the update phase continues, ie. its not a hard error */
 static bool mark_current_item_ignored( CSYNC *ctx, csync_file_stat_t *previous_fs, CSYNC_STATUS status )
@@ -658,6 +753,23 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       goto done;
   }
 
+  // Same for a local directory the client knows to be unchanged, as long as the
+  // database has its contents under this path: not for new or renamed ones.
+  if (ctx->current == LOCAL_REPLICA && ctx->current_fs
+      && (ctx->current_fs->instruction == CSYNC_INSTRUCTION_NONE
+          || ctx->current_fs->instruction == CSYNC_INSTRUCTION_EVAL
+          || ctx->current_fs->instruction == CSYNC_INSTRUCTION_UPDATE_METADATA)
+      && csync_local_read_from_db(ctx, uri)) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Reading local directory from database: %s", ctx->current_fs->path);
+      csync_local_prefetch_cancel(ctx, uri);
+      if( ! fill_tree_from_db(ctx, ctx->current_fs->path) ) {
+        errno = ENOENT;
+        ctx->status_code = CSYNC_STATUS_OPENDIR_ERROR;
+        goto error;
+      }
+      goto done;
+  }
+
   if ((dh = csync_vio_opendir(ctx, uri)) == NULL) {
       if (ctx->abort) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Aborted!");
@@ -819,6 +931,9 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
           /* If a directory has ignored files, put the flag on the parent directory as well */
           previous_fs->has_ignored_files = ctx->current_fs->has_ignored_files;
       }
+    } else if (flag == CSYNC_FTW_FLAG_DIR && ctx->current == LOCAL_REPLICA) {
+      /* We won't enter it, stop reading it ahead */
+      csync_local_prefetch_cancel(ctx, filename);
     }
 
     if (ctx->current_fs && previous_fs && ctx->current_fs->child_modified) {
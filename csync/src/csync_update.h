@@ -94,6 +94,34 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth);
 
+/**
+ * @brief Whether the contents of a local directory may be taken from the statedb.
+ *
+ * This is the case if the client set the checkLocalDiscoveryHook and it does
+ * not report changes below the directory. The root is always read from disk.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @param  uri          The full path of the local directory.
+ *
+ * @return true if the directory does not have to be read from disk.
+ */
+bool csync_local_read_from_db(CSYNC *ctx, const char *uri);
+
+/**
+ * @brief Look on disk for ignored entries below a local directory.
+ *
+ * A directory read from the statedb only knows the has_ignored_files flag of
+ * the server, reconcile asks this before it removes such a directory.
+ *
+ * @param  ctx          The csync context to use.
+ *
+ * @param  uri          The full path of the local directory.
+ *
+ * @return true if something below the directory is ignored or cannot be read.
+ */
+bool csync_local_has_ignored_files(CSYNC *ctx, const char *uri);
+
 #endif /* _CSYNC_UPDATE_H */
 
 /* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
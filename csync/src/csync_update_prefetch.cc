@@ -0,0 +1,336 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+extern "C" {
+#include "csync_private.h"
+#include "csync_update.h"
+#include "csync_update_prefetch.h"
+#include "vio/csync_vio_local.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.updater"
+#include "csync_log.h"
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct PrefetchedEntry {
+    csync_vio_file_stat_t *fs;
+    int statResult;
+};
+
+struct PrefetchedDir {
+    enum State { Queued, Running, Done, Cancelled };
+
+    explicit PrefetchedDir(const std::string &u)
+        : uri(u), state(Queued), openErrno(0), index(0) {}
+    ~PrefetchedDir() {
+        // Entries that were handed out by readdir are owned by the caller and set to NULL.
+        for (size_t i = 0; i < entries.size(); ++i) {
+            csync_vio_file_stat_destroy(entries[i].fs);
+        }
+    }
+
+    std::string uri;
+    State state;
+    int openErrno; // != 0 if the directory could not be opened
+    std::vector<PrefetchedEntry> entries;
+    size_t index; // next entry returned by readdir
+};
+
+}
+
+struct csync_local_prefetch_s {
+    static csync_local_prefetch_s *get(CSYNC *ctx) {
+        return reinterpret_cast<csync_local_prefetch_s *>(ctx->local_prefetch);
+    }
+
+    CSYNC *ctx;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable dirDone;
+    std::deque<PrefetchedDir *> queue;
+    // Directories which are queued, being read or done but not yet opened by the walker.
+    std::map<std::string, PrefetchedDir *> pending;
+    std::vector<std::thread> workers;
+    bool stopping;
+
+    // Only accessed from the walker thread
+    csync_vio_file_stat_t *lastEntry;
+    int lastStatResult;
+
+    // csync logging is thread local, forward it to the workers
+    csync_log_callback logCallback;
+    int logLevel;
+    void *logUserdata;
+
+    /* mutex must be held */
+    PrefetchedDir *enqueue(const std::string &uri) {
+        std::map<std::string, PrefetchedDir *>::iterator it = pending.find(uri);
+        if (it != pending.end()) {
+            return it->second;
+        }
+        PrefetchedDir *dir = new PrefetchedDir(uri);
+        pending[uri] = dir;
+        // The walker is depth-first: what it asked for last is what it needs first.
+        queue.push_front(dir);
+        return dir;
+    }
+
+    void readDirectory(PrefetchedDir *dir) {
+        if (ctx->abort) {
+            dir->openErrno = EINTR;
+            return;
+        }
+
+        csync_vio_handle_t *dh = csync_vio_local_opendir(dir->uri.c_str());
+        if (!dh) {
+            dir->openErrno = errno ? errno : EIO;
+            return;
+        }
+
+        csync_vio_file_stat_t *dirent = NULL;
+        while ((dirent = csync_vio_local_readdir(dh))) {
+            const char *name = dirent->name;
+            if (name && (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)) {
+                csync_vio_file_stat_destroy(dirent);
+                continue;
+            }
+
+            PrefetchedEntry entry;
+            entry.fs = dirent;
+            entry.statResult = -1;
+            if ((dirent->fields & CSYNC_VIO_LOCAL_STAT_FIELDS) == CSYNC_VIO_LOCAL_STAT_FIELDS) {
+                entry.statResult = 0;
+            } else if (name) {
+                std::string path = dir->uri.empty() ? std::string(name) : dir->uri + '/' + name;
+                entry.statResult = csync_vio_local_stat(path.c_str(), dirent);
+            }
+            dir->entries.push_back(entry);
+        }
+        csync_vio_local_closedir(dh);
+    }
+
+    void workerLoop() {
+        csync_set_log_callback(logCallback);
+        csync_set_log_level(logLevel);
+        csync_set_log_userdata(logUserdata);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            while (!stopping && queue.empty()) {
+                workAvailable.wait(lock);
+            }
+            if (stopping) {
+                break;
+            }
+
+            PrefetchedDir *dir = queue.front();
+            queue.pop_front();
+            dir->state = PrefetchedDir::Running;
+
+            lock.unlock();
+            readDirectory(dir);
+            lock.lock();
+
+            if (dir->state == PrefetchedDir::Cancelled) {
+                delete dir;
+                continue;
+            }
+            dir->state = PrefetchedDir::Done;
+            dirDone.notify_all();
+        }
+        lock.unlock();
+
+#ifdef WITH_ICONV
+        c_close_iconv();
+#endif
+    }
+};
+
+extern "C" {
+
+void csync_local_prefetch_start(CSYNC *ctx, int num_threads)
+{
+    if (num_threads < 2 || ctx->local_prefetch) {
+        return;
+    }
+
+    csync_local_prefetch_s *p = new csync_local_prefetch_s;
+    p->ctx = ctx;
+    p->stopping = false;
+    p->lastEntry = NULL;
+    p->lastStatResult = -1;
+    p->logCallback = csync_get_log_callback();
+    p->logLevel = csync_get_log_level();
+    p->logUserdata = csync_get_log_userdata();
+    ctx->local_prefetch = p;
+
+    for (int i = 0; i < num_threads; ++i) {
+        p->workers.push_back(std::thread(&csync_local_prefetch_s::workerLoop, p));
+    }
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Local discovery uses %d prefetch threads", num_threads);
+}
+
+void csync_local_prefetch_stop(CSYNC *ctx)
+{
+    csync_local_prefetch_s *p = csync_local_prefetch_s::get(ctx);
+    if (!p) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(p->mutex);
+        p->stopping = true;
+    }
+    p->workAvailable.notify_all();
+    for (size_t i = 0; i < p->workers.size(); ++i) {
+        p->workers[i].join();
+    }
+
+    for (std::map<std::string, PrefetchedDir *>::iterator it = p->pending.begin(); it != p->pending.end(); ++it) {
+        delete it->second;
+    }
+
+    delete p;
+    ctx->local_prefetch = NULL;
+}
+
+bool csync_local_prefetch_active(CSYNC *ctx)
+{
+    return ctx->local_prefetch != NULL;
+}
+
+void csync_local_prefetch_cancel(CSYNC *ctx, const char *uri)
+{
+    csync_local_prefetch_s *p = csync_local_prefetch_s::get(ctx);
+    if (!p) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(p->mutex);
+    std::map<std::string, PrefetchedDir *>::iterator it = p->pending.find(uri);
+    if (it == p->pending.end()) {
+        return;
+    }
+    PrefetchedDir *dir = it->second;
+    p->pending.erase(it);
+
+    switch (dir->state) {
+    case PrefetchedDir::Queued:
+        p->queue.erase(std::find(p->queue.begin(), p->queue.end(), dir));
+        delete dir;
+        break;
+    case PrefetchedDir::Running:
+        // The worker deletes it once it is done reading.
+        dir->state = PrefetchedDir::Cancelled;
+        break;
+    default:
+        delete dir;
+        break;
+    }
+}
+
+csync_vio_handle_t *csync_local_prefetch_opendir(CSYNC *ctx, const char *uri)
+{
+    csync_local_prefetch_s *p = csync_local_prefetch_s::get(ctx);
+    PrefetchedDir *dir = NULL;
+
+    {
+        std::unique_lock<std::mutex> lock(p->mutex);
+        dir = p->enqueue(uri);
+        if (dir->state == PrefetchedDir::Queued) {
+            p->workAvailable.notify_one();
+        }
+        while (dir->state != PrefetchedDir::Done) {
+            p->dirDone.wait(lock);
+        }
+        p->pending.erase(dir->uri);
+
+        // Queue the subdirectories in reverse so the first one ends up in front.
+        // Those the walker takes from the statedb are not read at all.
+        for (size_t i = dir->entries.size(); i > 0; --i) {
+            const PrefetchedEntry &entry = dir->entries[i - 1];
+            if (entry.statResult == 0 && entry.fs->name
+                    && entry.fs->type == CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+                std::string subdir = dir->uri + '/' + entry.fs->name;
+                if (!csync_local_read_from_db(ctx, subdir.c_str())) {
+                    p->enqueue(subdir);
+                }
+            }
+        }
+    }
+    p->workAvailable.notify_all();
+
+    if (dir->openErrno) {
+        errno = dir->openErrno;
+        delete dir;
+        return NULL;
+    }
+    return reinterpret_cast<csync_vio_handle_t *>(dir);
+}
+
+csync_vio_file_stat_t *csync_local_prefetch_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle)
+{
+    csync_local_prefetch_s *p = csync_local_prefetch_s::get(ctx);
+    PrefetchedDir *dir = reinterpret_cast<PrefetchedDir *>(dhandle);
+
+    if (dir->index >= dir->entries.size()) {
+        p->lastEntry = NULL;
+        return NULL;
+    }
+
+    PrefetchedEntry &entry = dir->entries[dir->index++];
+    csync_vio_file_stat_t *fs = entry.fs;
+    entry.fs = NULL; // ownership goes to the caller
+
+    p->lastEntry = fs;
+    p->lastStatResult = entry.statResult;
+    return fs;
+}
+
+int csync_local_prefetch_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle)
+{
+    csync_local_prefetch_s *p = csync_local_prefetch_s::get(ctx);
+    p->lastEntry = NULL;
+    delete reinterpret_cast<PrefetchedDir *>(dhandle);
+    return 0;
+}
+
+int csync_local_prefetch_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf)
+{
+    csync_local_prefetch_s *p = csync_local_prefetch_s::get(ctx);
+    if (p && buf == p->lastEntry) {
+        return p->lastStatResult;
+    }
+    return csync_vio_local_stat(uri, buf);
+}
+
+}
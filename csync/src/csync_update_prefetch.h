@@ -0,0 +1,68 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "csync.h"
+
+/**
+ * @file csync_update_prefetch.h
+ *
+ * @brief Parallel prefetching of local directory listings
+ *
+ * The local update detection walks the tree depth-first on a single thread
+ * (csync_ftw). With prefetching enabled, a pool of worker threads reads and
+ * stats directories ahead of that walk. The walk itself, the journal lookups
+ * and the tree insertions stay on the calling thread, so the resulting
+ * ctx->local.tree is identical to the one of a serial walk.
+ *
+ * When the walker opens a directory, all of its subdirectories are queued
+ * for prefetching. Directories the walker decides not to enter (ignored,
+ * excluded, too deep) are cancelled with csync_local_prefetch_cancel().
+ *
+ * The csync_vio layer dispatches to these functions while prefetching is
+ * active, csync_ftw does not need to know where the listing came from.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Start the worker pool. Does nothing if num_threads is smaller than 2. */
+void OCSYNC_EXPORT csync_local_prefetch_start(CSYNC *ctx, int num_threads);
+/* Stop the workers and drop all listings that were not consumed. */
+void OCSYNC_EXPORT csync_local_prefetch_stop(CSYNC *ctx);
+/* Tell the workers that the walker will not open this directory. */
+void OCSYNC_EXPORT csync_local_prefetch_cancel(CSYNC *ctx, const char *uri);
+
+/* Blocks until the listing of uri is available. Returns NULL and sets errno if it could not be opened. */
+csync_vio_handle_t OCSYNC_EXPORT *csync_local_prefetch_opendir(CSYNC *ctx, const char *uri);
+/* Returns the next entry. The entry is already stat'ed, see csync_local_prefetch_stat(). */
+csync_vio_file_stat_t OCSYNC_EXPORT *csync_local_prefetch_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle);
+int OCSYNC_EXPORT csync_local_prefetch_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle);
+/* Returns the result of the stat the worker did if buf is the entry last returned by readdir,
+ * stats uri otherwise. */
+int OCSYNC_EXPORT csync_local_prefetch_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf);
+/* True while the worker pool is running. */
+bool OCSYNC_EXPORT csync_local_prefetch_active(CSYNC *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,199 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "c_alloc.h"
+#include "c_arena.h"
+#include "c_jhash.h"
+
+#define C_ARENA_BLOCK_SIZE (256 * 1024)
+#define C_ARENA_ALIGN 8
+#define C_ARENA_MIN_INTERN_SLOTS 64
+
+typedef struct c_arena_block_s {
+  struct c_arena_block_s *next;
+  size_t size;
+  size_t used;
+  /* the data follows, aligned like the header */
+} c_arena_block_t;
+
+struct c_arena_s {
+  c_arena_block_t *blocks;    /* the current block first */
+  size_t reserved;
+  const char **interned;      /* open-addressing table, mask + 1 slots */
+  size_t interned_count;
+  size_t interned_mask;
+};
+
+/* Blocks come from calloc and are never reused, so the memory is zeroed already */
+static c_arena_block_t *_arena_add_block(c_arena_t *arena, size_t size) {
+  c_arena_block_t *block = c_calloc(1, sizeof(c_arena_block_t) + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  block->size = size;
+  arena->reserved += sizeof(c_arena_block_t) + size;
+  return block;
+}
+
+c_arena_t *c_arena_new(void) {
+  return c_malloc(sizeof(c_arena_t));
+}
+
+void c_arena_free(c_arena_t *arena) {
+  c_arena_block_t *block = NULL;
+
+  if (arena == NULL) {
+    return;
+  }
+
+  block = arena->blocks;
+  while (block) {
+    c_arena_block_t *next = block->next;
+    SAFE_FREE(block);
+    block = next;
+  }
+  SAFE_FREE(arena->interned);
+  SAFE_FREE(arena);
+}
+
+void *c_arena_alloc(c_arena_t *arena, size_t size) {
+  c_arena_block_t *block = NULL;
+
+  if (size == 0) {
+    return NULL;
+  }
+  size = (size + C_ARENA_ALIGN - 1) & ~((size_t) C_ARENA_ALIGN - 1);
+
+  block = arena->blocks;
+  if (block == NULL || block->size - block->used < size) {
+    if (size > C_ARENA_BLOCK_SIZE / 4) {
+      /* Big allocations get a block of their own, behind the current one */
+      block = _arena_add_block(arena, size);
+      if (block == NULL) {
+        return NULL;
+      }
+      if (arena->blocks) {
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+      } else {
+        arena->blocks = block;
+      }
+      block->used = size;
+      return block + 1;
+    }
+
+    block = _arena_add_block(arena, C_ARENA_BLOCK_SIZE);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  block->used += size;
+  return (char *) (block + 1) + block->used - size;
+}
+
+char *c_arena_strdup(c_arena_t *arena, const char *str) {
+  char *ret = NULL;
+  size_t len;
+
+  if (str == NULL) {
+    return NULL;
+  }
+
+  len = strlen(str);
+  ret = c_arena_alloc(arena, len + 1);
+  if (ret) {
+    memcpy(ret, str, len + 1);
+  }
+  return ret;
+}
+
+static int _arena_intern_grow(c_arena_t *arena) {
+  size_t num_slots = arena->interned ? (arena->interned_mask + 1) * 2 : C_ARENA_MIN_INTERN_SLOTS;
+  const char **slots = c_calloc(num_slots, sizeof(const char *));
+  size_t i;
+
+  if (slots == NULL) {
+    return -1;
+  }
+
+  for (i = 0; arena->interned && i <= arena->interned_mask; i++) {
+    const char *str = arena->interned[i];
+    size_t pos;
+
+    if (str == NULL) {
+      continue;
+    }
+    pos = c_jhash64((const uint8_t *) str, strlen(str), 0) & (num_slots - 1);
+    while (slots[pos]) {
+      pos = (pos + 1) & (num_slots - 1);
+    }
+    slots[pos] = str;
+  }
+
+  SAFE_FREE(arena->interned);
+  arena->interned = slots;
+  arena->interned_mask = num_slots - 1;
+  return 0;
+}
+
+const char *c_arena_intern(c_arena_t *arena, const char *str) {
+  size_t len;
+  size_t pos;
+  char *copy = NULL;
+
+  if (str == NULL) {
+    return NULL;
+  }
+
+  /* Keep the table at most half full */
+  if (arena->interned == NULL || (arena->interned_count + 1) * 2 > arena->interned_mask + 1) {
+    if (_arena_intern_grow(arena) < 0) {
+      return NULL;
+    }
+  }
+
+  len = strlen(str);
+  pos = c_jhash64((const uint8_t *) str, len, 0) & arena->interned_mask;
+  while (arena->interned[pos]) {
+    if (strcmp(arena->interned[pos], str) == 0) {
+      return arena->interned[pos];
+    }
+    pos = (pos + 1) & arena->interned_mask;
+  }
+
+  copy = c_arena_alloc(arena, len + 1);
+  if (copy == NULL) {
+    return NULL;
+  }
+  memcpy(copy, str, len + 1);
+  arena->interned[pos] = copy;
+  arena->interned_count++;
+  return copy;
+}
+
+size_t c_arena_size(const c_arena_t *arena) {
+  return arena ? arena->reserved : 0;
+}
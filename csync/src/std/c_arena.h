@@ -0,0 +1,95 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file c_arena.h
+ *
+ * @brief Interface of the cynapses libc arena allocator
+ *
+ * An arena hands out memory from large blocks by bumping a pointer. There
+ * is no way to free a single allocation: everything is released at once
+ * with c_arena_free(), which only has to free the blocks.
+ *
+ * The arena can also intern strings: c_arena_intern() returns the same
+ * copy for equal strings, so values that repeat for many entries are
+ * stored only once.
+ *
+ * @defgroup cynArenaInternals cynapses libc arena functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+#ifndef _C_ARENA_H
+#define _C_ARENA_H
+
+#include <stddef.h>
+
+struct c_arena_s; typedef struct c_arena_s c_arena_t;
+
+/**
+ * @brief Create an arena.
+ *
+ * @return  The new arena, NULL if it could not be allocated.
+ */
+c_arena_t *c_arena_new(void);
+
+/**
+ * @brief Release the arena and everything allocated from it.
+ *
+ * @param arena  The arena to free, may be NULL.
+ */
+void c_arena_free(c_arena_t *arena);
+
+/**
+ * @brief Allocate zeroed memory, aligned to 8 bytes.
+ *
+ * @param arena  The arena to allocate from.
+ *
+ * @param size   The number of bytes.
+ *
+ * @return   The memory, NULL if size is 0 or on allocation failure.
+ */
+void *c_arena_alloc(c_arena_t *arena, size_t size);
+
+/**
+ * @brief Copy a string into the arena.
+ *
+ * @return   The copy, NULL if str is NULL.
+ */
+char *c_arena_strdup(c_arena_t *arena, const char *str);
+
+/**
+ * @brief Return the copy of a string the arena holds for all equal strings.
+ *
+ * The result must not be modified.
+ *
+ * @return   The interned string, NULL if str is NULL.
+ */
+const char *c_arena_intern(c_arena_t *arena, const char *str);
+
+/**
+ * @brief Get the number of bytes the arena has reserved from the system.
+ */
+size_t c_arena_size(const c_arena_t *arena);
+
+/**
+ * }@
+ */
+#endif /* _C_ARENA_H */
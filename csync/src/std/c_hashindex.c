@@ -0,0 +1,265 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * static function don't have NULL pointer checks, segfaults are intended.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c_alloc.h"
+#include "c_hashindex.h"
+
+#define C_HASHINDEX_MIN_SLOTS 64
+
+/* The keys are usually hashes already, but mix them anyway so that
+ * sequential keys don't end up in one long probe sequence. */
+static size_t _hashindex_slot_of(const c_hashindex_t *index, uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+
+  return (size_t) key & index->mask;
+}
+
+static int _hashindex_rehash(c_hashindex_t *index, size_t num_slots) {
+  c_hashindex_slot_t *slots = NULL;
+  size_t i;
+
+  slots = calloc(num_slots, sizeof(c_hashindex_slot_t));
+  if (slots == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  SAFE_FREE(index->slots);
+  index->slots = slots;
+  index->mask = num_slots - 1;
+
+  for (i = 0; i < index->size; i++) {
+    uint64_t key = index->key(index->entries[i]);
+    size_t pos = _hashindex_slot_of(index, key);
+
+    while (index->slots[pos].index != 0) {
+      pos = (pos + 1) & index->mask;
+    }
+    index->slots[pos].key = key;
+    index->slots[pos].index = i + 1;
+  }
+
+  return 0;
+}
+
+void c_hashindex_create(c_hashindex_t **index, c_hashindex_key_func *key, c_hashindex_compare_func *data_compare) {
+  assert(index);
+  assert(key);
+  assert(data_compare);
+
+  c_hashindex_t *idx = NULL;
+
+  idx = c_malloc(sizeof(*idx));
+  idx->key = key;
+  idx->data_compare = data_compare;
+
+  *index = idx;
+}
+
+int c_hashindex_free(c_hashindex_t *index) {
+  if (index == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  SAFE_FREE(index->entries);
+  SAFE_FREE(index->slots);
+  SAFE_FREE(index->sorted);
+  SAFE_FREE(index);
+
+  return 0;
+}
+
+void c_hashindex_destroy(c_hashindex_t *index, void (*destructor)(void *)) {
+  size_t i;
+
+  if (index == NULL) {
+    return;
+  }
+
+  for (i = 0; i < index->size; i++) {
+    (*destructor)(index->entries[i]);
+  }
+
+  SAFE_FREE(index->entries);
+  SAFE_FREE(index->slots);
+  SAFE_FREE(index->sorted);
+  index->sorted_size = 0;
+  index->size = 0;
+  index->capacity = 0;
+  index->mask = 0;
+}
+
+int c_hashindex_insert(c_hashindex_t *index, void *data) {
+  uint64_t key;
+  size_t pos;
+
+  if (index == NULL || data == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Keep the table at most 3/4 full */
+  if (index->slots == NULL || (index->size + 1) * 4 > (index->mask + 1) * 3) {
+    size_t num_slots = index->slots == NULL ? C_HASHINDEX_MIN_SLOTS : (index->mask + 1) * 2;
+    if (_hashindex_rehash(index, num_slots) < 0) {
+      return -1;
+    }
+  }
+
+  key = index->key(data);
+  pos = _hashindex_slot_of(index, key);
+  while (index->slots[pos].index != 0) {
+    if (index->slots[pos].key == key) {
+      return 1;
+    }
+    pos = (pos + 1) & index->mask;
+  }
+
+  if (index->size == index->capacity) {
+    size_t capacity = index->capacity == 0 ? C_HASHINDEX_MIN_SLOTS : index->capacity * 2;
+    void **entries = realloc(index->entries, capacity * sizeof(void *));
+    if (entries == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    index->entries = entries;
+    index->capacity = capacity;
+  }
+
+  index->entries[index->size] = data;
+  index->slots[pos].key = key;
+  index->slots[pos].index = ++index->size;
+
+  return 0;
+}
+
+void *c_hashindex_find(c_hashindex_t *index, uint64_t key) {
+  size_t pos;
+
+  if (index == NULL || index->slots == NULL) {
+    return NULL;
+  }
+
+  pos = _hashindex_slot_of(index, key);
+  while (index->slots[pos].index != 0) {
+    if (index->slots[pos].key == key) {
+      return index->entries[index->slots[pos].index - 1];
+    }
+    pos = (pos + 1) & index->mask;
+  }
+
+  return NULL;
+}
+
+/* Bottom-up merge sort, stable and without recursion. qsort() can't pass
+ * the compare function of the index to its callback. */
+static int _hashindex_sort(c_hashindex_t *index) {
+  void **a = NULL;
+  void **b = NULL;
+  size_t n = index->size;
+  size_t width;
+
+  a = malloc(n * sizeof(void *));
+  b = malloc(n * sizeof(void *));
+  if (a == NULL || b == NULL) {
+    SAFE_FREE(a);
+    SAFE_FREE(b);
+    errno = ENOMEM;
+    return -1;
+  }
+  memcpy(a, index->entries, n * sizeof(void *));
+
+  for (width = 1; width < n; width *= 2) {
+    size_t lo;
+    void **tmp;
+
+    for (lo = 0; lo < n; lo += 2 * width) {
+      size_t mid = lo + width < n ? lo + width : n;
+      size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+      size_t i = lo, j = mid, k = lo;
+
+      while (i < mid && j < hi) {
+        if (index->data_compare(a[j], a[i]) < 0) {
+          b[k++] = a[j++];
+        } else {
+          b[k++] = a[i++];
+        }
+      }
+      while (i < mid) {
+        b[k++] = a[i++];
+      }
+      while (j < hi) {
+        b[k++] = a[j++];
+      }
+    }
+
+    tmp = a;
+    a = b;
+    b = tmp;
+  }
+
+  SAFE_FREE(b);
+  SAFE_FREE(index->sorted);
+  index->sorted = a;
+  index->sorted_size = n;
+
+  return 0;
+}
+
+int c_hashindex_walk(c_hashindex_t *index, void *data, c_hashindex_visit_func *visitor) {
+  void **sorted;
+  size_t i, n;
+
+  if (index == NULL || data == NULL || visitor == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (index->size == 0) {
+    return 0;
+  }
+
+  if (index->sorted_size != index->size && _hashindex_sort(index) < 0) {
+    return -1;
+  }
+
+  /* Entries inserted by the visitor are not visited */
+  sorted = index->sorted;
+  n = index->sorted_size;
+  for (i = 0; i < n; i++) {
+    if ((*visitor)(sorted[i], data) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file c_hashindex.h
+ *
+ * @brief Interface of the cynapses libc hash index
+ *
+ * A hash index stores data pointers in a contiguous array, in insertion
+ * order, and finds them by a 64bit key through an open-addressing table
+ * with linear probing. The key is extracted from the data by a callback,
+ * it is expected to be a hash already (e.g. the phash of a file).
+ *
+ * Compared to the red-black tree there is no allocation per entry and a
+ * lookup usually touches a single cache line of the table. The index does
+ * not keep its entries ordered; c_hashindex_walk() sorts them with the data
+ * compare function the first time it is called after an insertion.
+ *
+ * Entries can't be removed one by one, only all at once with
+ * c_hashindex_destroy().
+ *
+ * @defgroup cynHashIndexInternals cynapses libc hash index functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+#ifndef _C_HASHINDEX_H
+#define _C_HASHINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Forward declarations */
+struct c_hashindex_s; typedef struct c_hashindex_s c_hashindex_t;
+struct c_hashindex_slot_s; typedef struct c_hashindex_slot_s c_hashindex_slot_t;
+
+/**
+ * @brief Callback function returning the key of the data stored in the index.
+ *
+ * @param data  data as a generic pointer
+ *
+ * @return The 64bit key of the data.
+ */
+typedef uint64_t c_hashindex_key_func(const void *data);
+
+/**
+ * @brief Callback function to compare two data pointers of the index, it
+ *        defines the order of c_hashindex_walk().
+ *
+ * @return   It returns an integer less than, equal to, or greater than zero
+ *           like strcmp().
+ */
+typedef int c_hashindex_compare_func(const void *a, const void *b);
+
+/**
+ * @brief Visit function for the c_hashindex_walk() function.
+ *
+ * @param obj    The data that will be passed by c_hashindex_walk().
+ * @param data   Generic data pointer.
+ *
+ * @return 0 on success, < 0 on error. You should set errno.
+ */
+typedef int c_hashindex_visit_func(void *, void *);
+
+/**
+ * Slot of the open-addressing table. index is the position in the entries
+ * array plus one, 0 marks an empty slot.
+ */
+struct c_hashindex_slot_s {
+  uint64_t key;
+  size_t index;
+};
+
+/**
+ * Structure that represents a hash index
+ */
+struct c_hashindex_s {
+  void **entries;             /* data pointers in insertion order */
+  size_t size;
+  size_t capacity;
+  c_hashindex_slot_t *slots;  /* the table, mask + 1 slots */
+  size_t mask;
+  void **sorted;              /* entries in walk order */
+  size_t sorted_size;         /* outdated if it differs from size */
+  c_hashindex_key_func *key;
+  c_hashindex_compare_func *data_compare;
+};
+
+/**
+ * @brief Create the hash index
+ *
+ * @param index         The pointer to assign the allocated memory.
+ *
+ * @param key           Callback function returning the key of the data.
+ *
+ * @param data_compare  Callback function to compare two data pointers, it
+ *                      defines the order of c_hashindex_walk().
+ */
+void c_hashindex_create(c_hashindex_t **index, c_hashindex_key_func *key, c_hashindex_compare_func *data_compare);
+
+/**
+ * @brief Free the structure of a hash index.
+ *
+ * The data pointers are not freed, call c_hashindex_destroy() first.
+ *
+ * @param index  The index to free.
+ *
+ * @return   0 on success, less than 0 if an error occurred.
+ */
+int c_hashindex_free(c_hashindex_t *index);
+
+/**
+ * @brief Call the destructor for all data of the index and empty it.
+ *
+ * @param index       The index to empty.
+ *
+ * @param destructor  The destructor to call for each data pointer.
+ */
+void c_hashindex_destroy(c_hashindex_t *index, void (*destructor)(void *));
+
+/**
+ * @brief Insert a data pointer into the index.
+ *
+ * @param index  The index to insert into.
+ *
+ * @param data   The data to insert.
+ *
+ * @return   0 on success, 1 if an entry with the same key already exists
+ *           and < 0 if an error occurred with errno set.
+ */
+int c_hashindex_insert(c_hashindex_t *index, void *data);
+
+/**
+ * @brief Find the data with the given key.
+ *
+ * @param index  The index to search.
+ *
+ * @param key    The key to search for.
+ *
+ * @return   The data pointer, NULL if it was not found.
+ */
+void *c_hashindex_find(c_hashindex_t *index, uint64_t key);
+
+/**
+ * @brief Walk over the index in the order of the data compare function.
+ *
+ * The visitor may look up other entries. Entries it inserts are not visited.
+ *
+ * @param index    Index to walk.
+ * @param data     Data which should be passed to the visitor function.
+ * @param visitor  Visitor function. This will be called for each entry.
+ *
+ * @return   0 on sucess, less than 0 if an error occurred.
+ */
+int c_hashindex_walk(c_hashindex_t *index, void *data, c_hashindex_visit_func *visitor);
+
+/**
+ * @brief Get the number of entries in the index.
+ *
+ * @param I  The index to check.
+ *
+ * @return   The number of entries, 0 if the index is NULL.
+ */
+#define c_hashindex_size(I) ((I) == NULL ? 0 : (I)->size)
+
+/**
+ * @brief Get the data at a position of the insertion order.
+ *
+ * @param I  The index.
+ * @param N  The position, smaller than c_hashindex_size(I).
+ */
+#define c_hashindex_at(I, N) ((I)->entries[(N)])
+
+/**
+ * }@
+ */
+#endif /* _C_HASHINDEX_H */
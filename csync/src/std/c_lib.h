@@ -23,8 +23,10 @@
 
 #include "c_macro.h"
 #include "c_alloc.h"
+#include "c_arena.h"
 #include "c_path.h"
 #include "c_rbtree.h"
+#include "c_hashindex.h"
 #include "c_string.h"
 #include "c_time.h"
 #include "c_private.h"
@@ -31,6 +31,7 @@
 #include "vio/csync_vio.h"
 #include "vio/csync_vio_local.h"
 #include "csync_statedb.h"
+#include "csync_update_prefetch.h"
 #include "std/c_jhash.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.vio.main"
@@ -49,6 +50,9 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
 	if( ctx->callbacks.update_callback ) {
         ctx->callbacks.update_callback(ctx->replica, name, ctx->callbacks.update_callback_userdata);
 	}
+      if (csync_local_prefetch_active(ctx)) {
+        return csync_local_prefetch_opendir(ctx, name);
+      }
       return csync_vio_local_opendir(name);
       break;
     default:
@@ -75,6 +79,10 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
       rc = 0;
       break;
   case LOCAL_REPLICA:
+      if (csync_local_prefetch_active(ctx)) {
+        rc = csync_local_prefetch_closedir(ctx, dhandle);
+        break;
+      }
       rc = csync_vio_local_closedir(dhandle);
       break;
   default:
@@ -93,6 +101,9 @@ csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle
       return ctx->callbacks.remote_readdir_hook(dhandle, ctx->callbacks.vio_userdata);
       break;
     case LOCAL_REPLICA:
+      if (csync_local_prefetch_active(ctx)) {
+        return csync_local_prefetch_readdir(ctx, dhandle);
+      }
       return csync_vio_local_readdir(dhandle);
       break;
     default:
@@ -113,7 +124,14 @@ int csync_vio_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf) {
       assert(ctx->replica != REMOTE_REPLICA);
       break;
     case LOCAL_REPLICA:
-      rc = csync_vio_local_stat(uri, buf);
+      if ((buf->fields & CSYNC_VIO_LOCAL_STAT_FIELDS) == CSYNC_VIO_LOCAL_STAT_FIELDS) {
+        /* Already done by csync_vio_local_readdir() */
+        rc = 0;
+      } else if (csync_local_prefetch_active(ctx)) {
+        rc = csync_local_prefetch_stat(ctx, uri, buf);
+      } else {
+        rc = csync_vio_local_stat(uri, buf);
+      }
       if (rc < 0) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Local stat failed, errno %d", errno);
       }
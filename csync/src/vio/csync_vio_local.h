@@ -21,6 +21,15 @@
 #ifndef _CSYNC_VIO_LOCAL_H
 #define _CSYNC_VIO_LOCAL_H
 
+/*
+ * The fields csync_vio_local_stat() fills in. Where csync_vio_local_readdir()
+ * can stat the entries relative to the open directory, it fills them in
+ * already and csync_vio_stat() does not stat the entry again.
+ */
+#define CSYNC_VIO_LOCAL_STAT_FIELDS (CSYNC_VIO_FILE_STAT_FIELDS_TYPE | CSYNC_VIO_FILE_STAT_FIELDS_MODE \
+    | CSYNC_VIO_FILE_STAT_FIELDS_FLAGS | CSYNC_VIO_FILE_STAT_FIELDS_INODE \
+    | CSYNC_VIO_FILE_STAT_FIELDS_SIZE | CSYNC_VIO_FILE_STAT_FIELDS_MTIME)
+
 csync_vio_handle_t OCSYNC_EXPORT *csync_vio_local_opendir(const char *name);
 int OCSYNC_EXPORT csync_vio_local_closedir(csync_vio_handle_t *dhandle);
 csync_vio_file_stat_t OCSYNC_EXPORT *csync_vio_local_readdir(csync_vio_handle_t *dhandle);
@@ -19,12 +19,21 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "c_private.h"
 #include "c_lib.h"
@@ -39,11 +48,44 @@
  * directory functions
  */
 
+#if defined(__linux__) && defined(SYS_getdents64)
+/*
+ * Read the entries with getdents64() into a buffer that holds most
+ * directories at once, instead of going through the small readdir() buffer.
+ */
+#define CSYNC_VIO_LOCAL_GETDENTS
+#define DENTS_BUFFER_SIZE (128 * 1024)
+
+struct csync_dirent64_s {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+#if defined(__linux__) && defined(STATX_TYPE)
+#define CSYNC_VIO_LOCAL_STATX
+/* Set when the kernel is too old for statx(), then fstatat() is used.
+ * The prefetch threads share it, it is only accessed atomically. */
+static int _statx_unavailable = 0;
+#endif
+
 typedef struct dhandle_s {
+#ifdef CSYNC_VIO_LOCAL_GETDENTS
+  int fd;
+  char *buf;
+  size_t buf_pos;
+  size_t buf_len;
+#else
   DIR *dh;
+#endif
   char *path;
 } dhandle_t;
 
+static void _csync_vio_local_fill_stat(csync_vio_file_stat_t *buf, const csync_stat_t *sb);
+
 csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
   dhandle_t *handle = NULL;
   mbchar_t *dirname = NULL;
@@ -52,12 +94,24 @@ csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
 
   dirname = c_utf8_path_to_locale(name);
 
+#ifdef CSYNC_VIO_LOCAL_GETDENTS
+  handle->fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (handle->fd < 0) {
+    c_free_locale_string(dirname);
+    SAFE_FREE(handle);
+    return NULL;
+  }
+  handle->buf = c_malloc(DENTS_BUFFER_SIZE);
+  handle->buf_pos = 0;
+  handle->buf_len = 0;
+#else
   handle->dh = _topendir( dirname );
   if (handle->dh == NULL) {
     c_free_locale_string(dirname);
     SAFE_FREE(handle);
     return NULL;
   }
+#endif
 
   handle->path = c_strdup(name);
   c_free_locale_string(dirname);
@@ -75,7 +129,12 @@ int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
   }
 
   handle = (dhandle_t *) dhandle;
+#ifdef CSYNC_VIO_LOCAL_GETDENTS
+  rc = close(handle->fd);
+  SAFE_FREE(handle->buf);
+#else
   rc = _tclosedir(handle->dh);
+#endif
 
   SAFE_FREE(handle->path);
   SAFE_FREE(handle);
@@ -83,10 +142,72 @@ int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
   return rc;
 }
 
+/*
+ * Stat the entry relative to the open directory, so the kernel does not have
+ * to resolve the whole path again for every file. Only asks for the fields
+ * the update detection uses.
+ */
+static int _csync_vio_local_stat_at(dhandle_t *handle, const char *name, csync_vio_file_stat_t *buf) {
+  csync_stat_t sb;
+#ifdef CSYNC_VIO_LOCAL_GETDENTS
+  int fd = handle->fd;
+#else
+  int fd = dirfd(handle->dh);
+#endif
+
+#ifdef CSYNC_VIO_LOCAL_STATX
+  if (!__atomic_load_n(&_statx_unavailable, __ATOMIC_RELAXED)) {
+    struct statx stx;
+
+    if (statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+              STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME, &stx) == 0) {
+      ZERO_STRUCT(sb);
+      sb.st_mode = stx.stx_mode;
+      sb.st_ino = stx.stx_ino;
+      sb.st_size = stx.stx_size;
+      sb.st_mtime = stx.stx_mtime.tv_sec;
+      _csync_vio_local_fill_stat(buf, &sb);
+      return 0;
+    }
+    if (errno != ENOSYS) {
+      return -1;
+    }
+    __atomic_store_n(&_statx_unavailable, 1, __ATOMIC_RELAXED);
+  }
+#endif
+
+  if (fd < 0 || fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+    return -1;
+  }
+  _csync_vio_local_fill_stat(buf, &sb);
+  return 0;
+}
+
+#ifdef CSYNC_VIO_LOCAL_GETDENTS
+static struct csync_dirent64_s *_csync_vio_local_getdents(dhandle_t *handle) {
+  struct csync_dirent64_s *dirent = NULL;
+
+  if (handle->buf_pos >= handle->buf_len) {
+    long len = syscall(SYS_getdents64, handle->fd, handle->buf, DENTS_BUFFER_SIZE);
+    if (len <= 0) {
+      /* 0 is the end of the directory, errno is set otherwise */
+      return NULL;
+    }
+    handle->buf_len = len;
+    handle->buf_pos = 0;
+  }
+
+  dirent = (struct csync_dirent64_s *) (handle->buf + handle->buf_pos);
+  handle->buf_pos += dirent->d_reclen;
+  return dirent;
+}
+#endif
+
 csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
 
   dhandle_t *handle = NULL;
   csync_vio_file_stat_t *file_stat = NULL;
+  const char *d_name = NULL;
 
   handle = (dhandle_t *) dhandle;
 
@@ -97,24 +218,27 @@ csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
   }
   file_stat->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
 
-  struct _tdirent *dirent = NULL;
-
-  dirent = _treaddir(handle->dh);
+#ifdef CSYNC_VIO_LOCAL_GETDENTS
+  struct csync_dirent64_s *dirent = _csync_vio_local_getdents(handle);
+#else
+  struct _tdirent *dirent = _treaddir(handle->dh);
+#endif
   if (dirent == NULL) {
       goto err;
   }
-  file_stat->name = c_utf8_from_locale(dirent->d_name);
+  d_name = dirent->d_name;
+  file_stat->name = c_utf8_from_locale(d_name);
   if (file_stat->name == NULL) {
-      //file_stat->original_name = c_strdup(dirent->d_name);
-      if (asprintf(&file_stat->original_name, "%s/%s", handle->path, dirent->d_name) < 0) {
+      //file_stat->original_name = c_strdup(d_name);
+      if (asprintf(&file_stat->original_name, "%s/%s", handle->path, d_name) < 0) {
           goto err;
       }
       CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Invalid characters in file/directory name, please rename: \"%s\" (%s)",
-                dirent->d_name, handle->path);
+                d_name, handle->path);
   }
 
   /* Check for availability of d_type, see manpage. */
-#if defined(_DIRENT_HAVE_D_TYPE) || defined(__APPLE__)
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(__APPLE__) || defined(CSYNC_VIO_LOCAL_GETDENTS)
   switch (dirent->d_type) {
     case DT_FIFO:
     case DT_SOCK:
@@ -138,6 +262,15 @@ csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
   }
 #endif
 
+  /* The caller stats every entry but "." and "..", do it here while the
+   * directory is open. If that fails, the fields stay as they are and
+   * csync_vio_stat() tries again with the full path. */
+  if (!(d_name[0] == '.' && (d_name[1] == '\0' || (d_name[1] == '.' && d_name[2] == '\0')))) {
+      if (_csync_vio_local_stat_at(handle, d_name, file_stat) < 0) {
+          errno = 0;
+      }
+  }
+
   return file_stat;
 
 err:
@@ -146,20 +279,10 @@ err:
   return NULL;
 }
 
-
-int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
-  csync_stat_t sb;
-
-  mbchar_t *wuri = c_utf8_path_to_locale( uri );
-
-  if( _tstat(wuri, &sb) < 0) {
-    c_free_locale_string(wuri);
-    return -1;
-  }
-
+static void _csync_vio_local_fill_stat(csync_vio_file_stat_t *buf, const csync_stat_t *sb) {
   buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
 
-  switch(sb.st_mode & S_IFMT) {
+  switch(sb->st_mode & S_IFMT) {
     case S_IFBLK:
       buf->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
       break;
@@ -187,7 +310,7 @@ int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
   }
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
 
-  buf->mode = sb.st_mode;
+  buf->mode = sb->st_mode;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MODE;
 
   if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
@@ -197,27 +320,41 @@ int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
     buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
   }
 #ifdef __APPLE__
-  if (sb.st_flags & UF_HIDDEN) {
+  if (sb->st_flags & UF_HIDDEN) {
       buf->flags |= CSYNC_VIO_FILE_FLAGS_HIDDEN;
   }
 #endif
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
 
-  buf->inode = sb.st_ino;
+  buf->inode = sb->st_ino;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
 
+  buf->mtime = sb->st_mtime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+
+  buf->size = sb->st_size;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+}
+
+
+int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
+  csync_stat_t sb;
+
+  mbchar_t *wuri = c_utf8_path_to_locale( uri );
+
+  if( _tstat(wuri, &sb) < 0) {
+    c_free_locale_string(wuri);
+    return -1;
+  }
+
+  _csync_vio_local_fill_stat(buf, &sb);
+
   buf->atime = sb.st_atime;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
 
-  buf->mtime = sb.st_mtime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-
   buf->ctime = sb.st_ctime;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
 
-  buf->size = sb.st_size;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-
   c_free_locale_string(wuri);
   return 0;
 }
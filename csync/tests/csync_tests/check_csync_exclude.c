@@ -310,6 +310,54 @@ static void check_csync_pathes(void **state)
     assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
 }
 
+static void check_csync_excluded_matcher(void **state)
+{
+    CSYNC *csync = *state;
+    csync_exclude_matcher_t *matcher = NULL;
+    size_t i, t;
+
+    const char *patterns[] = {
+        "/exclude", "excl/", "]/", "/excludepath/withsubdir", "]rm_*", "]dir_only/",
+        "*.o", "foo*bar", "a*b*c", "x/*/y", "x*/z*", "*/*.log", "deep/", "a?c",
+        "[ab]x", "esc\\*aped", "*"
+    };
+    const char *paths[] = {
+        "", "/", "krawel_krawel", "exclude", "/exclude", "/foo/exclude", "excl", "/excl",
+        "meep/excl", "meep/excl/file", "meep/excl/", "/excludepath/withsubdir",
+        "/excludepath/withsubdir/foo", "/excludepath/withsubdir2", "rm_me", "x/rm_me",
+        "dir_only", "a/dir_only", "a/dir_only/f", "main.o", "a/main.o/b", "foobar",
+        "fooXbar", "foo/bar", "abc", "aXbYc", "a/b/c", "x/1/y", "x/1/2/y", "x1/z2",
+        "x/z", "logs/a.log", "a/b/c.log", ".csync_journal.db", "deep/deeper/file",
+        "abc/deep", "abc/deep/", "ax", "cx", "esc*aped", "escXaped", "my.~directory",
+        "/a_folder/my.~directory", ".netscape/cache", "unicode/пятницы.txt",
+        "unicode/中文.💩", "unicode/中文.hé", "latex_tmp/my_manuscript.run.xml",
+        "latex/songbook/my_manuscript.tex.tmp", "projects/.apdisk/totally_amazing.jar",
+        "Icon\r", "a/.DS_Store", "x.part", ".~lock.x#", "test.swp", ".test.swp"
+    };
+    const int types[] = { CSYNC_FTW_TYPE_FILE, CSYNC_FTW_TYPE_DIR, CSYNC_FTW_TYPE_SLINK };
+
+    /* Compare after each added pattern, "*" comes last since it matches everything */
+    for (size_t p = 0; p <= sizeof(patterns) / sizeof(patterns[0]); ++p) {
+        if (p > 0) {
+            _csync_exclude_add(&(csync->excludes), patterns[p - 1]);
+        }
+        matcher = csync_exclude_matcher_new(csync->excludes);
+#ifdef HAVE_FNMATCH
+        assert_non_null(matcher);
+#endif
+
+        for (i = 0; matcher && i < sizeof(paths) / sizeof(paths[0]); ++i) {
+            for (t = 0; t < sizeof(types) / sizeof(types[0]); ++t) {
+                assert_int_equal(csync_excluded_traversal_matcher(matcher, paths[i], types[t]),
+                                 csync_excluded_traversal(csync->excludes, paths[i], types[t]));
+                assert_int_equal(csync_excluded_no_ctx_matcher(matcher, paths[i], types[t]),
+                                 csync_excluded_no_ctx(csync->excludes, paths[i], types[t]));
+            }
+        }
+        csync_exclude_matcher_free(matcher);
+    }
+}
+
 static void check_csync_is_windows_reserved_word() {
     assert_true(csync_is_windows_reserved_word("CON"));
     assert_true(csync_is_windows_reserved_word("con"));
@@ -372,6 +420,49 @@ static void check_csync_excluded_performance(void **state)
         const double perCallMs = total / 2 / N * 1000;
         printf("csync_excluded_traversal: %f ms per call\n", perCallMs);
     }
+
+    csync_exclude_matcher_t *matcher = csync_exclude_matcher_new(csync->excludes);
+    if (!matcher) {
+        return;
+    }
+
+    {
+        struct timeval before, after;
+        gettimeofday(&before, 0);
+
+        for (i = 0; i < N; ++i) {
+            totalRc += csync_excluded_no_ctx_matcher(matcher, "/this/is/quite/a/long/path/with/many/components", CSYNC_FTW_TYPE_DIR);
+            totalRc += csync_excluded_no_ctx_matcher(matcher, "/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16/17/18/19/20/21/22/23/24/25/26/27/29", CSYNC_FTW_TYPE_FILE);
+        }
+        assert_int_equal(totalRc, CSYNC_NOT_EXCLUDED); // mainly to avoid optimization
+
+        gettimeofday(&after, 0);
+
+        const double total = (after.tv_sec - before.tv_sec)
+                + (after.tv_usec - before.tv_usec) / 1.0e6;
+        const double perCallMs = total / 2 / N * 1000;
+        printf("csync_excluded_no_ctx_matcher: %f ms per call, %.0f paths/s\n", perCallMs, 1000 / perCallMs);
+    }
+
+    {
+        struct timeval before, after;
+        gettimeofday(&before, 0);
+
+        for (i = 0; i < N; ++i) {
+            totalRc += csync_excluded_traversal_matcher(matcher, "/this/is/quite/a/long/path/with/many/components", CSYNC_FTW_TYPE_DIR);
+            totalRc += csync_excluded_traversal_matcher(matcher, "/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16/17/18/19/20/21/22/23/24/25/26/27/29", CSYNC_FTW_TYPE_FILE);
+        }
+        assert_int_equal(totalRc, CSYNC_NOT_EXCLUDED); // mainly to avoid optimization
+
+        gettimeofday(&after, 0);
+
+        const double total = (after.tv_sec - before.tv_sec)
+                + (after.tv_usec - before.tv_usec) / 1.0e6;
+        const double perCallMs = total / 2 / N * 1000;
+        printf("csync_excluded_traversal_matcher: %f ms per call, %.0f paths/s\n", perCallMs, 1000 / perCallMs);
+    }
+
+    csync_exclude_matcher_free(matcher);
 }
 
 static void check_csync_exclude_expand_escapes(void **state)
@@ -401,6 +492,7 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(check_csync_excluded, setup_init, teardown),
         cmocka_unit_test_setup_teardown(check_csync_excluded_traversal, setup_init, teardown),
         cmocka_unit_test_setup_teardown(check_csync_pathes, setup_init, teardown),
+        cmocka_unit_test_setup_teardown(check_csync_excluded_matcher, setup_init, teardown),
         cmocka_unit_test_setup_teardown(check_csync_is_windows_reserved_word, setup_init, teardown),
         cmocka_unit_test_setup_teardown(check_csync_excluded_performance, setup_init, teardown),
         cmocka_unit_test(check_csync_exclude_expand_escapes),
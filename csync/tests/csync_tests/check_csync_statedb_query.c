@@ -96,6 +96,54 @@ static int setup_db(void **state)
 
 }
 
+/* The full schema, rows with and without the optional columns */
+static int setup_full_db(void **state)
+{
+    char *errmsg;
+    int rc = 0;
+    sqlite3 *db = NULL;
+
+    const char *sql = "CREATE TABLE IF NOT EXISTS metadata ("
+        "phash INTEGER(8),"
+        "pathlen INTEGER,"
+        "path VARCHAR(4096),"
+        "inode INTEGER,"
+        "uid INTEGER,"
+        "gid INTEGER,"
+        "mode INTEGER,"
+        "modtime INTEGER(8),"
+        "type INTEGER,"
+        "md5 VARCHAR(32),"
+        "fileid VARCHAR(128),"
+        "remotePerm VARCHAR(128),"
+        "filesize BIGINT,"
+        "ignoredChildrenRemote INT,"
+        "contentChecksum TEXT,"
+        "contentChecksumTypeId INTEGER,"
+        "PRIMARY KEY(phash)"
+        ");";
+
+    const char *sql2 = "INSERT INTO metadata VALUES"
+        "(1, 3, 'dir', 10, 0, 0, 0, 1400000000, 2, 'etag1', '00000001oc', 'WDNVCK', 0, 1, NULL, 0),"
+        "(2, 9, 'dir/a.txt', 11, 0, 0, 0, 1400000001, 0, 'etag2', '00000002oc', 'WDNV', 42, 0, 'abc', 1),"
+        "(3, 9, 'dir/b.txt', 11, 0, 0, 0, 1400000002, 0, 'etag3', '00000003oc', 'WDNV', 4200000000, 0, NULL, 0),"
+        "(4, 5, 'c.txt', 0, 0, 0, 0, 1400000003, 0, NULL, NULL, NULL, 0, 0, NULL, 0);";
+
+    setup(state);
+    rc = sqlite3_open( TESTDB, &db);
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = sqlite3_exec( db, sql, NULL, NULL, &errmsg );
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = sqlite3_exec( db, sql2, NULL, NULL, &errmsg );
+    assert_int_equal(rc, SQLITE_OK);
+
+    sqlite3_close(db);
+
+    return 0;
+}
+
 static int teardown(void **state) {
     CSYNC *csync = *state;
     int rc = 0;
@@ -159,7 +207,7 @@ static void check_csync_statedb_insert_metadata(void **state)
         snprintf(st->path, 29, "file_%d" , i );
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_hashindex_insert(csync->local.tree, (void *) st);
         assert_int_equal(rc, 0);
     }
 
@@ -178,7 +226,7 @@ static void check_csync_statedb_write(void **state)
         snprintf(st->path, 29, "file_%d" , i );
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_hashindex_insert(csync->local.tree, (void *) st);
         assert_int_equal(rc, 0);
     }
 
@@ -208,6 +256,168 @@ static void check_csync_statedb_get_stat_by_inode_not_found(void **state)
     assert_null(tmp);
 }
 
+static void assert_stat_equal(csync_file_stat_t *a, csync_file_stat_t *b)
+{
+    if (a == NULL || b == NULL) {
+        assert_null(a);
+        assert_null(b);
+        return;
+    }
+    assert_int_equal(a->phash, b->phash);
+    assert_int_equal(a->pathlen, b->pathlen);
+    assert_string_equal(a->path, b->path);
+    assert_int_equal(a->inode, b->inode);
+    assert_int_equal(a->modtime, b->modtime);
+    assert_int_equal(a->type, b->type);
+    assert_int_equal(a->size, b->size);
+    assert_int_equal(a->has_ignored_files, b->has_ignored_files);
+    assert_int_equal(a->etag == NULL, b->etag == NULL);
+    if (a->etag) {
+        assert_string_equal(a->etag, b->etag);
+    }
+    assert_string_equal(a->file_id, b->file_id);
+    assert_string_equal(a->remotePerm, b->remotePerm);
+    assert_int_equal(a->checksumTypeId, b->checksumTypeId);
+    assert_int_equal(a->checksum == NULL, b->checksum == NULL);
+    if (a->checksum) {
+        assert_string_equal(a->checksum, b->checksum);
+    }
+}
+
+static void check_csync_statedb_in_memory_index(void **state)
+{
+    CSYNC *csync = *state;
+    const uint64_t hashes[] = { 1, 2, 3, 4, 666 };
+    const uint64_t inodes[] = { 10, 11, 0, 666 };
+    const char *file_ids[] = { "00000001oc", "00000002oc", "00000003oc", "", "666" };
+    csync_file_stat_t *from_db[5];
+    csync_file_stat_t *st;
+    size_t i;
+    int rc;
+
+    /* The same lookups, first with queries, then from the index */
+    for (i = 0; i < 5; i++) {
+        from_db[i] = csync_statedb_get_stat_by_hash(csync, hashes[i]);
+    }
+    assert_non_null(from_db[0]);
+    assert_null(from_db[4]);
+
+    rc = csync_statedb_index_load(csync);
+    assert_int_equal(rc, 0);
+    assert_non_null(csync->statedb.index);
+
+    for (i = 0; i < 5; i++) {
+        st = csync_statedb_get_stat_by_hash(csync, hashes[i]);
+        assert_stat_equal(st, from_db[i]);
+        csync_file_stat_free(st);
+    }
+
+    csync_statedb_index_free(csync);
+    for (i = 0; i < 4; i++) {
+        csync_file_stat_free(from_db[i]);
+        from_db[i] = csync_statedb_get_stat_by_inode(csync, inodes[i]);
+    }
+    csync_statedb_index_load(csync);
+    for (i = 0; i < 4; i++) {
+        st = csync_statedb_get_stat_by_inode(csync, inodes[i]);
+        assert_stat_equal(st, from_db[i]);
+        csync_file_stat_free(st);
+    }
+    /* Two rows have the inode 11, both return the first one */
+    assert_string_equal(from_db[1]->path, "dir/a.txt");
+
+    csync_statedb_index_free(csync);
+    for (i = 0; i < 5; i++) {
+        csync_file_stat_free(from_db[i]);
+        from_db[i] = csync_statedb_get_stat_by_file_id(csync, file_ids[i]);
+    }
+    csync_statedb_index_load(csync);
+    for (i = 0; i < 5; i++) {
+        st = csync_statedb_get_stat_by_file_id(csync, file_ids[i]);
+        assert_stat_equal(st, from_db[i]);
+        csync_file_stat_free(st);
+        csync_file_stat_free(from_db[i]);
+    }
+
+    /* The index outlives the database connection until the end of the sync */
+    csync_statedb_close(csync);
+    st = csync_statedb_get_stat_by_hash(csync, 2);
+    assert_non_null(st);
+    assert_string_equal(st->checksum, "abc");
+    csync_file_stat_free(st);
+
+    rc = csync_commit(csync);
+    assert_int_equal(rc, 0);
+    assert_null(csync->statedb.index);
+}
+
+static int lock_depth;
+static int lock_count;
+
+static void test_lock(void *userdata)
+{
+    assert_int_equal(lock_depth, 0);
+    (*(int *) userdata)++;
+    lock_depth++;
+    lock_count++;
+}
+
+static void test_unlock(void *userdata)
+{
+    (void) userdata;
+    assert_int_equal(lock_depth, 1);
+    lock_depth--;
+}
+
+static void check_csync_statedb_borrow_connection(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *st;
+    sqlite3 *db = NULL;
+    int userdata = 0;
+    int rc;
+
+    /* Give up the connection of the setup, borrow one of our own */
+    rc = csync_statedb_close(csync);
+    assert_int_equal(rc, 0);
+    rc = sqlite3_open_v2(TESTDB, &db, SQLITE_OPEN_READWRITE, NULL);
+    assert_int_equal(rc, SQLITE_OK);
+
+    lock_count = 0;
+    csync_statedb_borrow_connection(csync, db, test_lock, test_unlock, &userdata);
+    assert_true(csync->statedb.db == db);
+
+    /* load and close keep the connection and the statements */
+    rc = csync_statedb_load(csync, TESTDB, &csync->statedb.db);
+    assert_int_equal(rc, 0);
+    st = csync_statedb_get_stat_by_hash(csync, 2);
+    assert_non_null(st);
+    assert_string_equal(st->path, "dir/a.txt");
+    csync_file_stat_free(st);
+    rc = csync_statedb_close(csync);
+    assert_int_equal(rc, 0);
+    assert_non_null(csync->statedb.by_hash_stmt);
+    assert_true(csync->statedb.db == db);
+
+    st = csync_statedb_get_stat_by_inode(csync, 10);
+    assert_non_null(st);
+    csync_file_stat_free(st);
+    st = csync_statedb_get_stat_by_file_id(csync, "00000003oc");
+    assert_non_null(st);
+    csync_file_stat_free(st);
+    assert_int_equal(lock_count, 4);
+    assert_int_equal(userdata, 4);
+
+    /* After the release nothing is found, the owner can close its connection */
+    csync_statedb_release_connection(csync);
+    assert_null(csync->statedb.by_hash_stmt);
+    assert_null(csync->statedb.db);
+    st = csync_statedb_get_stat_by_hash(csync, 2);
+    assert_null(st);
+    rc = sqlite3_close(db);
+    assert_int_equal(rc, SQLITE_OK);
+}
+
 int torture_run_tests(void)
 {
     const struct CMUnitTest tests[] = {
@@ -217,6 +427,8 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(check_csync_statedb_write, setup, teardown),
         cmocka_unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash_not_found, setup_db, teardown),
         cmocka_unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode_not_found, setup_db, teardown),
+        cmocka_unit_test_setup_teardown(check_csync_statedb_in_memory_index, setup_full_db, teardown),
+        cmocka_unit_test_setup_teardown(check_csync_statedb_borrow_connection, setup_full_db, teardown),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -20,6 +20,7 @@
 #include "torture.h"
 
 #include "csync_update.c"
+#include "csync_update_prefetch.h"
 
 #define TESTDB "/tmp/check_csync/journal.db"
 
@@ -254,7 +255,7 @@ static void check_csync_detect_update(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashindex_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* create a statedb */
@@ -283,7 +284,7 @@ static void check_csync_detect_update_db_none(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashindex_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
 
@@ -310,7 +311,7 @@ static void check_csync_detect_update_db_eval(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashindex_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* create a statedb */
@@ -341,7 +342,7 @@ static void check_csync_detect_update_db_rename(void **state)
     /* the instruction should be set to rename */
     /*
      * temporarily broken.
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashindex_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_RENAME);
 
     st->instruction = CSYNC_INSTRUCTION_UPDATED;
@@ -369,7 +370,7 @@ static void check_csync_detect_update_db_new(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = c_hashindex_at(csync->local.tree, 0);
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
 
@@ -430,6 +431,146 @@ static void check_csync_ftw_failing_fn(void **state)
     assert_int_equal(rc, -1);
 }
 
+static size_t walk_local_tree(const char *uri, int threads)
+{
+    CSYNC *csync;
+    size_t size;
+    int rc;
+
+    unlink(TESTDB);
+    csync_create(&csync, uri);
+    csync_init(csync, TESTDB);
+
+    sqlite3 *db = NULL;
+    rc = sqlite3_open_v2(TESTDB, &db, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, NULL);
+    assert_int_equal(rc, SQLITE_OK);
+    statedb_create_metadata_table(db);
+    sqlite3_close(db);
+
+    rc = csync_statedb_load(csync, TESTDB, &csync->statedb.db);
+    assert_int_equal(rc, 0);
+
+    csync->current = LOCAL_REPLICA;
+    csync->replica = LOCAL_REPLICA;
+    csync_local_prefetch_start(csync, threads);
+    assert_int_equal(csync_local_prefetch_active(csync), threads > 1);
+    rc = csync_ftw(csync, uri, csync_walker, MAX_DEPTH);
+    csync_local_prefetch_stop(csync);
+    assert_int_equal(rc, 0);
+
+    size = c_hashindex_size(csync->local.tree);
+    csync_destroy(csync);
+    return size;
+}
+
+static void check_csync_ftw_prefetch(void **state)
+{
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("mkdir -p /tmp/check_csync1/a/b/c /tmp/check_csync1/d/e /tmp/check_csync1/.hidden/f");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/a/1 /tmp/check_csync1/a/b/2 /tmp/check_csync1/a/b/c/3 "
+                "/tmp/check_csync1/d/4 /tmp/check_csync1/d/e/5 /tmp/check_csync1/.hidden/f/6");
+    assert_int_equal(rc, 0);
+
+    /* The tree read with prefetching threads must be the same as the serial one */
+    size_t serial = walk_local_tree("/tmp/check_csync1", 1);
+    assert_int_equal(serial, 11);
+    assert_int_equal(walk_local_tree("/tmp/check_csync1", 4), serial);
+}
+
+static void statedb_insert_entry(sqlite3 *db, const char *path, int type)
+{
+    char *stmt = sqlite3_mprintf("INSERT INTO metadata"
+                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5) VALUES"
+                                 "(%lld, %d, '%q', %d, %d, %d, %d, %lld, %d, '%q');",
+                                 (long long signed int) c_jhash64((uint8_t *) path, strlen(path), 0),
+                                 (int) strlen(path), path, 0, 0, 0, 0, (long long signed int) 42, type, "etag");
+    int rc = sqlite3_exec(db, stmt, NULL, NULL, NULL);
+    sqlite3_free(stmt);
+    assert_int_equal(rc, SQLITE_OK);
+}
+
+/* Reports changes in "a/b/new" only */
+static int local_discovery_hook(void *userdata, const char *path)
+{
+    (void) userdata; /* unused */
+
+    return strcmp(path, "a") == 0 || strcmp(path, "a/b") == 0;
+}
+
+static void check_csync_ftw_local_from_db(void **state)
+{
+    int threads;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = system("mkdir -p /tmp/check_csync1/a/b /tmp/check_csync1/d /tmp/check_csync1/e");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/a/1 /tmp/check_csync1/a/b/new /tmp/check_csync1/d/4 "
+                "/tmp/check_csync1/d/new /tmp/check_csync1/e/5");
+    assert_int_equal(rc, 0);
+
+    for (threads = 1; threads <= 4; threads += 3) {
+        CSYNC *csync;
+        csync_file_stat_t *st;
+        sqlite3 *db = NULL;
+        const char *path;
+
+        unlink(TESTDB);
+        csync_create(&csync, "/tmp/check_csync1");
+        csync_init(csync, TESTDB);
+
+        /* e is not in the database */
+        rc = sqlite3_open_v2(TESTDB, &db, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, NULL);
+        assert_int_equal(rc, SQLITE_OK);
+        statedb_create_metadata_table(db);
+        statedb_insert_entry(db, "a", CSYNC_FTW_TYPE_DIR);
+        statedb_insert_entry(db, "a/b", CSYNC_FTW_TYPE_DIR);
+        statedb_insert_entry(db, "d", CSYNC_FTW_TYPE_DIR);
+        statedb_insert_entry(db, "d/4", CSYNC_FTW_TYPE_FILE);
+        statedb_insert_entry(db, "d/gone", CSYNC_FTW_TYPE_FILE);
+        sqlite3_close(db);
+
+        rc = csync_statedb_load(csync, TESTDB, &csync->statedb.db);
+        assert_int_equal(rc, 0);
+
+        csync->callbacks.checkLocalDiscoveryHook = local_discovery_hook;
+        csync->current = LOCAL_REPLICA;
+        csync->replica = LOCAL_REPLICA;
+        csync_local_prefetch_start(csync, threads);
+        rc = csync_ftw(csync, "/tmp/check_csync1", csync_walker, MAX_DEPTH);
+        csync_local_prefetch_stop(csync);
+        assert_int_equal(rc, 0);
+
+        /* a, a/1, a/b, a/b/new, d, d/4, d/gone, e, e/5 */
+        assert_int_equal(c_hashindex_size(csync->local.tree), 9);
+
+        /* d is read from the database, a new entry on disk is not seen */
+        path = "d/new";
+        assert_null(c_hashindex_find(csync->local.tree, c_jhash64((uint8_t *) path, strlen(path), 0)));
+        path = "d/gone";
+        st = c_hashindex_find(csync->local.tree, c_jhash64((uint8_t *) path, strlen(path), 0));
+        assert_non_null(st);
+        assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NONE);
+
+        /* The changed directory is read from disk */
+        path = "a/b/new";
+        st = c_hashindex_find(csync->local.tree, c_jhash64((uint8_t *) path, strlen(path), 0));
+        assert_non_null(st);
+        assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
+
+        /* e has no entries in the database, so it is read from disk as well */
+        path = "e/5";
+        assert_non_null(c_hashindex_find(csync->local.tree, c_jhash64((uint8_t *) path, strlen(path), 0)));
+
+        csync_destroy(csync);
+    }
+}
+
 int torture_run_tests(void)
 {
     const struct CMUnitTest tests[] = {
@@ -443,6 +584,8 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(check_csync_ftw, setup_ftw, teardown_rm),
         cmocka_unit_test_setup_teardown(check_csync_ftw_empty_uri, setup_ftw, teardown_rm),
         cmocka_unit_test_setup_teardown(check_csync_ftw_failing_fn, setup_ftw, teardown_rm),
+        cmocka_unit_test_setup_teardown(check_csync_ftw_prefetch, setup_ftw, teardown_rm),
+        cmocka_unit_test_setup_teardown(check_csync_ftw_local_from_db, setup_ftw, teardown_rm),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,155 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "std/c_alloc.h"
+#include "std/c_arena.h"
+
+static void setup(void **state) {
+    c_arena_t *arena = c_arena_new();
+
+    assert_non_null(arena);
+    *state = arena;
+}
+
+static void teardown(void **state) {
+    c_arena_free(*state);
+    *state = NULL;
+}
+
+static void check_c_arena_alloc(void **state)
+{
+    c_arena_t *arena = *state;
+    char *a, *b, *big;
+    size_t i;
+
+    assert_null(c_arena_alloc(arena, 0));
+
+    a = c_arena_alloc(arena, 3);
+    b = c_arena_alloc(arena, 5);
+    assert_non_null(a);
+    assert_non_null(b);
+    assert_true(((uintptr_t) a % 8) == 0);
+    assert_true(((uintptr_t) b % 8) == 0);
+    assert_true(b >= a + 3);
+
+    /* The memory is zeroed */
+    for (i = 0; i < 5; i++) {
+        assert_int_equal(b[i], 0);
+    }
+
+    /* Bigger than a block, and the current block is still used afterwards */
+    big = c_arena_alloc(arena, 4 * 1024 * 1024);
+    assert_non_null(big);
+    memset(big, 'x', 4 * 1024 * 1024);
+    b = c_arena_alloc(arena, 8);
+    assert_true(b > a && b < a + 256 * 1024);
+    assert_true(c_arena_size(arena) > 4 * 1024 * 1024);
+}
+
+static void check_c_arena_alloc_many(void **state)
+{
+    c_arena_t *arena = *state;
+    int *last = NULL;
+    int i;
+
+    /* Fills several blocks, nothing may overlap */
+    for (i = 0; i < 200000; i++) {
+        int *p = c_arena_alloc(arena, sizeof(int) * 3);
+        assert_non_null(p);
+        p[0] = i;
+        p[2] = i;
+        if (last) {
+            assert_int_equal(last[0], i - 1);
+            assert_int_equal(last[2], i - 1);
+        }
+        last = p;
+    }
+}
+
+static void check_c_arena_strdup(void **state)
+{
+    c_arena_t *arena = *state;
+    const char *str = "some etag";
+    char *copy;
+
+    assert_null(c_arena_strdup(arena, NULL));
+
+    copy = c_arena_strdup(arena, str);
+    assert_string_equal(copy, str);
+    assert_true(copy != str);
+    assert_true(c_arena_strdup(arena, str) != copy);
+
+    assert_string_equal(c_arena_strdup(arena, ""), "");
+}
+
+static void check_c_arena_intern(void **state)
+{
+    c_arena_t *arena = *state;
+    char buf[32];
+    const char *first[1000];
+    int i;
+
+    assert_null(c_arena_intern(arena, NULL));
+
+    strcpy(buf, "WDNVCKR");
+    first[0] = c_arena_intern(arena, buf);
+    assert_string_equal(first[0], "WDNVCKR");
+    assert_true(first[0] != buf);
+    assert_true(c_arena_intern(arena, "WDNVCKR") == first[0]);
+    assert_true(c_arena_intern(arena, "WDNVCK") != first[0]);
+
+    /* Enough distinct strings to grow the table a few times */
+    for (i = 1; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "perm%d", i);
+        first[i] = c_arena_intern(arena, buf);
+        assert_string_equal(first[i], buf);
+    }
+    for (i = 1; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "perm%d", i);
+        assert_true(c_arena_intern(arena, buf) == first[i]);
+    }
+    assert_true(c_arena_intern(arena, "WDNVCKR") == first[0]);
+}
+
+static void check_c_arena_free_null(void **state)
+{
+    (void) state; /* unused */
+
+    c_arena_free(NULL);
+    assert_int_equal(c_arena_size(NULL), 0);
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test_setup_teardown(check_c_arena_alloc, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_alloc_many, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_strdup, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_intern, setup, teardown),
+      unit_test(check_c_arena_free_null),
+  };
+
+  return run_tests(tests);
+}
@@ -0,0 +1,338 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2017      by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <errno.h>
+#include <time.h>
+
+#include "torture.h"
+
+#include "std/c_alloc.h"
+#include "std/c_hashindex.h"
+
+typedef struct test_s {
+    int key;
+    int number;
+} test_t;
+
+static uint64_t data_key(const void *data) {
+    return (uint64_t) ((const test_t *) data)->key;
+}
+
+/* Walk in descending key order, the opposite of the insertion order */
+static int data_cmp(const void *a, const void *b) {
+    const test_t *ta = (const test_t *) a;
+    const test_t *tb = (const test_t *) b;
+
+    if (ta->key > tb->key) {
+        return -1;
+    } else if (ta->key < tb->key) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int visitor(void *obj, void *data) {
+    test_t *a;
+    test_t *b;
+
+    a = (test_t *) obj;
+    b = (test_t *) data;
+
+    if (a->key == b->key) {
+        a->number = 42;
+    }
+
+    return 0;
+}
+
+static int order_visitor(void *obj, void *data) {
+    test_t *a = (test_t *) obj;
+    int *last = (int *) data;
+
+    if (a->key >= *last) {
+        return -1;
+    }
+    *last = a->key;
+
+    return 0;
+}
+
+static int abort_visitor(void *obj, void *data) {
+    (void) obj;
+    (void) data;
+
+    errno = EIO;
+    return -1;
+}
+
+static void destructor(void *data) {
+    test_t *freedata = NULL;
+
+    freedata = (test_t *) data;
+    SAFE_FREE(freedata);
+}
+
+static void setup(void **state) {
+    c_hashindex_t *index = NULL;
+
+    c_hashindex_create(&index, data_key, data_cmp);
+
+    *state = index;
+}
+
+static void setup_complete_index(void **state) {
+    c_hashindex_t *index = NULL;
+    int i = 0;
+    int rc;
+
+    c_hashindex_create(&index, data_key, data_cmp);
+
+    for (i = 0; i < 100; i++) {
+        test_t *testdata = NULL;
+
+        testdata = c_malloc(sizeof(test_t));
+        assert_non_null(testdata);
+
+        testdata->key = i;
+
+        rc = c_hashindex_insert(index, (void *) testdata);
+        assert_int_equal(rc, 0);
+    }
+
+    *state = index;
+}
+
+static void teardown(void **state) {
+    c_hashindex_t *index = *state;
+
+    c_hashindex_destroy(index, destructor);
+    c_hashindex_free(index);
+
+    *state = NULL;
+}
+
+static void check_c_hashindex_create_free(void **state)
+{
+    c_hashindex_t *index = NULL;
+    int rc;
+
+    (void) state; /* unused */
+
+    c_hashindex_create(&index, data_key, data_cmp);
+    assert_int_equal(c_hashindex_size(index), 0);
+    assert_null(c_hashindex_find(index, 42));
+
+    rc = c_hashindex_free(index);
+    assert_int_equal(rc, 0);
+}
+
+static void check_c_hashindex_free_null(void **state)
+{
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = c_hashindex_free(NULL);
+    assert_int_equal(rc, -1);
+    assert_int_equal(c_hashindex_size((c_hashindex_t *) NULL), 0);
+}
+
+static void check_c_hashindex_insert_many(void **state)
+{
+    c_hashindex_t *index = *state;
+    int i = 0, rc;
+
+    /* Enough to grow the table a few times */
+    for (i = 0; i < 10000; i++) {
+        test_t *testdata = NULL;
+
+        testdata = malloc(sizeof(test_t));
+        assert_non_null(testdata);
+
+        testdata->key = i;
+
+        rc = c_hashindex_insert(index, testdata);
+        assert_int_equal(rc, 0);
+    }
+    assert_int_equal(c_hashindex_size(index), 10000);
+
+    for (i = 0; i < 10000; i++) {
+        test_t *testdata = c_hashindex_find(index, i);
+        assert_non_null(testdata);
+        assert_int_equal(testdata->key, i);
+        assert_true(c_hashindex_at(index, i) == testdata);
+    }
+    assert_null(c_hashindex_find(index, 10000));
+}
+
+static void check_c_hashindex_insert_duplicate(void **state)
+{
+    c_hashindex_t *index = *state;
+    test_t *testdata;
+    int rc;
+
+    testdata = malloc(sizeof(test_t));
+    assert_non_null(testdata);
+
+    testdata->key = 42;
+
+    rc = c_hashindex_insert(index, (void *) testdata);
+    assert_int_equal(rc, 0);
+
+    /* add again */
+    testdata = malloc(sizeof(test_t));
+    assert_non_null(testdata);
+
+    testdata->key = 42;
+
+    /* check for duplicate */
+    rc = c_hashindex_insert(index, (void *) testdata);
+    assert_int_equal(rc, 1);
+    assert_int_equal(c_hashindex_size(index), 1);
+
+    free(testdata);
+}
+
+static void check_c_hashindex_find(void **state)
+{
+    c_hashindex_t *index = *state;
+    test_t *testdata;
+
+    /* find the entry with the key 42 */
+    testdata = (test_t *) c_hashindex_find(index, 42);
+    assert_non_null(testdata);
+    assert_int_equal(testdata->key, 42);
+
+    assert_null(c_hashindex_find(index, 100));
+}
+
+static void check_c_hashindex_walk(void **state)
+{
+    c_hashindex_t *index = *state;
+    int rc;
+    test_t *testdata;
+
+    testdata = (test_t *) c_malloc(sizeof(test_t));
+    testdata->key = 42;
+
+    rc = c_hashindex_walk(index, testdata, visitor);
+    assert_int_equal(rc, 0);
+    free(testdata);
+
+    /* find the entry with the key 42 */
+    testdata = (test_t *) c_hashindex_find(index, 42);
+    assert_non_null(testdata);
+    assert_int_equal(testdata->number, 42);
+}
+
+static void check_c_hashindex_walk_order(void **state)
+{
+    c_hashindex_t *index = *state;
+    test_t *testdata;
+    int last = 1000;
+    int rc;
+
+    rc = c_hashindex_walk(index, &last, order_visitor);
+    assert_int_equal(rc, 0);
+    assert_int_equal(last, 0);
+
+    /* An insertion after a walk is sorted in on the next one */
+    testdata = c_malloc(sizeof(test_t));
+    testdata->key = 150;
+    rc = c_hashindex_insert(index, testdata);
+    assert_int_equal(rc, 0);
+
+    last = 1000;
+    rc = c_hashindex_walk(index, &last, order_visitor);
+    assert_int_equal(rc, 0);
+    assert_int_equal(last, 0);
+}
+
+static void check_c_hashindex_walk_abort(void **state)
+{
+    c_hashindex_t *index = *state;
+    int rc;
+
+    rc = c_hashindex_walk(index, index, abort_visitor);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EIO);
+}
+
+static void check_c_hashindex_walk_null(void **state)
+{
+    c_hashindex_t *index = *state;
+    int rc;
+    test_t *testdata;
+
+    testdata = (test_t *) malloc(sizeof(test_t));
+    testdata->key = 42;
+
+    rc = c_hashindex_walk(NULL, testdata, visitor);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+
+    rc = c_hashindex_walk(index, NULL, visitor);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+
+    rc = c_hashindex_walk(index, testdata, NULL);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EINVAL);
+
+    /* find the entry with the key 42 */
+    assert_non_null(c_hashindex_find(index, 42));
+
+    free(testdata);
+}
+
+static void check_c_hashindex_destroy_reuse(void **state)
+{
+    c_hashindex_t *index = *state;
+    test_t *testdata;
+    int rc;
+
+    c_hashindex_destroy(index, destructor);
+    assert_int_equal(c_hashindex_size(index), 0);
+    assert_null(c_hashindex_find(index, 42));
+
+    testdata = c_malloc(sizeof(test_t));
+    testdata->key = 42;
+    rc = c_hashindex_insert(index, testdata);
+    assert_int_equal(rc, 0);
+    assert_true(c_hashindex_find(index, 42) == testdata);
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test(check_c_hashindex_create_free),
+      unit_test(check_c_hashindex_free_null),
+      unit_test_setup_teardown(check_c_hashindex_insert_many, setup, teardown),
+      unit_test_setup_teardown(check_c_hashindex_insert_duplicate, setup, teardown),
+      unit_test_setup_teardown(check_c_hashindex_find, setup_complete_index, teardown),
+      unit_test_setup_teardown(check_c_hashindex_walk, setup_complete_index, teardown),
+      unit_test_setup_teardown(check_c_hashindex_walk_order, setup_complete_index, teardown),
+      unit_test_setup_teardown(check_c_hashindex_walk_abort, setup_complete_index, teardown),
+      unit_test_setup_teardown(check_c_hashindex_walk_null, setup_complete_index, teardown),
+      unit_test_setup_teardown(check_c_hashindex_destroy_reuse, setup_complete_index, teardown),
+  };
+
+  return run_tests(tests);
+}
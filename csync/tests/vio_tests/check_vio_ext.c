@@ -28,6 +28,7 @@
 
 #include "csync_private.h"
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -420,6 +421,52 @@ static void check_readdir_longtree(void **state)
 }
 
 // https://github.com/owncloud/client/issues/3128 https://github.com/owncloud/client/issues/2777
+static void check_readdir_stat(void **state)
+{
+    csync_vio_handle_t *dh;
+    csync_vio_file_stat_t *dirent;
+    csync_vio_file_stat_t *fs;
+    int files_cnt = 0;
+
+    (void) state;
+
+    create_dirs( "stat/sub/" );
+    create_file( CSYNC_TEST_DIR "/stat/", "file.txt", "some content");
+
+    dh = csync_vio_local_opendir(CSYNC_TEST_DIR "/stat");
+    assert_non_null(dh);
+
+    while( (dirent = csync_vio_local_readdir(dh)) ) {
+        if( c_streq( dirent->name, "..") || c_streq( dirent->name, "." )) {
+            csync_vio_file_stat_destroy(dirent);
+            continue;
+        }
+
+        fs = csync_vio_file_stat_new();
+        if (c_streq(dirent->name, "file.txt")) {
+            assert_int_equal(csync_vio_local_stat(CSYNC_TEST_DIR "/stat/file.txt", fs), 0);
+            assert_int_equal(dirent->type, CSYNC_VIO_FILE_TYPE_REGULAR);
+            files_cnt++;
+        } else {
+            assert_string_equal(dirent->name, "sub");
+            assert_int_equal(csync_vio_local_stat(CSYNC_TEST_DIR "/stat/sub", fs), 0);
+            assert_int_equal(dirent->type, CSYNC_VIO_FILE_TYPE_DIRECTORY);
+        }
+#ifndef _WIN32
+        /* The entries are already stat'ed relative to the directory */
+        assert_int_equal(dirent->fields & CSYNC_VIO_LOCAL_STAT_FIELDS, CSYNC_VIO_LOCAL_STAT_FIELDS);
+        assert_int_equal(dirent->mode, fs->mode);
+        assert_true(dirent->inode == fs->inode);
+        assert_true(dirent->size == fs->size);
+        assert_true(dirent->mtime == fs->mtime);
+#endif
+        csync_vio_file_stat_destroy(fs);
+        csync_vio_file_stat_destroy(dirent);
+    }
+    assert_int_equal(csync_vio_local_closedir(dh), 0);
+    assert_int_equal(files_cnt, 1);
+}
+
 static void check_readdir_bigunicode(void **state)
 {
     statevar *sv = (statevar*) *state;
@@ -465,6 +512,7 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_readdir_shorttree, setup_testenv, teardown),
         unit_test_setup_teardown(check_readdir_with_content, setup_testenv, teardown),
         unit_test_setup_teardown(check_readdir_longtree, setup_testenv, teardown),
+        unit_test_setup_teardown(check_readdir_stat, setup_testenv, teardown),
         unit_test_setup_teardown(check_readdir_bigunicode, setup_testenv, teardown),
     };
 
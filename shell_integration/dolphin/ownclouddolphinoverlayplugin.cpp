@@ -22,6 +22,7 @@
 #include <QtNetwork/QLocalSocket>
 #include <KIOCore/kfileitem.h>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QTimer>
 #include "ownclouddolphinpluginhelper.h"
 
@@ -33,12 +34,20 @@ class OwncloudDolphinPlugin : public KOverlayIconPlugin
     typedef QHash<QByteArray, QByteArray> StatusMap;
     StatusMap m_status;
 
+    // When the statuses of a directory were asked for, the pushes keep them up to date after that
+    QHash<QByteArray, QElapsedTimer> m_requestedDirectories;
+    // The entries of a STATUSES reply that are still to come, and its directory
+    int m_pendingEntries = 0;
+    QByteArray m_entriesDirectory;
+
 public:
 
     OwncloudDolphinPlugin() {
         auto helper = OwncloudDolphinPluginHelper::instance();
         QObject::connect(helper, &OwncloudDolphinPluginHelper::commandRecieved,
                          this, &OwncloudDolphinPlugin::slotCommandRecieved);
+        QObject::connect(helper, &OwncloudDolphinPluginHelper::connected,
+                         this, &OwncloudDolphinPlugin::slotConnected);
     }
 
     QStringList getOverlays(const QUrl& url) override {
@@ -50,7 +59,12 @@ public:
         QDir localPath(url.toLocalFile());
         const QByteArray localFile = localPath.canonicalPath().toUtf8();
 
-        helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+        if (helper->hasSocketApiVersion(1, 1)) {
+            // One request answers for all the files of the directory
+            requestDirectory(localFile.left(localFile.lastIndexOf('/')));
+        } else {
+            helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+        }
 
         StatusMap::iterator it = m_status.find(localFile);
         if (it != m_status.constEnd()) {
@@ -60,6 +74,16 @@ public:
     }
 
 private:
+    void requestDirectory(const QByteArray &directory) {
+        if (directory.isEmpty())
+            return;
+        QElapsedTimer &requested = m_requestedDirectories[directory];
+        if (requested.isValid() && !requested.hasExpired(5000))
+            return;
+        requested.start();
+        OwncloudDolphinPluginHelper::instance()->sendCommand(QByteArray("RETRIEVE_FILE_STATUSES:" + directory + "\n"));
+    }
+
     QStringList overlaysForString(const QByteArray &status) {
         QStringList r;
         if (status.startsWith("NOP"))
@@ -80,8 +104,32 @@ private:
         return r;
     }
 
+    void slotConnected() {
+        // A reply may have been cut off, and the new client knows of no directory
+        m_pendingEntries = 0;
+        m_entriesDirectory.clear();
+        m_requestedDirectories.clear();
+    }
+
     void slotCommandRecieved(const QByteArray &line) {
 
+        // STATUSES:<count>:<directory> is followed by count lines of <status>:<name>
+        if (m_pendingEntries > 0) {
+            --m_pendingEntries;
+            int col = line.indexOf(':');
+            if (col > 0)
+                setStatus(m_entriesDirectory + '/' + line.mid(col + 1), line.left(col));
+            return;
+        }
+        if (line.startsWith("STATUSES:")) {
+            int col = line.indexOf(':', 9);
+            if (col == -1)
+                return;
+            m_pendingEntries = line.mid(9, col - 9).toInt();
+            m_entriesDirectory = line.mid(col + 1);
+            return;
+        }
+
         QList<QByteArray> tokens = line.split(':');
         if (tokens.count() != 3)
             return;
@@ -90,11 +138,14 @@ private:
         if (tokens[2].isEmpty())
             return;
 
-        const QByteArray name = tokens[2];
+        setStatus(tokens[2], tokens[1]);
+    }
+
+    void setStatus(const QByteArray &name, const QByteArray &newStatus) {
         QByteArray &status = m_status[name]; // reference to the item in the hash
-        if (status == tokens[1])
+        if (status == newStatus)
             return;
-        status = tokens[1];
+        status = newStatus;
 
         emit overlaysChanged(QUrl::fromLocalFile(QString::fromUtf8(name)), overlaysForString(status));
     }
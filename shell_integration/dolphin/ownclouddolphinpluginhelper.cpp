@@ -51,6 +51,14 @@ bool OwncloudDolphinPluginHelper::isConnected() const
     return _socket.state() == QLocalSocket::ConnectedState;
 }
 
+bool OwncloudDolphinPluginHelper::hasSocketApiVersion(int major, int minor) const
+{
+    const QList<QByteArray> version = _socketApiVersion.split('.');
+    const int ownMajor = version.value(0).toInt();
+    const int ownMinor = version.value(1).toInt();
+    return ownMajor > major || (ownMajor == major && ownMinor >= minor);
+}
+
 void OwncloudDolphinPluginHelper::sendCommand(const char* data)
 {
     _socket.write(data);
@@ -59,6 +67,10 @@ void OwncloudDolphinPluginHelper::sendCommand(const char* data)
 
 void OwncloudDolphinPluginHelper::slotConnected()
 {
+    _line.clear();
+    _socketApiVersion.clear();
+    emit connected();
+    sendCommand("VERSION:\n");
     sendCommand("SHARE_MENU_TITLE:\n");
 }
 
@@ -92,6 +104,10 @@ void OwncloudDolphinPluginHelper::slotReadyRead()
             QString file = QString::fromUtf8(line.constData() + col + 1, line.size() - col - 1);
             _paths.append(file);
             continue;
+        } else if (line.startsWith("VERSION:")) {
+            // VERSION:<client version>:<socket api version>
+            _socketApiVersion = line.mid(line.lastIndexOf(':') + 1);
+            continue;
         } else if (line.startsWith("SHARE_MENU_TITLE:")) {
             auto col = line.indexOf(':');
             _shareActionString = QString::fromUtf8(line.constData() + col + 1, line.size() - col - 1);
@@ -30,11 +30,15 @@ public:
 
     QString shareActionString() const { return _shareActionString; }
     bool isConnected() const;
+    /** Whether the client speaks at least that version of the socket API */
+    bool hasSocketApiVersion(int major, int minor) const;
     void sendCommand(const char *data);
     QVector<QString> paths() const { return _paths; }
 
 signals:
     void commandRecieved(const QByteArray &cmd);
+    /** Connected to a client, possibly another one than before */
+    void connected();
 
 protected:
     void timerEvent(QTimerEvent*) override;
@@ -48,5 +52,6 @@ private:
     QByteArray _line;
     QVector<QString> _paths;
     QString _shareActionString;
+    QByteArray _socketApiVersion;
     QBasicTimer _connectTimer;
 };
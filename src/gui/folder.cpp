@@ -19,6 +19,7 @@
 #include "accountstate.h"
 #include "folder.h"
 #include "folderman.h"
+#include "folderwatcher.h"
 #include "logger.h"
 #include "configfile.h"
 #include "networkjobs.h"
@@ -59,6 +60,8 @@ Folder::Folder(const FolderDefinition& definition,
       , _consecutiveFollowUpSyncs(0)
       , _journal(_definition.absoluteJournalPath())
       , _fileLog(new SyncRunFileLog)
+      , _fullLocalDiscoveryNeeded(true)
+      , _fullLocalDiscoveryInSync(false)
       , _saveBackwardsCompatible(false)
 {
     qsrand(QTime::currentTime().msec());
@@ -447,6 +450,19 @@ int Folder::slotWipeErrorBlacklist()
     return _journal.wipeErrorBlacklist();
 }
 
+void Folder::slotWatchedPathReported(const QString& path)
+{
+    // Remember the path for the local discovery before any filtering: our own
+    // changes are in the journal after the sync, but a user may have
+    // touched the same file meanwhile.
+    if (path.startsWith(this->path())) {
+        _localDiscoveryPaths.insert(path.mid(this->path().size()));
+    } else if (QDir::cleanPath(path) == QDir::cleanPath(this->path())) {
+        // A change of the root itself, e.g. after a buffer overflow of the watcher
+        slotNextSyncFullLocalDiscovery();
+    }
+}
+
 void Folder::slotWatchedPathChanged(const QString& path)
 {
     // The folder watcher fires a lot of bogus notifications during
@@ -615,9 +631,20 @@ bool Folder::proxyDirty()
     return _proxyDirty;
 }
 
+void Folder::setFolderWatcher(FolderWatcher *watcher)
+{
+    _folderWatcher = watcher;
+    connect(watcher, SIGNAL(pathReported(QString)), this, SLOT(slotWatchedPathReported(QString)));
+    connect(watcher, SIGNAL(lostChanges()), this, SLOT(slotNextSyncFullLocalDiscovery()));
+}
+
+void Folder::slotNextSyncFullLocalDiscovery()
+{
+    _fullLocalDiscoveryNeeded = true;
+}
+
 void Folder::startSync(const QStringList &pathList)
 {
-    Q_UNUSED(pathList)
     if (proxyDirty()) {
         setProxyDirty(false);
     }
@@ -651,10 +678,34 @@ void Folder::startSync(const QStringList &pathList)
     auto newFolderLimit = cfgFile.newBigFolderSizeLimit();
     opt._newBigFolderSizeLimit = newFolderLimit.first ? newFolderLimit.second * 1000LL * 1000LL : -1; // convert from MB to B
     opt._confirmExternalStorage = cfgFile.confirmExternalStorage();
+    opt._localDiscoveryThreads = cfgFile.localDiscoveryThreads();
+    opt._inMemoryJournalIndex = cfgFile.inMemoryJournalIndex();
+    opt._remoteDiscoveryJobs = cfgFile.remoteDiscoveryJobs();
+    opt._initialChunkSize = cfgFile.chunkSize();
+    opt._minChunkSize = cfgFile.minChunkSize();
+    opt._maxChunkSize = cfgFile.maxChunkSize();
+    opt._targetChunkUploadDuration = cfgFile.targetChunkUploadDuration();
+    opt._minDeltaDownloadSize = cfgFile.minDeltaDownloadSize();
     _engine->setSyncOptions(opt);
 
     _engine->setIgnoreHiddenFiles(_definition.ignoreHiddenFiles);
 
+    // Unless something may have been missed, only the paths that changed
+    // since the last sync are read from disk. The watcher misses what
+    // happens while the client is not running, so the first sync reads all.
+    foreach (const QString &p, pathList) {
+        _localDiscoveryPaths.insert(p);
+    }
+    qint64 fullLocalDiscoveryInterval = cfgFile.fullLocalDiscoveryInterval();
+    _fullLocalDiscoveryInSync = _fullLocalDiscoveryNeeded
+            || fullLocalDiscoveryInterval < 0
+            || !_folderWatcher || !_folderWatcher->isReliable()
+            || !_timeSinceLastFullLocalDiscovery.isValid()
+            || _timeSinceLastFullLocalDiscovery.hasExpired(fullLocalDiscoveryInterval);
+    _engine->setLocalDiscoveryOptions(!_fullLocalDiscoveryInSync, _localDiscoveryPaths);
+    _localDiscoveryPathsInSync = _localDiscoveryPaths;
+    _localDiscoveryPaths.clear();
+
     QMetaObject::invokeMethod(_engine.data(), "startSync", Qt::QueuedConnection);
 
     emit syncStarted();
@@ -752,6 +803,18 @@ void Folder::slotSyncFinished(bool success)
         journalDb()->setSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList, QStringList());
     }
 
+    // The journal is up to date with the changes the sync looked at, except
+    // for the failed items which slotItemCompleted() kept.
+    if (success) {
+        if (_fullLocalDiscoveryInSync) {
+            _fullLocalDiscoveryNeeded = false;
+            _timeSinceLastFullLocalDiscovery.start();
+        }
+    } else {
+        _localDiscoveryPaths += _localDiscoveryPathsInSync;
+    }
+    _localDiscoveryPathsInSync.clear();
+
     emit syncStateChange();
 
     // The syncFinished result that is to be triggered here makes the folderman
@@ -818,6 +881,14 @@ void Folder::slotItemCompleted(const SyncFileItemPtr &item)
         FolderMan::instance()->removeMonitorPath( alias(), path()+item->_file );
     }
 
+    // Look at failed items again in the next sync, even if they do not change
+    if (item->hasErrorStatus()) {
+        _localDiscoveryPaths.insert(item->_file);
+        if (!item->_renameTarget.isEmpty()) {
+            _localDiscoveryPaths.insert(item->_renameTarget);
+        }
+    }
+
     _syncResult.processCompletedItem(item);
 
     _fileLog->logItem(*item);
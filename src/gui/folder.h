@@ -27,6 +27,7 @@
 
 #include <QObject>
 #include <QStringList>
+#include <QSet>
 
 class QThread;
 class QSettings;
@@ -36,6 +37,7 @@ namespace OCC {
 class SyncEngine;
 class AccountState;
 class SyncRunFileLog;
+class FolderWatcher;
 
 /**
  * @brief The FolderDefinition class
@@ -223,6 +225,12 @@ public:
       */
      void setSaveBackwardsCompatible(bool save);
 
+     /**
+      * The watcher reporting the changes in this folder. As long as it
+      * reports all of them, a sync only reads the changed local paths.
+      */
+     void setFolderWatcher(FolderWatcher *watcher);
+
 signals:
     void syncStateChange();
     void syncStarted();
@@ -272,6 +280,18 @@ public slots:
        */
       void slotWatchedPathChanged(const QString& path);
 
+      /**
+       * Triggered by the folder watcher for every reported path, even
+       * ignored ones: remembers it for the local discovery of the next sync.
+       */
+      void slotWatchedPathReported(const QString& path);
+
+      /**
+       * Read the whole local folder in the next sync, for example because
+       * the ignore list changed or the folder watcher missed changes.
+       */
+      void slotNextSyncFullLocalDiscovery();
+
 private slots:
     void slotSyncStarted();
     void slotSyncError(const QString& );
@@ -347,6 +367,17 @@ private:
 
     QTimer _scheduleSelfTimer;
 
+    QPointer<FolderWatcher> _folderWatcher;
+
+    /// Local paths that changed since the last sync, relative to the folder.
+    /// Only those are read from disk unless _fullLocalDiscoveryNeeded is set.
+    QSet<QString> _localDiscoveryPaths;
+    /// The paths the running sync reads, given back if it fails
+    QSet<QString> _localDiscoveryPathsInSync;
+    bool _fullLocalDiscoveryNeeded;
+    bool _fullLocalDiscoveryInSync;
+    QElapsedTimer _timeSinceLastFullLocalDiscovery;
+
     /**
      * When the same local path is synced to multiple accounts, only one
      * of them can be stored in the settings in a way that's compatible
@@ -159,6 +159,7 @@ void FolderMan::registerFolderMonitor( Folder *folder )
         // to the signal mapper which maps to the folder alias. The changed path
         // is lost this way, but we do not need it for the current implementation.
         connect(fw, SIGNAL(pathChanged(QString)), folder, SLOT(slotWatchedPathChanged(QString)));
+        folder->setFolderWatcher(fw);
 
         _folderWatchers.insert(folder->alias(), fw);
     }
@@ -40,11 +40,10 @@ namespace OCC {
 
 FolderWatcher::FolderWatcher(const QString &root, Folder* folder)
     : QObject(folder),
-      _folder(folder)
+      _folder(folder),
+      _isReliable(true)
 {
     _d.reset(new FolderWatcherPrivate(this, root));
-
-    _timer.start();
 }
 
 FolderWatcher::~FolderWatcher()
@@ -64,6 +63,20 @@ bool FolderWatcher::pathIsIgnored( const QString& path )
     return false;
 }
 
+bool FolderWatcher::isReliable() const
+{
+    return _isReliable;
+}
+
+void FolderWatcher::changesLost(bool reliable)
+{
+    qDebug() << "The folder watcher lost changes, reliable:" << reliable;
+    if (!reliable) {
+        _isReliable = false;
+    }
+    emit lostChanges();
+}
+
 void FolderWatcher::changeDetected( const QString& path )
 {
     QStringList paths(path);
@@ -74,19 +87,11 @@ void FolderWatcher::changeDetected( const QStringList& paths )
 {
     // qDebug() << Q_FUNC_INFO << paths;
 
-    // TODO: this shortcut doesn't look very reliable:
-    //   - why is the timeout only 1 second?
-    //   - what if there is more than one file being updated frequently?
-    //   - why do we skip the file altogether instead of e.g. reducing the upload frequency?
-
-    // Check if the same path was reported within the last second.
-    QSet<QString> pathsSet = paths.toSet();
-    if( pathsSet == _lastPaths && _timer.elapsed() < 1000 ) {
-        // the same path was reported within the last second. Skip.
-        return;
+    // Ignored paths still matter to the local discovery: an ignored file
+    // keeps its directory from being removed.
+    foreach (const QString &path, paths) {
+        emit pathReported(path);
     }
-    _lastPaths = pathsSet;
-    _timer.restart();
 
     QSet<QString> changedPaths;
 
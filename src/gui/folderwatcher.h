@@ -21,7 +21,6 @@
 #include <QObject>
 #include <QString>
 #include <QStringList>
-#include <QTime>
 #include <QHash>
 #include <QScopedPointer>
 #include <QSet>
@@ -69,11 +68,25 @@ public:
     /* Check if the path is ignored. */
     bool pathIsIgnored( const QString& path );
 
+    /**
+     * Whether all changes are reported. Not the case if the backend
+     * could not watch every directory, e.g. because of a system limit.
+     */
+    bool isReliable() const;
+
 signals:
     /** Emitted when one of the watched directories or one
      *  of the contained files is changed. */
     void pathChanged(const QString &path);
 
+    /** Emitted for every path the backend reports, also for the ignored
+     *  ones and the repeats that pathChanged() leaves out. */
+    void pathReported(const QString &path);
+
+    /** Emitted when changes were missed, e.g. because an event queue
+     *  overflowed. The folder has to be looked at completely. */
+    void lostChanges();
+
     /** Emitted if an error occurs */
     void error(const QString& error);
 
@@ -83,13 +96,16 @@ protected slots:
     void changeDetected( const QStringList& paths);
 
 protected:
+    // called from the implementations when events were lost; if the
+    // watcher cannot report all changes from now on, reliable is false
+    void changesLost(bool reliable);
+
     QHash<QString, int> _pendingPathes;
 
 private:
     QScopedPointer<FolderWatcherPrivate> _d;
-    QTime _timer;
-    QSet<QString> _lastPaths;
     Folder* _folder;
+    bool _isReliable;
 
     friend class FolderWatcherPrivate;
 };
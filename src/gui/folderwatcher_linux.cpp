@@ -38,6 +38,7 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString& path
         connect(_socket.data(), SIGNAL(activated(int)), SLOT(slotReceivedNotification(int)));
     } else {
         qDebug() << Q_FUNC_INFO << "notify_init() failed: " << strerror(errno);
+        _parent->changesLost(false);
     }
 
     QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
@@ -83,7 +84,12 @@ void FolderWatcherPrivate::inotifyRegisterPath(const QString& path)
                                    IN_MOVE_SELF |IN_UNMOUNT |IN_ONLYDIR);
         if( wd > -1 ) {
             _watches.insert(wd, path);
-         }
+        } else if (errno == ENOSPC || errno == ENOMEM) {
+            // Out of watches (fs.inotify.max_user_watches): changes in this
+            // directory will not be reported
+            qDebug() << Q_FUNC_INFO << "Could not watch" << path << strerror(errno);
+            _parent->changesLost(false);
+        }
     }
 }
 
@@ -165,6 +171,12 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
             continue;
         }
 
+        // The kernel dropped events
+        if (event->mask & IN_Q_OVERFLOW) {
+            qDebug() << Q_FUNC_INFO << "inotify event queue overflowed";
+            _parent->changesLost(true);
+        }
+
         // Fire event for the path that was changed.
         if (event->len > 0 && event->wd > -1) {
             QByteArray fileName(event->name);
@@ -176,6 +188,11 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
             } else {
                 const QString p = _watches[event->wd] + '/' + fileName;
                 //qDebug() << "found a change in " << p;
+                // Watch new directories right away, not only once they are synced
+                if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && (event->mask & IN_ISDIR)
+                        && !_parent->pathIsIgnored(p)) {
+                    slotAddFolderRecursive(p);
+                }
                 _parent->changeDetected(p);
             }
         }
@@ -57,7 +57,8 @@ static void callback(
             | kFSEventStreamEventFlagItemRemoved // for rm
             | kFSEventStreamEventFlagItemInodeMetaMod // for mtime change
             | kFSEventStreamEventFlagItemRenamed // also coming for moves to trash in finder
-            | kFSEventStreamEventFlagItemModified; // for content change
+            | kFSEventStreamEventFlagItemModified // for content change
+            | kFSEventStreamEventFlagMustScanSubDirs; // events were dropped below that path
     //We ignore other flags, e.g. for owner change, xattr change, Finder label change etc
 
     qDebug() << "FolderWatcherPrivate::callback by OS X";
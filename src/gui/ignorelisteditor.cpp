@@ -126,8 +126,10 @@ void IgnoreListEditor::slotUpdateLocalIgnoreList()
     // We need to force a remote discovery after a change of the ignore list.
     // Otherwise we would not download the files/directories that are no longer
     // ignored (because the remote etag did not change)   (issue #3172)
+    // Same for the local files, which were not in the journal either.
     foreach (Folder* folder, folderMan->map()) {
         folder->journalDb()->forceRemoteDiscoveryNextSync();
+        folder->slotNextSyncFullLocalDiscovery();
         folderMan->scheduleFolder(folder);
     }
 
@@ -57,7 +57,8 @@
 // This is the version that is returned when the client asks for the VERSION.
 // The first number should be changed if there is an incompatible change that breaks old clients.
 // The second number should be changed when there are new features.
-#define MIRALL_SOCKET_API_VERSION "1.0"
+// 1.1: RETRIEVE_FILE_STATUSES
+#define MIRALL_SOCKET_API_VERSION "1.1"
 
 #define DEBUG qDebug() << "SocketApi: "
 
@@ -115,7 +116,11 @@ public:
 
     void sendMessage(const QString& message, bool doWait = false) const
     {
-        DEBUG << "Sending message: " << message;
+        // Of a reply of several lines like STATUSES, only the first one is logged
+        const int newline = message.indexOf(QLatin1Char('\n'));
+        const QString logMessage = newline == -1 || newline == message.length() - 1
+            ? message : message.left(newline) + QLatin1String(" ...");
+        DEBUG << "Sending message: " << logMessage;
         QString localMessage = message;
         if( ! localMessage.endsWith(QLatin1Char('\n'))) {
             localMessage.append(QLatin1Char('\n'));
@@ -127,7 +132,7 @@ public:
             socket->waitForBytesWritten(1000);
         }
         if( sent != bytesToSend.length() ) {
-            qDebug() << "WARN: Could not send all data on socket for " << localMessage;
+            qDebug() << "WARN: Could not send all data on socket for " << logMessage;
         }
 
     }
@@ -387,6 +392,59 @@ void SocketApi::command_RETRIEVE_FILE_STATUS(const QString& argument, SocketList
     listener->sendMessage(message);
 }
 
+/**
+ * The statuses of all the entries of a directory, answered in one message:
+ *
+ *   STATUSES:<count>:<directory>
+ *   <status>:<name>     (count lines)
+ *
+ * Outside of the sync folders, only the sync folders in the directory have an entry.
+ */
+void SocketApi::command_RETRIEVE_FILE_STATUSES(const QString& argument, SocketListener* listener)
+{
+    qDebug() << Q_FUNC_INFO << argument;
+
+    QString directory = QDir::cleanPath(argument);
+    if( directory.endsWith(QLatin1Char('/')) ) {
+        directory.truncate(directory.length()-1);
+    }
+    // Status pushes for the entries are welcome from now on
+    listener->registerMonitoredDirectory(qHash(directory));
+
+    QString entries;
+    int count = 0;
+    Folder* syncFolder = FolderMan::instance()->folderForPath( directory );
+    if (syncFolder) {
+        QString relativeDirectory = directory.mid(syncFolder->cleanPath().length()+1);
+        if (!relativeDirectory.isEmpty()) {
+            relativeDirectory.append(QLatin1Char('/'));
+        }
+        SyncFileStatusTracker &tracker = syncFolder->syncEngine().syncFileStatusTracker();
+        const QStringList names = QDir(directory).entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System, QDir::NoSort);
+        foreach (const QString &name, names) {
+            // Would break the framing of the lines
+            if (name.contains(QLatin1Char('\n'))) {
+                continue;
+            }
+            entries += tracker.fileStatus(relativeDirectory + name).toSocketAPIString() % QLatin1Char(':') % name % QLatin1Char('\n');
+            ++count;
+        }
+    } else {
+        foreach (Folder *f, FolderMan::instance()->map()) {
+            const QString folderPath = f->cleanPath();
+            if (folderPath.left(folderPath.lastIndexOf(QLatin1Char('/'))) == directory) {
+                entries += f->syncEngine().syncFileStatusTracker().fileStatus(QString()).toSocketAPIString()
+                    % QLatin1Char(':') % folderPath.mid(directory.length()+1) % QLatin1Char('\n');
+                ++count;
+            }
+        }
+    }
+
+    const QString message = QLatin1String("STATUSES:") % QString::number(count) % QLatin1Char(':')
+        % QDir::toNativeSeparators(directory) % QLatin1Char('\n') % entries;
+    listener->sendMessage(message);
+}
+
 void SocketApi::command_SHARE(const QString& localFile, SocketListener* listener)
 {
     qDebug() << Q_FUNC_INFO << localFile;
@@ -70,6 +70,7 @@ private:
 
     Q_INVOKABLE void command_RETRIEVE_FOLDER_STATUS(const QString& argument, SocketListener* listener);
     Q_INVOKABLE void command_RETRIEVE_FILE_STATUS(const QString& argument, SocketListener* listener);
+    Q_INVOKABLE void command_RETRIEVE_FILE_STATUSES(const QString& argument, SocketListener* listener);
     Q_INVOKABLE void command_SHARE(const QString& localFile, SocketListener* listener);
 
     Q_INVOKABLE void command_VERSION(const QString& argument, SocketListener* listener);
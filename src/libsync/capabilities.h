@@ -45,6 +45,15 @@ public:
     /// disable parallel upload in chunking
     bool chunkingParallelUploadDisabled() const;
 
+    /**
+     * Whether the server gives the block checksums of a file, for the
+     * downloads that only fetch the changed blocks.
+     *
+     * Path: dav/blockMap
+     * Default: false
+     */
+    bool blockMapDownload() const;
+
     /// returns true if the capabilities report notifications
     bool notificationsAvailable() const;
 
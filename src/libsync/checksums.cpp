@@ -19,6 +19,13 @@
 #include "account.h"
 
 #include <qtconcurrentrun.h>
+#include <QFile>
+#include <QThread>
+#include <QThreadPool>
+
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
 
 /** \file checksums.cpp
  *
@@ -65,6 +72,21 @@
  *
  * Content checksums are not sent to the server.
  *
+ * Streaming Checksums
+ * -------------------
+ *
+ * A new upload does not read the file beforehand: both checksums are
+ * computed by a ChecksumStream from the data that is sent. The transmission
+ * checksum is only needed at the end, in the header of the last chunk
+ * or of the MOVE of the new chunking. Resumed uploads, whose first part
+ * is not sent again, compute the checksums up front.
+ *
+ * Downloads hash the data as it is written to the temporary file. A resumed
+ * download hashes the part that is already there before it continues. The
+ * streamed types are the content checksum type and the upload checksum type
+ * of the server, which is the one the files are most likely tagged with.
+ * A header of another type is validated by reading the file again.
+ *
  * Checksum Algorithms
  * -------------------
  *
@@ -117,6 +139,173 @@ QByteArray contentChecksumType()
     return type;
 }
 
+bool streamingChecksumEnabled()
+{
+    static bool enabled = qgetenv("OWNCLOUD_DISABLE_STREAMING_CHECKSUM").isEmpty();
+    return enabled;
+}
+
+namespace {
+class ChecksumThreadPool : public QThreadPool
+{
+public:
+    ChecksumThreadPool()
+    {
+        int threads = qgetenv("OWNCLOUD_CHECKSUM_THREADS").toInt();
+        if (threads <= 0) {
+            threads = qBound(1, QThread::idealThreadCount() / 2, 4);
+        }
+        setMaxThreadCount(threads);
+        qDebug() << "Using" << threads << "threads for checksums";
+    }
+};
+}
+Q_GLOBAL_STATIC(ChecksumThreadPool, checksumThreadPoolInstance)
+
+QThreadPool *checksumThreadPool()
+{
+    return checksumThreadPoolInstance();
+}
+
+ChecksumStream::ChecksumStream(const QList<QByteArray> &checksumTypes)
+    : _position(0)
+{
+    foreach (const QByteArray &type, checksumTypes) {
+        Hash hash = { type, 0, 0 };
+        if (type == checkSumMD5C) {
+            hash.crypto = new QCryptographicHash(QCryptographicHash::Md5);
+        } else if (type == checkSumSHA1C) {
+            hash.crypto = new QCryptographicHash(QCryptographicHash::Sha1);
+        }
+#ifdef ZLIB_FOUND
+        else if (type == checkSumAdlerC) {
+            hash.adler = adler32(0L, Z_NULL, 0);
+        }
+#endif
+        else {
+            qDebug() << "Unknown checksum type:" << type;
+            continue;
+        }
+        _hashes.append(hash);
+    }
+}
+
+ChecksumStream::~ChecksumStream()
+{
+    foreach (const Hash &hash, _hashes) {
+        delete hash.crypto;
+    }
+}
+
+void ChecksumStream::addData(qint64 offset, const char *data, qint64 len)
+{
+    QMutexLocker lock(&_mutex);
+    // Skip what was hashed already, a gap can't be filled from here
+    if (offset > _position || offset + len <= _position) {
+        return;
+    }
+    data += _position - offset;
+    len -= _position - offset;
+
+    for (int i = 0; i < _hashes.size(); ++i) {
+        Hash &hash = _hashes[i];
+        if (hash.crypto) {
+            hash.crypto->addData(data, len);
+        }
+#ifdef ZLIB_FOUND
+        else {
+            hash.adler = adler32(hash.adler, (const Bytef *)data, len);
+        }
+#endif
+    }
+    _position += len;
+}
+
+bool ChecksumStream::addFromFile(const QString &filePath, qint64 end)
+{
+    // The file is read without the lock, addData() may move the position meanwhile
+    qint64 pos = position();
+    if (end <= pos) {
+        return true;
+    }
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered) || !file.seek(pos)) {
+        qDebug() << "Could not read" << filePath << file.errorString();
+        return false;
+    }
+    FileSystem::adviseSequentialRead(&file);
+    QByteArray buf(qMin(end - pos, FileSystem::checksumReadSize), Qt::Uninitialized);
+    while (pos < end) {
+        qint64 size = file.read(buf.data(), qMin(end - pos, qint64(buf.size())));
+        if (size <= 0) {
+            qDebug() << "Could not read" << filePath << "up to" << end << file.errorString();
+            return false;
+        }
+        addData(pos, buf.constData(), size);
+        pos += size;
+
+        // Skip what the uploads hashed in the meantime
+        const qint64 hashed = position();
+        if (hashed > pos) {
+            pos = hashed;
+            if (pos < end && !file.seek(pos)) {
+                qDebug() << "Could not read" << filePath << file.errorString();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Takes the pointer by value to keep the stream alive while the thread uses it
+static bool addFromFileShared(QSharedPointer<ChecksumStream> stream, const QString &filePath, qint64 end)
+{
+    return stream->addFromFile(filePath, end);
+}
+
+QFuture<bool> ChecksumStream::addFromFileAsync(const QSharedPointer<ChecksumStream> &stream,
+                                               const QString &filePath, qint64 end)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    return QtConcurrent::run(checksumThreadPool(), addFromFileShared, stream, filePath, end);
+#else
+    return QtConcurrent::run(addFromFileShared, stream, filePath, end);
+#endif
+}
+
+QByteArray ChecksumStream::result(const QByteArray &checksumType) const
+{
+    QMutexLocker lock(&_mutex);
+    foreach (const Hash &hash, _hashes) {
+        if (hash.type != checksumType) {
+            continue;
+        }
+        if (hash.crypto) {
+            return hash.crypto->result().toHex();
+        }
+        return QByteArray::number(hash.adler, 16);
+    }
+    return QByteArray();
+}
+
+void ChecksumStream::reset()
+{
+    QMutexLocker lock(&_mutex);
+    for (int i = 0; i < _hashes.size(); ++i) {
+        Hash &hash = _hashes[i];
+        if (hash.crypto) {
+            hash.crypto->reset();
+        }
+#ifdef ZLIB_FOUND
+        else {
+            hash.adler = adler32(0L, Z_NULL, 0);
+        }
+#endif
+    }
+    _position = 0;
+}
+
 ComputeChecksum::ComputeChecksum(QObject* parent)
     : QObject(parent)
 {
@@ -138,7 +327,11 @@ void ComputeChecksum::start(const QString& filePath)
     connect( &_watcher, SIGNAL(finished()),
              this, SLOT(slotCalculationDone()),
              Qt::UniqueConnection );
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    _watcher.setFuture(QtConcurrent::run(checksumThreadPool(), ComputeChecksum::computeNow, filePath, checksumType()));
+#else
     _watcher.setFuture(QtConcurrent::run(ComputeChecksum::computeNow, filePath, checksumType()));
+#endif
 }
 
 QByteArray ComputeChecksum::computeNow(const QString& filePath, const QByteArray& checksumType)
@@ -176,17 +369,25 @@ ValidateChecksumHeader::ValidateChecksumHeader(QObject *parent)
 {
 }
 
-void ValidateChecksumHeader::start(const QString& filePath, const QByteArray& checksumHeader)
+bool ValidateChecksumHeader::parseHeader(const QByteArray& checksumHeader)
 {
     // If the incoming header is empty no validation can happen. Just continue.
     if( checksumHeader.isEmpty() ) {
         emit validated(QByteArray(), QByteArray());
-        return;
+        return false;
     }
 
     if( !parseChecksumHeader(checksumHeader, &_expectedChecksumType, &_expectedChecksum) ) {
         qDebug() << "Checksum header malformed:" << checksumHeader;
         emit validationFailed(tr("The checksum header is malformed."));
+        return false;
+    }
+    return true;
+}
+
+void ValidateChecksumHeader::start(const QString& filePath, const QByteArray& checksumHeader)
+{
+    if (!parseHeader(checksumHeader)) {
         return;
     }
 
@@ -197,6 +398,22 @@ void ValidateChecksumHeader::start(const QString& filePath, const QByteArray& ch
     calculator->start(filePath);
 }
 
+void ValidateChecksumHeader::start(const QString& filePath, const QByteArray& checksumHeader,
+                                   const ChecksumStream& stream)
+{
+    if (!parseHeader(checksumHeader)) {
+        return;
+    }
+
+    QByteArray checksum = stream.result(_expectedChecksumType);
+    if (checksum.isEmpty()) {
+        qDebug() << "Checksum" << _expectedChecksumType << "was not streamed, computing it for" << filePath;
+        start(filePath, checksumHeader);
+        return;
+    }
+    slotChecksumCalculated(_expectedChecksumType, checksum);
+}
+
 void ValidateChecksumHeader::slotChecksumCalculated(const QByteArray& checksumType,
                                                     const QByteArray& checksum)
 {
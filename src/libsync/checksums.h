@@ -20,6 +20,12 @@
 #include <QObject>
 #include <QByteArray>
 #include <QFutureWatcher>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QCryptographicHash>
+#include <QVector>
+
+class QThreadPool;
 
 namespace OCC {
 
@@ -37,6 +43,17 @@ bool uploadChecksumEnabled();
 /// Checks OWNCLOUD_CONTENT_CHECKSUM_TYPE (default: SHA1)
 QByteArray contentChecksumType();
 
+/// Checks OWNCLOUD_DISABLE_STREAMING_CHECKSUM
+bool streamingChecksumEnabled();
+
+/**
+ * The threads that compute checksums of files.
+ *
+ * Reading is limited by the disk more than by the cores, so there are few
+ * threads: half the cores, at most 4. OWNCLOUD_CHECKSUM_THREADS sets the number.
+ */
+OWNCLOUDSYNC_EXPORT QThreadPool *checksumThreadPool();
+
 
 /**
  * Computes the checksum of a file.
@@ -80,6 +97,61 @@ private:
     QFutureWatcher<QByteArray> _watcher;
 };
 
+/**
+ * Computes checksums of a file from the data read for its upload.
+ *
+ * The data has to come in the order of the file: addData() only uses the
+ * part that continues what was hashed so far. Data that was read ahead
+ * of that, by chunks uploaded in parallel, has to be hashed again with
+ * addFromFile() once the gap before it is closed.
+ *
+ * Thread safe: the uploads still hash their data with addData() while
+ * addFromFile() catches up in another thread.
+ * \ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ChecksumStream
+{
+public:
+    /** The unknown types in checksumTypes are ignored */
+    explicit ChecksumStream(const QList<QByteArray> &checksumTypes);
+    ~ChecksumStream();
+
+    /** Number of bytes from the start of the file that were hashed */
+    qint64 position() const { QMutexLocker lock(&_mutex); return _position; }
+
+    /** Hashes the data read at offset of the file, if it continues position() */
+    void addData(qint64 offset, const char *data, qint64 len);
+
+    /**
+     * Reads the file from position() up to end and hashes it.
+     *
+     * Returns false if the file could not be read up to end.
+     */
+    bool addFromFile(const QString &filePath, qint64 end);
+
+    /** Calls addFromFile() in the checksumThreadPool() */
+    static QFuture<bool> addFromFileAsync(const QSharedPointer<ChecksumStream> &stream,
+                                          const QString &filePath, qint64 end);
+
+    /** The checksum of the data hashed so far. Empty if the type is not computed */
+    QByteArray result(const QByteArray &checksumType) const;
+
+    /** Forgets the data hashed so far, to start again at the start of the file */
+    void reset();
+
+private:
+    struct Hash {
+        QByteArray type;
+        QCryptographicHash *crypto; // null for Adler32
+        quint32 adler;
+    };
+    QVector<Hash> _hashes;
+    qint64 _position;
+    mutable QMutex _mutex; // protects _hashes and _position
+
+    Q_DISABLE_COPY(ChecksumStream)
+};
+
 /**
  * Checks whether a file's checksum matches the expected value.
  * @ingroup libsync
@@ -99,6 +171,12 @@ public:
      */
     void start(const QString& filePath, const QByteArray& checksumHeader);
 
+    /**
+     * Same as above, but takes the checksum from \a stream if it computed
+     * the type of the header. The signals are then emitted right away.
+     */
+    void start(const QString& filePath, const QByteArray& checksumHeader, const ChecksumStream& stream);
+
 signals:
     void validated(const QByteArray& checksumType, const QByteArray& checksum);
     void validationFailed( const QString& errMsg );
@@ -107,6 +185,8 @@ private slots:
     void slotChecksumCalculated(const QByteArray& checksumType, const QByteArray& checksum);
 
 private:
+    bool parseHeader(const QByteArray& checksumHeader);
+
     QByteArray _expectedChecksumType;
     QByteArray _expectedChecksum;
 };
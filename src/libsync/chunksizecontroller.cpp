@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "chunksizecontroller.h"
+
+#include <QDebug>
+
+namespace OCC {
+
+ChunkSizeController::ChunkSizeController(quint64 initialSize, quint64 minSize, quint64 maxSize,
+                                         qint64 targetDurationMsec)
+    : _minSize(qMax<quint64>(1, minSize))
+    , _maxSize(qMax(_minSize, maxSize))
+    , _targetDurationMsec(targetDurationMsec)
+{
+    _chunkSize = _targetDurationMsec > 0 ? qBound(_minSize, initialSize, _maxSize) : initialSize;
+}
+
+void ChunkSizeController::chunkUploaded(quint64 size, qint64 msec)
+{
+    if (_targetDurationMsec <= 0 || size == 0) {
+        return;
+    }
+    // The end of a file: too short to tell much about the speed
+    if (size < _chunkSize / 2) {
+        return;
+    }
+
+    // The size that would have taken the target duration at the same speed.
+    // The measures vary a lot with the other uploads running at the same time,
+    // the average with the current size smoothes the changes.
+    double predictedSize = double(size) * _targetDurationMsec / qMax<qint64>(1, msec);
+    double newSize = _chunkSize / 2. + predictedSize / 2.;
+    _chunkSize = newSize >= _maxSize ? _maxSize : qMax(_minSize, quint64(newSize));
+}
+
+void ChunkSizeController::chunkFailed()
+{
+    if (_targetDurationMsec <= 0) {
+        return;
+    }
+    _chunkSize = qMax(_minSize, _chunkSize / 2);
+    qDebug() << Q_FUNC_INFO << "chunk size is now" << _chunkSize;
+}
+
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef CHUNKSIZECONTROLLER_H
+#define CHUNKSIZECONTROLLER_H
+
+#include "owncloudlib.h"
+
+#include <QtGlobal>
+
+namespace OCC {
+
+/**
+ * @brief Picks the size of the upload chunks from the measured upload times
+ *
+ * The size aims at chunks that take about the target duration to upload:
+ * big enough that the cost of each request does not matter on fast links,
+ * small enough that not much is lost when a chunk fails on slow ones.
+ *
+ * With a target duration of 0, the chunk size stays the initial one.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ChunkSizeController
+{
+public:
+    explicit ChunkSizeController(quint64 initialSize = 10 * 1000 * 1000,
+                                 quint64 minSize = 1000 * 1000,
+                                 quint64 maxSize = 100 * 1000 * 1000,
+                                 qint64 targetDurationMsec = 0);
+
+    /** The size of the next chunks in bytes */
+    quint64 chunkSize() const { return _chunkSize; }
+
+    /** A chunk of size bytes was uploaded in msec milliseconds */
+    void chunkUploaded(quint64 size, qint64 msec);
+
+    /** The upload of a chunk timed out or failed because of the network */
+    void chunkFailed();
+
+private:
+    quint64 _chunkSize;
+    quint64 _minSize;
+    quint64 _maxSize;
+    qint64 _targetDurationMsec;
+};
+
+}
+
+#endif
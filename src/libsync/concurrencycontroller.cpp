@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "concurrencycontroller.h"
+
+#include <QDebug>
+
+namespace OCC {
+
+ConcurrencyController::ConcurrencyController(int initial, int minimum, int maximum)
+    : _minimum(qMax(1, minimum))
+    , _maximum(qMax(_minimum, maximum))
+    , _roundJobs(0)
+    , _roundFailed(false)
+    , _roundBytes(0)
+    , _roundSmallJobs(0)
+    , _roundSmallLatency(0)
+    , _lastJobRate(0)
+    , _lastByteRate(0)
+    , _baseLatency(-1)
+{
+    _concurrency = qBound(_minimum, initial, _maximum);
+}
+
+void ConcurrencyController::jobFinished(quint64 bytes, qint64 msec)
+{
+    if (_minimum == _maximum) {
+        return;
+    }
+    // The rates are measured from the end of a job: the first one only starts the clock
+    if (!_roundTimer.isValid()) {
+        _roundTimer.start();
+        return;
+    }
+
+    _roundJobs++;
+    _roundBytes += bytes;
+    if (bytes <= smallRequestSize) {
+        _roundSmallJobs++;
+        _roundSmallLatency += msec;
+    }
+    if (_roundJobs >= 2 * _concurrency) {
+        finishRound();
+    }
+}
+
+void ConcurrencyController::jobFailed()
+{
+    if (_minimum == _maximum) {
+        return;
+    }
+    if (_roundFailed) {
+        return;
+    }
+    _roundFailed = true;
+    const int previous = _concurrency;
+    _concurrency = qMax(_minimum, _concurrency / 2);
+    qDebug() << "Parallel transfers" << previous << "->" << _concurrency << "after a failure";
+}
+
+void ConcurrencyController::finishRound()
+{
+    const double seconds = qMax<qint64>(1, _roundTimer.restart()) / 1000.;
+    const double jobRate = _roundJobs / seconds;
+    const double byteRate = _roundBytes / seconds;
+    const double latency = _roundSmallJobs > 0 ? double(_roundSmallLatency) / _roundSmallJobs : -1;
+
+    // The failure already decreased the concurrency, the rates of that round
+    // are no baseline for the next one
+    if (!_roundFailed) {
+        const int previous = _concurrency;
+        // The rates vary a bit from round to round even when nothing changed
+        const bool improved = jobRate > 1.1 * _lastJobRate || byteRate > 1.1 * _lastByteRate;
+        if (latency >= 0 && (_baseLatency < 0 || latency < _baseLatency)) {
+            _baseLatency = latency;
+        }
+        if (improved || (latency >= 0 && latency <= 1.5 * _baseLatency)) {
+            _concurrency = qMin(_maximum, _concurrency + 1);
+        } else if (latency > 2 * _baseLatency) {
+            _concurrency = qMax(_minimum, _concurrency / 2);
+        }
+
+        if (_concurrency != previous) {
+            qDebug() << "Parallel transfers" << previous << "->" << _concurrency
+                     << "jobs/s:" << jobRate << "bytes/s:" << byteRate
+                     << "latency:" << latency << "base latency:" << _baseLatency;
+        }
+
+        _lastJobRate = jobRate;
+        _lastByteRate = byteRate;
+    }
+
+    _roundJobs = 0;
+    _roundFailed = false;
+    _roundBytes = 0;
+    _roundSmallJobs = 0;
+    _roundSmallLatency = 0;
+}
+
+}
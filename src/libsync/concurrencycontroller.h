@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef CONCURRENCYCONTROLLER_H
+#define CONCURRENCYCONTROLLER_H
+
+#include "owncloudlib.h"
+
+#include <QElapsedTimer>
+
+namespace OCC {
+
+/**
+ * @brief Picks the number of transfers to run in parallel from the measured jobs
+ *
+ * The measures are taken in rounds of about twice the current concurrency
+ * finished jobs. After each round (additive increase, multiplicative decrease):
+ *  - a timeout or server overload halves the concurrency at once, only once
+ *    per round since the other jobs of a burst of failures ran under the
+ *    same concurrency, and the round it cut short is not measured,
+ *  - the concurrency goes up by one when the rate of finished jobs or bytes
+ *    improved, or when the small requests are still about as fast as the
+ *    fastest ones seen,
+ *  - it is halved when the small requests got much slower without any
+ *    improvement of the rates: the requests are only queueing up somewhere,
+ *    in the client, on the link or on the server.
+ *
+ * The latency is only taken from the small requests since the duration of
+ * the big ones depends on the bandwidth more than on the latency.
+ *
+ * With a minimum equal to the maximum, the concurrency stays fixed.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ConcurrencyController
+{
+public:
+    explicit ConcurrencyController(int initial = 3, int minimum = 1, int maximum = 6);
+
+    /** The number of transfers that may run in parallel */
+    int concurrency() const { return _concurrency; }
+
+    /** A job that used the network finished after msec milliseconds, having transferred bytes */
+    void jobFinished(quint64 bytes, qint64 msec);
+
+    /** A job timed out or the server said it is overloaded */
+    void jobFailed();
+
+    /** Requests of up to this size count for the latency */
+    static const quint64 smallRequestSize = 100 * 1024;
+
+private:
+    void finishRound();
+
+    int _concurrency;
+    int _minimum;
+    int _maximum;
+
+    QElapsedTimer _roundTimer;
+    int _roundJobs;
+    bool _roundFailed;
+    quint64 _roundBytes;
+    int _roundSmallJobs;
+    qint64 _roundSmallLatency;
+
+    // The rates of the previous round, per second
+    double _lastJobRate;
+    double _lastByteRate;
+    // The lowest average latency of the small requests of a round, -1 if unknown
+    double _baseLatency;
+};
+
+}
+
+#endif
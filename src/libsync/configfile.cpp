@@ -53,6 +53,14 @@ static const char updateCheckIntervalC[] = "updateCheckInterval";
 static const char geometryC[] = "geometry";
 static const char timeoutC[] = "timeout";
 static const char chunkSizeC[] = "chunkSize";
+static const char minChunkSizeC[] = "minChunkSize";
+static const char maxChunkSizeC[] = "maxChunkSize";
+static const char targetChunkUploadDurationC[] = "targetChunkUploadDuration";
+static const char minDeltaDownloadSizeC[] = "minDeltaDownloadSize";
+static const char localDiscoveryThreadsC[] = "localDiscoveryThreads";
+static const char inMemoryJournalIndexC[] = "inMemoryJournalIndex";
+static const char remoteDiscoveryJobsC[] = "remoteDiscoveryJobs";
+static const char fullLocalDiscoveryIntervalC[] = "fullLocalDiscoveryInterval";
 
 static const char proxyHostC[] = "Proxy/host";
 static const char proxyTypeC[] = "Proxy/type";
@@ -130,6 +138,54 @@ quint64 ConfigFile::chunkSize() const
     return settings.value(QLatin1String(chunkSizeC), 10*1000*1000).toLongLong(); // default to 10 MB
 }
 
+quint64 ConfigFile::minChunkSize() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(minChunkSizeC), 1000*1000).toLongLong(); // default to 1 MB
+}
+
+quint64 ConfigFile::maxChunkSize() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(maxChunkSizeC), 100*1000*1000).toLongLong(); // default to 100 MB
+}
+
+qint64 ConfigFile::targetChunkUploadDuration() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(targetChunkUploadDurationC), 60 * 1000).toLongLong(); // default to 1 minute
+}
+
+qint64 ConfigFile::minDeltaDownloadSize() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(minDeltaDownloadSizeC), 100*1000*1000).toLongLong(); // default to 100 MB
+}
+
+int ConfigFile::localDiscoveryThreads() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(localDiscoveryThreadsC), 4).toInt();
+}
+
+bool ConfigFile::inMemoryJournalIndex() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(inMemoryJournalIndexC), false).toBool();
+}
+
+int ConfigFile::remoteDiscoveryJobs() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(remoteDiscoveryJobsC), 4).toInt();
+}
+
+qint64 ConfigFile::fullLocalDiscoveryInterval() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(fullLocalDiscoveryIntervalC), 60 * 60 * 1000).toLongLong(); // default to 1 hour
+}
+
 void ConfigFile::setOptionalDesktopNotifications(bool show)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
@@ -115,6 +115,23 @@ public:
 
     int timeout() const;
     quint64 chunkSize() const;
+    /** Bounds of the upload chunk size when it follows the throughput */
+    quint64 minChunkSize() const;
+    quint64 maxChunkSize() const;
+    /** Time the upload of a chunk should take (in ms), 0 keeps chunkSize() for all chunks */
+    qint64 targetChunkUploadDuration() const;
+    /** Size from which downloads only fetch the changed blocks, 0 disables it */
+    qint64 minDeltaDownloadSize() const;
+    /** Threads reading the local tree ahead of the discovery, 1 disables it */
+    int localDiscoveryThreads() const;
+    /** Whether the journal is read into memory once per sync for the discovery */
+    bool inMemoryJournalIndex() const;
+    /** Changed remote directories listed in parallel during the discovery, 0 disables it */
+    int remoteDiscoveryJobs() const;
+    /** Maximum time between two syncs that read the whole local folder (in ms).
+     *  In between only the paths the folder watcher reported are read,
+     *  a negative value disables that */
+    qint64 fullLocalDiscoveryInterval() const;
 
     void saveGeometry(QWidget *w);
     void restoreGeometry(QWidget *w);
@@ -17,6 +17,8 @@
 #include "account.h"
 #include "theme.h"
 #include "asserts.h"
+#include "syncjournaldb.h"
+#include "syncjournalfilerecord.h"
 
 #include <csync_private.h>
 #include <csync_rename.h>
@@ -24,6 +26,7 @@
 #include <qdebug.h>
 #include <QUrl>
 #include <QFileInfo>
+#include <algorithm>
 #include <cstring>
 
 
@@ -147,6 +150,32 @@ int DiscoveryJob::checkSelectiveSyncNewFolderCallback(void *data, const char *pa
     return static_cast<DiscoveryJob*>(data)->checkSelectiveSyncNewFolder(QString::fromUtf8(path), remotePerm);
 }
 
+bool DiscoveryJob::shouldDiscoverLocally(const char *path) const
+{
+    const QString p = QString::fromUtf8(path);
+
+    // The directory or one of its parents changed (an empty path is the root)
+    QString dir = p;
+    forever {
+        if (std::binary_search(_localDiscoveryPaths.begin(), _localDiscoveryPaths.end(), dir)) {
+            return true;
+        }
+        if (dir.isEmpty()) {
+            break;
+        }
+        dir.truncate(qMax(dir.lastIndexOf(QLatin1Char('/')), 0));
+    }
+
+    // Something below the directory changed
+    const QString prefix = p + QLatin1Char('/');
+    auto it = std::lower_bound(_localDiscoveryPaths.begin(), _localDiscoveryPaths.end(), prefix);
+    return it != _localDiscoveryPaths.end() && it->startsWith(prefix);
+}
+
+int DiscoveryJob::shouldDiscoverLocallyCallback(void *data, const char *path)
+{
+    return static_cast<DiscoveryJob*>(data)->shouldDiscoverLocally(path);
+}
 
 void DiscoveryJob::update_job_update_callback (bool local,
                                     const char *dirUrl,
@@ -248,6 +277,7 @@ int get_errno_from_http_errcode( int err, const QString & reason ) {
 
 DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent)
     : QObject(parent), _subPath(path), _account(account), _ignoredFirst(false), _isRootPath(false), _isExternalStorage(false)
+    , _hrefPrefixLength(-1)
 {
 }
 
@@ -264,9 +294,9 @@ void DiscoverySingleDirectoryJob::start()
         props << "http://owncloud.org/ns:data-fingerprint";
 
     lsColJob->setProperties(props);
+    // The entries come to listingEntry() instead of the directoryListingIterated signal
+    lsColJob->setEntryHandler(this);
 
-    QObject::connect(lsColJob, SIGNAL(directoryListingIterated(QString,QMap<QString,QString>)),
-                     this, SLOT(directoryListingIteratedSlot(QString,QMap<QString,QString>)));
     QObject::connect(lsColJob, SIGNAL(finishedWithError(QNetworkReply*)), this, SLOT(lsJobFinishedWithErrorSlot(QNetworkReply*)));
     QObject::connect(lsColJob, SIGNAL(finishedWithoutError()), this, SLOT(lsJobFinishedWithoutErrorSlot()));
     lsColJob->start();
@@ -281,91 +311,100 @@ void DiscoverySingleDirectoryJob::abort()
     }
 }
 
-static csync_vio_file_stat_t* propertyMapToFileStat(const QMap<QString,QString> &map)
+static void fillFileStat(csync_vio_file_stat_t *file_stat, const QString *values)
 {
-    csync_vio_file_stat_t* file_stat = csync_vio_file_stat_new();
-
-    for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
-        //qDebug() << it.key() << it.value();
-        QString property = it.key();
-        QString value = it.value();
-        if (property == "resourcetype") {
-            if (value.contains("collection")) {
-                file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-            } else {
-                file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-            }
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-        } else if  (property == "getlastmodified") {
-            file_stat->mtime = oc_httpdate_parse(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-        } else if (property == "getcontentlength") {
-            bool ok = false;
-            qlonglong ll = value.toLongLong(&ok);
-            if (ok && ll >= 0) {
-                file_stat->size = ll;
-                file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-            }
-        } else if (property == "getetag") {
-            file_stat->etag = csync_normalize_etag(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
-        } else if (property == "id") {
-            csync_vio_file_stat_set_file_id(file_stat, value.toUtf8());
-        } else if (property == "downloadURL") {
-            file_stat->directDownloadUrl = strdup(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL;
-        } else if (property == "dDC") {
-            file_stat->directDownloadCookies = strdup(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES;
-        } else if (property == "permissions") {
-            auto v = value.toUtf8();
-            if (value.isEmpty()) {
-                // special meaning for our code: server returned permissions but are empty
-                // meaning only reading is allowed for this resource
-                file_stat->remotePerm[0] = ' ';
-                // see _csync_detect_update()
-                file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
-            } else if (v.length() < int(sizeof(file_stat->remotePerm))) {
-                strcpy(file_stat->remotePerm, v.constData());
-                file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
-            } else {
-                qWarning() << "permissions too large" << v;
-            }
+    const QString &resourceType = values[LsColEntryHandler::ResourceType];
+    if (!resourceType.isNull()) {
+        if (resourceType.contains("collection")) {
+            file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+        } else {
+            file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+        }
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+    }
+    const QString &lastModified = values[LsColEntryHandler::GetLastModified];
+    if (!lastModified.isNull()) {
+        file_stat->mtime = oc_httpdate_parse(lastModified.toUtf8());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+    }
+    const QString &contentLength = values[LsColEntryHandler::GetContentLength];
+    if (!contentLength.isNull()) {
+        bool ok = false;
+        qlonglong ll = contentLength.toLongLong(&ok);
+        if (ok && ll >= 0) {
+            file_stat->size = ll;
+            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+        }
+    }
+    const QString &etag = values[LsColEntryHandler::GetETag];
+    if (!etag.isNull()) {
+        file_stat->etag = csync_normalize_etag(etag.toUtf8());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
+    }
+    const QString &id = values[LsColEntryHandler::Id];
+    if (!id.isNull()) {
+        csync_vio_file_stat_set_file_id(file_stat, id.toUtf8());
+    }
+    const QString &downloadUrl = values[LsColEntryHandler::DownloadURL];
+    if (!downloadUrl.isNull()) {
+        file_stat->directDownloadUrl = strdup(downloadUrl.toUtf8());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL;
+    }
+    const QString &dDC = values[LsColEntryHandler::DDC];
+    if (!dDC.isNull()) {
+        file_stat->directDownloadCookies = strdup(dDC.toUtf8());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES;
+    }
+    const QString &permissions = values[LsColEntryHandler::Permissions];
+    if (!permissions.isNull()) {
+        auto v = permissions.toUtf8();
+        if (permissions.isEmpty()) {
+            // special meaning for our code: server returned permissions but are empty
+            // meaning only reading is allowed for this resource
+            file_stat->remotePerm[0] = ' ';
+            // see _csync_detect_update()
+            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
+        } else if (v.length() < int(sizeof(file_stat->remotePerm))) {
+            strcpy(file_stat->remotePerm, v.constData());
+            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
+        } else {
+            qWarning() << "permissions too large" << v;
         }
     }
-
-    return file_stat;
 }
 
-void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, const QMap<QString,QString> &map)
+void DiscoverySingleDirectoryJob::listingEntry(const QString &href, const QString *values)
 {
-    //qDebug() << Q_FUNC_INFO << _subPath << file << map.count() << map.keys() << _account->davPath() << _lsColJob->reply()->request().url().path();
+    const QString &etag = values[GetETag];
     if (!_ignoredFirst) {
         // The first entry is for the folder itself, we should process it differently.
         _ignoredFirst = true;
-        if (map.contains("permissions")) {
-            auto perm = map.value("permissions");
+        const QString &perm = values[Permissions];
+        if (!perm.isNull()) {
             emit firstDirectoryPermissions(perm);
             _isExternalStorage = perm.contains(QLatin1Char('M'));
         }
-        if (map.contains("data-fingerprint")) {
-            _dataFingerprint = map.value("data-fingerprint").toUtf8();
+        if (!values[DataFingerprint].isNull()) {
+            _dataFingerprint = values[DataFingerprint].toUtf8();
         }
     } else {
         // Remove <webDAV-Url>/folder/ from <webDAV-Url>/folder/subfile.txt
-        file.remove(0, _lsColJob->reply()->request().url().path().length());
-        // remove trailing slash
-        while (file.endsWith('/')) {
-            file.chop(1);
+        if (_hrefPrefixLength < 0) {
+            _hrefPrefixLength = _lsColJob->reply()->request().url().path().length();
         }
-        // remove leading slash
-        while (file.startsWith('/')) {
-            file = file.remove(0, 1);
+        int begin = qMin(_hrefPrefixLength, href.size());
+        int end = href.size();
+        // remove leading and trailing slashes
+        while (begin < end && href.at(begin) == QLatin1Char('/')) {
+            ++begin;
+        }
+        while (end > begin && href.at(end - 1) == QLatin1Char('/')) {
+            --end;
         }
 
-
-        FileStatPointer file_stat(propertyMapToFileStat(map));
-        file_stat->name = strdup(file.toUtf8());
+        FileStatPointer file_stat(csync_vio_file_stat_new());
+        file_stat->name = strdup(href.midRef(begin, end - begin).toUtf8());
+        fillFileStat(file_stat.get(), values);
         if (!file_stat->etag || strlen(file_stat->etag) == 0) {
             qDebug() << "WARNING: etag of" << file_stat->name << "is" << file_stat->etag << " This must not happen.";
         }
@@ -376,22 +415,15 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
             std::replace(file_stat->remotePerm, file_stat->remotePerm + strlen(file_stat->remotePerm),
                          'M', 'm');
         }
-
-        QStringRef fileRef(&file);
-        int slashPos = file.lastIndexOf(QLatin1Char('/'));
-        if( slashPos > -1 ) {
-            fileRef = file.midRef(slashPos+1);
-        }
-        //qDebug() << "!!!!" << file_stat << file_stat->name << file_stat->file_id << map.count();
-        _results.append(file_stat);
+        _results.push_back(std::move(file_stat));
     }
 
     //This works in concerto with the RequestEtagJob and the Folder object to check if the remote folder changed.
-    if (map.contains("getetag")) {
-       _etagConcatenation += map.value("getetag");
+    if (!etag.isNull()) {
+       _etagConcatenation += etag;
 
        if (_firstEtag.isEmpty()) {
-           _firstEtag = map.value("getetag"); // for directory itself
+           _firstEtag = etag; // for directory itself
        }
     }
 }
@@ -399,7 +431,7 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
 void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
 {
     if (!_ignoredFirst) {
-        // This is a sanity check, if we haven't _ignoredFirst then it means we never received any directoryListingIteratedSlot
+        // This is a sanity check, if we haven't _ignoredFirst then it means we never received any listingEntry()
         // which means somehow the server XML was bogus
         emit finishedWithError(ERRNO_WRONG_CONTENT, QLatin1String("Server error: PROPFIND reply is not XML formatted!"));
         deleteLater();
@@ -407,7 +439,7 @@ void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
     }
     emit etag(_firstEtag);
     emit etagConcatenation(_etagConcatenation);
-    emit finishedWithResult(_results);
+    emit finishedWithResult();
     deleteLater();
 }
 
@@ -445,10 +477,18 @@ void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &
     connect(discoveryJob, SIGNAL(doGetSizeSignal(QString,qint64*)),
             this, SLOT(doGetSizeSlot(QString,qint64*)),
             Qt::QueuedConnection);
+    connect(discoveryJob, SIGNAL(doClosedirSignal(QString)),
+            this, SLOT(doClosedirSlot(QString)),
+            Qt::QueuedConnection);
 }
 
-// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
-void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+void DiscoveryMainThread::setPrefetchOptions(SyncJournalDb *journal, int maxJobs)
+{
+    _journal = journal;
+    _maxPrefetchJobs = qMax(0, maxJobs);
+}
+
+QString DiscoveryMainThread::fullRemotePath(const QString &subPath) const
 {
     QString fullPath = _pathPrefix;
     if (!_pathPrefix.endsWith('/')) {
@@ -459,6 +499,13 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     while (fullPath.endsWith('/')) {
         fullPath.chop(1);
     }
+    return fullPath;
+}
+
+// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
+void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+{
+    QString fullPath = fullRemotePath(subPath);
 
     // emit _discoveryJob->folderDiscovered(false, subPath);
     _discoveryJob->update_job_update_callback (false, subPath.toUtf8(), _discoveryJob);
@@ -467,10 +514,28 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     _currentDiscoveryDirectoryResult = r;
     _currentDiscoveryDirectoryResult->path = fullPath;
 
+    if (_maxPrefetchJobs > 0) {
+        _walkedDirectories.insert(fullPath, false);
+
+        auto it = _prefetched.find(fullPath);
+        if (it != _prefetched.end()) {
+            if (it->second.job) {
+                // Still running, finishPrefetch() hands it over
+                _waitingForPrefetch = fullPath;
+                return;
+            }
+            PrefetchedDirectory dir = std::move(it->second);
+            _prefetched.erase(it);
+            deliverResult(dir.code, dir.msg, std::move(dir.list));
+            startPrefetchJobs();
+            return;
+        }
+    }
+
     // Schedule the DiscoverySingleDirectoryJob
     _singleDirJob = new DiscoverySingleDirectoryJob(_account, fullPath, this);
-    QObject::connect(_singleDirJob, SIGNAL(finishedWithResult(const QList<FileStatPointer> &)),
-                     this, SLOT(singleDirectoryJobResultSlot(const QList<FileStatPointer> &)));
+    QObject::connect(_singleDirJob, SIGNAL(finishedWithResult()),
+                     this, SLOT(singleDirectoryJobResultSlot()));
     QObject::connect(_singleDirJob, SIGNAL(finishedWithError(int,QString)),
                      this, SLOT(singleDirectoryJobFinishedWithErrorSlot(int,QString)));
     QObject::connect(_singleDirJob, SIGNAL(firstDirectoryPermissions(QString)),
@@ -487,28 +552,184 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     _singleDirJob->start();
 }
 
+void DiscoveryMainThread::doClosedirSlot(const QString &path)
+{
+    if (_maxPrefetchJobs <= 0) {
+        return;
+    }
+    _walkedDirectories.insert(path, true);
+
+    // The walker is not going to ask for what was listed below this directory
+    // and not taken yet: it was ignored or excluded.
+    const QString pathSlash = path + QLatin1Char('/');
+    auto it = _prefetched.lower_bound(pathSlash);
+    while (it != _prefetched.end() && it->first.startsWith(pathSlash)) {
+        if (it->second.job) {
+            it->second.job->disconnect(this);
+            it->second.job->abort();
+            --_runningPrefetchJobs;
+        }
+        it = _prefetched.erase(it);
+    }
+    startPrefetchJobs();
+}
+
+void DiscoveryMainThread::deliverResult(int code, const QString &msg, std::deque<FileStatPointer> list)
+{
+    _currentDiscoveryDirectoryResult->code = code;
+    _currentDiscoveryDirectoryResult->msg = msg;
+    _currentDiscoveryDirectoryResult->list = std::move(list);
+    _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
 
-void DiscoveryMainThread::singleDirectoryJobResultSlot(const QList<FileStatPointer> & result)
+    _discoveryJob->_vioMutex.lock();
+    _discoveryJob->_vioWaitCondition.wakeAll();
+    _discoveryJob->_vioMutex.unlock();
+}
+
+/* Whether the walker already opened this directory, or closed one of its parents */
+bool DiscoveryMainThread::isWalkedOrSkipped(const QString &path) const
 {
-    if (!_currentDiscoveryDirectoryResult) {
+    if (_walkedDirectories.contains(path)) {
+        return true;
+    }
+    QString parent = path;
+    int slash;
+    while ((slash = parent.lastIndexOf(QLatin1Char('/'))) >= 0) {
+        parent.truncate(slash);
+        if (_walkedDirectories.value(parent, false)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DiscoveryMainThread::schedulePrefetch(const QString &path, const std::deque<FileStatPointer> &list)
+{
+    if (_maxPrefetchJobs <= 0 || !_journal || !_discoveryJob) {
+        return;
+    }
+
+    // The path relative to the sync folder, as in the journal
+    QString relativePath = path.mid(fullRemotePath(QString()).length());
+    while (relativePath.startsWith(QLatin1Char('/'))) {
+        relativePath.remove(0, 1);
+    }
+    const SyncOptions &options = _discoveryJob->_syncOptions;
+
+    // The walker enters the subdirectories depth first in the order of the listing,
+    // so they go to the front of the queue, before the siblings of their parents.
+    auto insertPos = _prefetchQueue.begin();
+    for (const FileStatPointer &stat : list) {
+        if (!(stat->fields & CSYNC_VIO_FILE_STAT_FIELDS_TYPE)
+                || stat->type != CSYNC_VIO_FILE_TYPE_DIRECTORY || !stat->name) {
+            continue;
+        }
+        const QString name = QString::fromUtf8(stat->name);
+        const QString relative = relativePath.isEmpty() ? name : relativePath + QLatin1Char('/') + name;
+        if (findPathInList(_discoveryJob->_selectiveSyncBlackList, relative)) {
+            continue;
+        }
+
+        SyncJournalFileRecord record = _journal->getFileRecord(relative);
+        if (record.isValid()) {
+            if (stat->etag && record._etag == stat->etag) {
+                continue; // csync takes its contents from the journal
+            }
+        } else if (options._newBigFolderSizeLimit >= 0
+                   || (options._confirmExternalStorage && std::strchr(stat->remotePerm, 'M'))) {
+            // Whether csync enters a new folder depends on checkSelectiveSyncNewFolder()
+            continue;
+        }
+
+        insertPos = _prefetchQueue.insert(insertPos, path + QLatin1Char('/') + name);
+        ++insertPos;
+    }
+    startPrefetchJobs();
+}
+
+void DiscoveryMainThread::startPrefetchJobs()
+{
+    // The listings the walker has not taken yet are kept in memory, bound them too.
+    while (_runningPrefetchJobs < _maxPrefetchJobs
+           && _prefetched.size() < size_t(_maxPrefetchJobs) * 4
+           && !_prefetchQueue.isEmpty()) {
+        QString path = _prefetchQueue.takeFirst();
+        if (_prefetched.count(path) || isWalkedOrSkipped(path)) {
+            continue;
+        }
+
+        auto job = new DiscoverySingleDirectoryJob(_account, path, this);
+        QObject::connect(job, SIGNAL(finishedWithResult()),
+                         this, SLOT(prefetchJobResultSlot()));
+        QObject::connect(job, SIGNAL(finishedWithError(int,QString)),
+                         this, SLOT(prefetchJobFinishedWithErrorSlot(int,QString)));
+        _prefetched[path].job = job;
+        ++_runningPrefetchJobs;
+        job->start();
+    }
+}
+
+void DiscoveryMainThread::finishPrefetch(DiscoverySingleDirectoryJob *job, int code, const QString &msg,
+                                         std::deque<FileStatPointer> list)
+{
+    const QString path = job->path();
+    auto it = _prefetched.find(path);
+    if (it == _prefetched.end() || it->second.job != job) {
         return; // possibly aborted
     }
-    qDebug() << Q_FUNC_INFO << "Have" << result.count() << "results for " << _currentDiscoveryDirectoryResult->path;
+    --_runningPrefetchJobs;
 
+    // Queue the subdirectories before the walker may go on
+    if (code == 0) {
+        schedulePrefetch(path, list);
+    }
 
-    _currentDiscoveryDirectoryResult->list = result;
-    _currentDiscoveryDirectoryResult->code = 0;
-    _currentDiscoveryDirectoryResult->listIndex = 0;
-    _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
+    if (_currentDiscoveryDirectoryResult && _waitingForPrefetch == path) {
+        qDebug() << Q_FUNC_INFO << "Have the prefetched listing the walker waits for" << path;
+        _prefetched.erase(path);
+        _waitingForPrefetch.clear();
+        deliverResult(code, msg, std::move(list));
+    } else {
+        it = _prefetched.find(path);
+        it->second.job = 0;
+        it->second.code = code;
+        it->second.msg = msg;
+        it->second.list = std::move(list);
+    }
+    startPrefetchJobs();
+}
+
+void DiscoveryMainThread::prefetchJobResultSlot()
+{
+    if (auto job = qobject_cast<DiscoverySingleDirectoryJob *>(sender())) {
+        finishPrefetch(job, 0, QString(), job->takeResults());
+    }
+}
+
+void DiscoveryMainThread::prefetchJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg)
+{
+    if (auto job = qobject_cast<DiscoverySingleDirectoryJob *>(sender())) {
+        qDebug() << Q_FUNC_INFO << job->path() << csyncErrnoCode << msg;
+        finishPrefetch(job, csyncErrnoCode, msg, std::deque<FileStatPointer>());
+    }
+}
+
+void DiscoveryMainThread::singleDirectoryJobResultSlot()
+{
+    if (!_currentDiscoveryDirectoryResult || !_singleDirJob) {
+        return; // possibly aborted
+    }
+    std::deque<FileStatPointer> result = _singleDirJob->takeResults();
+    qDebug() << Q_FUNC_INFO << "Have" << result.size() << "results for " << _currentDiscoveryDirectoryResult->path;
 
     if (!_firstFolderProcessed) {
         _firstFolderProcessed = true;
         _dataFingerprint = _singleDirJob->_dataFingerprint;
     }
 
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+    // While the sync thread still waits, it does not use the journal
+    schedulePrefetch(_currentDiscoveryDirectoryResult->path, result);
+    deliverResult(0, QString(), std::move(result));
 }
 
 void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg)
@@ -518,13 +739,7 @@ void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrno
     }
     qDebug() << Q_FUNC_INFO << csyncErrnoCode << msg;
 
-     _currentDiscoveryDirectoryResult->code = csyncErrnoCode;
-     _currentDiscoveryDirectoryResult->msg = msg;
-     _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
-
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+    deliverResult(csyncErrnoCode, msg, std::deque<FileStatPointer>());
 }
 
 void DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot(const QString &p)
@@ -538,15 +753,7 @@ void DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot(const
 
 void DiscoveryMainThread::doGetSizeSlot(const QString& path, qint64* result)
 {
-    QString fullPath = _pathPrefix;
-    if (!_pathPrefix.endsWith('/')) {
-        fullPath += '/';
-    }
-    fullPath += path;
-    // remove trailing slash
-    while (fullPath.endsWith('/')) {
-        fullPath.chop(1);
-    }
+    QString fullPath = fullRemotePath(path);
 
     _currentGetSizeResult = result;
 
@@ -595,9 +802,19 @@ void DiscoveryMainThread::abort() {
     if (_singleDirJob) {
         _singleDirJob->disconnect(SIGNAL(finishedWithError(int,QString)), this);
         _singleDirJob->disconnect(SIGNAL(firstDirectoryPermissions(QString)), this);
-        _singleDirJob->disconnect(SIGNAL(finishedWithResult(const QList<FileStatPointer> &)), this);
+        _singleDirJob->disconnect(SIGNAL(finishedWithResult()), this);
         _singleDirJob->abort();
     }
+    for (auto &it : _prefetched) {
+        if (it.second.job) {
+            it.second.job->disconnect(this);
+            it.second.job->abort();
+        }
+    }
+    _prefetched.clear();
+    _prefetchQueue.clear();
+    _runningPrefetchJobs = 0;
+    _waitingForPrefetch.clear();
     if (_currentDiscoveryDirectoryResult) {
         if (_discoveryJob->_vioMutex.tryLock()) {
             _currentDiscoveryDirectoryResult->msg = tr("Aborted by the user"); // Actually also created somewhere else by sync engine
@@ -653,10 +870,11 @@ csync_vio_file_stat_t* DiscoveryJob::remote_vio_readdir_hook (csync_vio_handle_t
     DiscoveryJob *discoveryJob = static_cast<DiscoveryJob*>(userdata);
     if (discoveryJob) {
         DiscoveryDirectoryResult *directoryResult = static_cast<DiscoveryDirectoryResult*>(dhandle);
-        if (directoryResult->listIndex < directoryResult->list.size()) {
-            csync_vio_file_stat_t *file_stat = directoryResult->list.at(directoryResult->listIndex++).data();
-            // Make a copy, csync_update will delete the copy
-            return csync_vio_file_stat_copy(file_stat);
+        if (!directoryResult->list.empty()) {
+            // Hand the entry over, csync_update deletes it
+            csync_vio_file_stat_t *file_stat = directoryResult->list.front().release();
+            directoryResult->list.pop_front();
+            return file_stat;
         }
     }
     return NULL;
@@ -669,17 +887,20 @@ void DiscoveryJob::remote_vio_closedir_hook (csync_vio_handle_t *dhandle,  void
         DiscoveryDirectoryResult *directoryResult = static_cast<DiscoveryDirectoryResult*> (dhandle);
         QString path = directoryResult->path;
         qDebug() << Q_FUNC_INFO << discoveryJob << path;
-        delete directoryResult; // just deletes the struct and the iterator, the data itself is owned by the SyncEngine/DiscoveryMainThread
+        emit discoveryJob->doClosedirSignal(path);
+        delete directoryResult; // also deletes the entries csync did not read
     }
 }
 
 void DiscoveryJob::start() {
     _selectiveSyncBlackList.sort();
     _selectiveSyncWhiteList.sort();
+    _localDiscoveryPaths.sort();
     _csync_ctx->callbacks.update_callback_userdata = this;
     _csync_ctx->callbacks.update_callback = update_job_update_callback;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = isInSelectiveSyncBlackListCallback;
     _csync_ctx->callbacks.checkSelectiveSyncNewFolderHook = checkSelectiveSyncNewFolderCallback;
+    _csync_ctx->callbacks.checkLocalDiscoveryHook = _localDiscoveryFromJournal ? shouldDiscoverLocallyCallback : 0;
 
     _csync_ctx->callbacks.remote_opendir_hook = remote_vio_opendir_hook;
     _csync_ctx->callbacks.remote_readdir_hook = remote_vio_readdir_hook;
@@ -694,6 +915,7 @@ void DiscoveryJob::start() {
 
     _csync_ctx->callbacks.checkSelectiveSyncNewFolderHook = 0;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = 0;
+    _csync_ctx->callbacks.checkLocalDiscoveryHook = 0;
     _csync_ctx->callbacks.update_callback = 0;
     _csync_ctx->callbacks.update_callback_userdata = 0;
 
@@ -23,10 +23,15 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QLinkedList>
+#include <QHash>
+#include <deque>
+#include <map>
+#include <memory>
 
 namespace OCC {
 
 class Account;
+class SyncJournalDb;
 
 /**
  * The Discovery Phase was once called "update" phase in csync terms.
@@ -35,49 +40,54 @@ class Account;
  */
 
 struct SyncOptions {
-    SyncOptions() : _newBigFolderSizeLimit(-1), _confirmExternalStorage(false) {}
+    SyncOptions() : _newBigFolderSizeLimit(-1), _confirmExternalStorage(false), _localDiscoveryThreads(1), _inMemoryJournalIndex(false),
+        _remoteDiscoveryJobs(0), _initialChunkSize(10 * 1000 * 1000), _minChunkSize(1000 * 1000),
+        _maxChunkSize(100 * 1000 * 1000), _targetChunkUploadDuration(0),
+        _minDeltaDownloadSize(100 * 1000 * 1000) {}
     /** Maximum size (in Bytes) a folder can have without asking for confirmation.
      * -1 means infinite */
     qint64 _newBigFolderSizeLimit;
     /** If a confirmation should be asked for external storages */
     bool _confirmExternalStorage;
+    /** Number of threads reading and stat'ing local directories in parallel.
+     * 1 means the local tree is walked by the discovery thread only */
+    int _localDiscoveryThreads;
+    /** Read the whole journal once per sync instead of querying it for each file.
+     * Faster for large journals, at the cost of keeping it in memory during the sync */
+    bool _inMemoryJournalIndex;
+    /** Number of changed remote directories listed in parallel, ahead of the discovery.
+     * 0 means each remote directory is listed when csync asks for it */
+    int _remoteDiscoveryJobs;
+    /** The size (in Bytes) of the first upload chunks */
+    quint64 _initialChunkSize;
+    /** Bounds of the chunk size (in Bytes) when it is adapted */
+    quint64 _minChunkSize;
+    quint64 _maxChunkSize;
+    /** Time (in ms) the upload of a chunk should take, the chunk size is adapted to it.
+     * 0 means all chunks have the initial size */
+    qint64 _targetChunkUploadDuration;
+    /** Files (in Bytes) from this size only fetch their changed blocks when the server
+     * supports it. 0 means they are always downloaded completely */
+    qint64 _minDeltaDownloadSize;
 };
 
 
+struct FileStatDeleter {
+    void operator()(csync_vio_file_stat_t *stat) const { csync_vio_file_stat_destroy(stat); }
+};
+
 /**
- * @brief The FileStatPointer class
+ * @brief Owns a csync_vio_file_stat_t until it is handed over to csync
  * @ingroup libsync
  */
-class FileStatPointer {
-public:
-    FileStatPointer(csync_vio_file_stat_t *stat)
-        : _stat(stat)
-    { }
-    FileStatPointer(const FileStatPointer &other)
-        : _stat(csync_vio_file_stat_copy(other._stat))
-    { }
-    ~FileStatPointer() {
-        csync_vio_file_stat_destroy(_stat);
-    }
-    FileStatPointer &operator=(const FileStatPointer &other) {
-        csync_vio_file_stat_destroy(_stat);
-        _stat = csync_vio_file_stat_copy(other._stat);
-        return *this;
-    }
-    inline csync_vio_file_stat_t *data() const { return _stat; }
-    inline csync_vio_file_stat_t *operator->() const { return _stat; }
-
-private:
-    csync_vio_file_stat_t *_stat;
-};
+typedef std::unique_ptr<csync_vio_file_stat_t, FileStatDeleter> FileStatPointer;
 
 struct DiscoveryDirectoryResult {
     QString path;
     QString msg;
     int code;
-    QList<FileStatPointer> list;
-    int listIndex;
-    DiscoveryDirectoryResult() : code(EIO), listIndex(0) { }
+    std::deque<FileStatPointer> list; // taken from the front by the readdir hook
+    DiscoveryDirectoryResult() : code(EIO) { }
 };
 
 /**
@@ -87,27 +97,31 @@ struct DiscoveryDirectoryResult {
  *
  * @ingroup libsync
  */
-class DiscoverySingleDirectoryJob : public QObject {
+class OWNCLOUDSYNC_EXPORT DiscoverySingleDirectoryJob : public QObject, private LsColEntryHandler {
     Q_OBJECT
 public:
     explicit DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent = 0);
     // Specify thgat this is the root and we need to check the data-fingerprint
     void setIsRootPath() { _isRootPath = true; }
+    QString path() const { return _subPath; }
     void start();
     void abort();
+    /** The entries of the directory, once finishedWithResult was emitted */
+    std::deque<FileStatPointer> takeResults() { return std::move(_results); }
     // This is not actually a network job, it is just a job
 signals:
     void firstDirectoryPermissions(const QString &);
     void etagConcatenation(const QString &);
     void etag(const QString &);
-    void finishedWithResult(const QList<FileStatPointer> &);
+    void finishedWithResult();
     void finishedWithError(int csyncErrnoCode, const QString &msg);
 private slots:
-    void directoryListingIteratedSlot(QString, const QMap<QString,QString>&);
     void lsJobFinishedWithoutErrorSlot();
     void lsJobFinishedWithErrorSlot(QNetworkReply*);
 private:
-    QList<FileStatPointer> _results;
+    void listingEntry(const QString &href, const QString *values) Q_DECL_OVERRIDE;
+
+    std::deque<FileStatPointer> _results;
     QString _subPath;
     QString _etagConcatenation;
     QString _firstEtag;
@@ -119,6 +133,8 @@ private:
     bool _isRootPath;
     // If this directory is an external storage (The first item has 'M' in its permission)
     bool _isExternalStorage;
+    // Length of the path of this directory in the hrefs, -1 until the first entry
+    int _hrefPrefixLength;
     QPointer<LsColJob> _lsColJob;
 
 public:
@@ -138,12 +154,45 @@ class DiscoveryMainThread : public QObject {
     qint64 *_currentGetSizeResult;
     bool _firstFolderProcessed;
 
+    /* A listing requested before csync's walker asks for it.
+     * The job is null once it finished, the result is then in code, msg and list */
+    struct PrefetchedDirectory {
+        PrefetchedDirectory() : code(EIO) { }
+        QPointer<DiscoverySingleDirectoryJob> job;
+        int code;
+        QString msg;
+        std::deque<FileStatPointer> list;
+    };
+    SyncJournalDb *_journal;
+    int _maxPrefetchJobs;
+    int _runningPrefetchJobs;
+    std::map<QString, PrefetchedDirectory> _prefetched; // by full remote path
+    QLinkedList<QString> _prefetchQueue; // full remote paths, in the order the walker is expected to ask
+    QHash<QString, bool> _walkedDirectories; // full remote paths the walker opened, true once closed
+    QString _waitingForPrefetch; // the full path _currentDiscoveryDirectoryResult waits for
+
+    QString fullRemotePath(const QString &subPath) const;
+    bool isWalkedOrSkipped(const QString &path) const;
+    void deliverResult(int code, const QString &msg, std::deque<FileStatPointer> list);
+    void schedulePrefetch(const QString &path, const std::deque<FileStatPointer> &list);
+    void startPrefetchJobs();
+    void finishPrefetch(DiscoverySingleDirectoryJob *job, int code, const QString &msg,
+                        std::deque<FileStatPointer> list);
+
 public:
     DiscoveryMainThread(AccountPtr account) : QObject(), _account(account),
-        _currentDiscoveryDirectoryResult(0), _currentGetSizeResult(0), _firstFolderProcessed(false)
+        _currentDiscoveryDirectoryResult(0), _currentGetSizeResult(0), _firstFolderProcessed(false),
+        _journal(0), _maxPrefetchJobs(0), _runningPrefetchJobs(0)
     { }
     void abort();
 
+    /**
+     * List up to maxJobs changed remote directories in parallel, ahead of csync's walker.
+     * A subdirectory is listed early when its etag differs from the one in the journal.
+     * 0 disables it.
+     */
+    void setPrefetchOptions(SyncJournalDb *journal, int maxJobs);
+
     QByteArray _dataFingerprint;
 
 
@@ -151,14 +200,18 @@ public slots:
     // From DiscoveryJob:
     void doOpendirSlot(const QString &url, DiscoveryDirectoryResult* );
     void doGetSizeSlot(const QString &path ,qint64 *result);
+    void doClosedirSlot(const QString &path);
 
     // From Job:
-    void singleDirectoryJobResultSlot(const QList<FileStatPointer> &);
+    void singleDirectoryJobResultSlot();
     void singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg);
     void singleDirectoryJobFirstDirectoryPermissionsSlot(const QString&);
 
     void slotGetSizeFinishedWithError();
     void slotGetSizeResult(const QVariantMap&);
+
+    void prefetchJobResultSlot();
+    void prefetchJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg);
 signals:
     void etag(const QString &);
     void etagConcatenation(const QString &);
@@ -191,6 +244,13 @@ class DiscoveryJob : public QObject {
     bool checkSelectiveSyncNewFolder(const QString &path, const char *remotePerm);
     static int checkSelectiveSyncNewFolderCallback(void* data, const char* path, const char* remotePerm);
 
+    /**
+     * return true if the local directory must be read from disk,
+     * false if its contents can be taken from the journal
+     */
+    bool shouldDiscoverLocally(const char *path) const;
+    static int shouldDiscoverLocallyCallback(void *, const char *);
+
     // Just for progress
     static void update_job_update_callback (bool local,
                                             const char *dirname,
@@ -209,7 +269,7 @@ class DiscoveryJob : public QObject {
 
 public:
     explicit DiscoveryJob(CSYNC *ctx, QObject* parent = 0)
-            : QObject(parent), _csync_ctx(ctx) {
+            : QObject(parent), _csync_ctx(ctx), _localDiscoveryFromJournal(false) {
         // We need to forward the log property as csync uses thread local
         // and updates run in another thread
         _log_callback = csync_get_log_callback();
@@ -219,6 +279,10 @@ public:
 
     QStringList _selectiveSyncBlackList;
     QStringList _selectiveSyncWhiteList;
+    /** If set, only the local directories containing, or contained in, one of
+     *  _localDiscoveryPaths are read from disk. The others come from the journal. */
+    bool _localDiscoveryFromJournal;
+    QStringList _localDiscoveryPaths;
     SyncOptions _syncOptions;
     Q_INVOKABLE void start();
 signals:
@@ -228,6 +292,8 @@ signals:
     // After the discovery job has been woken up again (_vioWaitCondition)
     void doOpendirSignal(QString url, DiscoveryDirectoryResult*);
     void doGetSizeSignal(const QString &path, qint64 *result);
+    // The walker is done with this directory and everything below it
+    void doClosedirSignal(const QString &path);
 
     // A new folder was discovered and was not synced because of the confirmation feature
     void newBigFolder(const QString &folder, bool isExternal);
@@ -25,20 +25,23 @@ extern "C" {
 
 using namespace OCC;
 
-ExcludedFiles::ExcludedFiles(c_strlist_t** excludesPtr)
+ExcludedFiles::ExcludedFiles(c_strlist_t** excludesPtr, csync_exclude_matcher_t** matcherPtr)
     : _excludesPtr(excludesPtr)
+    , _matcherPtr(matcherPtr)
 {
 }
 
 ExcludedFiles::~ExcludedFiles()
 {
     c_strlist_destroy(*_excludesPtr);
+    csync_exclude_matcher_free(*_matcherPtr);
 }
 
 ExcludedFiles& ExcludedFiles::instance()
 {
     static c_strlist_t* globalExcludes;
-    static ExcludedFiles inst(&globalExcludes);
+    static csync_exclude_matcher_t* globalMatcher;
+    static ExcludedFiles inst(&globalExcludes, &globalMatcher);
     return inst;
 }
 
@@ -51,6 +54,7 @@ void ExcludedFiles::addExcludeFilePath(const QString& path)
 void ExcludedFiles::addExcludeExpr(const QString &expr)
 {
     _csync_exclude_add(_excludesPtr, expr.toLatin1().constData());
+    compileExcludes();
 }
 #endif
 
@@ -64,9 +68,17 @@ bool ExcludedFiles::reloadExcludes()
         if (csync_exclude_load(file.toUtf8(), _excludesPtr) < 0)
             success = false;
     }
+    compileExcludes();
     return success;
 }
 
+void ExcludedFiles::compileExcludes()
+{
+    csync_exclude_matcher_free(*_matcherPtr);
+    *_matcherPtr = csync_exclude_matcher_new(*_excludesPtr);
+    emit excludesChanged();
+}
+
 bool ExcludedFiles::isExcluded(
         const QString& filePath,
         const QString& basePath,
@@ -103,5 +115,8 @@ bool ExcludedFiles::isExcluded(
         relativePath.chop(1);
     }
 
+    if (*_matcherPtr) {
+        return csync_excluded_no_ctx_matcher(*_matcherPtr, relativePath.toUtf8(), type) != CSYNC_NOT_EXCLUDED;
+    }
     return csync_excluded_no_ctx(*_excludesPtr, relativePath.toUtf8(), type) != CSYNC_NOT_EXCLUDED;
 }
@@ -37,7 +37,7 @@ class OWNCLOUDSYNC_EXPORT ExcludedFiles : public QObject
 public:
     static ExcludedFiles & instance();
 
-    ExcludedFiles(c_strlist_t** excludesPtr);
+    ExcludedFiles(c_strlist_t** excludesPtr, csync_exclude_matcher_t** matcherPtr);
     ~ExcludedFiles();
 
     /**
@@ -64,14 +64,23 @@ public:
 
 public slots:
     /**
-     * Reloads the exclude patterns from the registered paths.
+     * Reloads the exclude patterns from the registered paths
+     * and compiles them.
      */
     bool reloadExcludes();
 
+signals:
+    /** The patterns changed, a path may be excluded differently */
+    void excludesChanged();
+
 private:
+    void compileExcludes();
+
     // This is a pointer to the csync exclude list, its is owned by this class
     // but the pointer can be in a csync_context so that it can itself also query the list.
     c_strlist_t** _excludesPtr;
+    // The list compiled by reloadExcludes(), owned and shared the same way.
+    csync_exclude_matcher_t** _matcherPtr;
     QSet<QString> _excludeFiles;
 };
 
@@ -29,6 +29,10 @@
 #include <qabstractfileengine.h>
 #endif
 
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#endif
+
 #ifdef Q_OS_WIN
 #include <windows.h>
 #include <windef.h>
@@ -509,17 +513,25 @@ QString FileSystem::fileSystemForPath(const QString & path)
 }
 #endif
 
-#define BUFSIZE qint64(500*1024)  // 500 KiB
+void FileSystem::adviseSequentialRead(QFile* file)
+{
+#if defined(Q_OS_UNIX) && defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(file->handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+    Q_UNUSED(file);
+#endif
+}
 
 static QByteArray readToCrypto( const QString& filename, QCryptographicHash::Algorithm algo )
 {
     QFile file(filename);
-    const qint64 bufSize = qMin(BUFSIZE, file.size() + 1);
+    const qint64 bufSize = qMin(FileSystem::checksumReadSize, file.size() + 1);
     QByteArray buf(bufSize, Qt::Uninitialized);
     QByteArray arr;
     QCryptographicHash crypto( algo );
 
-    if (file.open(QIODevice::ReadOnly)) {
+    if (file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        FileSystem::adviseSequentialRead(&file);
         qint64 size;
         while (!file.atEnd()) {
             size = file.read( buf.data(), bufSize );
@@ -546,11 +558,12 @@ QByteArray FileSystem::calcSha1( const QString& filename )
 QByteArray FileSystem::calcAdler32( const QString& filename )
 {
     QFile file(filename);
-    const qint64 bufSize = qMin(BUFSIZE, file.size() + 1);
+    const qint64 bufSize = qMin(FileSystem::checksumReadSize, file.size() + 1);
     QByteArray buf(bufSize, Qt::Uninitialized);
 
     unsigned int adler = adler32(0L, Z_NULL, 0);
-    if (file.open(QIODevice::ReadOnly)) {
+    if (file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        FileSystem::adviseSequentialRead(&file);
         qint64 size;
         while (!file.atEnd()) {
             size = file.read(buf.data(), bufSize);
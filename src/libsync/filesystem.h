@@ -178,6 +178,19 @@ bool openAndSeekFileSharedRead(QFile* file, QString* error, qint64 seek);
 QString fileSystemForPath(const QString & path);
 #endif
 
+/**
+ * Size of the reads when a file is hashed.
+ *
+ * Large reads need fewer system calls and let the disk read ahead.
+ */
+const qint64 checksumReadSize = 1024 * 1024;
+
+/**
+ * Tells the system that \a file will be read once from start to end, so
+ * that it reads ahead more. Does nothing where that isn't supported.
+ */
+void OWNCLOUDSYNC_EXPORT adviseSequentialRead(QFile* file);
+
 QByteArray OWNCLOUDSYNC_EXPORT calcMd5( const QString& fileName );
 QByteArray OWNCLOUDSYNC_EXPORT calcSha1( const QString& fileName );
 #ifdef ZLIB_FOUND
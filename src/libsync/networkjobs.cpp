@@ -135,146 +135,269 @@ bool MkColJob::finished()
 }
 
 /*********************************************************************************************/
-// supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
-static QString readContentsAsString(QXmlStreamReader &reader) {
-    QString result;
-    int level = 0;
-    do {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        if (type == QXmlStreamReader::StartElement) {
-            level++;
-            result += "<" + reader.name().toString() + ">";
-        } else if (type == QXmlStreamReader::Characters) {
-            result += reader.text();
-        } else if (type == QXmlStreamReader::EndElement) {
-            level--;
-            if (level < 0) {
-                break;
-            }
-            result += "</" + reader.name().toString() + ">";
+/* Indexed by LsColEntryHandler::Property */
+static const char *const listingPropertyNames[] = {
+    "resourcetype",
+    "getlastmodified",
+    "getcontentlength",
+    "getetag",
+    "id",
+    "downloadURL",
+    "dDC",
+    "permissions",
+    "size",
+    "data-fingerprint"
+};
+
+static int listingPropertyId(const QStringRef &name)
+{
+    for (int i = 0; i < LsColEntryHandler::PropertyCount; ++i) {
+        if (name == QLatin1String(listingPropertyNames[i])) {
+            return i;
         }
-
-    } while (!reader.atEnd());
-    return result;
+    }
+    return -1;
 }
 
-
+// supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
 LsColXMLParser::LsColXMLParser()
+    : _sizes(0), _entryHandler(0), _failed(false), _currentPropsHaveHttp200(false), _insidePropstat(false),
+      _insideProp(false), _insideMultiStatus(false), _reading(ReadingNothing), _readingProperty(-1),
+      _readingDepth(0)
 {
 
 }
 
 bool LsColXMLParser::parse( const QByteArray& xml, QHash<QString, qint64> *sizes, const QString& expectedPath)
 {
-    // Parse DAV response
-    QXmlStreamReader reader(xml);
-    reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
-
-    QStringList folders;
-    QString currentHref;
-    QMap<QString, QString> currentTmpProperties;
-    QMap<QString, QString> currentHttp200Properties;
-    bool currentPropsHaveHttp200 = false;
-    bool insidePropstat = false;
-    bool insideProp = false;
-    bool insideMultiStatus = false;
-
-    while (!reader.atEnd()) {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        QString name = reader.name().toString();
+    begin(sizes, expectedPath);
+    addData(xml);
+    return end();
+}
+
+void LsColXMLParser::begin(QHash<QString, qint64> *sizes, const QString &expectedPath)
+{
+    _reader.clear();
+    _reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
+    _sizes = sizes;
+    _expectedPath = expectedPath;
+    _failed = false;
+    _folders.clear();
+    _currentHref.clear();
+    _currentTmpProperties.clear();
+    _currentHttp200Properties.clear();
+    _currentPropsHaveHttp200 = false;
+    _insidePropstat = false;
+    _insideProp = false;
+    _insideMultiStatus = false;
+    for (int i = 0; i < LsColEntryHandler::PropertyCount; ++i) {
+        _currentTmpValues[i].clear();
+        _currentHttp200Values[i].clear();
+    }
+    _reading = ReadingNothing;
+}
+
+bool LsColXMLParser::addData(const QByteArray &data)
+{
+    if (_failed) {
+        return false;
+    }
+    _reader.addData(data);
+    readTokens();
+    return !_failed;
+}
+
+bool LsColXMLParser::end()
+{
+    if (_failed) {
+        return false;
+    }
+    if (_reader.hasError()) {
+        // The document is incomplete. Whatever had been emitted before came as directoryListingIterated
+        qDebug() << "ERROR" << _reader.errorString();
+        return false;
+    } else if (!_insideMultiStatus) {
+        qDebug() << "ERROR no WebDAV response?";
+        return false;
+    }
+    emit directoryListingSubfolders(_folders);
+    emit finishedWithoutError();
+    return true;
+}
+
+void LsColXMLParser::startReading(ReadingState state)
+{
+    _reading = state;
+    if (_entryHandler && state == ReadingProperty) {
+        // Only the known properties are kept, no need for the name
+        _readingProperty = listingPropertyId(_reader.name());
+    } else {
+        _readingName = _reader.name().toString();
+    }
+    _readingText.clear();
+    _readingDepth = 0;
+}
+
+// Called at the end element of what startReading() started, returns false if the reply is not valid
+bool LsColXMLParser::endReading()
+{
+    ReadingState state = _reading;
+    _reading = ReadingNothing;
+
+    if (state == ReadingHref) {
+        // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
+        // but the result will have URL encoding..
+        QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(_readingText.toUtf8()));
+        if (!hrefString.startsWith(_expectedPath)) {
+            qDebug() << "Invalid href" << hrefString << "expected starting with" << _expectedPath;
+            return false;
+        }
+        _currentHref = hrefString;
+    } else if (state == ReadingStatus) {
+        _currentPropsHaveHttp200 = _readingText.startsWith("HTTP/1.1 200");
+    } else if (state == ReadingProperty && _entryHandler) {
+        if (_readingProperty == LsColEntryHandler::ResourceType && _readingText.contains("collection")) {
+            _folders.append(_currentHref);
+        } else if (_readingProperty == LsColEntryHandler::Size) {
+            bool ok = false;
+            auto s = _readingText.toLongLong(&ok);
+            if (ok && _sizes) {
+                _sizes->insert(_currentHref, s);
+            }
+        }
+        if (_readingProperty >= 0) {
+            // An empty element is not a missing property, see the permissions
+            _currentTmpValues[_readingProperty] = _readingText.isNull() ? QString(QLatin1String("")) : _readingText;
+        }
+    } else if (state == ReadingProperty) {
+        if (_readingName == QLatin1String("resourcetype") && _readingText.contains("collection")) {
+            _folders.append(_currentHref);
+        } else if (_readingName == QLatin1String("size")) {
+            bool ok = false;
+            auto s = _readingText.toLongLong(&ok);
+            if (ok && _sizes) {
+                _sizes->insert(_currentHref, s);
+            }
+        }
+        _currentTmpProperties.insert(_readingName, _readingText);
+    }
+    return true;
+}
+
+void LsColXMLParser::readTokens()
+{
+    // Stops with PrematureEndOfDocumentError at the end of the data received so far,
+    // reading goes on from there once more data was added.
+    while (!_reader.atEnd()) {
+        QXmlStreamReader::TokenType type = _reader.readNext();
+
+        if (_reading != ReadingNothing) {
+            if (type == QXmlStreamReader::Characters) {
+                _readingText += _reader.text();
+            } else if (type == QXmlStreamReader::StartElement) {
+                _readingDepth++;
+                if (_reading == ReadingProperty) {
+                    _readingText += "<" + _reader.name().toString() + ">";
+                }
+            } else if (type == QXmlStreamReader::EndElement) {
+                if (_readingDepth == 0) {
+                    if (!endReading()) {
+                        _failed = true;
+                        return;
+                    }
+                } else {
+                    _readingDepth--;
+                    if (_reading == ReadingProperty) {
+                        _readingText += "</" + _reader.name().toString() + ">";
+                    }
+                }
+            }
+            continue;
+        }
+
+        QStringRef name = _reader.name();
         // Start elements with DAV:
-        if (type == QXmlStreamReader::StartElement && reader.namespaceUri() == QLatin1String("DAV:")) {
+        if (type == QXmlStreamReader::StartElement && _reader.namespaceUri() == QLatin1String("DAV:")) {
             if (name == QLatin1String("href")) {
-                // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
-                // but the result will have URL encoding..
-                QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(reader.readElementText().toUtf8()));
-                if (!hrefString.startsWith(expectedPath)) {
-                    qDebug() << "Invalid href" << hrefString << "expected starting with" << expectedPath;
-                    return false;
-                }
-                currentHref = hrefString;
+                startReading(ReadingHref);
+                continue;
             } else if (name == QLatin1String("response")) {
             } else if (name == QLatin1String("propstat")) {
-                insidePropstat = true;
-            } else if (name == QLatin1String("status") && insidePropstat) {
-                QString httpStatus = reader.readElementText();
-                if (httpStatus.startsWith("HTTP/1.1 200")) {
-                    currentPropsHaveHttp200 = true;
-                } else {
-                    currentPropsHaveHttp200 = false;
-                }
+                _insidePropstat = true;
+            } else if (name == QLatin1String("status") && _insidePropstat) {
+                startReading(ReadingStatus);
+                continue;
             } else if (name == QLatin1String("prop")) {
-                insideProp = true;
+                _insideProp = true;
                 continue;
             } else if (name == QLatin1String("multistatus")) {
-                insideMultiStatus = true;
+                _insideMultiStatus = true;
                 continue;
             }
         }
 
-        if (type == QXmlStreamReader::StartElement && insidePropstat && insideProp) {
+        if (type == QXmlStreamReader::StartElement && _insidePropstat && _insideProp) {
             // All those elements are properties
-            QString propertyContent = readContentsAsString(reader);
-            if (name == QLatin1String("resourcetype") && propertyContent.contains("collection")) {
-                folders.append(currentHref);
-            } else if (name == QLatin1String("size")) {
-                bool ok = false;
-                auto s = propertyContent.toLongLong(&ok);
-                if (ok && sizes) {
-                    sizes->insert(currentHref, s);
-                }
-            }
-            currentTmpProperties.insert(reader.name().toString(), propertyContent);
+            startReading(ReadingProperty);
+            continue;
         }
 
         // End elements with DAV:
         if (type == QXmlStreamReader::EndElement) {
-            if (reader.namespaceUri() == QLatin1String("DAV:")) {
-                if (reader.name() == "response") {
-                    if (currentHref.endsWith('/')) {
-                        currentHref.chop(1);
+            if (_reader.namespaceUri() == QLatin1String("DAV:")) {
+                if (name == "response") {
+                    if (_currentHref.endsWith('/')) {
+                        _currentHref.chop(1);
+                    }
+                    if (_entryHandler) {
+                        _entryHandler->listingEntry(_currentHref, _currentHttp200Values);
+                        for (int i = 0; i < LsColEntryHandler::PropertyCount; ++i) {
+                            _currentHttp200Values[i].clear();
+                        }
+                    } else {
+                        emit directoryListingIterated(_currentHref, _currentHttp200Properties);
+                        _currentHttp200Properties.clear();
                     }
-                    emit directoryListingIterated(currentHref, currentHttp200Properties);
-                    currentHref.clear();
-                    currentHttp200Properties.clear();
-                } else if (reader.name() == "propstat") {
-                    insidePropstat = false;
-                    if (currentPropsHaveHttp200) {
-                        currentHttp200Properties = QMap<QString,QString>(currentTmpProperties);
+                    _currentHref.clear();
+                } else if (name == "propstat") {
+                    _insidePropstat = false;
+                    if (_entryHandler) {
+                        for (int i = 0; i < LsColEntryHandler::PropertyCount; ++i) {
+                            if (_currentPropsHaveHttp200) {
+                                _currentHttp200Values[i] = _currentTmpValues[i];
+                            }
+                            _currentTmpValues[i].clear();
+                        }
+                    } else {
+                        if (_currentPropsHaveHttp200) {
+                            _currentHttp200Properties = QMap<QString,QString>(_currentTmpProperties);
+                        }
+                        _currentTmpProperties.clear();
                     }
-                    currentTmpProperties.clear();
-                    currentPropsHaveHttp200 = false;
-                } else if (reader.name() == "prop") {
-                    insideProp = false;
+                    _currentPropsHaveHttp200 = false;
+                } else if (name == "prop") {
+                    _insideProp = false;
                 }
             }
         }
     }
 
-    if (reader.hasError()) {
+    if (_reader.hasError() && _reader.error() != QXmlStreamReader::PrematureEndOfDocumentError) {
         // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
-        qDebug() << "ERROR" << reader.errorString() << xml;
-        return false;
-    } else if (!insideMultiStatus) {
-        qDebug() << "ERROR no WebDAV response?" << xml;
-        return false;
-    } else {
-        emit directoryListingSubfolders(folders);
-        emit finishedWithoutError();
+        qDebug() << "ERROR" << _reader.errorString();
+        _failed = true;
     }
-    return true;
-
 }
 
 /*********************************************************************************************/
 
 LsColJob::LsColJob(AccountPtr account, const QString &path, QObject *parent)
-    : AbstractNetworkJob(account, path, parent)
+    : AbstractNetworkJob(account, path, parent), _entryHandler(0)
 {
 }
 
 LsColJob::LsColJob(AccountPtr account, const QUrl &url, QObject *parent)
-    : AbstractNetworkJob(account, QString(), parent), _url(url)
+    : AbstractNetworkJob(account, QString(), parent), _url(url), _entryHandler(0)
 {
 }
 
@@ -326,29 +449,57 @@ void LsColJob::start()
     } else {
         sendRequest("PROPFIND", makeDavUrl(path()), req, buf);
     }
+    connect(reply(), SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
     AbstractNetworkJob::start();
 }
 
-// TODO: Instead of doing all in this slot, we should iteratively parse in readyRead(). This
-// would allow us to be more asynchronous in processing while data is coming from the network,
-// not all in one big blob at the end.
-bool LsColJob::finished()
+bool LsColJob::isListingReply() const
 {
     QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
     int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (httpCode == 207 && contentType.contains("application/xml; charset=utf-8")) {
-        LsColXMLParser parser;
-        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
-                 this, SIGNAL(directoryListingSubfolders(const QStringList&)) );
-        connect( &parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
-                 this, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)) );
-        connect( &parser, SIGNAL(finishedWithError(QNetworkReply *)),
-                 this, SIGNAL(finishedWithError(QNetworkReply *)) );
-        connect( &parser, SIGNAL(finishedWithoutError()),
-                 this, SIGNAL(finishedWithoutError()) );
-
-        QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
-        if( !parser.parse( reply()->readAll(), &_sizes, expectedPath ) ) {
+    return httpCode == 207 && contentType.contains("application/xml; charset=utf-8");
+}
+
+void LsColJob::startParser()
+{
+    _parser.reset(new LsColXMLParser);
+    connect( _parser.data(), SIGNAL(directoryListingSubfolders(const QStringList&)),
+             this, SIGNAL(directoryListingSubfolders(const QStringList&)) );
+    connect( _parser.data(), SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
+             this, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)) );
+    connect( _parser.data(), SIGNAL(finishedWithError(QNetworkReply *)),
+             this, SIGNAL(finishedWithError(QNetworkReply *)) );
+    connect( _parser.data(), SIGNAL(finishedWithoutError()),
+             this, SIGNAL(finishedWithoutError()) );
+
+    QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
+    _parser->begin(&_sizes, expectedPath);
+    _parser->setEntryHandler(_entryHandler);
+}
+
+// The entries are parsed and emitted while the reply arrives,
+// the body of a big listing never has to be in memory at once.
+void LsColJob::slotReadyRead()
+{
+    if (!_parser) {
+        if (!isListingReply()) {
+            return; // finished() handles it
+        }
+        startParser();
+    }
+    _parser->addData(reply()->readAll());
+}
+
+bool LsColJob::finished()
+{
+    int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (isListingReply()) {
+        if (!_parser) {
+            // No readyRead, or the reply of a redirected request
+            startParser();
+        }
+        _parser->addData(reply()->readAll());
+        if (!_parser->end()) {
             // XML parse error
             emit finishedWithError(reply());
         }
@@ -18,6 +18,9 @@
 
 #include "abstractnetworkjob.h"
 
+#include <QScopedPointer>
+#include <QXmlStreamReader>
+
 class QUrl;
 
 namespace OCC {
@@ -40,7 +43,46 @@ private slots:
 };
 
 /**
- * @brief The LsColJob class
+ * @brief Receives the entries of a listing, with the known properties already sorted out
+ *
+ * When set on the LsColJob, the parser does not build a QMap for each
+ * entry and does not emit directoryListingIterated.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT LsColEntryHandler {
+public:
+    enum Property {
+        ResourceType,
+        GetLastModified,
+        GetContentLength,
+        GetETag,
+        Id,
+        DownloadURL,
+        DDC,
+        Permissions,
+        Size,
+        DataFingerprint,
+        PropertyCount
+    };
+
+    virtual ~LsColEntryHandler() {}
+
+    /**
+     * Called for each response of the listing, the href is percent-decoded and
+     * without trailing slash. values has PropertyCount entries, a null string
+     * for each property the server did not return with a 200 status.
+     */
+    virtual void listingEntry(const QString &href, const QString *values) = 0;
+};
+
+/**
+ * @brief Parser for the multistatus reply of a PROPFIND
+ *
+ * The reply can be given at once with parse(), or as it arrives with
+ * begin(), addData() and end(). Every response is emitted as soon as
+ * it is complete, so only the unparsed part of the reply is kept.
+ *
  * @ingroup libsync
  */
 class OWNCLOUDSYNC_EXPORT LsColXMLParser : public QObject {
@@ -50,14 +92,57 @@ public:
 
     bool parse(const QByteArray &xml, QHash<QString, qint64> *sizes, const QString& expectedPath);
 
+    void begin(QHash<QString, qint64> *sizes, const QString &expectedPath);
+    void setEntryHandler(LsColEntryHandler *handler) { _entryHandler = handler; }
+    /** Parses what can be parsed, returns false on error. Data after an error is ignored */
+    bool addData(const QByteArray &data);
+    /** Checks the document is complete, and emits directoryListingSubfolders and finishedWithoutError if so */
+    bool end();
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString,QString> &properties);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
 
+private:
+    enum ReadingState { ReadingNothing, ReadingHref, ReadingStatus, ReadingProperty };
+
+    void readTokens();
+    void startReading(ReadingState state);
+    bool endReading();
+
+    QXmlStreamReader _reader;
+    QHash<QString, qint64> *_sizes;
+    LsColEntryHandler *_entryHandler;
+    QString _expectedPath;
+    bool _failed;
+
+    QStringList _folders;
+    QString _currentHref;
+    QMap<QString, QString> _currentTmpProperties;
+    QMap<QString, QString> _currentHttp200Properties;
+    bool _currentPropsHaveHttp200;
+    bool _insidePropstat;
+    bool _insideProp;
+    bool _insideMultiStatus;
+
+    // Instead of the maps when there is an entry handler, by LsColEntryHandler::Property
+    QString _currentTmpValues[LsColEntryHandler::PropertyCount];
+    QString _currentHttp200Values[LsColEntryHandler::PropertyCount];
+
+    // The text of the element being read can arrive in several pieces
+    ReadingState _reading;
+    QString _readingName;
+    int _readingProperty; // LsColEntryHandler::Property, -1 for the others
+    QString _readingText;
+    int _readingDepth;
 };
 
+/**
+ * @brief The LsColJob class
+ * @ingroup libsync
+ */
 class OWNCLOUDSYNC_EXPORT LsColJob : public AbstractNetworkJob {
     Q_OBJECT
 public:
@@ -77,6 +162,9 @@ public:
     void setProperties(QList<QByteArray> properties);
     QList<QByteArray> properties() const;
 
+    /** Hands the entries to handler instead of emitting directoryListingIterated */
+    void setEntryHandler(LsColEntryHandler *handler) { _entryHandler = handler; }
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString,QString> &properties);
@@ -85,10 +173,16 @@ signals:
 
 private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
+    void slotReadyRead();
 
 private:
+    bool isListingReply() const;
+    void startParser();
+
     QList<QByteArray> _properties;
     QUrl _url; // Used instead of path() if the url is specified in the constructor
+    LsColEntryHandler *_entryHandler;
+    QScopedPointer<LsColXMLParser> _parser; // Set once the reply is known to be a listing
 };
 
 /**
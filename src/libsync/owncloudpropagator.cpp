@@ -26,6 +26,7 @@
 #include "utility.h"
 #include "account.h"
 #include "asserts.h"
+#include "progressdispatcher.h"
 #include <json.h>
 
 #ifdef Q_OS_WIN
@@ -40,7 +41,6 @@
 #include <QObject>
 #include <QTimerEvent>
 #include <QDebug>
-#include <qmath.h>
 
 namespace OCC {
 
@@ -76,11 +76,9 @@ OwncloudPropagator::~OwncloudPropagator()
 
 int OwncloudPropagator::maximumActiveTransferJob()
 {
-    if (_downloadLimit.fetchAndAddAcquire(0) != 0 || _uploadLimit.fetchAndAddAcquire(0) != 0) {
-        // disable parallelism when there is a network limit.
-        return 1;
-    }
-    return qCeil(hardMaximumActiveJob()/2.);
+    // With a bandwidth limit, the BandwidthManager shares it between the transfers.
+    // More of them only make each one slower, and the controller backs off.
+    return _concurrencyController.concurrency();
 }
 
 /* The maximum number of active jobs in parallel  */
@@ -101,7 +99,25 @@ PropagateItemJob::~PropagateItemJob()
         // needed. But if a job has a bug or is deleted before the network jobs signal get received,
         // we might risk end up with dangling pointer in the list which may cause crashes.
         p->_activeJobList.removeAll(this);
+        if (_blocking) {
+            p->_blockingJobs--;
+        }
+    }
+}
+
+bool PropagateItemJob::scheduleSelfOrChild()
+{
+    if (_state != NotYetStarted) {
+        return false;
+    }
+    _state = Running;
+    _runningTime.start();
+    if (parallelism() == WaitForFinished) {
+        _blocking = true;
+        propagator()->_blockingJobs++;
     }
+    QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
+    return true;
 }
 
 static time_t getMinBlacklistTime()
@@ -216,6 +232,10 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
     _item->_status = statusArg;
 
     _state = Finished;
+    if (_blocking) {
+        _blocking = false;
+        propagator()->_blockingJobs--;
+    }
     if (_item->_isRestoration) {
         if( _item->_status == SyncFileItem::Success
                 || _item->_status == SyncFileItem::Conflict) {
@@ -261,6 +281,8 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
         break;
     }
 
+    reportToConcurrencyController();
+
     emit propagator()->itemCompleted(_item);
     emit finished(_item->_status);
 
@@ -270,6 +292,26 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
     }
 }
 
+void PropagateItemJob::reportToConcurrencyController()
+{
+    // Local operations say nothing about the network
+    const bool isTransfer = ProgressInfo::isSizeDependent(*_item);
+    if (!_runningTime.isValid() || (!isTransfer && _item->_direction != SyncFileItem::Up)) {
+        return;
+    }
+
+    auto &controller = propagator()->_concurrencyController;
+    const int code = _item->_httpErrorCode;
+    if (_item->_status == SyncFileItem::FatalError
+            || code == 500 || code == 502 || code == 503 || code == 504 || code == 429) {
+        // Timeouts, network errors and an overloaded server. Other errors,
+        // like 507 Insufficient Storage, do not go away with fewer transfers.
+        controller.jobFailed();
+    } else {
+        controller.jobFinished(isTransfer ? _item->_size : 0, _runningTime.elapsed());
+    }
+}
+
 /**
  * For delete or remove, check that we are not removing from a shared directory.
  * If we are, try to restore the file
@@ -399,18 +441,33 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
     /* This builds all the jobs needed for the propagation.
      * Each directory is a PropagateDirectory job, which contains the files in it.
      * In order to do that we loop over the items. (which are sorted by destination)
-     * When we enter a directory, we can create the directory job and push it on the stack. */
+     * When we enter a directory, we can create the directory job and push it on the stack.
+     *
+     * Since the contents of a directory directly follow it, everything is done in
+     * that single pass: no item is looked at more than a few times. */
 
     _rootJob.reset(new PropagateDirectory(this));
     QStack<QPair<QString /* directory name */, PropagateDirectory* /* job */> > directories;
     directories.push(qMakePair(QString(), _rootJob.data()));
+    // Appended as they are found, they go to the root job in the reverse order
     QVector<PropagatorJob*> directoriesToRemove;
     QString removedDirectory;
+    // The uploads into a directory that changed its type are skipped until that destination prefix
+    QString skippedUploadsPrefix;
     foreach(const SyncFileItemPtr &item, items) {
 
+        if (!skippedUploadsPrefix.isEmpty()) {
+            if (item->destination().startsWith(skippedUploadsPrefix)) {
+                item->_instruction = CSYNC_INSTRUCTION_NONE;
+                _anotherSyncNeeded = true;
+            } else {
+                skippedUploadsPrefix.clear();
+            }
+        }
+
         if (!removedDirectory.isEmpty() && item->_file.startsWith(removedDirectory)) {
             // this is an item in a directory which is going to be removed.
-            PropagateDirectory *delDirJob = qobject_cast<PropagateDirectory*>(directoriesToRemove.first());
+            PropagateDirectory *delDirJob = qobject_cast<PropagateDirectory*>(directoriesToRemove.last());
 
             if (item->_instruction == CSYNC_INSTRUCTION_REMOVE) {
                 // already taken care of. (by the removal of the parent directory)
@@ -454,18 +511,14 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
                 // checkForPermissions() has already run and used the permissions
                 // of the file we're about to delete to decide whether uploading
                 // to the new dir is ok...
-                foreach(const SyncFileItemPtr &item2, items) {
-                    if (item2->destination().startsWith(item->destination() + "/")) {
-                        item2->_instruction = CSYNC_INSTRUCTION_NONE;
-                        _anotherSyncNeeded = true;
-                    }
-                }
+                // They are the items that follow, see above.
+                skippedUploadsPrefix = item->destination() + "/";
             }
 
             if (item->_instruction == CSYNC_INSTRUCTION_REMOVE) {
                 // We do the removal of directories at the end, because there might be moves from
                 // these directories that will happen later.
-                directoriesToRemove.prepend(dir);
+                directoriesToRemove.append(dir);
                 removedDirectory = item->_file + "/";
 
                 // We should not update the etag of parent directories of the removed directory
@@ -484,7 +537,7 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
         } else {
             if (item->_instruction == CSYNC_INSTRUCTION_TYPE_CHANGE) {
                 // will delete directories, so defer execution
-                directoriesToRemove.prepend(createJob(item));
+                directoriesToRemove.append(createJob(item));
                 removedDirectory = item->_file + "/";
             } else {
                 directories.top().second->appendTask(item);
@@ -492,14 +545,16 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
         }
     }
 
-    foreach(PropagatorJob* it, directoriesToRemove) {
-        _rootJob->appendJob(it);
+    for (int i = directoriesToRemove.size() - 1; i >= 0; --i) {
+        _rootJob->appendJob(directoriesToRemove.at(i));
     }
 
     connect(_rootJob.data(), SIGNAL(finished(SyncFileItem::Status)), this, SLOT(emitFinished(SyncFileItem::Status)));
 
     qDebug() << "Using QNAM/HTTP parallel code path";
 
+    // Puts the root job on the ready queue
+    _rootJob->scheduleSelfOrChild();
     scheduleNextJob();
 }
 
@@ -534,19 +589,6 @@ int OwncloudPropagator::httpTimeout()
     return timeout;
 }
 
-quint64 OwncloudPropagator::chunkSize()
-{
-    static uint chunkSize;
-    if (!chunkSize) {
-        chunkSize = qgetenv("OWNCLOUD_CHUNK_SIZE").toUInt();
-        if (chunkSize == 0) {
-            ConfigFile cfg;
-            chunkSize = cfg.chunkSize();
-        }
-    }
-    return chunkSize;
-}
-
 
 bool OwncloudPropagator::localFileNameClash( const QString& relFile )
 {
@@ -643,33 +685,73 @@ void OwncloudPropagator::scheduleNextJob()
 
 void OwncloudPropagator::scheduleNextJobImpl()
 {
-    // TODO: If we see that the automatic up-scaling has a bad impact we
-    // need to check how to avoid this.
-    // Down-scaling on slow networks? https://github.com/owncloud/client/issues/3382
+    // The _concurrencyController scales maximumActiveTransferJob() up and down
     // Making sure we do up/down at same time? https://github.com/owncloud/client/issues/1633
 
+    if (_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    // Several jobs are started at once, but not more than there are free slots: the jobs
+    // only join the _activeJobList once they use the network, local jobs and uploads
+    // computing their checksum are not in it. The next ones are started in the next
+    // event loop iteration, when the limits are up to date.
+    // If the started jobs used all the slots, look again once they joined the list;
+    // with no slot free to begin with, the next finished job schedules again.
+    int freeSlots = hardMaximumActiveJob() - _activeJobList.count();
+    int started = 0;
+    while (freeSlots > 0 && _blockingJobs == 0 && mayStartJob()) {
+        if (!startReadyJob()) {
+            return;
+        }
+        freeSlots--;
+        started++;
+    }
+    if (started > 0 && freeSlots == 0) {
+        scheduleNextJob();
+    }
+}
+
+bool OwncloudPropagator::mayStartJob()
+{
     if (_activeJobList.count() < maximumActiveTransferJob()) {
-        if (_rootJob->scheduleSelfOrChild()) {
-            scheduleNextJob();
+        return true;
+    }
+    if (_activeJobList.count() >= hardMaximumActiveJob()) {
+        return false;
+    }
+
+    int likelyFinishedQuicklyCount = 0;
+    // NOTE: Only counts the first 3 jobs! Then for each
+    // one that is likely finished quickly, we can launch another one.
+    // When a job finishes another one will "move up" to be one of the first 3 and then
+    // be counted too.
+    for (int i = 0; i < maximumActiveTransferJob() && i < _activeJobList.count(); i++) {
+        if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
+            likelyFinishedQuicklyCount++;
         }
-    } else if (_activeJobList.count() < hardMaximumActiveJob()) {
-        int likelyFinishedQuicklyCount = 0;
-        // NOTE: Only counts the first 3 jobs! Then for each
-        // one that is likely finished quickly, we can launch another one.
-        // When a job finishes another one will "move up" to be one of the first 3 and then
-        // be counted too.
-        for (int i = 0; i < maximumActiveTransferJob() && i < _activeJobList.count(); i++) {
-            if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
-                likelyFinishedQuicklyCount++;
-            }
+    }
+    if (_activeJobList.count() < maximumActiveTransferJob() + likelyFinishedQuicklyCount) {
+        qDebug() <<  "Can pump in another request! activeJobs =" << _activeJobList.count();
+        return true;
+    }
+    return false;
+}
+
+bool OwncloudPropagator::startReadyJob()
+{
+    while (!_readyJobs.isEmpty()) {
+        PropagatorCompositeJob *job = _readyJobs.first();
+        if (!job || job->_state != PropagatorJob::Running || !job->hasJobsToStart()) {
+            _readyJobs.removeFirst();
+            continue;
         }
-        if (_activeJobList.count() < maximumActiveTransferJob() + likelyFinishedQuicklyCount) {
-            qDebug() <<  "Can pump in another request! activeJobs =" << _activeJobList.count();
-            if (_rootJob->scheduleSelfOrChild()) {
-                scheduleNextJob();
-            }
+        // A composite subjob goes in front of the queue, the loop continues with it
+        if (job->startNextJob()) {
+            return true;
         }
     }
+    return false;
 }
 
 void OwncloudPropagator::reportProgress(const SyncFileItem &item, quint64 bytes)
@@ -730,41 +812,31 @@ PropagatorJob::JobParallelism PropagatorCompositeJob::parallelism()
 
 bool PropagatorCompositeJob::scheduleSelfOrChild()
 {
-    if (_state == Finished) {
+    if (_state != NotYetStarted) {
         return false;
     }
+    _state = Running;
 
-    // Start the composite job
-    if (_state == NotYetStarted) {
-        _state = Running;
-    }
-
-    // Ask all the running composite jobs if they have something new to schedule.
-    for (int i = 0; i < _runningJobs.size(); ++i) {
-        ASSERT(_runningJobs.at(i)->_state == Running);
-
-        if (possiblyRunNextJob(_runningJobs.at(i))) {
-            return true;
-        }
-
-        // If any of the running sub jobs is not parallel, we have to cancel the scheduling
-        // of the rest of the list and wait for the blocking job to finish and schedule the next one.
-        auto paral = _runningJobs.at(i)->parallelism();
-        if (paral == WaitForFinished) {
-            return false;
-        }
+    if (hasJobsToStart()) {
+        propagator()->_readyJobs.prepend(this);
+    } else if (_runningJobs.isEmpty()) {
+        // Nothing to do. Our parent job may be in the middle of starting us, post to the
+        // event loop to avoid removing ourself from its list before it is done.
+        QMetaObject::invokeMethod(this, "finalize", Qt::QueuedConnection);
     }
+    return false;
+}
 
-    // Now it's our turn, check if we have something left to do.
+bool PropagatorCompositeJob::startNextJob()
+{
     if (!_jobsToDo.isEmpty()) {
-        PropagatorJob *nextJob = _jobsToDo.first();
-        _jobsToDo.remove(0);
+        PropagatorJob *nextJob = _jobsToDo.takeFirst();
         _runningJobs.append(nextJob);
-        return possiblyRunNextJob(nextJob);
+        connect(nextJob, SIGNAL(finished(SyncFileItem::Status)), this, SLOT(slotSubJobFinished(SyncFileItem::Status)));
+        return nextJob->scheduleSelfOrChild();
     }
     while (!_tasksToDo.isEmpty()) {
-        SyncFileItemPtr nextTask = _tasksToDo.first();
-        _tasksToDo.remove(0);
+        SyncFileItemPtr nextTask = _tasksToDo.takeFirst();
         PropagatorJob *job = propagator()->createJob(nextTask);
         if (!job) {
             qWarning() << "Useless task found for file" << nextTask->destination() << "instruction" << nextTask->_instruction;
@@ -772,14 +844,12 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
         }
 
         _runningJobs.append(job);
-        return possiblyRunNextJob(job);
+        connect(job, SIGNAL(finished(SyncFileItem::Status)), this, SLOT(slotSubJobFinished(SyncFileItem::Status)));
+        return job->scheduleSelfOrChild();
     }
 
-    // If neither us or our children had stuff left to do we could hang. Make sure
-    // we mark this job as finished so that the propagator can schedule a new one.
-    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
-        // Our parent jobs are already iterating over their running jobs, post to the event loop
-        // to avoid removing ourself from that list while they iterate.
+    // Only useless tasks were left
+    if (_runningJobs.isEmpty()) {
         QMetaObject::invokeMethod(this, "finalize", Qt::QueuedConnection);
     }
     return false;
@@ -858,25 +928,16 @@ PropagatorJob::JobParallelism PropagateDirectory::parallelism()
 
 bool PropagateDirectory::scheduleSelfOrChild()
 {
-    if (_state == Finished) {
+    if (_state != NotYetStarted) {
         return false;
     }
+    _state = Running;
 
-    if (_state == NotYetStarted) {
-        _state = Running;
-    }
-
-    if (_firstJob && _firstJob->_state == NotYetStarted) {
+    // The sub jobs only become ready once the first job is done
+    if (_firstJob) {
         return _firstJob->scheduleSelfOrChild();
     }
-
-    if (_firstJob && _firstJob->_state == Running) {
-        // Don't schedule any more job until this is done.
-        return false;
-    }
-
     return _subJobs.scheduleSelfOrChild();
-
 }
 
 void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
@@ -892,6 +953,7 @@ void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
         return;
     }
 
+    _subJobs.scheduleSelfOrChild();
     propagator()->scheduleNextJob();
 }
 
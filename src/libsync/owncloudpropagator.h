@@ -29,6 +29,8 @@
 #include "syncjournaldb.h"
 #include "bandwidthmanager.h"
 #include "accountfwd.h"
+#include "chunksizecontroller.h"
+#include "concurrencycontroller.h"
 
 namespace OCC {
 
@@ -95,7 +97,8 @@ public:
 public slots:
     virtual void abort() {}
 
-    /** Starts this job, or a new subjob
+    /** Starts this job. The composite jobs put themselves on the ready queue
+     * of the propagator, which starts their subjobs.
      * returns true if a job was started.
      */
     virtual bool scheduleSelfOrChild() = 0;
@@ -136,21 +139,20 @@ protected slots:
     void slotRestoreJobFinished(SyncFileItem::Status status);
 
 private:
+    /** Reports the duration and the outcome of the job to the ConcurrencyController */
+    void reportToConcurrencyController();
+
     QScopedPointer<PropagateItemJob> _restoreJob;
+    QElapsedTimer _runningTime;
+    // Whether it is counted in the _blockingJobs of the propagator
+    bool _blocking;
 
 public:
     PropagateItemJob(OwncloudPropagator* propagator, const SyncFileItemPtr &item)
-        : PropagatorJob(propagator), _item(item) {}
+        : PropagatorJob(propagator), _blocking(false), _item(item) {}
     ~PropagateItemJob();
 
-    bool scheduleSelfOrChild() Q_DECL_OVERRIDE {
-        if (_state != NotYetStarted) {
-            return false;
-        }
-        _state = Running;
-        QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
-        return true;
-    }
+    bool scheduleSelfOrChild() Q_DECL_OVERRIDE;
 
     SyncFileItemPtr  _item;
 
@@ -165,8 +167,9 @@ public slots:
 class PropagatorCompositeJob : public PropagatorJob {
     Q_OBJECT
 public:
-    QVector<PropagatorJob *> _jobsToDo;
-    SyncFileItemVector _tasksToDo;
+    // Lists, since the jobs are taken from the front
+    QList<PropagatorJob *> _jobsToDo;
+    QList<SyncFileItemPtr> _tasksToDo;
     QVector<PropagatorJob *> _runningJobs;
     SyncFileItem::Status _hasError;  // NoStatus,  or NormalError / SoftError if there was an error
 
@@ -196,14 +199,15 @@ public:
 
     qint64 committedDiskSpace() const Q_DECL_OVERRIDE;
 
-private slots:
-    bool possiblyRunNextJob(PropagatorJob *next) {
-        if (next->_state == NotYetStarted) {
-            connect(next, SIGNAL(finished(SyncFileItem::Status)), this, SLOT(slotSubJobFinished(SyncFileItem::Status)));
-        }
-        return next->scheduleSelfOrChild();
-    }
+    bool hasJobsToStart() const { return !_jobsToDo.isEmpty() || !_tasksToDo.isEmpty(); }
+
+    /** Starts the next subjob, the directories before the files.
+     * returns true if a job was started, false if there was none or if it is
+     * a composite job that went on the ready queue.
+     */
+    bool startNextJob();
 
+private slots:
     void slotSubJobFinished(SyncFileItem::Status status);
     void finalize();
 };
@@ -270,7 +274,7 @@ public:
     }
 };
 
-class OwncloudPropagator : public QObject {
+class OWNCLOUDSYNC_EXPORT OwncloudPropagator : public QObject {
     Q_OBJECT
 public:
     const QString _localDir; // absolute path to the local directory. ends with '/'
@@ -288,6 +292,9 @@ public:
             , _journal(progressDb)
             , _finishedEmited(false)
             , _bandwidthManager(this)
+            , _concurrencyController((hardMaximumActiveJob() + 1) / 2, 1, hardMaximumActiveJob())
+            , _minDeltaDownloadSize(0)
+            , _blockingJobs(0)
             , _anotherSyncNeeded(false)
             , _account(account)
     { }
@@ -302,6 +309,15 @@ public:
 
     QAtomicInt _abortRequested; // boolean set by the main thread to abort.
 
+    /* Decides the size of the upload chunks, set up by the SyncEngine */
+    ChunkSizeController _chunkSizeController;
+
+    /* Decides the number of parallel transfers */
+    ConcurrencyController _concurrencyController;
+
+    /* Downloads from this size try to fetch only the changed blocks, 0 disables it */
+    qint64 _minDeltaDownloadSize;
+
     /** The list of currently active jobs.
         This list contains the jobs that are currently using ressources and is used purely to
         know how many jobs there is currently running for the scheduler.
@@ -310,10 +326,20 @@ public:
      */
     QList<PropagateItemJob*> _activeJobList;
 
+    /** The composite jobs that have subjobs to start, in the order they are served.
+        A composite job is put in front when it starts, so that the directories are
+        propagated depth first like the items are sorted.
+     */
+    QList<QPointer<PropagatorCompositeJob> > _readyJobs;
+
+    /** The number of running jobs that are WaitForFinished: no job starts while there is one */
+    int _blockingJobs;
+
     /** We detected that another sync is required after this one */
     bool _anotherSyncNeeded;
 
-    /* the maximum number of jobs using bandwidth (uploads or downloads, in parallel) */
+    /* the maximum number of jobs using bandwidth (uploads or downloads, in parallel),
+       decided by the _concurrencyController */
     int maximumActiveTransferJob();
     /* The maximum number of active jobs in parallel  */
     int hardMaximumActiveJob();
@@ -356,7 +382,7 @@ public:
     static int httpTimeout();
 
     /** returns the size of chunks in bytes  */
-    static quint64 chunkSize();
+    quint64 chunkSize() const { return _chunkSizeController.chunkSize(); }
 
     AccountPtr account() const;
 
@@ -401,6 +427,10 @@ signals:
     void touchedFile(const QString &fileName);
 
 private:
+    /** Whether the limits on the active jobs allow another one */
+    bool mayStartJob();
+    /** Starts a job from the ready queue, returns false if there was none to start */
+    bool startReadyJob();
 
     AccountPtr _account;
     QScopedPointer<PropagateDirectory> _rootJob;
@@ -89,7 +89,7 @@ bool SqlDatabase::checkDb()
     return true;
 }
 
-bool SqlDatabase::openOrCreateReadWrite( const QString& filename )
+bool SqlDatabase::openOrCreateReadWrite( const QString& filename, bool checkIntegrity )
 {
     if( isOpen() ) {
         return true;
@@ -99,7 +99,7 @@ bool SqlDatabase::openOrCreateReadWrite( const QString& filename )
         return false;
     }
 
-    if( !checkDb() ) {
+    if( checkIntegrity && !checkDb() ) {
         // When disk space is low, checking the db may fail even though it's fine.
         qint64 freeSpace = Utility::freeDiskSpace(filename);
         if (freeSpace < 1000000) {
@@ -35,7 +35,9 @@ public:
     explicit SqlDatabase();
 
     bool isOpen();
-    bool openOrCreateReadWrite( const QString& filename );
+    /** Opens the database. Unless checkIntegrity is false, a database that fails
+     * PRAGMA quick_check is removed and created again. */
+    bool openOrCreateReadWrite( const QString& filename, bool checkIntegrity = true );
     bool openReadOnly( const QString& filename );
     bool transaction();
     bool commit();
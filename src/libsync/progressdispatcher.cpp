@@ -142,6 +142,7 @@ void ProgressInfo::reset()
 {
     _currentItems.clear();
     _currentDiscoveredFolder.clear();
+    _parallelTransfers = 0;
     _sizeProgress = Progress();
     _fileProgress = Progress();
     _totalSizeOfCompletedJobs = 0;
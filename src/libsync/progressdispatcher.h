@@ -154,6 +154,9 @@ public:
     // Used during local and remote update phase
     QString _currentDiscoveredFolder;
 
+    // The number of transfers the propagator may currently run in parallel
+    int _parallelTransfers;
+
     void setProgressComplete(const SyncFileItem &item);
 
     void setProgressItem(const SyncFileItem &item, quint64 completed);
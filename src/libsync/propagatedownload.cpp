@@ -15,6 +15,7 @@
 #include "config.h"
 #include "owncloudpropagator_p.h"
 #include "propagatedownload.h"
+#include "propagatedownloaddelta.h"
 #include "networkjobs.h"
 #include "account.h"
 #include "syncjournaldb.h"
@@ -68,7 +69,7 @@ GETFileJob::GETFileJob(AccountPtr account, const QString& path, QFile *device,
                     quint64 resumeStart,  QObject* parent)
 : AbstractNetworkJob(account, path, parent),
   _device(device), _headers(headers), _expectedEtagForResume(expectedEtagForResume)
-, _resumeStart(resumeStart) , _errorStatus(SyncFileItem::NoStatus)
+, _resumeStart(resumeStart), _rangeEnd(-1), _errorStatus(SyncFileItem::NoStatus)
 , _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
 , _hasEmittedFinishedSignal(false), _lastModified()
 {
@@ -80,7 +81,7 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl& url, QFile *device,
 
 : AbstractNetworkJob(account, url.toEncoded(), parent),
   _device(device), _headers(headers), _expectedEtagForResume(expectedEtagForResume)
-, _resumeStart(resumeStart), _errorStatus(SyncFileItem::NoStatus), _directDownloadUrl(url)
+, _resumeStart(resumeStart), _rangeEnd(-1), _errorStatus(SyncFileItem::NoStatus), _directDownloadUrl(url)
 , _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
 , _hasEmittedFinishedSignal(false), _lastModified()
 {
@@ -88,8 +89,11 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl& url, QFile *device,
 
 
 void GETFileJob::start() {
-    if (_resumeStart > 0) {
+    if (_resumeStart > 0 || _rangeEnd >= 0) {
         _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) +'-';
+        if (_rangeEnd >= 0) {
+            _headers["Range"] += QByteArray::number(_rangeEnd);
+        }
         _headers["Accept-Ranges"] = "bytes";
         qDebug() << "Retry with range " << _headers["Range"];
     }
@@ -171,6 +175,13 @@ void GETFileJob::slotMetaDataChanged()
             start = rx.cap(1).toULongLong();
         }
     }
+    if (_rangeEnd >= 0 && ranges.isEmpty()) {
+        qDebug() << Q_FUNC_INFO << "The server ignored the range" << _headers["Range"];
+        _errorString = tr("Server does not support partial downloads");
+        _errorStatus = SyncFileItem::NormalError;
+        reply()->abort();
+        return;
+    }
     if (start != _resumeStart) {
         qDebug() << Q_FUNC_INFO <<  "Wrong content-range: "<< ranges << " while expecting start was" << _resumeStart;
         if (ranges.isEmpty()) {
@@ -183,6 +194,9 @@ void GETFileJob::slotMetaDataChanged()
                 return;
             }
             _resumeStart = 0;
+            if (_checksumStream) {
+                _checksumStream->reset();
+            }
         } else {
             _errorString = tr("Server returned wrong content-range");
             _errorStatus = SyncFileItem::NormalError;
@@ -270,6 +284,9 @@ void GETFileJob::slotReadyRead()
                 reply()->abort();
                 return;
             }
+            if (_checksumStream) {
+                _checksumStream->addData(_device->pos() - w, buffer.constData(), w);
+            }
         }
     }
 
@@ -336,6 +353,7 @@ void PropagateDownloadFile::start()
 
     QString tmpFileName;
     QByteArray expectedEtagForResume;
+    _checksumStream.reset();
     const SyncJournalDb::DownloadInfo progressInfo = propagator()->_journal->getDownloadInfo(_item->_file);
     if (progressInfo._valid) {
         // if the etag has changed meanwhile, remove the already downloaded part.
@@ -386,22 +404,139 @@ void PropagateDownloadFile::start()
         return;
     }
 
+    _tmpFileName = tmpFileName;
+    _expectedEtagForResume = expectedEtagForResume;
+
+    if (_resumeStart == 0 && !_deltaDownload && deltaDownloadPossible()) {
+        // The temporary file is not written in order, it cannot be resumed. It is
+        // recorded without an etag, which never matches: the next start() removes
+        // it if this job could not, e.g. after a crash.
+        _tmpFile.close();
+        SyncJournalDb::DownloadInfo pi;
+        pi._tmpfile = _tmpFileName;
+        pi._valid = true;
+        propagator()->_journal->setDownloadInfo(_item->_file, pi);
+        propagator()->_journal->commit("delta download start");
+        propagator()->_activeJobList.append(this);
+        _deltaDownload = new DeltaDownload(propagator(), _item, _tmpFile.fileName(), this);
+        connect(_deltaDownload, SIGNAL(finished()), SLOT(slotDeltaDownloadFinished()));
+        connect(_deltaDownload, SIGNAL(progress(qint64)), SLOT(slotDeltaDownloadProgress(qint64)));
+        _deltaDownload->start();
+        return;
+    }
+
+    startFullDownload();
+}
+
+bool PropagateDownloadFile::deltaDownloadPossible() const
+{
+    const qint64 minSize = propagator()->_minDeltaDownloadSize;
+    if (minSize <= 0 || qint64(_item->_size) < minSize
+            || !_item->_directDownloadUrl.isEmpty()
+            || !propagator()->account()->capabilities().blockMapDownload()) {
+        return false;
+    }
+
+    // Only a file that is there already has blocks to reuse
+    if (_item->_instruction != CSYNC_INSTRUCTION_SYNC && _item->_instruction != CSYNC_INSTRUCTION_CONFLICT) {
+        return false;
+    }
+    const QFileInfo existingFile(propagator()->getFilePath(_item->_file));
+    return existingFile.isFile() && existingFile.size() > 0;
+}
+
+void PropagateDownloadFile::slotDeltaDownloadProgress(qint64 bytes)
+{
+    _downloadProgress = bytes;
+    propagator()->reportProgress(*_item, bytes);
+}
+
+void PropagateDownloadFile::slotDeltaDownloadFinished()
+{
+    propagator()->_activeJobList.removeOne(this);
+
+    if (_deltaDownload->result() == DeltaDownload::Done) {
+        // The checksum of the whole file was verified already
+        transmissionChecksumValidated(_deltaDownload->checksumType(), _deltaDownload->checksum());
+        return;
+    }
+
+    // Start again from an empty file
+    _downloadProgress = 0;
+    propagator()->reportProgress(*_item, 0);
+    if (!_tmpFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        done(SyncFileItem::NormalError, _tmpFile.errorString());
+        return;
+    }
+    startFullDownload();
+}
+
+void PropagateDownloadFile::startFullDownload()
+{
     {
         SyncJournalDb::DownloadInfo pi;
         pi._etag = _item->_etag;
-        pi._tmpfile = tmpFileName;
+        pi._tmpfile = _tmpFileName;
         pi._valid = true;
         propagator()->_journal->setDownloadInfo(_item->_file, pi);
         propagator()->_journal->commit("download file start");
     }
 
+    propagator()->_activeJobList.append(this);
+
+    if (streamingChecksumEnabled()) {
+        // Hash the content checksum and the checksum the server most likely sends
+        QList<QByteArray> types;
+        const QByteArray theContentChecksumType = contentChecksumType();
+        if (!theContentChecksumType.isEmpty()) {
+            types.append(theContentChecksumType);
+        }
+        const QByteArray serverChecksumType = propagator()->account()->capabilities().uploadChecksumType();
+        if (!serverChecksumType.isEmpty() && serverChecksumType != theContentChecksumType) {
+            types.append(serverChecksumType);
+        }
+        if (!types.isEmpty()) {
+            _checksumStream.reset(new ChecksumStream(types));
+        }
+    }
+
+    if (_checksumStream && _resumeStart > 0) {
+        // Hash the part that was downloaded before, the new data continues it
+        auto watcher = new QFutureWatcher<bool>(this);
+        connect(watcher, SIGNAL(finished()), SLOT(slotChecksumStreamSeeded()));
+        watcher->setFuture(ChecksumStream::addFromFileAsync(_checksumStream, _tmpFile.fileName(), _resumeStart));
+        return;
+    }
+
+    startGetJob();
+}
+
+void PropagateDownloadFile::slotChecksumStreamSeeded()
+{
+    auto watcher = static_cast<QFutureWatcher<bool> *>(sender());
+    watcher->deleteLater();
+
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0)) {
+        propagator()->_activeJobList.removeOne(this);
+        return;
+    }
+
+    if (!watcher->result()) {
+        // The validation reads the file again instead
+        _checksumStream.reset();
+    }
+    startGetJob();
+}
+
+void PropagateDownloadFile::startGetJob()
+{
     QMap<QByteArray, QByteArray> headers;
 
     if (_item->_directDownloadUrl.isEmpty()) {
         // Normal job, download from oC instance
         _job = new GETFileJob(propagator()->account(),
                             propagator()->_remoteFolder + _item->_file,
-                            &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
+                            &_tmpFile, headers, _expectedEtagForResume, _resumeStart, this);
     } else {
         // We were provided a direct URL, use that one
         qDebug() << Q_FUNC_INFO << "directDownloadUrl given for " << _item->_file << _item->_directDownloadUrl;
@@ -413,12 +548,12 @@ void PropagateDownloadFile::start()
         QUrl url = QUrl::fromUserInput(_item->_directDownloadUrl);
         _job = new GETFileJob(propagator()->account(),
                               url,
-                              &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
+                              &_tmpFile, headers, _expectedEtagForResume, _resumeStart, this);
     }
     _job->setBandwidthManager(&propagator()->_bandwidthManager);
+    _job->setChecksumStream(_checksumStream);
     connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotGetFinished()));
     connect(_job, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotDownloadProgress(qint64,qint64)));
-    propagator()->_activeJobList.append(this);
     _job->start();
 }
 
@@ -565,7 +700,15 @@ void PropagateDownloadFile::slotGetFinished()
     connect(validator, SIGNAL(validationFailed(QString)),
             SLOT(slotChecksumFail(QString)));
     auto checksumHeader = job->reply()->rawHeader(checkSumHeaderC);
-    validator->start(_tmpFile.fileName(), checksumHeader);
+    if (_checksumStream && _checksumStream->position() != _tmpFile.size()) {
+        qDebug() << "Streamed checksum does not cover the file" << _checksumStream->position() << _tmpFile.size();
+        _checksumStream.reset();
+    }
+    if (_checksumStream) {
+        validator->start(_tmpFile.fileName(), checksumHeader, *_checksumStream);
+    } else {
+        validator->start(_tmpFile.fileName(), checksumHeader);
+    }
 }
 
 void PropagateDownloadFile::slotChecksumFail( const QString& errMsg )
@@ -686,6 +829,14 @@ void PropagateDownloadFile::transmissionChecksumValidated(const QByteArray &chec
         return contentChecksumComputed(checksumType, checksum);
     }
 
+    // It was hashed while downloading
+    if (_checksumStream) {
+        const QByteArray streamed = _checksumStream->result(theContentChecksumType);
+        if (!streamed.isEmpty()) {
+            return contentChecksumComputed(theContentChecksumType, streamed);
+        }
+    }
+
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(theContentChecksumType);
@@ -837,10 +988,27 @@ void PropagateDownloadFile::slotDownloadProgress(qint64 received, qint64)
 }
 
 
+PropagateDownloadFile::~PropagateDownloadFile()
+{
+    // A delta download that failed after it was assembled, e.g. because the local
+    // file changed meanwhile, leaves its temporary file behind. The journal may be
+    // closed already, its record goes in the next start().
+    if (_deltaDownload && _deltaDownload->result() == DeltaDownload::Done && _tmpFile.exists()) {
+        _tmpFile.close();
+        FileSystem::remove(_tmpFile.fileName());
+    }
+}
+
 void PropagateDownloadFile::abort()
 {
     if (_job &&  _job->reply())
         _job->reply()->abort();
+    if (_deltaDownload && _deltaDownload->result() == DeltaDownload::Running) {
+        _deltaDownload->abort();
+        // The local blocks may still be copied into it, so the record stays
+        // for the next start()
+        FileSystem::remove(_tmpFile.fileName());
+    }
 }
 
 
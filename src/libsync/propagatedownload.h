@@ -21,6 +21,9 @@
 
 namespace OCC {
 
+class ChecksumStream;
+class DeltaDownload;
+
 /**
  * @brief The GETFileJob class
  * @ingroup libsync
@@ -32,6 +35,7 @@ class GETFileJob : public AbstractNetworkJob {
     QString _errorString;
     QByteArray _expectedEtagForResume;
     quint64 _resumeStart;
+    qint64 _rangeEnd;
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
@@ -41,6 +45,7 @@ class GETFileJob : public AbstractNetworkJob {
     QPointer<BandwidthManager> _bandwidthManager;
     bool _hasEmittedFinishedSignal;
     time_t _lastModified;
+    QSharedPointer<ChecksumStream> _checksumStream;
 public:
 
     // DOES NOT take ownership of the device.
@@ -58,6 +63,13 @@ public:
     }
 
     virtual void start() Q_DECL_OVERRIDE;
+
+    /**
+     * Only requests the bytes up to \a end (inclusive), from resumeStart().
+     * The server has to honor the range, else the job fails.
+     */
+    void setRangeEnd(qint64 end) { _rangeEnd = end; }
+
     virtual bool finished() Q_DECL_OVERRIDE {
 //         qDebug() << Q_FUNC_INFO << reply()->bytesAvailable() << _hasEmittedFinishedSignal;
         if (reply()->bytesAvailable()) {
@@ -75,6 +87,9 @@ public:
         }
     }
 
+    /** The data written to the device is also given to \a stream */
+    void setChecksumStream(const QSharedPointer<ChecksumStream> &stream) { _checksumStream = stream; }
+
     void setBandwidthManager(BandwidthManager *bwm);
     void setChoked(bool c);
     void setBandwidthLimited(bool b);
@@ -111,6 +126,7 @@ class PropagateDownloadFile : public PropagateItemJob {
 public:
     PropagateDownloadFile(OwncloudPropagator* propagator,const SyncFileItemPtr& item)
         : PropagateItemJob(propagator, item), _resumeStart(0), _downloadProgress(0), _deleteExisting(false) {}
+    ~PropagateDownloadFile();
     void start() Q_DECL_OVERRIDE;
     qint64 committedDiskSpace() const Q_DECL_OVERRIDE;
 
@@ -136,15 +152,30 @@ private slots:
     void downloadFinished();
     void slotDownloadProgress(qint64,qint64);
     void slotChecksumFail( const QString& errMsg );
+    void slotChecksumStreamSeeded();
+    void slotDeltaDownloadFinished();
+    void slotDeltaDownloadProgress(qint64 bytes);
 
 private:
     void deleteExistingFolder();
+    /** Whether only the changed blocks of the file can be fetched, see DeltaDownload */
+    bool deltaDownloadPossible() const;
+    void startFullDownload();
+    void startGetJob();
 
     quint64 _resumeStart;
     qint64 _downloadProgress;
     QPointer<GETFileJob> _job;
     QFile _tmpFile;
     bool _deleteExisting;
+    QString _tmpFileName;
+    QByteArray _expectedEtagForResume;
+
+    /// Hashes the data as it is downloaded, null if streamingChecksumEnabled() is false
+    QSharedPointer<ChecksumStream> _checksumStream;
+
+    /// Set once the changed blocks were fetched, or were tried to
+    QPointer<DeltaDownload> _deltaDownload;
 
     QElapsedTimer _stopwatch;
 };
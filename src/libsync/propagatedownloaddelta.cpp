@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "config.h"
+#include "propagatedownloaddelta.h"
+#include "owncloudpropagator_p.h"
+#include "propagatedownload.h"
+#include "account.h"
+#include "checksums.h"
+#include "filesystem.h"
+#include "asserts.h"
+
+#include <json.h>
+#include <qtconcurrentrun.h>
+#include <QCryptographicHash>
+#include <QDebug>
+
+namespace OCC {
+
+// The block size comes from the server, it is only trusted within these bounds
+static const qint64 minBlockSize = 4 * 1024;
+static const qint64 maxBlockSize = 64 * 1024 * 1024;
+
+// The files are read and copied in pieces of that size, whatever the block size
+static const qint64 copyBufferSize = 64 * 1024;
+
+bool BlockMap::isValid() const
+{
+    return _blockSize >= minBlockSize && _blockSize <= maxBlockSize && _size >= 0
+        && _blocks.size() == (_size + _blockSize - 1) / _blockSize;
+}
+
+BlockMap BlockMap::fromJson(const QByteArray &json)
+{
+    BlockMap map;
+    bool ok = false;
+    QVariantMap obj = QtJson::parse(QString::fromUtf8(json), ok).toMap();
+    if (!ok) {
+        qDebug() << "Invalid block map" << json.left(200);
+        return map;
+    }
+    map._size = obj["size"].toLongLong();
+    map._blockSize = obj["blockSize"].toLongLong();
+    map._checksumHeader = obj["checksum"].toByteArray();
+    foreach (const QVariant &block, obj["blocks"].toList()) {
+        map._blocks.append(block.toByteArray());
+    }
+    return map;
+}
+
+BlockMap BlockMap::fromFile(const QString &filePath, qint64 blockSize)
+{
+    BlockMap map;
+    QFile file(filePath);
+    if (blockSize < minBlockSize || blockSize > maxBlockSize
+            || !file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        return map;
+    }
+    FileSystem::adviseSequentialRead(&file);
+
+    map._size = file.size();
+    map._blockSize = blockSize;
+    char buf[copyBufferSize];
+    for (qint64 pos = 0; pos < map._size; pos += blockSize) {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        for (qint64 left = qMin(blockSize, map._size - pos); left > 0;) {
+            const qint64 len = qMin(copyBufferSize, left);
+            if (file.read(buf, len) != len) {
+                qDebug() << "Could not read" << filePath << file.errorString();
+                return BlockMap();
+            }
+            hash.addData(buf, static_cast<int>(len));
+            left -= len;
+        }
+        map._blocks.append(hash.result().toHex());
+    }
+    return map;
+}
+
+GetBlockMapJob::GetBlockMapJob(AccountPtr account, const QString &path, QObject *parent)
+    : AbstractNetworkJob(account, path, parent)
+{
+}
+
+void GetBlockMapJob::start()
+{
+    QNetworkRequest req;
+    QUrl url = makeDavUrl(path());
+    QList<QPair<QString, QString> > params;
+    params << qMakePair(QString::fromLatin1("blockmap"), QString::fromLatin1("1"));
+    url.setQueryItems(params);
+    sendRequest("GET", url, req);
+    AbstractNetworkJob::start();
+}
+
+bool GetBlockMapJob::finished()
+{
+    if (reply()->error() == QNetworkReply::NoError
+            && reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200) {
+        _etag = getEtagFromReply(reply());
+        _blockMap = BlockMap::fromJson(reply()->readAll());
+    } else {
+        qDebug() << "No block map for" << path() << reply()->errorString();
+    }
+    emit finishedSignal();
+    return true;
+}
+
+DeltaDownload::DeltaDownload(OwncloudPropagator *propagator, const SyncFileItemPtr &item,
+                             const QString &tmpFileName, QObject *parent)
+    : QObject(parent)
+    , _propagator(propagator)
+    , _item(item)
+    , _tmpFileName(tmpFileName)
+    , _result(Running)
+    , _bytesInPlace(0)
+    , _fetchedBytes(0)
+{
+}
+
+void DeltaDownload::start()
+{
+    auto job = new GetBlockMapJob(_propagator->account(), _propagator->_remoteFolder + _item->_file, this);
+    connect(job, SIGNAL(finishedSignal()), SLOT(slotBlockMapReceived()));
+    _job = job;
+    job->start();
+}
+
+void DeltaDownload::abort()
+{
+    if (_job && _job->reply()) {
+        _job->reply()->abort();
+    }
+    _tmpFile.close();
+}
+
+void DeltaDownload::fail(const QString &reason)
+{
+    qDebug() << "Downloading the whole file" << _item->_file << "-" << reason;
+    _tmpFile.close();
+    _result = Unavailable;
+    emit finished();
+}
+
+void DeltaDownload::slotBlockMapReceived()
+{
+    auto job = qobject_cast<GetBlockMapJob *>(sender());
+    ASSERT(job);
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    _remote = job->blockMap();
+    if (!_remote.isValid()) {
+        return fail(QLatin1String("no valid block map"));
+    }
+    // Without it, the assembled file could not be verified
+    if (_remote._checksumHeader.isEmpty()) {
+        return fail(QLatin1String("no checksum in the block map"));
+    }
+    if (job->etag() != _item->_etag || quint64(_remote._size) != _item->_size) {
+        return fail(QLatin1String("the file changed since the discovery"));
+    }
+
+    connect(&_copyWatcher, SIGNAL(finished()), SLOT(slotLocalBlocksCopied()), Qt::UniqueConnection);
+    const QString localPath = _propagator->getFilePath(_item->_file);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    _copyWatcher.setFuture(QtConcurrent::run(checksumThreadPool(), copyLocalBlocks, localPath, _tmpFileName, _remote));
+#else
+    _copyWatcher.setFuture(QtConcurrent::run(copyLocalBlocks, localPath, _tmpFileName, _remote));
+#endif
+}
+
+DeltaDownload::CopyResult DeltaDownload::copyLocalBlocks(const QString &localPath, const QString &tmpPath,
+                                                         const BlockMap &remote)
+{
+    CopyResult result;
+    const BlockMap local = BlockMap::fromFile(localPath, remote._blockSize);
+    if (!local.isValid()) {
+        return result;
+    }
+
+    // Where each block can be found in the local file, the length is part of the key
+    // since the last block may be shorter
+    QHash<QByteArray, int> localBlocks;
+    for (int j = local._blocks.size() - 1; j >= 0; --j) {
+        localBlocks.insert(local._blocks[j] + ':' + QByteArray::number(local.blockLength(j)), j);
+    }
+
+    QFile source(localPath);
+    QFile target(tmpPath);
+    if (!source.open(QIODevice::ReadOnly | QIODevice::Unbuffered)
+            || !target.open(QIODevice::ReadWrite | QIODevice::Unbuffered)
+            || !target.resize(0)) {
+        qDebug() << "Could not open" << localPath << source.errorString() << tmpPath << target.errorString();
+        return result;
+    }
+    FileSystem::adviseSequentialRead(&source);
+
+    char buf[copyBufferSize];
+    for (int i = 0; i < remote._blocks.size(); ++i) {
+        const qint64 start = i * remote._blockSize;
+        const qint64 len = remote.blockLength(i);
+
+        // The same block at the same place is the most likely
+        int j = -1;
+        if (i < local._blocks.size() && local._blocks[i] == remote._blocks[i] && local.blockLength(i) == len) {
+            j = i;
+        } else {
+            j = localBlocks.value(remote._blocks[i] + ':' + QByteArray::number(len), -1);
+        }
+
+        if (j < 0) {
+            if (!result._missing.isEmpty() && result._missing.last().second == start) {
+                result._missing.last().second = start + len;
+            } else {
+                result._missing.append(qMakePair(start, start + len));
+            }
+            continue;
+        }
+
+        if (!source.seek(j * remote._blockSize) || !target.seek(start)) {
+            qDebug() << "Could not seek to block" << j << "or" << i << source.errorString() << target.errorString();
+            return result;
+        }
+        for (qint64 left = len; left > 0;) {
+            const qint64 chunk = qMin(copyBufferSize, left);
+            if (source.read(buf, chunk) != chunk || target.write(buf, chunk) != chunk) {
+                qDebug() << "Could not copy block" << j << "to" << i << source.errorString() << target.errorString();
+                return result;
+            }
+            left -= chunk;
+        }
+    }
+    if (!target.resize(remote._size)) {
+        return result;
+    }
+    result._ok = true;
+    return result;
+}
+
+void DeltaDownload::slotLocalBlocksCopied()
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    const CopyResult copied = _copyWatcher.result();
+    if (!copied._ok) {
+        return fail(QLatin1String("the local blocks could not be copied"));
+    }
+    _ranges = copied._missing;
+
+    _bytesInPlace = _remote._size;
+    foreach (const auto &range, _ranges) {
+        _bytesInPlace -= range.second - range.first;
+    }
+    qDebug() << "Delta download of" << _item->_file << ":" << _ranges.size() << "ranges,"
+             << _remote._size - _bytesInPlace << "of" << _remote._size << "bytes to fetch";
+    emit progress(_bytesInPlace);
+
+    _tmpFile.setFileName(_tmpFileName);
+    if (!_tmpFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        return fail(_tmpFile.errorString());
+    }
+    fetchNextRange();
+}
+
+void DeltaDownload::fetchNextRange()
+{
+    if (_ranges.isEmpty()) {
+        _tmpFile.close();
+        auto validator = new ValidateChecksumHeader(this);
+        connect(validator, SIGNAL(validated(QByteArray,QByteArray)),
+                SLOT(slotValidated(QByteArray,QByteArray)));
+        connect(validator, SIGNAL(validationFailed(QString)),
+                SLOT(slotValidationFailed(QString)));
+        validator->start(_tmpFileName, _remote._checksumHeader);
+        return;
+    }
+
+    const QPair<qint64, qint64> range = _ranges.first();
+    if (!_tmpFile.seek(range.first)) {
+        return fail(_tmpFile.errorString());
+    }
+    auto job = new GETFileJob(_propagator->account(), _propagator->_remoteFolder + _item->_file,
+                              &_tmpFile, QMap<QByteArray, QByteArray>(), _item->_etag, range.first, this);
+    job->setRangeEnd(range.second - 1);
+    job->setBandwidthManager(&_propagator->_bandwidthManager);
+    connect(job, SIGNAL(finishedSignal()), SLOT(slotRangeFinished()));
+    connect(job, SIGNAL(downloadProgress(qint64,qint64)), SLOT(slotRangeProgress(qint64,qint64)));
+    _job = job;
+    job->start();
+}
+
+void DeltaDownload::slotRangeProgress(qint64 received, qint64)
+{
+    emit progress(_bytesInPlace + received);
+}
+
+void DeltaDownload::slotRangeFinished()
+{
+    auto job = qobject_cast<GETFileJob *>(sender());
+    ASSERT(job);
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    const QPair<qint64, qint64> range = _ranges.takeFirst();
+    if (job->reply()->error() != QNetworkReply::NoError) {
+        return fail(job->errorString());
+    }
+    if (_tmpFile.pos() != range.second) {
+        return fail(QString::fromLatin1("range %1-%2 ended at %3").arg(range.first).arg(range.second).arg(_tmpFile.pos()));
+    }
+    _fetchedBytes += range.second - range.first;
+    _bytesInPlace += range.second - range.first;
+    emit progress(_bytesInPlace);
+    fetchNextRange();
+}
+
+void DeltaDownload::slotValidated(const QByteArray &checksumType, const QByteArray &checksum)
+{
+    qDebug() << "Delta download of" << _item->_file << "fetched" << _fetchedBytes << "of" << _remote._size << "bytes";
+    _checksumType = checksumType;
+    _checksum = checksum;
+    _result = Done;
+    emit finished();
+}
+
+void DeltaDownload::slotValidationFailed(const QString &errMsg)
+{
+    fail(errMsg);
+}
+
+}
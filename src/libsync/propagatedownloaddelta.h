@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "owncloudpropagator.h"
+#include "abstractnetworkjob.h"
+
+#include <QFile>
+#include <QFutureWatcher>
+#include <QPair>
+#include <QVector>
+
+namespace OCC {
+
+/**
+ * @brief The SHA1 checksums of the blocks of a file
+ *
+ * Block i covers the bytes from i * blockSize, the last block may be shorter.
+ *
+ * The server gives it as JSON:
+ * \code
+ * { "size": 20971521, "blockSize": 1048576, "checksum": "SHA1:...",
+ *   "blocks": [ "<sha1 of block 0>", ... ] }
+ * \endcode
+ * where checksum is the checksum header of the whole file.
+ *
+ * @ingroup libsync
+ */
+struct OWNCLOUDSYNC_EXPORT BlockMap
+{
+    BlockMap() : _size(0), _blockSize(0) {}
+
+    qint64 _size;
+    qint64 _blockSize;
+    QVector<QByteArray> _blocks;
+    QByteArray _checksumHeader;
+
+    /** Whether the block size is sane and the blocks cover the size */
+    bool isValid() const;
+
+    qint64 blockLength(int block) const { return qMin(_blockSize, _size - block * _blockSize); }
+
+    static BlockMap fromJson(const QByteArray &json);
+
+    /** Computes the map of a local file. Invalid if the file could not be read */
+    static BlockMap fromFile(const QString &filePath, qint64 blockSize);
+};
+
+/**
+ * @brief Gets the BlockMap of a file from the server
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT GetBlockMapJob : public AbstractNetworkJob {
+    Q_OBJECT
+public:
+    explicit GetBlockMapJob(AccountPtr account, const QString &path, QObject *parent = 0);
+    void start() Q_DECL_OVERRIDE;
+
+    /** Invalid if the server did not give one */
+    const BlockMap &blockMap() const { return _blockMap; }
+    QByteArray etag() const { return _etag; }
+
+signals:
+    void finishedSignal();
+
+private slots:
+    bool finished() Q_DECL_OVERRIDE;
+
+private:
+    BlockMap _blockMap;
+    QByteArray _etag;
+};
+
+/**
+ * @brief Downloads a file by fetching only the blocks the local file does not have
+ *
+ * The blocks of the server's BlockMap that are found in the local file,
+ * at any block boundary, are copied from it. The other ones are fetched
+ * with range requests, one range of consecutive blocks at a time. The
+ * result is verified with the checksum of the whole file.
+ *
+ * When that fails for any reason, result() is Unavailable and the file has
+ * to be downloaded completely.
+ *
+ * @ingroup libsync
+ */
+class DeltaDownload : public QObject {
+    Q_OBJECT
+public:
+    enum Result {
+        Running,
+        Done,
+        Unavailable
+    };
+
+    DeltaDownload(OwncloudPropagator *propagator, const SyncFileItemPtr &item,
+                  const QString &tmpFileName, QObject *parent = 0);
+
+    void start();
+    void abort();
+
+    Result result() const { return _result; }
+
+    /** The checksum that verified the file, once it is Done */
+    QByteArray checksumType() const { return _checksumType; }
+    QByteArray checksum() const { return _checksum; }
+
+    /** Number of bytes fetched from the server */
+    qint64 fetchedBytes() const { return _fetchedBytes; }
+
+signals:
+    void finished();
+    /** Bytes of the file that are in place */
+    void progress(qint64 bytes);
+
+private slots:
+    void slotBlockMapReceived();
+    void slotLocalBlocksCopied();
+    void slotRangeFinished();
+    void slotRangeProgress(qint64 received, qint64);
+    void slotValidated(const QByteArray &checksumType, const QByteArray &checksum);
+    void slotValidationFailed(const QString &errMsg);
+
+private:
+    struct CopyResult {
+        CopyResult() : _ok(false) {}
+        bool _ok;
+        /// The ranges (start, end exclusive) that were not in the local file
+        QVector<QPair<qint64, qint64> > _missing;
+    };
+    static CopyResult copyLocalBlocks(const QString &localPath, const QString &tmpPath, const BlockMap &remote);
+
+    void fetchNextRange();
+    void fail(const QString &reason);
+
+    OwncloudPropagator *_propagator;
+    SyncFileItemPtr _item;
+    QString _tmpFileName;
+    QFile _tmpFile;
+    BlockMap _remote;
+    QFutureWatcher<CopyResult> _copyWatcher;
+    QVector<QPair<qint64, qint64> > _ranges;
+    QPointer<AbstractNetworkJob> _job;
+    Result _result;
+    qint64 _bytesInPlace;
+    qint64 _fetchedBytes;
+    QByteArray _checksumType;
+    QByteArray _checksum;
+};
+
+}
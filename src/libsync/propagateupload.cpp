@@ -68,6 +68,7 @@ PUTFileJob::~PUTFileJob()
 }
 
 void PUTFileJob::start() {
+    _requestTimer.start();
     QNetworkRequest req;
     for(QMap<QByteArray, QByteArray>::const_iterator it = _headers.begin(); it != _headers.end(); ++it) {
         req.setRawHeader(it.key(), it.value());
@@ -246,6 +247,14 @@ void PropagateUploadFileCommon::slotComputeContentChecksum()
         return;
     }
 
+    // A resumed upload does not send the start of the file again, so it can't be hashed on the way
+    const SyncJournalDb::UploadInfo progressInfo = propagator()->_journal->getUploadInfo(_item->_file);
+    if (streamingChecksumEnabled()
+            && !(progressInfo._valid && Utility::qDateTimeToTime_t(progressInfo._modtime) == _item->_modtime)) {
+        startChecksumStream(checksumType);
+        return;
+    }
+
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(checksumType);
@@ -257,6 +266,32 @@ void PropagateUploadFileCommon::slotComputeContentChecksum()
     computeChecksum->start(filePath);
 }
 
+void PropagateUploadFileCommon::startChecksumStream(const QByteArray& contentChecksumType)
+{
+    // Reuse the content checksum as the transmission checksum if possible
+    const auto capabilities = propagator()->account()->capabilities();
+    QByteArray transmissionChecksumType = contentChecksumType;
+    if (!capabilities.supportedChecksumTypes().contains(contentChecksumType)) {
+        transmissionChecksumType = uploadChecksumEnabled() ? capabilities.uploadChecksumType() : QByteArray();
+    }
+
+    QList<QByteArray> types;
+    if (!contentChecksumType.isEmpty()) {
+        types.append(contentChecksumType);
+    }
+    if (!transmissionChecksumType.isEmpty() && transmissionChecksumType != contentChecksumType) {
+        types.append(transmissionChecksumType);
+    }
+    if (!types.isEmpty()) {
+        _checksumStream.reset(new ChecksumStream(types));
+    }
+
+    // The values are set by slotStreamedChecksumsComputed()
+    _item->_contentChecksumType = contentChecksumType;
+    _item->_contentChecksum.clear();
+    slotStartUpload(transmissionChecksumType, QByteArray());
+}
+
 void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray& contentChecksumType, const QByteArray& contentChecksum)
 {
     _item->_contentChecksum = contentChecksum;
@@ -343,7 +378,8 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray& transmissionCh
 }
 
 UploadDevice::UploadDevice(BandwidthManager *bwm)
-    : _read(0),
+    : _start(0), _size(0), _read(0),
+      _fileSize(0), _fileModTime(0),
       _bandwidthManager(bwm),
       _bandwidthQuota(0),
       _readWithProgress(0),
@@ -361,27 +397,29 @@ UploadDevice::~UploadDevice() {
 
 bool UploadDevice::prepareAndOpen(const QString& fileName, qint64 start, qint64 size)
 {
-    _data.clear();
+    _file.close();
+    _file.setFileName(fileName);
     _read = 0;
 
-    QFile file(fileName);
     QString openError;
-    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, start)) {
+    if (!FileSystem::openAndSeekFileSharedRead(&_file, &openError, start)) {
         setErrorString(openError);
         return false;
     }
 
-    size = qBound(0ll, size, FileSystem::getSize(fileName) - start);
-    _data.resize(size);
-    auto read = file.read(_data.data(), size);
-    if (read != size) {
-        setErrorString(file.errorString());
-        return false;
-    }
+    _fileSize = _file.size();
+    _fileModTime = FileSystem::getModTime(fileName);
+    _start = start;
+    _size = qBound(0ll, size, _fileSize - start);
 
     return QIODevice::open(QIODevice::ReadOnly);
 }
 
+bool UploadDevice::fileChanged() const
+{
+    return _file.size() != _fileSize
+        || FileSystem::getModTime(_file.fileName()) != _fileModTime;
+}
 
 qint64 UploadDevice::writeData(const char* , qint64 ) {
     ASSERT(false, "write to read only device");
@@ -390,14 +428,14 @@ qint64 UploadDevice::writeData(const char* , qint64 ) {
 
 qint64 UploadDevice::readData(char* data, qint64 maxlen) {
     //qDebug() << Q_FUNC_INFO << maxlen << _read << _size << _bandwidthQuota;
-    if (_data.size() - _read <= 0) {
+    if (_size - _read <= 0) {
         // at end
         if (_bandwidthManager) {
             _bandwidthManager->unregisterUploadDevice(this);
         }
         return -1;
     }
-    maxlen = qMin(maxlen, _data.size() - _read);
+    maxlen = qMin(maxlen, _size - _read);
     if (maxlen == 0) {
         return 0;
     }
@@ -412,8 +450,28 @@ qint64 UploadDevice::readData(char* data, qint64 maxlen) {
         }
         _bandwidthQuota -= maxlen;
     }
-    std::memcpy(data, _data.data()+_read, maxlen);
+
+    // Only after a seek() the file is not where we left it
+    if (_file.pos() != _start + _read && !_file.seek(_start + _read)) {
+        setErrorString(_file.errorString());
+        return -1;
+    }
+    if (_file.read(data, maxlen) != maxlen) {
+        // The file got shorter since it was opened
+        setErrorString(tr("Local file changed during sync."));
+        return -1;
+    }
+    if (_checksumStream) {
+        _checksumStream->addData(_start + _read, data, maxlen);
+    }
     _read += maxlen;
+
+    // Fail before handing out the last bytes, so the server does not get a mix of two versions
+    if (_read == _size && fileChanged()) {
+        qDebug() << Q_FUNC_INFO << _file.fileName() << "changed while it was uploaded";
+        setErrorString(tr("Local file changed during sync."));
+        return -1;
+    }
     return maxlen;
 }
 
@@ -427,19 +485,19 @@ void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
 }
 
 bool UploadDevice::atEnd() const {
-    return _read >= _data.size();
+    return _read >= _size;
 }
 
 qint64 UploadDevice::size() const{
 //    qDebug() << this << Q_FUNC_INFO << _size;
-    return _data.size();
+    return _size;
 }
 
 qint64 UploadDevice::bytesAvailable() const
 {
 //    qDebug() << this << Q_FUNC_INFO << _size << _read << QIODevice::bytesAvailable()
 //             <<   _size - _read + QIODevice::bytesAvailable();
-    return _data.size() - _read + QIODevice::bytesAvailable();
+    return _size - _read + QIODevice::bytesAvailable();
 }
 
 // random access, we can seek
@@ -451,7 +509,7 @@ bool UploadDevice::seek ( qint64 pos ) {
     if (! QIODevice::seek(pos)) {
         return false;
     }
-    if (pos < 0 || pos > _data.size()) {
+    if (pos < 0 || pos > _size) {
         return false;
     }
     _read = pos;
@@ -508,6 +566,123 @@ void PropagateUploadFileCommon::slotPollFinished()
     finalize();
 }
 
+void PropagateUploadFileCommon::updateChunkSize(PUTFileJob *job, QNetworkReply::NetworkError err)
+{
+    if (err == QNetworkReply::NoError) {
+        propagator()->_chunkSizeController.chunkUploaded(job->device()->size(), job->msSinceStart());
+    } else if (job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 0
+               && !propagator()->_abortRequested.fetchAndAddRelaxed(0)
+               && FileSystem::verifyFileUnchanged(propagator()->getFilePath(_item->_file),
+                                                  _item->_size, _item->_modtime)) {
+        // No reply from the server: a timeout or a network problem. Unless the
+        // upload stopped because the file changed, see abortIfFileChanged()
+        propagator()->_chunkSizeController.chunkFailed();
+    }
+}
+
+void PropagateUploadFileCommon::catchUpChecksumStream(qint64 end)
+{
+    if (!_checksumStream) {
+        startNextChunk();
+        return;
+    }
+    // The data was read recently by the uploads, it is still in the cache
+    foreach (auto *job, _jobs) {
+        if (auto putJob = qobject_cast<PUTFileJob *>(job)) {
+            end = qMin(end, static_cast<UploadDevice *>(putJob->device())->filePosition());
+        }
+    }
+    if (end <= _checksumStream->position()) {
+        startNextChunk();
+        return;
+    }
+    _checksumThreads++;
+    auto watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, SIGNAL(finished()), SLOT(slotChecksumStreamCaughtUp()));
+    watcher->setFuture(ChecksumStream::addFromFileAsync(_checksumStream,
+                                                        propagator()->getFilePath(_item->_file), end));
+}
+
+void PropagateUploadFileCommon::slotChecksumStreamCaughtUp()
+{
+    auto watcher = static_cast<QFutureWatcher<bool> *>(sender());
+    watcher->deleteLater();
+    _checksumThreads--;
+
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0) || _state == Finished) {
+        return;
+    }
+    if (!watcher->result()) {
+        abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return;
+    }
+    startNextChunk();
+}
+
+bool PropagateUploadFileCommon::abortIfFileChanged()
+{
+    const QString fullFilePath = propagator()->getFilePath(_item->_file);
+    if (FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        return false;
+    }
+    propagator()->_anotherSyncNeeded = true;
+    abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+    return true;
+}
+
+bool PropagateUploadFileCommon::computeStreamedChecksums()
+{
+    if (!_checksumStream) {
+        return false;
+    }
+    // A catch up or this computation is running already, it calls
+    // startNextChunk() again when it is done
+    if (_checksumThreads > 0) {
+        return true;
+    }
+    ASSERT(_jobs.isEmpty());
+    _checksumThreads++;
+    propagator()->_activeJobList.append(this);
+    auto watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, SIGNAL(finished()), SLOT(slotStreamedChecksumsComputed()));
+    watcher->setFuture(ChecksumStream::addFromFileAsync(_checksumStream,
+                                                        propagator()->getFilePath(_item->_file), _item->_size));
+    return true;
+}
+
+void PropagateUploadFileCommon::slotStreamedChecksumsComputed()
+{
+    auto watcher = static_cast<QFutureWatcher<bool> *>(sender());
+    watcher->deleteLater();
+    _checksumThreads--;
+    propagator()->_activeJobList.removeOne(this);
+
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    // The checksums are only right if the file did not change while it was read
+    const QString fullFilePath = propagator()->getFilePath(_item->_file);
+    if (!watcher->result() || !FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        propagator()->_anotherSyncNeeded = true;
+        abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return;
+    }
+
+    // A type the stream did not know gives no checksum, like ComputeChecksum
+    _transmissionChecksum = _checksumStream->result(_transmissionChecksumType);
+    if (_transmissionChecksum.isEmpty()) {
+        _transmissionChecksumType.clear();
+    }
+    _item->_contentChecksum = _checksumStream->result(_item->_contentChecksumType);
+    if (_item->_contentChecksum.isEmpty()) {
+        _item->_contentChecksumType.clear();
+    }
+    _checksumStream.reset();
+
+    startNextChunk();
+}
+
 void PropagateUploadFileCommon::checkResettingErrors()
 {
     if (_item->_httpErrorCode == 412
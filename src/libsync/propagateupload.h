@@ -19,10 +19,12 @@
 #include <QBuffer>
 #include <QFile>
 #include <QDebug>
+#include <QSharedPointer>
 
 
 namespace OCC {
 class BandwidthManager;
+class ChecksumStream;
 
 /**
  * @brief The UploadDevice class
@@ -34,9 +36,20 @@ public:
     UploadDevice(BandwidthManager *bwm);
     ~UploadDevice();
 
-    /** Reads the data from the file and opens the device */
+    /**
+     * Opens the file and the device for the given range of the file.
+     *
+     * Nothing is read yet: readData() reads the file in the pieces QNAM asks
+     * for, so the memory used does not depend on the chunk size.
+     */
     bool prepareAndOpen(const QString& fileName, qint64 start, qint64 size);
 
+    /** The data read is also given to the stream, to compute the checksums of the file */
+    void setChecksumStream(const QSharedPointer<ChecksumStream> &stream) { _checksumStream = stream; }
+
+    /** The position in the file up to which the data was read */
+    qint64 filePosition() const { return _start + _read; }
+
     qint64 writeData(const char* , qint64 ) Q_DECL_OVERRIDE;
     qint64 readData(char* data, qint64 maxlen) Q_DECL_OVERRIDE;
     bool atEnd() const Q_DECL_OVERRIDE;
@@ -62,10 +75,20 @@ signals:
 
 private:
 
-    // The file data
-    QByteArray _data;
-    // Position in the data
+    /** Whether the file was modified since prepareAndOpen() */
+    bool fileChanged() const;
+
+    // The file, read at _start + _read
+    QFile _file;
+    // The range of the file that is uploaded
+    qint64 _start;
+    qint64 _size;
+    // Position in the range
     qint64 _read;
+    // Size and modification time of the file when it was opened
+    qint64 _fileSize;
+    time_t _fileModTime;
+    QSharedPointer<ChecksumStream> _checksumStream;
 
     // Bandwidth manager related
     QPointer<BandwidthManager> _bandwidthManager;
@@ -90,6 +113,7 @@ private:
     QMap<QByteArray, QByteArray> _headers;
     QString _errorString;
     QUrl _url;
+    QElapsedTimer _requestTimer;
 
 public:
     // Takes ownership of the device
@@ -110,8 +134,13 @@ public:
 
     int _chunk;
 
+    QIODevice *device() const { return _device; }
+
     virtual void start() Q_DECL_OVERRIDE;
 
+    /** Time since the request was sent */
+    qint64 msSinceStart() const { return _requestTimer.elapsed(); }
+
     virtual bool finished() Q_DECL_OVERRIDE {
         emit finishedSignal();
         return true;
@@ -174,12 +203,18 @@ signals:
  *   +---> start()  --> (delete job) -------+
  *   |                                      |
  *   +--> slotComputeContentChecksum()  <---+
- *                   |
- *                   v
- *    slotComputeTransmissionChecksum()
+ *                   |                \
+ *                   v                 startChecksumStream() (new upload)
+ *    slotComputeTransmissionChecksum()    |
+ *         |                               |
+ *         v                               |
+ *    slotStartUpload()  <-----------------+
  *         |
  *         v
- *    slotStartUpload()  -> doStartUpload()
+ *    doStartUpload()
+ *         .
+ *         .  computeStreamedChecksums() before the checksum header is needed
+ *         .
  *                                  .
  *                                  .
  *                                  v
@@ -201,10 +236,14 @@ protected:
     QByteArray _transmissionChecksum;
     QByteArray _transmissionChecksumType;
 
+    /// Computes the checksums while the file is uploaded, null if they were computed up front
+    QSharedPointer<ChecksumStream> _checksumStream;
+    /// Number of threads that hash the file for the _checksumStream
+    int _checksumThreads;
 
 public:
     PropagateUploadFileCommon(OwncloudPropagator* propagator,const SyncFileItemPtr& item)
-        : PropagateItemJob(propagator, item), _finished(false), _deleteExisting(false) {}
+        : PropagateItemJob(propagator, item), _finished(false), _deleteExisting(false), _checksumThreads(0) {}
 
     /**
      * Whether an existing entity with the same name may be deleted before
@@ -224,6 +263,9 @@ private slots:
     void slotComputeTransmissionChecksum(const QByteArray& contentChecksumType, const QByteArray& contentChecksum);
     // transmission checksum computed, prepare the upload
     void slotStartUpload(const QByteArray& transmissionChecksumType, const QByteArray& transmissionChecksum);
+private:
+    // A new upload: the checksums are computed from the data that is sent
+    void startChecksumStream(const QByteArray& contentChecksumType);
 public:
     virtual void doStartUpload() = 0;
 
@@ -237,6 +279,8 @@ public slots:
 
 private slots:
     void slotPollFinished();
+    void slotStreamedChecksumsComputed();
+    void slotChecksumStreamCaughtUp();
 
 protected:
     /**
@@ -246,6 +290,31 @@ protected:
      */
     void checkResettingErrors();
 
+    /** Lets the chunk size of the next uploads follow how this PUT went */
+    void updateChunkSize(PUTFileJob *job, QNetworkReply::NetworkError err);
+
+    /**
+     * Hashes the part of the file before end that the running uploads have read already,
+     * so they continue the checksums, in a thread. Then calls startNextChunk(), or fails
+     * the upload if the file could not be read.
+     */
+    void catchUpChecksumStream(qint64 end);
+
+    /**
+     * Fails the upload softly if the file changed since the discovery. The
+     * UploadDevice stops reading such a file, the reply then only has a
+     * network error without HTTP status.
+     */
+    bool abortIfFileChanged();
+
+    /**
+     * With a checksum stream, hashes the rest of the file in a thread, sets the checksums
+     * and calls startNextChunk() again. Returns false if the checksums are known already.
+     */
+    bool computeStreamedChecksums();
+
+    virtual void startNextChunk() = 0;
+
     // Bases headers that need to be sent with every chunk
     QMap<QByteArray, QByteArray> headers();
 
@@ -275,18 +344,19 @@ private:
     int _currentChunk;
     int _chunkCount; /// Total number of chunks for this file
     int _transferId; /// transfer id (part of the url)
+    quint64 _chunkSize; /// All the chunks of a transfer have the same size, except the last one
 
-    quint64 chunkSize() const { return propagator()->chunkSize(); }
+    quint64 chunkSize() const { return _chunkSize; }
 
 
 public:
     PropagateUploadFileV1(OwncloudPropagator* propagator,const SyncFileItemPtr& item) :
-        PropagateUploadFileCommon(propagator,item) {}
+        PropagateUploadFileCommon(propagator,item), _chunkSize(0) {}
 
     void doStartUpload() Q_DECL_OVERRIDE;
 
 private slots:
-    void startNextChunk();
+    void startNextChunk() Q_DECL_OVERRIDE;
     void slotPutFinished();
     void slotUploadProgress(qint64,qint64);
 };
@@ -300,7 +370,7 @@ private slots:
 class PropagateUploadFileNG : public PropagateUploadFileCommon {
     Q_OBJECT
 private:
-    quint64 _sent; /// amount of data (bytes) that was already sent
+    quint64 _sent; /// amount of data (bytes) that was already sent, or is being sent
     uint _transferId; /// transfer id (part of the url)
     int _currentChunk; /// Id of the next chunk that will be sent
     bool _removeJobError; /// If not null, there was an error removing the job
@@ -324,7 +394,9 @@ public:
     void doStartUpload() Q_DECL_OVERRIDE;
 private:
     void startNewUpload();
-    void startNextChunk();
+    void startNextChunk() Q_DECL_OVERRIDE;
+    /** Whether several chunks of the file may be uploaded at the same time */
+    bool parallelChunkUpload();
 private slots:
     void slotPropfindFinished();
     void slotPropfindFinishedWithError();
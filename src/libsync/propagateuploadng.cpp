@@ -75,6 +75,9 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
     |
     +-> MOVE ------> moveJobFinished() ---> finalize()
 
+  Several chunks may be uploaded at the same time, see parallelChunkUpload().
+  The MOVE is only sent once none of them is running anymore.
+
 
  */
 
@@ -275,7 +278,14 @@ void PropagateUploadFileNG::startNextChunk()
     quint64 currentChunkSize = qMin(chunkSize(), fileSize - _sent);
 
     if (currentChunkSize == 0) {
-        ASSERT(_jobs.isEmpty());
+        if (!_jobs.isEmpty()) {
+            // The last one of the chunks still being uploaded sends the MOVE
+            return;
+        }
+        // The MOVE carries the checksum of the whole file
+        if (computeStreamedChecksums()) {
+            return;
+        }
         _finished = true;
         // Finish with a MOVE
         QString destination = QDir::cleanPath(propagator()->account()->url().path() + QLatin1Char('/')
@@ -303,6 +313,7 @@ void PropagateUploadFileNG::startNextChunk()
     }
 
     auto device = new UploadDevice(&propagator()->_bandwidthManager);
+    device->setChecksumStream(_checksumStream);
     const QString fileName = propagator()->getFilePath(_item->_file);
 
     if (! device->prepareAndOpen(fileName, _sent, currentChunkSize)) {
@@ -337,8 +348,26 @@ void PropagateUploadFileNG::startNextChunk()
     propagator()->_activeJobList.append(this);
     _currentChunk++;
 
-    // FIXME! parallel chunk?
+    // The server assembles the chunks by their number, so they can be uploaded in any order.
+    // If the upload is interrupted, the resume keeps the chunks before the first missing one.
+    if (_sent < fileSize && parallelChunkUpload()
+            && propagator()->_activeJobList.count() < propagator()->maximumActiveTransferJob()) {
+        startNextChunk();
+    }
+}
 
+bool PropagateUploadFileNG::parallelChunkUpload()
+{
+    if (propagator()->account()->capabilities().chunkingParallelUploadDisabled()) {
+        return false;
+    }
+    // The BandwidthManager shares a limit between the running uploads: more
+    // chunks of the same file would not make it faster
+    if (propagator()->_uploadLimit.fetchAndAddAcquire(0) != 0) {
+        return false;
+    }
+    static QByteArray env = qgetenv("OWNCLOUD_PARALLEL_CHUNK");
+    return env.isEmpty() || (env != "false" && env != "0");
 }
 
 void PropagateUploadFileNG::slotPutFinished()
@@ -362,6 +391,8 @@ void PropagateUploadFileNG::slotPutFinished()
     }
 
     QNetworkReply::NetworkError err = job->reply()->error();
+    // Each chunk is cut with the size of the moment, the server does not mind
+    updateChunkSize(job, err);
 
 #if QT_VERSION < QT_VERSION_CHECK(5, 4, 2)
     if (err == QNetworkReply::OperationCanceledError && job->reply()->property("owncloud-should-soft-cancel").isValid()) {
@@ -376,6 +407,9 @@ void PropagateUploadFileNG::slotPutFinished()
 
     if (err != QNetworkReply::NoError) {
         _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (_item->_httpErrorCode == 0 && abortIfFileChanged()) {
+            return;
+        }
         QByteArray replyContent = job->reply()->readAll();
         qDebug() << replyContent; // display the XML error in the debug
         QString errorString = errorMessage(job->errorString(), replyContent);
@@ -394,7 +428,8 @@ void PropagateUploadFileNG::slotPutFinished()
     }
 
     ENFORCE(_sent <= _item->_size, "can't send more than size");
-    bool finished = _sent == _item->_size;
+    // Other chunks may still be on their way
+    bool finished = _sent == _item->_size && _jobs.isEmpty();
 
     // Check if the file still exists
     const QString fullFilePath(propagator()->getFilePath(_item->_file));
@@ -428,6 +463,9 @@ void PropagateUploadFileNG::slotPutFinished()
         uploadInfo._errorCount = 0;
         propagator()->_journal->setUploadInfo(_item->_file, uploadInfo);
         propagator()->_journal->commit("Upload info");
+
+        catchUpChecksumStream(_sent);
+        return;
     }
     startNextChunk();
 }
@@ -507,7 +545,16 @@ void PropagateUploadFileNG::slotUploadProgress(qint64 sent, qint64 total)
     if (sent == 0 && total == 0) {
         return;
     }
-    propagator()->reportProgress(*_item, _sent + sent - total);
+
+    // _sent includes all of the chunks that are still being uploaded
+    sender()->setProperty("byteWritten", sent);
+    quint64 amount = _sent;
+    foreach (AbstractNetworkJob *job, _jobs) {
+        if (auto putJob = qobject_cast<PUTFileJob *>(job)) {
+            amount -= putJob->device()->size() - putJob->property("byteWritten").toLongLong();
+        }
+    }
+    propagator()->reportProgress(*_item, amount);
 }
 
 }
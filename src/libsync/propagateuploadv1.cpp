@@ -37,7 +37,7 @@
 namespace OCC {
 void PropagateUploadFileV1::doStartUpload()
 {
-    _chunkCount = std::ceil(_item->_size / double(chunkSize()));
+    _chunkSize = propagator()->chunkSize();
     _startChunk = 0;
     _transferId = qrand() ^ _item->_modtime ^ (_item->_size << 16);
 
@@ -46,8 +46,13 @@ void PropagateUploadFileV1::doStartUpload()
     if (progressInfo._valid && Utility::qDateTimeToTime_t(progressInfo._modtime) == _item->_modtime ) {
         _startChunk = progressInfo._chunk;
         _transferId = progressInfo._transferid;
+        // The chunk size may have changed since, resume with the one the chunks were cut with
+        if (progressInfo._size > 0) {
+            _chunkSize = progressInfo._size;
+        }
         qDebug() << Q_FUNC_INFO << _item->_file << ": Resuming from chunk " << _startChunk;
     }
+    _chunkCount = std::ceil(_item->_size / double(chunkSize()));
 
     _currentChunk = 0;
 
@@ -75,7 +80,6 @@ void PropagateUploadFileV1::startNextChunk()
 
     QString path = _item->_file;
 
-    UploadDevice *device = new UploadDevice(&propagator()->_bandwidthManager);
     qint64 chunkStart = 0;
     qint64 currentChunkSize = fileSize;
     bool isFinalChunk = false;
@@ -103,12 +107,19 @@ void PropagateUploadFileV1::startNextChunk()
     }
     qDebug() << _chunkCount << isFinalChunk << chunkStart << currentChunkSize;
 
+    // The checksum header goes with the last chunk, it has to be hashed before it is sent
+    if (isFinalChunk && computeStreamedChecksums()) {
+        return;
+    }
+
     if (isFinalChunk && !_transmissionChecksumType.isEmpty()) {
         headers[checkSumHeaderC] = makeChecksumHeader(
                 _transmissionChecksumType, _transmissionChecksum);
     }
 
     const QString fileName = propagator()->getFilePath(_item->_file);
+    UploadDevice *device = new UploadDevice(&propagator()->_bandwidthManager);
+    device->setChecksumStream(_checksumStream);
     if (! device->prepareAndOpen(fileName, chunkStart, currentChunkSize)) {
         qDebug() << "ERR: Could not prepare upload device: " << device->errorString();
 
@@ -190,6 +201,7 @@ void PropagateUploadFileV1::slotPutFinished()
     }
 
     QNetworkReply::NetworkError err = job->reply()->error();
+    updateChunkSize(job, err);
 
 #if QT_VERSION < QT_VERSION_CHECK(5, 4, 2)
     if (err == QNetworkReply::OperationCanceledError && job->reply()->property("owncloud-should-soft-cancel").isValid()) {        // Abort the job and try again later.
@@ -203,6 +215,9 @@ void PropagateUploadFileV1::slotPutFinished()
 
     if (err != QNetworkReply::NoError) {
         _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (_item->_httpErrorCode == 0 && abortIfFileChanged()) {
+            return;
+        }
         if(checkForProblemsWithShared(_item->_httpErrorCode,
             tr("The file was edited locally but is part of a read only share. "
                "It is restored and your edit is in the conflict file."))) {
@@ -310,11 +325,13 @@ void PropagateUploadFileV1::slotPutFinished()
         }
         pi._chunk = (currentChunk + _startChunk + 1) % _chunkCount ; // next chunk to start with
         pi._transferid = _transferId;
+        pi._size = _chunkSize;
         pi._modtime =  Utility::qDateTimeFromTime_t(_item->_modtime);
         pi._errorCount = 0; // successful chunk upload resets
         propagator()->_journal->setUploadInfo(_item->_file, pi);
         propagator()->_journal->commit("Upload info");
-        startNextChunk();
+
+        catchUpChecksumStream(qMin(_item->_size, chunkSize() * quint64(_currentChunk)));
         return;
     }
 
@@ -22,6 +22,7 @@
 #include "creds/abstractcredentials.h"
 #include "syncfilestatus.h"
 #include "csync_private.h"
+#include "csync_statedb.h"
 #include "filesystem.h"
 #include "propagateremotedelete.h"
 #include "asserts.h"
@@ -73,6 +74,7 @@ SyncEngine::SyncEngine(AccountPtr account, const QString& localPath,
   , _backInTimeFiles(0)
   , _uploadLimit(0)
   , _downloadLimit(0)
+  , _localDiscoveryFromJournal(false)
   , _checksum_hook(journal)
   , _anotherSyncNeeded(NoFollowUpSync)
 {
@@ -91,13 +93,17 @@ SyncEngine::SyncEngine(AccountPtr account, const QString& localPath,
     const QString dbFile = _journal->databaseFilePath();
     csync_init(_csync_ctx, dbFile.toUtf8().data());
 
-    _excludedFiles.reset(new ExcludedFiles(&_csync_ctx->excludes));
+    _excludedFiles.reset(new ExcludedFiles(&_csync_ctx->excludes, &_csync_ctx->exclude_matcher));
     _syncFileStatusTracker.reset(new SyncFileStatusTracker(this));
 
     _clearTouchedFilesTimer.setSingleShot(true);
     _clearTouchedFilesTimer.setInterval(30*1000);
     connect(&_clearTouchedFilesTimer, SIGNAL(timeout()), SLOT(slotClearTouchedFiles()));
 
+    // The journal may be closed by any thread
+    connect(_journal, SIGNAL(connectionAboutToClose()),
+            SLOT(slotJournalConnectionAboutToClose()), Qt::DirectConnection);
+
     _thread.setObjectName("SyncEngine_Thread");
 }
 
@@ -110,6 +116,21 @@ SyncEngine::~SyncEngine()
     csync_destroy(_csync_ctx);
 }
 
+void SyncEngine::lockJournal(void *journal)
+{
+    static_cast<SyncJournalDb *>(journal)->lockConnection();
+}
+
+void SyncEngine::unlockJournal(void *journal)
+{
+    static_cast<SyncJournalDb *>(journal)->unlockConnection();
+}
+
+void SyncEngine::slotJournalConnectionAboutToClose()
+{
+    csync_statedb_release_connection(_csync_ctx);
+}
+
 //Convert an error code from csync to a user readable string.
 // Keep that function thread safe as it can be called from the sync thread or the main thread
 QString SyncEngine::csyncErrorToString(CSYNC_STATUS err)
@@ -344,7 +365,7 @@ int SyncEngine::treewalkRemote( TREE_WALK_FILE* file, void *data )
  * Called on each entry in the local and remote trees by
  * csync_walk_local_tree()/csync_walk_remote_tree().
  *
- * It merges the two csync rbtrees into a single map of SyncFileItems.
+ * It merges the two csync trees into a single map of SyncFileItems.
  *
  * See doc/dev/sync-algorithm.md for an overview.
  */
@@ -784,10 +805,21 @@ void SyncEngine::startSync()
 
     _csync_ctx->read_remote_from_db = true;
 
+    // The environment variable wins over the sync options, the benchmarks use it.
+    static int envDiscoveryThreads = qgetenv("OWNCLOUD_LOCAL_DISCOVERY_THREADS").toInt();
+    _csync_ctx->local_discovery_threads = envDiscoveryThreads > 0 ? envDiscoveryThreads : _syncOptions._localDiscoveryThreads;
+    static QByteArray envJournalIndex = qgetenv("OWNCLOUD_JOURNAL_INDEX");
+    _csync_ctx->statedb_in_memory_index = envJournalIndex.isEmpty() ? _syncOptions._inMemoryJournalIndex : envJournalIndex != "0";
+
     // This tells csync to never read from the DB if it is empty
     // thereby speeding up the initial discovery significantly.
     _csync_ctx->db_is_empty = (fileRecordCount == 0);
 
+    // csync reads the journal through the journal's own connection instead of
+    // opening a second one: discovery, reconcile and propagation share one page cache.
+    csync_statedb_borrow_connection(_csync_ctx, _journal->sqliteConnection(),
+                                    lockJournal, unlockJournal, _journal);
+
     bool ok;
     auto selectiveSyncBlackList = _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &ok);
     if (ok) {
@@ -837,6 +869,12 @@ void SyncEngine::startSync()
         return;
     }
 
+    discoveryJob->_localDiscoveryFromJournal = _localDiscoveryFromJournal;
+    discoveryJob->_localDiscoveryPaths = _localDiscoveryPaths.toList();
+    if (_localDiscoveryFromJournal) {
+        qDebug() << "Local discovery limited to" << _localDiscoveryPaths.size() << "changed paths";
+    }
+
     discoveryJob->_syncOptions = _syncOptions;
     discoveryJob->moveToThread(&_thread);
     connect(discoveryJob, SIGNAL(finished(int)), this, SLOT(slotDiscoveryJobFinished(int)));
@@ -850,6 +888,9 @@ void SyncEngine::startSync()
     // This is used for the DiscoveryJob to be able to request the main thread/
     // to read in directory contents.
     _discoveryMainThread->setupHooks( discoveryJob, _remotePath);
+    static QByteArray envRemoteDiscoveryJobs = qgetenv("OWNCLOUD_REMOTE_DISCOVERY_JOBS");
+    _discoveryMainThread->setPrefetchOptions(_journal, envRemoteDiscoveryJobs.isEmpty()
+            ? _syncOptions._remoteDiscoveryJobs : envRemoteDiscoveryJobs.toInt());
 
     // Starts the update in a seperate thread
     QMetaObject::invokeMethod(discoveryJob, "start", Qt::QueuedConnection);
@@ -898,7 +939,7 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     _backInTimeFiles = 0;
     bool walkOk = true;
     _remotePerms.clear();
-    _remotePerms.reserve(c_rbtree_size(_csync_ctx->remote.tree));
+    _remotePerms.reserve(c_hashindex_size(_csync_ctx->remote.tree));
     _seenFiles.clear();
     _temporarilyUnavailablePaths.clear();
     _renamedFolders.clear();
@@ -1004,6 +1045,21 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
 
     _propagator = QSharedPointer<OwncloudPropagator>(
         new OwncloudPropagator (_account, _localPath, _remotePath, _journal));
+    static quint64 envChunkSize = qgetenv("OWNCLOUD_CHUNK_SIZE").toULongLong();
+    if (envChunkSize > 0) {
+        // A fixed chunk size was asked for
+        _propagator->_chunkSizeController = ChunkSizeController(envChunkSize);
+    } else {
+        _propagator->_chunkSizeController = ChunkSizeController(_syncOptions._initialChunkSize,
+            _syncOptions._minChunkSize, _syncOptions._maxChunkSize, _syncOptions._targetChunkUploadDuration);
+    }
+    _propagator->_minDeltaDownloadSize = _syncOptions._minDeltaDownloadSize;
+    static int envParallelTransfers = qgetenv("OWNCLOUD_PARALLEL_TRANSFERS").toInt();
+    if (envParallelTransfers > 0) {
+        // A fixed number of parallel transfers was asked for
+        _propagator->_concurrencyController = ConcurrencyController(envParallelTransfers,
+            envParallelTransfers, envParallelTransfers);
+    }
     connect(_propagator.data(), SIGNAL(itemCompleted(const SyncFileItemPtr &)),
             this, SLOT(slotItemCompleted(const SyncFileItemPtr &)));
     connect(_propagator.data(), SIGNAL(progress(const SyncFileItem &,quint64)),
@@ -1024,9 +1080,17 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     if (_needsUpdate)
         emit(started());
 
+    qDebug() << "<<#### Post-Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Post-Reconcile Finished"));
+
+    // The records of the completed items are written by a background thread
+    static bool envNoJournalWriteBehind = qgetenv("OWNCLOUD_JOURNAL_WRITE_BEHIND") == "0";
+    if (!envNoJournalWriteBehind) {
+        _journal->startWriteBehind();
+    }
+
     _propagator->start(syncItems);
 
-    qDebug() << "<<#### Post-Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Post-Reconcile Finished"));
+    qDebug() << "<<#### Propagation plan end ############################################# " << _stopWatch.addLapTime(QLatin1String("Propagation Plan Finished"));
 }
 
 void SyncEngine::slotCleanPollsJobAborted(const QString &error)
@@ -1035,6 +1099,12 @@ void SyncEngine::slotCleanPollsJobAborted(const QString &error)
     finalize(false);
 }
 
+void SyncEngine::setLocalDiscoveryOptions(bool fromJournal, const QSet<QString> &paths)
+{
+    _localDiscoveryFromJournal = fromJournal;
+    _localDiscoveryPaths = paths;
+}
+
 void SyncEngine::setNetworkLimits(int upload, int download)
 {
     _uploadLimit = upload;
@@ -1067,6 +1137,7 @@ void SyncEngine::slotItemCompleted(const SyncFileItemPtr &item)
     qDebug() << Q_FUNC_INFO << item->_file << instruction_str << item->_status << item->_errorString;
 
     _progressInfo->setProgressComplete(*item);
+    _progressInfo->_parallelTransfers = _propagator->maximumActiveTransferJob();
 
     if (item->_status == SyncFileItem::FatalError) {
         emit csyncError(item->_errorString);
@@ -1082,6 +1153,12 @@ void SyncEngine::slotFinished(bool success)
         _anotherSyncNeeded = ImmediateFollowUp;
     }
 
+    // The sync only succeeded once its records are in the database
+    if (!_journal->finishWriteBehind()) {
+        emit csyncError(tr("Error writing metadata to the database"));
+        success = false;
+    }
+
     if (success) {
         _journal->setDataFingerprint(_discoveryMainThread->_dataFingerprint);
     }
@@ -1109,6 +1186,8 @@ void SyncEngine::finalize(bool success)
 
     csync_commit(_csync_ctx);
     _journal->close();
+    // Not while the sync is starting, when the journal is busiest
+    _journal->startBackgroundIntegrityCheck();
 
     qDebug() << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished"));
     _stopWatch.stop();
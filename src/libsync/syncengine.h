@@ -78,6 +78,17 @@ public:
     bool isSyncRunning() const { return _syncRunning; }
 
     void setSyncOptions(const SyncOptions &options) { _syncOptions = options; }
+
+    /**
+     * Whether the local discovery reads the whole local tree from disk.
+     *
+     * If fromJournal is set, only the directories leading to one of the
+     * paths, or below one, are read from disk and the others are taken
+     * from the journal. The paths are relative to the local folder and must
+     * cover every local change since the last sync, e.g. as reported by a
+     * file system watcher. By default the whole tree is read.
+     */
+    void setLocalDiscoveryOptions(bool fromJournal, const QSet<QString> &paths = QSet<QString>());
     bool ignoreHiddenFiles() const { return _csync_ctx->ignore_hidden_files; }
     void setIgnoreHiddenFiles(bool ignore) { _csync_ctx->ignore_hidden_files = ignore; }
 
@@ -161,11 +172,17 @@ private slots:
     /** Wipes the _touchedFiles hash */
     void slotClearTouchedFiles();
 
+    /** csync must not use the journal connection anymore */
+    void slotJournalConnectionAboutToClose();
+
 private:
     void handleSyncError(CSYNC *ctx, const char *state);
 
     QString journalDbFilePath() const;
 
+    static void lockJournal(void *journal);
+    static void unlockJournal(void *journal);
+
     static int treewalkLocal( TREE_WALK_FILE*, void *);
     static int treewalkRemote( TREE_WALK_FILE*, void *);
     int treewalkFile( TREE_WALK_FILE*, bool );
@@ -248,6 +265,10 @@ private:
     int _downloadLimit;
     SyncOptions _syncOptions;
 
+    // See setLocalDiscoveryOptions()
+    bool _localDiscoveryFromJournal;
+    QSet<QString> _localDiscoveryPaths;
+
     // hash containing the permissions on the remote directory
     QHash<QString, QByteArray> _remotePerms;
 
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncfilestatuscache.h"
+#include "syncjournalfilerecord.h"
+
+#include <QStringList>
+
+namespace OCC {
+
+SyncFileStatusCache::Node::Node()
+    : _excluded(Unknown)
+    , _inJournal(Unknown)
+    , _shared(false)
+    , _childRecordsKnown(false)
+{
+}
+
+SyncFileStatusCache::Node::~Node()
+{
+    qDeleteAll(_children);
+}
+
+SyncFileStatusCache::Node *SyncFileStatusCache::Node::addChild(const QString &name)
+{
+    Node *node = new Node;
+    if (_childRecordsKnown) {
+        node->_inJournal = No;
+    }
+    _children.insert(name, node);
+    return node;
+}
+
+void SyncFileStatusCache::Node::clearChildren()
+{
+    qDeleteAll(_children);
+    _children.clear();
+    _childRecordsKnown = false;
+}
+
+SyncFileStatusCache::SyncFileStatusCache()
+{
+}
+
+SyncFileStatusCache::~SyncFileStatusCache()
+{
+}
+
+const SyncFileStatusCache::Node *SyncFileStatusCache::find(const QString &path, const Node **parent) const
+{
+    if (path.isEmpty()) {
+        return &_root;
+    }
+    const QStringList names = path.split(QLatin1Char('/'));
+    const Node *node = &_root;
+    for (int i = 0; i < names.size(); ++i) {
+        if (parent && i == names.size() - 1) {
+            *parent = node;
+        }
+        node = node->child(names.at(i));
+        if (!node) {
+            return 0;
+        }
+    }
+    return node;
+}
+
+SyncFileStatusCache::Node *SyncFileStatusCache::findOrAdd(const QString &path)
+{
+    if (path.isEmpty()) {
+        return &_root;
+    }
+    Node *node = &_root;
+    foreach (const QString &name, path.split(QLatin1Char('/'))) {
+        Node *child = node->child(name);
+        node = child ? child : node->addChild(name);
+    }
+    return node;
+}
+
+SyncFileStatusCache::Entry SyncFileStatusCache::entry(const QString &path) const
+{
+    Entry entry;
+    const Node *parent = 0;
+    if (const Node *node = find(path, &parent)) {
+        entry._excluded = State(node->_excluded);
+        entry._inJournal = State(node->_inJournal);
+        entry._shared = node->_shared;
+    } else if (parent && parent->_childRecordsKnown) {
+        entry._inJournal = No;
+    }
+    return entry;
+}
+
+void SyncFileStatusCache::setExcluded(const QString &path, bool excluded)
+{
+    findOrAdd(path)->_excluded = excluded ? Yes : No;
+}
+
+void SyncFileStatusCache::setJournalRecord(const QString &path, bool inJournal, bool shared)
+{
+    Node *node = findOrAdd(path);
+    node->_inJournal = inJournal ? Yes : No;
+    node->_shared = shared;
+}
+
+bool SyncFileStatusCache::childRecordsKnown(const QString &directory) const
+{
+    const Node *node = find(directory);
+    return node && node->_childRecordsKnown;
+}
+
+void SyncFileStatusCache::setChildRecords(const QString &directory, const QVector<SyncJournalFileRecord> &records)
+{
+    Node *dir = findOrAdd(directory);
+    foreach (Node *child, dir->_children) {
+        child->_inJournal = No;
+        child->_shared = false;
+    }
+    dir->_childRecordsKnown = true;
+
+    const int prefixLength = directory.isEmpty() ? 0 : directory.length() + 1;
+    foreach (const SyncJournalFileRecord &record, records) {
+        const QString name = record._path.mid(prefixLength);
+        Node *child = dir->child(name);
+        if (!child) {
+            child = dir->addChild(name);
+        }
+        child->_inJournal = Yes;
+        child->_shared = record._remotePerm.contains('S');
+    }
+}
+
+void SyncFileStatusCache::invalidate(const QString &path, bool recursive)
+{
+    if (path.isEmpty()) {
+        if (recursive) {
+            clear();
+        }
+        return;
+    }
+
+    const Node *parent = 0;
+    Node *node = const_cast<Node *>(find(path, &parent));
+    if (!node) {
+        if (!parent || !parent->_childRecordsKnown) {
+            // Nothing is known about it
+            return;
+        }
+        // It may have a record now, unlike the other unknown children of the parent
+        node = const_cast<Node *>(parent)->addChild(path.mid(path.lastIndexOf(QLatin1Char('/')) + 1));
+    }
+    node->_excluded = Unknown;
+    node->_inJournal = Unknown;
+    node->_shared = false;
+    if (recursive) {
+        node->clearChildren();
+    }
+}
+
+void SyncFileStatusCache::clear()
+{
+    _root.clearChildren();
+}
+
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+namespace OCC {
+
+class SyncJournalFileRecord;
+
+/**
+ * @brief What SyncFileStatusTracker knows about the paths, as a tree of their components
+ *
+ * Keeps whether a path is excluded and whether it has a journal record, and
+ * if it is shared, so that the status of a path needs neither the exclude
+ * patterns nor the journal again until something happens to it. The
+ * children of a directory are filled from the journal at once, a path that
+ * is not among them has no record.
+ *
+ * Only used from the thread of the SyncEngine, it does not lock.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT SyncFileStatusCache
+{
+public:
+    enum State {
+        Unknown,
+        No,
+        Yes
+    };
+
+    struct Entry
+    {
+        Entry() : _excluded(Unknown), _inJournal(Unknown), _shared(false) {}
+        State _excluded;
+        State _inJournal;
+        bool _shared;
+    };
+
+    SyncFileStatusCache();
+    ~SyncFileStatusCache();
+
+    /** What is known about a path, not "" */
+    Entry entry(const QString &path) const;
+
+    void setExcluded(const QString &path, bool excluded);
+    void setJournalRecord(const QString &path, bool inJournal, bool shared);
+
+    /** Whether setChildRecords() was called for the directory since it was invalidated */
+    bool childRecordsKnown(const QString &directory) const;
+    /** The journal records of all the children of a directory, "" being the root */
+    void setChildRecords(const QString &directory, const QVector<SyncJournalFileRecord> &records);
+
+    /**
+     * Forgets what is known about a path. With recursive, about everything
+     * below it as well.
+     */
+    void invalidate(const QString &path, bool recursive);
+    void clear();
+
+private:
+    struct Node
+    {
+        Node();
+        ~Node();
+        Node *child(const QString &name) const { return _children.value(name); }
+        Node *addChild(const QString &name);
+        void clearChildren();
+
+        QHash<QString, Node *> _children;
+        quint8 _excluded;
+        quint8 _inJournal;
+        bool _shared;
+        // All the children with a journal record are in _children
+        bool _childRecordsKnown;
+    };
+
+    const Node *find(const QString &path, const Node **parent = 0) const;
+    Node *findOrAdd(const QString &path);
+
+    Node _root;
+};
+
+}
@@ -75,7 +75,10 @@ static inline bool showWarningInSocketApi(const SyncFileItem& item)
 
 SyncFileStatusTracker::SyncFileStatusTracker(SyncEngine *syncEngine)
     : _syncEngine(syncEngine)
+    , _cacheIgnoreHiddenFiles(false)
 {
+    connect(syncEngine, SIGNAL(syncItemDiscovered(const SyncFileItem&)),
+            SLOT(slotItemDiscovered(const SyncFileItem&)));
     connect(syncEngine, SIGNAL(aboutToPropagate(SyncFileItemVector&)),
             SLOT(slotAboutToPropagate(SyncFileItemVector&)));
     connect(syncEngine, SIGNAL(itemCompleted(const SyncFileItemPtr&)),
@@ -83,6 +86,7 @@ SyncFileStatusTracker::SyncFileStatusTracker(SyncEngine *syncEngine)
     connect(syncEngine, SIGNAL(finished(bool)), SLOT(slotSyncFinished()));
     connect(syncEngine, SIGNAL(started()), SLOT(slotSyncEngineRunningChanged()));
     connect(syncEngine, SIGNAL(finished(bool)), SLOT(slotSyncEngineRunningChanged()));
+    connect(&syncEngine->excludedFiles(), SIGNAL(excludesChanged()), SLOT(slotExcludesChanged()));
 }
 
 SyncFileStatus SyncFileStatusTracker::fileStatus(const QString& relativePath)
@@ -100,9 +104,19 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString& relativePath)
     // update the exclude list at runtime and doing it statically here removes
     // our ability to notify changes through the fileStatusChanged signal,
     // it's an acceptable compromize to treat all exclude types the same.
-    if( _syncEngine->excludedFiles().isExcluded(_syncEngine->localPath() + relativePath,
-                                                _syncEngine->localPath(),
-                                                _syncEngine->ignoreHiddenFiles()) ) {
+    if (_cacheIgnoreHiddenFiles != _syncEngine->ignoreHiddenFiles()) {
+        _cache.clear();
+        _cacheIgnoreHiddenFiles = _syncEngine->ignoreHiddenFiles();
+    }
+    SyncFileStatusCache::Entry cached = _cache.entry(relativePath);
+    if (cached._excluded == SyncFileStatusCache::Unknown) {
+        bool excluded = _syncEngine->excludedFiles().isExcluded(_syncEngine->localPath() + relativePath,
+                                                                _syncEngine->localPath(),
+                                                                _cacheIgnoreHiddenFiles);
+        _cache.setExcluded(relativePath, excluded);
+        cached._excluded = excluded ? SyncFileStatusCache::Yes : SyncFileStatusCache::No;
+    }
+    if (cached._excluded == SyncFileStatusCache::Yes) {
         return SyncFileStatus(SyncFileStatus::StatusWarning);
     }
 
@@ -110,9 +124,12 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString& relativePath)
         return SyncFileStatus::StatusSync;
 
     // First look it up in the database to know if it's shared
-    SyncJournalFileRecord rec = _syncEngine->journal()->getFileRecord(relativePath);
-    if (rec.isValid()) {
-        return resolveSyncAndErrorStatus(relativePath, rec._remotePerm.contains("S") ? Shared : NotShared);
+    if (cached._inJournal == SyncFileStatusCache::Unknown) {
+        loadJournalRecords(relativePath);
+        cached = _cache.entry(relativePath);
+    }
+    if (cached._inJournal == SyncFileStatusCache::Yes) {
+        return resolveSyncAndErrorStatus(relativePath, cached._shared ? Shared : NotShared);
     }
 
     // Must be a new file not yet in the database, check if it's syncing or has an error.
@@ -126,6 +143,7 @@ void SyncFileStatusTracker::slotPathTouched(const QString& fileName)
     ASSERT(fileName.startsWith(folderPath));
     QString localPath = fileName.mid(folderPath.size());
     _dirtyPaths.insert(localPath);
+    _cache.invalidate(localPath, false);
 
     emit fileStatusChanged(fileName, SyncFileStatus::StatusSync);
 }
@@ -173,6 +191,12 @@ void SyncFileStatusTracker::decSyncCountAndEmitStatusChanged(const QString &rela
     }
 }
 
+void SyncFileStatusTracker::slotItemDiscovered(const SyncFileItem& item)
+{
+    // Metadata updates are written to the journal during the discovery
+    _cache.invalidate(item._file, false);
+}
+
 void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector& items)
 {
     ASSERT(_syncCount.isEmpty());
@@ -228,6 +252,18 @@ void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
 {
     // qDebug() << Q_FUNC_INFO << item.destination() << item._status << item._instruction;
 
+    // The records of the item may have changed. The ones below a directory only
+    // when it was moved or removed, otherwise its children complete on their own.
+    const bool subtreeChanged = item->_isDirectory
+        && (item->_instruction == CSYNC_INSTRUCTION_REMOVE
+            || item->_instruction == CSYNC_INSTRUCTION_RENAME
+            || item->_instruction == CSYNC_INSTRUCTION_TYPE_CHANGE
+            || item->destination() != item->_file);
+    _cache.invalidate(item->_file, subtreeChanged);
+    if (item->destination() != item->_file) {
+        _cache.invalidate(item->destination(), subtreeChanged);
+    }
+
     if (showErrorInSocketApi(*item)) {
         _syncProblems[item->_file] = SyncFileStatus::StatusError;
         invalidateParentPaths(item->destination());
@@ -263,6 +299,29 @@ void SyncFileStatusTracker::slotSyncEngineRunningChanged()
     emit fileStatusChanged(getSystemDestination(QString()), resolveSyncAndErrorStatus(QString(), NotShared));
 }
 
+void SyncFileStatusTracker::slotExcludesChanged()
+{
+    _cache.clear();
+}
+
+void SyncFileStatusTracker::loadJournalRecords(const QString& relativePath)
+{
+    // A file manager asks for the whole directory, read all of it at once
+    int lastSlashIndex = relativePath.lastIndexOf('/');
+    QString directory = lastSlashIndex == -1 ? QString() : relativePath.left(lastSlashIndex);
+    if (!_cache.childRecordsKnown(directory)) {
+        bool ok = false;
+        QVector<SyncJournalFileRecord> records = _syncEngine->journal()->getChildRecords(directory, &ok);
+        if (ok) {
+            _cache.setChildRecords(directory, records);
+            return;
+        }
+    }
+
+    SyncJournalFileRecord rec = _syncEngine->journal()->getFileRecord(relativePath);
+    _cache.setJournalRecord(relativePath, rec.isValid(), rec._remotePerm.contains("S"));
+}
+
 SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedFlag, PathKnownFlag isPathKnown)
 {
     // If it's a new file and that we're not syncing it yet,
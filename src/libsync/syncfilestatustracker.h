@@ -19,6 +19,7 @@
 #include "ownsql.h"
 #include "syncfileitem.h"
 #include "syncfilestatus.h"
+#include "syncfilestatuscache.h"
 #include <map>
 #include <QSet>
 
@@ -45,16 +46,20 @@ signals:
     void fileStatusChanged(const QString& systemFileName, SyncFileStatus fileStatus);
 
 private slots:
+    void slotItemDiscovered(const SyncFileItem& item);
     void slotAboutToPropagate(SyncFileItemVector& items);
     void slotItemCompleted(const SyncFileItemPtr& item);
     void slotSyncFinished();
     void slotSyncEngineRunningChanged();
+    void slotExcludesChanged();
 
 private:
     enum SharedFlag { UnknownShared, NotShared, Shared };
     enum PathKnownFlag { PathUnknown = 0, PathKnown };
     SyncFileStatus resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedState, PathKnownFlag isPathKnown = PathKnown);
 
+    // Fills the cache for the path from the journal
+    void loadJournalRecords(const QString& relativePath);
     void invalidateParentPaths(const QString& path);
     QString getSystemDestination(const QString& relativePath);
     void incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedState);
@@ -68,6 +73,11 @@ private:
     // We'll show a file/directory as SYNC as long as its sync count is > 0.
     // A directory that starts/ends propagation will in turn increase/decrease its own parent by 1.
     QHash<QString, int> _syncCount;
+
+    // What fileStatus() found in the exclude patterns and in the journal,
+    // for the ignoreHiddenFiles() setting it was filled with
+    SyncFileStatusCache _cache;
+    bool _cacheIgnoreHiddenFiles;
 };
 
 }
@@ -17,6 +17,8 @@
 #include <QDebug>
 #include <QElapsedTimer>
 #include <QUrl>
+#include <QThread>
+#include <qtconcurrentrun.h>
 
 #include "ownsql.h"
 
@@ -33,12 +35,39 @@
 
 namespace OCC {
 
+// How often the full integrity check of a journal that was closed cleanly runs in the background
+static const qint64 integrityCheckIntervalMs = 24 * 60 * 60 * 1000;
+
+// The write-behind queues at most that many records, writes them in batches
+// and commits after that many writes or that much time
+static const int writeBehindQueueSize = 1000;
+static const int writeBehindBatchSize = 100;
+static const int writeBehindCommitWrites = 1000;
+static const qint64 writeBehindCommitMsec = 1000;
+
+class SyncJournalDb::WriteBehindThread : public QThread
+{
+public:
+    explicit WriteBehindThread(SyncJournalDb *journal) : _journal(journal) {}
+
+protected:
+    void run() Q_DECL_OVERRIDE { _journal->writeBehindLoop(); }
+
+private:
+    SyncJournalDb *_journal;
+};
+
 SyncJournalDb::SyncJournalDb(const QString& dbFilePath, QObject *parent) :
     QObject(parent),
     _dbFile(dbFilePath),
-    _transaction(0)
+    _transaction(0),
+    _integrityCheckRequested(false),
+    _walMode(false),
+    _writeBehindStopping(false),
+    _writeBehindFailed(false),
+    _uncommittedWrites(0)
 {
-
+    connect(&_integrityCheckWatcher, SIGNAL(finished()), SLOT(slotIntegrityCheckFinished()));
 }
 
 QString SyncJournalDb::makeDbName(const QUrl& remoteUrl,
@@ -161,18 +190,20 @@ void SyncJournalDb::startTransaction()
     }
 }
 
-void SyncJournalDb::commitTransaction()
+bool SyncJournalDb::commitTransaction()
 {
     if( _transaction == 1 ) {
         if( ! _db.commit() ) {
             qDebug() << "ERROR committing to the database: " << _db.error();
-            return;
+            return false;
         }
         _transaction = 0;
+        _uncommittedWrites = 0;
         // qDebug() << "XXX Transaction END!";
     } else {
         qDebug() << "No database Transaction to commit";
     }
+    return true;
 }
 
 bool SyncJournalDb::sqlFail( const QString& log, const SqlQuery& query )
@@ -180,6 +211,9 @@ bool SyncJournalDb::sqlFail( const QString& log, const SqlQuery& query )
     commitTransaction();
     qWarning() << "SQL Error" << log << query.error();
     ASSERT(false);
+    if( _db.isOpen() ) {
+        emit connectionAboutToClose();
+    }
     _db.close();
     return false;
 }
@@ -212,8 +246,18 @@ bool SyncJournalDb::checkConnect()
         return false;
     }
 
-    // The database file is created by this call (SQLITE_OPEN_CREATE)
-    if( !_db.openOrCreateReadWrite(_dbFile) ) {
+    // The database file is created by this call (SQLITE_OPEN_CREATE).
+    // PRAGMA quick_check reads the whole file, it only runs here if the journal
+    // was not closed cleanly. Otherwise it runs in the background.
+    bool opened = _db.openOrCreateReadWrite(_dbFile, /*checkIntegrity=*/false);
+    if( opened && integrityCheckNeeded() ) {
+        qDebug() << "Checking the integrity of" << _dbFile;
+        _db.close();
+        opened = _db.openOrCreateReadWrite(_dbFile);
+        _integrityCheckRequested = false;
+        _lastIntegrityCheck.start();
+    }
+    if( !opened ) {
         QString error = _db.error();
         qDebug() << "Error opening the db: " << error;
         return false;
@@ -224,6 +268,8 @@ bool SyncJournalDb::checkConnect()
         return false;
     }
 
+    setCleanShutdownMarker(false);
+
     SqlQuery pragma1(_db);
     pragma1.prepare("SELECT sqlite_version();");
     if (!pragma1.exec()) {
@@ -245,6 +291,7 @@ bool SyncJournalDb::checkConnect()
     } else {
         pragma1.next();
         qDebug() << "sqlite3 journal_mode=" << pragma1.stringValue(0);
+        _walMode = pragma1.stringValue(0).compare(QLatin1String("wal"), Qt::CaseInsensitive) == 0;
     }
 
     // For debugging purposes, allow temp_store to be set
@@ -599,6 +646,8 @@ bool SyncJournalDb::checkConnect()
 
 void SyncJournalDb::close()
 {
+    finishWriteBehind();
+
     QMutexLocker locker(&_mutex);
     qDebug() << Q_FUNC_INFO << _dbFile;
 
@@ -626,6 +675,12 @@ void SyncJournalDb::close()
     _setDataFingerprintQuery1.reset(0);
     _setDataFingerprintQuery2.reset(0);
 
+    if( _db.isOpen() ) {
+        emit connectionAboutToClose();
+        if( !_integrityCheckRequested ) {
+            setCleanShutdownMarker(true);
+        }
+    }
     _db.close();
     _avoidReadFromDbOnNextSyncFilter.clear();
 }
@@ -826,10 +881,34 @@ qint64 SyncJournalDb::getPHash(const QString& file)
     return h;
 }
 
-bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
+bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& record )
 {
-    SyncJournalFileRecord record = _record;
+    {
+        QMutexLocker queueLocker(&_queueMutex);
+        if (_writeBehindThread) {
+            while (_writeQueue.size() >= writeBehindQueueSize && !_writeBehindFailed) {
+                _queueNotFull.wait(&_queueMutex);
+            }
+            if (_writeBehindFailed) {
+                return false;
+            }
+            _writeQueue.append(record);
+            auto &queued = _queuedRecords[record._path];
+            queued.first = record;
+            queued.second++;
+            _queueNotEmpty.wakeOne();
+            return true;
+        }
+    }
+
     QMutexLocker locker(&_mutex);
+    writeQueuedRecords();
+    return writeFileRecord(record);
+}
+
+bool SyncJournalDb::writeFileRecord( const SyncJournalFileRecord& _record )
+{
+    SyncJournalFileRecord record = _record;
 
     if (!_avoidReadFromDbOnNextSyncFilter.isEmpty()) {
         // If we are a directory that should not be read from db next time, don't write the etag
@@ -897,6 +976,8 @@ bool SyncJournalDb::deleteFileRecord(const QString& filename, bool recursively)
     QMutexLocker locker(&_mutex);
 
     if( checkConnect() ) {
+        writeQueuedRecords();
+
         // if (!recursively) {
         // always delete the actual file.
 
@@ -934,6 +1015,16 @@ bool SyncJournalDb::deleteFileRecord(const QString& filename, bool recursively)
 
 SyncJournalFileRecord SyncJournalDb::getFileRecord(const QString& filename)
 {
+    {
+        // A queued record is newer than the one in the database. It leaves
+        // the queue only once it was written, with the mutex held.
+        QMutexLocker queueLocker(&_queueMutex);
+        auto it = _queuedRecords.constFind(filename);
+        if (it != _queuedRecords.constEnd()) {
+            return it->first;
+        }
+    }
+
     QMutexLocker locker(&_mutex);
 
     qlonglong phash = getPHash( filename );
@@ -986,6 +1077,45 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord(const QString& filename)
     return rec;
 }
 
+QVector<SyncJournalFileRecord> SyncJournalDb::getChildRecords(const QString& directory, bool *ok)
+{
+    QVector<SyncJournalFileRecord> records;
+    QMutexLocker locker(&_mutex);
+
+    *ok = false;
+    if( !checkConnect() ) {
+        return records;
+    }
+    writeQueuedRecords();
+
+    // Only the direct children are returned, the grandchildren are filtered out by sqlite
+    SqlQuery query(_db);
+    if( directory.isEmpty() ) {
+        query.prepare("SELECT path, type, remotePerm FROM metadata WHERE path NOT LIKE '%/%'");
+    } else {
+        // The paths below the directory, '0' follows '/', the index on path is used
+        query.prepare("SELECT path, type, remotePerm FROM metadata WHERE path > ?1 AND path < ?2"
+                      " AND substr(path, ?3) NOT LIKE '%/%'");
+        query.bindValue(1, QString(directory + QLatin1Char('/')));
+        query.bindValue(2, QString(directory + QLatin1Char('0')));
+        query.bindValue(3, directory.length() + 2);
+    }
+    if (!query.exec()) {
+        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << query.error();
+        return records;
+    }
+
+    while (query.next()) {
+        SyncJournalFileRecord rec;
+        rec._path = query.stringValue(0);
+        rec._type = query.intValue(1);
+        rec._remotePerm = query.baValue(2);
+        records.append(rec);
+    }
+    *ok = true;
+    return records;
+}
+
 bool SyncJournalDb::postSyncCleanup(const QSet<QString>& filepathsToKeep,
                                     const QSet<QString>& prefixesToKeep)
 {
@@ -994,6 +1124,7 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString>& filepathsToKeep,
     if( !checkConnect() ) {
         return false;
     }
+    writeQueuedRecords();
 
     SqlQuery query(_db);
     query.prepare("SELECT phash, path FROM metadata order by path");
@@ -1047,6 +1178,7 @@ int SyncJournalDb::getFileRecordCount()
     if( !checkConnect() ) {
         return -1;
     }
+    writeQueuedRecords();
 
     SqlQuery query(_db);
     query.prepare("SELECT COUNT(*) FROM metadata");
@@ -1076,6 +1208,7 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString& filename,
         qDebug() << "Failed to connect database.";
         return false;
     }
+    writeQueuedRecords();
 
     int checksumTypeId = mapChecksumType(contentChecksumType);
     auto & query = _setFileRecordChecksumQuery;
@@ -1110,6 +1243,7 @@ bool SyncJournalDb::updateLocalMetadata(const QString& filename,
         qDebug() << "Failed to connect database.";
         return false;
     }
+    writeQueuedRecords();
 
     auto & query = _setFileRecordLocalMetadataQuery;
 
@@ -1667,6 +1801,7 @@ void SyncJournalDb::avoidRenamesOnNextSync(const QString& path)
     if( !checkConnect() ) {
         return;
     }
+    writeQueuedRecords();
 
     SqlQuery query(_db);
     query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE path == ?1 OR path LIKE(?2||'/%')");
@@ -1695,6 +1830,7 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QString& fileName)
     if( !checkConnect() ) {
         return;
     }
+    writeQueuedRecords();
 
     SqlQuery query(_db);
     // This query will match entries for which the path is a prefix of fileName
@@ -1717,6 +1853,7 @@ void SyncJournalDb::forceRemoteDiscoveryNextSync()
     if( !checkConnect() ) {
         return;
     }
+    writeQueuedRecords();
 
     forceRemoteDiscoveryNextSyncLocked();
 }
@@ -1850,12 +1987,21 @@ void SyncJournalDb::clearFileTable()
 void SyncJournalDb::commit(const QString& context, bool startTrans)
 {
     QMutexLocker lock(&_mutex);
+    if( startTrans && _transaction == 1 && isWriteBehindRunning() ) {
+        // The write-behind commits it with the next group
+        if( _uncommittedWrites++ == 0 ) {
+            _uncommittedSince.start();
+        }
+        return;
+    }
+    writeQueuedRecords();
     commitInternal(context, startTrans);
 }
 
 void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 {
     QMutexLocker lock(&_mutex);
+    writeQueuedRecords();
     if( _transaction == 1 ) {
         commitInternal(context, true);
     } else {
@@ -1864,14 +2010,259 @@ void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 }
 
 
-void SyncJournalDb::commitInternal(const QString& context, bool startTrans )
+bool SyncJournalDb::commitInternal(const QString& context, bool startTrans )
 {
     qDebug() << Q_FUNC_INFO << "Transaction commit " << context << (startTrans ? "and starting new transaction" : "");
-    commitTransaction();
+    bool ok = commitTransaction();
 
     if( startTrans ) {
         startTransaction();
     }
+    return ok;
+}
+
+void SyncJournalDb::startWriteBehind()
+{
+    QMutexLocker queueLocker(&_queueMutex);
+    if (_writeBehindThread) {
+        return;
+    }
+    qDebug() << "Starting the write-behind of" << _dbFile;
+    _writeBehindFailed = false;
+    _writeBehindThread.reset(new WriteBehindThread(this));
+    _writeBehindThread->start();
+}
+
+bool SyncJournalDb::finishWriteBehind()
+{
+    {
+        QMutexLocker queueLocker(&_queueMutex);
+        if (!_writeBehindThread) {
+            // Nothing was written behind since the last call
+            return true;
+        }
+        _writeBehindStopping = true;
+        _queueNotEmpty.wakeOne();
+    }
+    _writeBehindThread->wait();
+    {
+        QMutexLocker queueLocker(&_queueMutex);
+        _writeBehindThread.reset();
+        _writeBehindStopping = false;
+    }
+
+    QMutexLocker locker(&_mutex);
+    writeQueuedRecords();
+    // Also retries a group commit that failed
+    bool committed = true;
+    if( _uncommittedWrites > 0 || (_transaction == 1 && _writeBehindFailed) ) {
+        committed = commitInternal(QLatin1String("write-behind finished"));
+    }
+
+    QMutexLocker queueLocker(&_queueMutex);
+    const bool ok = committed && !_writeBehindFailed;
+    qDebug() << "Finished the write-behind of" << _dbFile << (ok ? "" : "with errors");
+    // Reported now, the next sync starts without it
+    _writeBehindFailed = false;
+    return ok;
+}
+
+bool SyncJournalDb::isWriteBehindRunning()
+{
+    QMutexLocker queueLocker(&_queueMutex);
+    return !_writeBehindThread.isNull();
+}
+
+void SyncJournalDb::writeQueuedRecords(int maxRecords)
+{
+    QList<SyncJournalFileRecord> batch;
+    {
+        QMutexLocker queueLocker(&_queueMutex);
+        if (_writeQueue.isEmpty()) {
+            return;
+        }
+        if (maxRecords < 0 || _writeQueue.size() <= maxRecords) {
+            batch.swap(_writeQueue);
+        } else {
+            batch = _writeQueue.mid(0, maxRecords);
+            _writeQueue.erase(_writeQueue.begin(), _writeQueue.begin() + maxRecords);
+        }
+        _queueNotFull.wakeAll();
+    }
+
+    // Outside of a transaction every record would be committed on its own
+    if( _transaction == 0 && checkConnect() ) {
+        startTransaction();
+    }
+    bool ok = true;
+    foreach (const SyncJournalFileRecord &record, batch) {
+        ok = writeFileRecord(record) && ok;
+    }
+    if( _uncommittedWrites == 0 ) {
+        _uncommittedSince.start();
+    }
+    _uncommittedWrites += batch.size();
+
+    QMutexLocker queueLocker(&_queueMutex);
+    foreach (const SyncJournalFileRecord &record, batch) {
+        auto it = _queuedRecords.find(record._path);
+        if (--it->second == 0) {
+            _queuedRecords.erase(it);
+        }
+    }
+    if (!ok) {
+        _writeBehindFailed = true;
+        _queueNotFull.wakeAll();
+    }
+}
+
+void SyncJournalDb::writeBehindLoop()
+{
+    forever {
+        {
+            QMutexLocker queueLocker(&_queueMutex);
+            if (_writeQueue.isEmpty()) {
+                if (_writeBehindStopping) {
+                    return;
+                }
+                // Wakes up to commit in time when nothing comes
+                _queueNotEmpty.wait(&_queueMutex, writeBehindCommitMsec);
+            }
+        }
+
+        QMutexLocker locker(&_mutex);
+        writeQueuedRecords(writeBehindBatchSize);
+        if( _uncommittedWrites >= writeBehindCommitWrites
+                || (_uncommittedWrites > 0 && _uncommittedSince.hasExpired(writeBehindCommitMsec)) ) {
+            if( !commitInternal(QLatin1String("write-behind")) ) {
+                QMutexLocker queueLocker(&_queueMutex);
+                _writeBehindFailed = true;
+                _queueNotFull.wakeAll();
+            }
+        }
+    }
+}
+
+/*
+ * The clean shutdown marker lives in the user_version field of the database
+ * header, reading it does not touch the tables. It is 0 while the journal is
+ * open and the schema_version of the database once it was closed cleanly. A
+ * schema that changed after that is a reason for a check as well.
+ */
+bool SyncJournalDb::integrityCheckNeeded()
+{
+    static bool alwaysCheck = qgetenv("OWNCLOUD_JOURNAL_INTEGRITY_CHECK") == "1";
+    if( alwaysCheck || _integrityCheckRequested ) {
+        return true;
+    }
+
+    SqlQuery markerQuery("PRAGMA user_version;", _db);
+    SqlQuery schemaQuery("PRAGMA schema_version;", _db);
+    if( !markerQuery.next() || !schemaQuery.next() ) {
+        return true;
+    }
+
+    int marker = markerQuery.intValue(0);
+    if( marker == 0 ) {
+        qDebug() << "The journal was not closed cleanly";
+        return true;
+    }
+    if( marker != schemaQuery.intValue(0) ) {
+        qDebug() << "The journal schema changed since it was closed";
+        return true;
+    }
+    return false;
+}
+
+void SyncJournalDb::setCleanShutdownMarker(bool clean)
+{
+    int marker = 0;
+    if( clean ) {
+        SqlQuery schemaQuery("PRAGMA schema_version;", _db);
+        if( !schemaQuery.next() ) {
+            return;
+        }
+        marker = schemaQuery.intValue(0);
+    }
+
+    SqlQuery query(_db);
+    query.prepare(QString("PRAGMA user_version = %1;").arg(marker));
+    if( !query.exec() ) {
+        qDebug() << "Could not set the clean shutdown marker of" << _dbFile << query.error();
+    }
+}
+
+// Opening a database read-only runs PRAGMA quick_check on it
+static bool checkJournalIntegrity(const QString &dbFile)
+{
+    SqlDatabase db;
+    bool ok = db.openReadOnly(dbFile);
+    db.close();
+    return ok;
+}
+
+void SyncJournalDb::startBackgroundIntegrityCheck()
+{
+    QMutexLocker locker(&_mutex);
+    // Outside of WAL mode the reading check would block the writes for its whole duration
+    if( !_walMode || _integrityCheckWatcher.isRunning()
+            || (_lastIntegrityCheck.isValid() && !_lastIntegrityCheck.hasExpired(integrityCheckIntervalMs)) ) {
+        return;
+    }
+
+    _lastIntegrityCheck.start();
+    _integrityCheckWatcher.setFuture(QtConcurrent::run(checkJournalIntegrity, _dbFile));
+}
+
+void SyncJournalDb::slotIntegrityCheckFinished()
+{
+    if( _integrityCheckWatcher.result() ) {
+        qDebug() << "Background integrity check of" << _dbFile << "passed";
+        return;
+    }
+    qDebug() << "Background integrity check of" << _dbFile << "failed, checking again when opening it";
+
+    // close() keeps the marker unclean while the journal is open. When it is
+    // closed already, clear the marker so that a restart knows as well.
+    QMutexLocker locker(&_mutex);
+    _integrityCheckRequested = true;
+    if( !_db.isOpen() ) {
+        SqlDatabase db;
+        if( db.openOrCreateReadWrite(_dbFile, /*checkIntegrity=*/false) ) {
+            SqlQuery query(db);
+            query.prepare("PRAGMA user_version = 0;");
+            if( !query.exec() ) {
+                qDebug() << "Could not clear the clean shutdown marker of" << _dbFile << query.error();
+            }
+        }
+        db.close();
+    }
+}
+
+void SyncJournalDb::requestIntegrityCheck()
+{
+    QMutexLocker locker(&_mutex);
+    _integrityCheckRequested = true;
+}
+
+sqlite3 *SyncJournalDb::sqliteConnection()
+{
+    QMutexLocker locker(&_mutex);
+    if( !checkConnect() ) {
+        return 0;
+    }
+    return _db.sqliteDb();
+}
+
+void SyncJournalDb::lockConnection()
+{
+    _mutex.lock();
+    writeQueuedRecords();
+}
+
+void SyncJournalDb::unlockConnection()
+{
+    _mutex.unlock();
 }
 
 SyncJournalDb::~SyncJournalDb()
@@ -18,13 +18,16 @@
 #include <QObject>
 #include <qmutex.h>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
 #include <QHash>
+#include <QWaitCondition>
 
 #include "utility.h"
 #include "ownsql.h"
+#include "syncjournalfilerecord.h"
 
 namespace OCC {
-class SyncJournalFileRecord;
 class SyncJournalErrorBlacklistRecord;
 
 /**
@@ -56,6 +59,13 @@ public:
     /// Like setFileRecord, but preserves checksums
     bool setFileRecordMetadata( const SyncJournalFileRecord& record );
 
+    /**
+     * The records of the direct children of a directory, "" being the root.
+     *
+     * Only _path, _type and _remotePerm are read.
+     */
+    QVector<SyncJournalFileRecord> getChildRecords(const QString& directory, bool *ok);
+
     bool deleteFileRecord( const QString& filename, bool recursively = false );
     int getFileRecordCount();
     bool updateFileRecordChecksum(const QString& filename,
@@ -86,7 +96,7 @@ public:
         UploadInfo() : _chunk(0), _transferid(0), _size(0), _errorCount(0), _valid(false) {}
         int _chunk;
         int _transferid;
-        quint64 _size; //currently unused
+        quint64 _size; // the chunk size of the transfer, old chunking only. 0 if unknown
         QDateTime _modtime;
         int _errorCount;
         bool _valid;
@@ -155,8 +165,54 @@ public:
     void commit(const QString &context, bool startTrans = true);
     void commitIfNeededAndStartNewTransaction(const QString &context);
 
+    /**
+     * Write the file records from a background thread, while a sync propagates.
+     *
+     * Until finishWriteBehind(), setFileRecord() and setFileRecordMetadata() only
+     * queue the record and getFileRecord() returns the queued ones. The other
+     * functions that use the file records write the queue first. The thread
+     * commits after a number of writes or some time, commit() only waits for
+     * that when it does not start a new transaction.
+     */
+    void startWriteBehind();
+
+    /**
+     * Writes and commits the queued records and stops the thread.
+     *
+     * Returns false if a record could not be written or committed since
+     * startWriteBehind(). True when the write-behind is not running.
+     */
+    bool finishWriteBehind();
+
     void close();
 
+    /**
+     * Run the full integrity check (PRAGMA quick_check) the next time the
+     * journal is opened. A journal that fails it is removed and created again.
+     *
+     * Otherwise the check only runs on open if the journal was not closed
+     * cleanly, and once a day in the background.
+     */
+    void requestIntegrityCheck();
+
+    /**
+     * Runs the integrity check in a background thread if it is due. Only in
+     * WAL mode, where it does not block the writes. Called once a sync is over.
+     */
+    void startBackgroundIntegrityCheck();
+
+    /**
+     * The SQLite connection of the journal, opened if needed, or 0 on error.
+     *
+     * It is shared with csync (csync_statedb_borrow_connection). Every use
+     * outside of this class has to be between lockConnection() and
+     * unlockConnection(). connectionAboutToClose() is emitted, with the lock
+     * held, before the connection is closed.
+     */
+    sqlite3 *sqliteConnection();
+    void lockConnection();
+    void unlockConnection();
+
     /**
      * return true if everything is correct
      */
@@ -180,20 +236,34 @@ public:
      */
     void clearFileTable();
 
+signals:
+    void connectionAboutToClose();
+
+private slots:
+    void slotIntegrityCheckFinished();
+
 private:
     bool updateDatabaseStructure();
     bool updateMetadataTableStructure();
     bool updateErrorBlacklistTableStructure();
     bool sqlFail(const QString& log, const SqlQuery &query );
-    void commitInternal(const QString &context, bool startTrans = true);
+    bool commitInternal(const QString &context, bool startTrans = true);
+    bool writeFileRecord(const SyncJournalFileRecord& record);
+    // Writes the queue of the write-behind, at most maxRecords of it. The mutex must be held.
+    void writeQueuedRecords(int maxRecords = -1);
+    bool isWriteBehindRunning();
+    void writeBehindLoop();
     void startTransaction();
-    void commitTransaction();
+    bool commitTransaction();
     QStringList tableColumns( const QString& table );
     bool checkConnect();
 
     // Same as forceRemoteDiscoveryNextSync but without acquiring the lock
     void forceRemoteDiscoveryNextSyncLocked();
 
+    bool integrityCheckNeeded();
+    void setCleanShutdownMarker(bool clean);
+
     // Returns the integer id of the checksum type
     //
     // Returns 0 on failure and for empty checksum types.
@@ -232,6 +302,28 @@ private:
      * that would write the etag and would void the purpose of avoidReadFromDbOnNextSync
      */
     QList<QString> _avoidReadFromDbOnNextSyncFilter;
+
+    bool _integrityCheckRequested;
+    bool _walMode; // the journal mode of the last connection
+    QElapsedTimer _lastIntegrityCheck; // invalid until the first check of this session
+    QFutureWatcher<bool> _integrityCheckWatcher;
+
+    // The write-behind, _queueMutex protects the members below it and is
+    // never locked before _mutex
+    class WriteBehindThread;
+    QScopedPointer<WriteBehindThread> _writeBehindThread;
+    QMutex _queueMutex;
+    QWaitCondition _queueNotEmpty;
+    QWaitCondition _queueNotFull;
+    QList<SyncJournalFileRecord> _writeQueue;
+    // The latest record of a path and how many of its records are queued or being written
+    QHash<QString, QPair<SyncJournalFileRecord, int> > _queuedRecords;
+    bool _writeBehindStopping;
+    bool _writeBehindFailed;
+
+    // Writes in the running transaction that the write-behind has to commit, with the mutex
+    int _uncommittedWrites;
+    QElapsedTimer _uncommittedSince;
 };
 
 bool OWNCLOUDSYNC_EXPORT
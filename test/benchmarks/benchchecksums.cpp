@@ -0,0 +1,115 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtCore>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QThreadPool>
+
+#include "checksums.h"
+#include "filesystem.h"
+#include "propagatorjobs.h"
+
+using namespace OCC;
+
+static void report(const char *what, qint64 bytes, qint64 msec)
+{
+    qDebug() << what << msec << "ms" << (msec > 0 ? bytes / 1024 / 1024 * 1000 / msec : 0) << "MB/s";
+}
+
+static bool writeFile(const QString &path, qint64 size)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    QByteArray block(1024 * 1024, Qt::Uninitialized);
+    for (int i = 0; i < block.size(); ++i) {
+        block[i] = char(qrand());
+    }
+    for (qint64 written = 0; written < size; written += block.size()) {
+        if (file.write(block.constData(), qMin(qint64(block.size()), size - written)) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The files are in the cache after they are written: this measures the computation, not the disk
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QTemporaryDir dir;
+    qint64 megabytes = qgetenv("OWNCLOUD_BENCH_CHECKSUM_MB").toLongLong();
+    if (megabytes <= 0) {
+        megabytes = 256;
+    }
+    const qint64 fileSize = megabytes * 1024 * 1024;
+    const int numFiles = qMax(1, checksumThreadPool()->maxThreadCount()) * 4;
+
+    QStringList files;
+    for (int i = 0; i < numFiles; ++i) {
+        files.append(dir.path() + "/file" + QString::number(i));
+        if (!writeFile(files.last(), fileSize / numFiles)) {
+            qWarning() << "Could not write" << files.last();
+            return -1;
+        }
+    }
+    const QString bigFile = dir.path() + "/big";
+    if (!writeFile(bigFile, fileSize)) {
+        qWarning() << "Could not write" << bigFile;
+        return -1;
+    }
+    qDebug() << "FILE SIZE" << megabytes << "MB";
+
+    QElapsedTimer timer;
+    QList<QByteArray> types;
+    types << checkSumSHA1C << checkSumMD5C;
+#ifdef ZLIB_FOUND
+    types << checkSumAdlerC;
+#endif
+
+    // One thread, one type at a time
+    foreach (const QByteArray &type, types) {
+        timer.start();
+        if (ComputeChecksum::computeNow(bigFile, type).isEmpty()) {
+            return -1;
+        }
+        report(type.constData(), fileSize, timer.elapsed());
+    }
+
+    // One thread, all the types in the same read
+    timer.start();
+    ChecksumStream stream(types);
+    if (!stream.addFromFile(bigFile, fileSize)) {
+        return -1;
+    }
+    report("ALL TYPES ONE READ", fileSize, timer.elapsed());
+
+    // Many files at once in the checksum threads
+    qDebug() << "CHECKSUM THREADS" << checksumThreadPool()->maxThreadCount();
+    timer.start();
+    QList<ComputeChecksum *> computations;
+    int pending = files.size();
+    QEventLoop loop;
+    foreach (const QString &file, files) {
+        auto computation = new ComputeChecksum(&app);
+        computation->setChecksumType(checkSumSHA1C);
+        QObject::connect(computation, &ComputeChecksum::done, [&]() {
+            if (--pending == 0)
+                loop.quit();
+        });
+        computation->start(file);
+        computations.append(computation);
+    }
+    loop.exec();
+    report("SHA1 PARALLEL", fileSize, timer.elapsed());
+    qDeleteAll(computations);
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtCore>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+#include "syncjournaldb.h"
+#include "syncjournalfilerecord.h"
+
+using namespace OCC;
+
+// What the propagation does for every completed tiny file: look at the record,
+// write the new one and commit. Reports the time the calling thread spent and
+// the longest single call.
+static bool run(const char *what, const QString &dbFile, int numFiles, bool writeBehind)
+{
+    SyncJournalDb journal(dbFile);
+    journal.commitIfNeededAndStartNewTransaction("start");
+    if (writeBehind) {
+        journal.startWriteBehind();
+    }
+
+    SyncJournalFileRecord record;
+    record._modtime = QDateTime::currentDateTimeUtc();
+    record._remotePerm = "WDNVR";
+    record._fileSize = 1;
+    record._contentChecksum = "da39a3ee5e6b4b0d3255bfef95601890afd80709";
+    record._contentChecksumType = "SHA1";
+
+    QElapsedTimer timer;
+    QElapsedTimer callTimer;
+    qint64 longestCall = 0;
+    timer.start();
+    for (int i = 0; i < numFiles; ++i) {
+        callTimer.start();
+        record._path = QString("dir%1/file%2").arg(i / 1000).arg(i);
+        record._etag = QByteArray::number(i);
+        record._fileId = QByteArray::number(i) + "oc";
+        journal.getFileRecord(record._path);
+        if (!journal.setFileRecord(record)) {
+            return false;
+        }
+        journal.commit("upload file start");
+        longestCall = qMax(longestCall, callTimer.elapsed());
+    }
+    const qint64 queued = timer.elapsed();
+    bool ok = journal.finishWriteBehind();
+    journal.commit("All Finished.", false);
+    qDebug() << what << timer.elapsed() << "ms," << queued << "ms in the calls, longest call"
+             << longestCall << "ms";
+    ok = ok && journal.getFileRecordCount() == numFiles;
+    journal.close();
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int numFiles = qgetenv("OWNCLOUD_BENCH_JOURNAL_FILES").toInt();
+    if (numFiles <= 0) {
+        numFiles = 100000;
+    }
+    qDebug() << "NUMFILES" << numFiles;
+
+    QTemporaryDir dir;
+    bool ok = run("SYNCHRONOUS", dir.path() + "/sync.db", numFiles, false);
+    ok = ok && run("WRITE-BEHIND", dir.path() + "/writebehind.db", numFiles, true);
+    return ok ? 0 : -1;
+}
@@ -7,6 +7,11 @@
 
 #include "syncenginetestutils.h"
 #include <syncengine.h>
+#include <QElapsedTimer>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
 
 using namespace OCC;
 
@@ -39,5 +44,23 @@ int main(int argc, char *argv[])
 
     qDebug() << "NUMFILES" << numFiles;
     qDebug() << "NUMDIRS" << numDirs;
-    return fakeFolder.syncOnce() ? 0 : -1;
+
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = fakeFolder.syncOnce();
+    qDebug() << "FIRST SYNC" << timer.restart() << "ms";
+
+    // Nothing changed: this one is mostly discovery.
+    // Compare runs with OWNCLOUD_LOCAL_DISCOVERY_THREADS=1 and a higher value.
+    ok = ok && fakeFolder.syncOnce();
+    qDebug() << "NO CHANGE SYNC" << timer.elapsed() << "ms";
+
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // KB on Linux, bytes on OS X
+        qDebug() << "PEAK RSS" << usage.ru_maxrss;
+    }
+#endif
+    return ok ? 0 : -1;
 }
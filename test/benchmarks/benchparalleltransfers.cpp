@@ -0,0 +1,51 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+#include <QElapsedTimer>
+
+using namespace OCC;
+
+// Compare with OWNCLOUD_PARALLEL_TRANSFERS=3, the former fixed number of transfers,
+// and with OWNCLOUD_BENCH_LATENCY_MSEC set to other server latencies.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    int latency = qgetenv("OWNCLOUD_BENCH_LATENCY_MSEC").toInt();
+    if (latency <= 0) {
+        latency = 50;
+    }
+
+    FakeFolder fakeFolder{FileInfo{}};
+    fakeFolder.setResponseDelay(latency);
+
+    int maxParallel = 0;
+    QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress,
+                     [&](const ProgressInfo &progress) {
+        maxParallel = qMax(maxParallel, progress._parallelTransfers);
+    });
+
+    const int numSmallFiles = 500;
+    const int numBigFiles = 20;
+    fakeFolder.localModifier().mkdir("up");
+    for (int i = 0; i < numSmallFiles; ++i) {
+        fakeFolder.localModifier().insert("up/small" + QString::number(i), 100);
+    }
+    fakeFolder.remoteModifier().mkdir("down");
+    for (int i = 0; i < numBigFiles; ++i) {
+        fakeFolder.remoteModifier().insert("down/big" + QString::number(i), 2 * 1000 * 1000);
+    }
+
+    qDebug() << "LATENCY" << latency << "ms";
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = fakeFolder.syncOnce();
+    qDebug() << "SYNC" << timer.elapsed() << "ms";
+    qDebug() << "MAX PARALLEL TRANSFERS" << maxParallel;
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,72 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtCore>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+#include "account.h"
+#include "owncloudpropagator.h"
+#include "syncjournaldb.h"
+
+using namespace OCC;
+
+static SyncFileItemPtr makeItem(const QString &file, bool isDirectory, csync_instructions_e instruction,
+                                SyncFileItem::Direction direction)
+{
+    SyncFileItemPtr item(new SyncFileItem);
+    item->_file = file;
+    item->_isDirectory = isDirectory;
+    item->_type = isDirectory ? SyncFileItem::Directory : SyncFileItem::File;
+    item->_instruction = instruction;
+    item->_direction = direction;
+    return item;
+}
+
+/* numItems items in directories of 100 files. One directory in four was a file
+   that became a directory with new files in it, one file in ten became a directory. */
+static SyncFileItemVector makeItems(int numItems)
+{
+    SyncFileItemVector items;
+    items.reserve(numItems);
+    for (int dir = 0; items.size() < numItems; ++dir) {
+        const QString dirName = QString("dir%1").arg(dir, 6, 10, QChar('0'));
+        const bool typeChange = dir % 4 == 0;
+        items.append(makeItem(dirName, true,
+                              typeChange ? CSYNC_INSTRUCTION_TYPE_CHANGE : CSYNC_INSTRUCTION_NEW,
+                              SyncFileItem::Up));
+        for (int file = 0; file < 100 && items.size() < numItems; ++file) {
+            items.append(makeItem(dirName + QString("/file%1").arg(file, 3, 10, QChar('0')), false,
+                                  file % 10 == 0 ? CSYNC_INSTRUCTION_TYPE_CHANGE : CSYNC_INSTRUCTION_NEW,
+                                  file % 2 ? SyncFileItem::Up : SyncFileItem::Down));
+        }
+    }
+    std::sort(items.begin(), items.end());
+    return items;
+}
+
+// The time per item should stay about the same when the number of items grows
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QTemporaryDir dir;
+    SyncJournalDb journal(dir.path() + "/._sync_bench.db");
+    AccountPtr account = Account::create();
+
+    for (int numItems = 62500; numItems <= 500000; numItems *= 2) {
+        SyncFileItemVector items = makeItems(numItems);
+        OwncloudPropagator propagator(account, dir.path(), "", &journal);
+        QElapsedTimer timer;
+        timer.start();
+        propagator.start(items);
+        const qint64 msec = timer.elapsed();
+        qDebug() << "ITEMS" << numItems << "PLAN" << msec << "ms"
+                 << double(msec) * 1000 / numItems << "us per item";
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtCore>
+#include <QElapsedTimer>
+#include <QLocalSocket>
+#include <QTemporaryDir>
+
+#include "folderman.h"
+#include "account.h"
+#include "accountstate.h"
+#include "configfile.h"
+#include "theme.h"
+#include "creds/httpcredentials.h"
+
+using namespace OCC;
+
+class HttpCredentialsTest : public HttpCredentials {
+public:
+    HttpCredentialsTest(const QString& user, const QString& password)
+        : HttpCredentials(user, password)
+    {}
+
+    void askFromUser() Q_DECL_OVERRIDE {
+
+    }
+};
+
+// Reads the replies of the client until the condition holds for a line. The
+// client runs in this thread, so the events are processed meanwhile.
+template <typename Done>
+static bool readUntil(QLocalSocket &socket, Done done)
+{
+    QElapsedTimer timeout;
+    timeout.start();
+    while (!timeout.hasExpired(60000)) {
+        while (socket.canReadLine()) {
+            QByteArray line = socket.readLine();
+            line.chop(1);
+            if (done(line)) {
+                return true;
+            }
+        }
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+    }
+    return false;
+}
+
+// What a file manager does when it shows a directory: ask for the status of
+// each entry, or of the whole directory at once. Measured up to the last reply.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int numFiles = qgetenv("OWNCLOUD_BENCH_SOCKETAPI_FILES").toInt();
+    if (numFiles <= 0) {
+        numFiles = 20000;
+    }
+    qDebug() << "NUMFILES" << numFiles;
+
+    QTemporaryDir runtimeDir;
+    QTemporaryDir confDir;
+    QTemporaryDir syncDir;
+    qputenv("XDG_RUNTIME_DIR", runtimeDir.path().toLocal8Bit());
+    ConfigFile::setConfDir(confDir.path()); // we don't want to pollute the user's config file
+
+    const QString dirPath = QDir(syncDir.path()).canonicalPath();
+    for (int i = 0; i < numFiles; ++i) {
+        QFile f(dirPath + QString("/file%1.txt").arg(i));
+        if (!f.open(QFile::WriteOnly)) {
+            return -1;
+        }
+        f.write("x");
+    }
+
+    FolderMan folderman;
+    AccountPtr account = Account::create();
+    account->setCredentials(new HttpCredentialsTest("testuser", "secret"));
+    account->setUrl(QUrl("http://example.de"));
+    AccountStatePtr accountState(new AccountState(account));
+
+    FolderDefinition definition;
+    definition.localPath = dirPath;
+    definition.targetPath = dirPath;
+    definition.alias = dirPath;
+    definition.paused = true;
+    if (!folderman.addFolder(accountState.data(), definition)) {
+        return -1;
+    }
+
+    QLocalSocket socket;
+    socket.connectToServer(runtimeDir.path() + "/" + Theme::instance()->appName() + "/socket");
+    QElapsedTimer timer;
+    timer.start();
+    while (socket.state() != QLocalSocket::ConnectedState && !timer.hasExpired(10000)) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+    }
+    if (socket.state() != QLocalSocket::ConnectedState) {
+        qDebug() << "Could not connect" << socket.errorString();
+        return -1;
+    }
+    const QStringList names = QDir(dirPath).entryList(QDir::Files);
+
+    timer.start();
+    QByteArray requests;
+    foreach (const QString &name, names) {
+        requests += "RETRIEVE_FILE_STATUS:" + (dirPath + "/" + name).toUtf8() + "\n";
+    }
+    socket.write(requests);
+    int replies = 0;
+    bool ok = readUntil(socket, [&](const QByteArray &line) {
+        return line.startsWith("STATUS:") && ++replies == names.size();
+    });
+    qDebug() << "RETRIEVE_FILE_STATUS" << timer.elapsed() << "ms," << replies << "replies";
+
+    timer.start();
+    socket.write("RETRIEVE_FILE_STATUSES:" + dirPath.toUtf8() + "\n");
+    int entries = -1;
+    ok = ok && readUntil(socket, [&](const QByteArray &line) {
+        if (entries < 0) {
+            if (line.startsWith("STATUSES:")) {
+                entries = line.split(':').value(1).toInt();
+            }
+            return entries == 0;
+        }
+        return --entries == 0;
+    });
+    qDebug() << "RETRIEVE_FILE_STATUSES" << timer.elapsed() << "ms";
+
+    socket.disconnectFromServer();
+    return ok && replies == numFiles ? 0 : -1;
+}
@@ -15,8 +15,12 @@
 #include <QDir>
 #include <QNetworkReply>
 #include <QMap>
+#include <QTimer>
+#include <QUrlQuery>
 #include <QtTest>
 
+#include <functional>
+
 static const QUrl sRootUrl("owncloud://somehost/owncloud/remote.php/webdav/");
 static const QUrl sRootUrl2("owncloud://somehost/owncloud/remote.php/dav/files/admin/");
 static const QUrl sUploadUrl("owncloud://somehost/owncloud/remote.php/dav/uploads/admin/");
@@ -33,6 +37,15 @@ inline QString getFilePathFromUrl(const QUrl &url) {
 }
 
 
+// Makes the reply respond from the event loop, after the response delay of its FakeQNAM
+inline void respondLater(QObject *reply) {
+    const int delay = reply->parent() ? reply->parent()->property("responseDelay").toInt() : 0;
+    if (delay > 0)
+        QTimer::singleShot(delay, reply, [reply] { QMetaObject::invokeMethod(reply, "respond"); });
+    else
+        QMetaObject::invokeMethod(reply, "respond", Qt::QueuedConnection);
+}
+
 inline QString generateEtag() {
     return QString::number(QDateTime::currentDateTime().toMSecsSinceEpoch(), 16);
 }
@@ -61,6 +74,8 @@ public:
     virtual void remove(const QString &relativePath) = 0;
     virtual void insert(const QString &relativePath, qint64 size = 64, char contentChar = 'W') = 0;
     virtual void setContents(const QString &relativePath, char contentChar) = 0;
+    // Contents that are not one repeated character, to tell the blocks of a file apart
+    virtual void setContentBytes(const QString &relativePath, const QByteArray &contents) = 0;
     virtual void appendByte(const QString &relativePath) = 0;
     virtual void mkdir(const QString &relativePath) = 0;
     virtual void rename(const QString &relativePath, const QString &relativeDestinationDirectory) = 0;
@@ -100,6 +115,12 @@ public:
         file.open(QFile::WriteOnly);
         file.write(QByteArray{}.fill(contentChar, size));
     }
+    void setContentBytes(const QString &relativePath, const QByteArray &contents) override {
+        QFile file{_rootDir.filePath(relativePath)};
+        QVERIFY(file.exists());
+        file.open(QFile::WriteOnly);
+        file.write(contents);
+    }
     void appendByte(const QString &relativePath) override {
         QFile file{_rootDir.filePath(relativePath)};
         QVERIFY(file.exists());
@@ -178,12 +199,23 @@ public:
         FileInfo *file = findInvalidatingEtags(relativePath);
         Q_ASSERT(file);
         file->contentChar = contentChar;
+        file->contents.clear();
+    }
+
+    void setContentBytes(const QString &relativePath, const QByteArray &contents) override {
+        FileInfo *file = findInvalidatingEtags(relativePath);
+        Q_ASSERT(file && !contents.isEmpty());
+        file->contents = contents;
+        file->size = contents.size();
+        file->contentChar = contents.at(0);
     }
 
     void appendByte(const QString &relativePath) override {
         FileInfo *file = findInvalidatingEtags(relativePath);
         Q_ASSERT(file);
         file->size += 1;
+        if (!file->contents.isEmpty())
+            file->contents.append(file->contentChar);
     }
 
     void mkdir(const QString &relativePath) override {
@@ -284,6 +316,8 @@ public:
     QByteArray fileId = generateFileId();
     qint64 size = 0;
     char contentChar = 'W';
+    // When not empty, the actual contents instead of size times contentChar
+    QByteArray contents;
 
     // Sorted by name to be able to compare trees
     QMap<QString, FileInfo> children;
@@ -364,7 +398,7 @@ public:
         xml.writeEndElement(); // multistatus
         xml.writeEndDocument();
 
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        respondLater(this);
     }
 
     Q_INVOKABLE void respond() {
@@ -413,6 +447,7 @@ public:
         if ((fileInfo = remoteRootFileInfo.find(fileName))) {
             fileInfo->size = putPayload.size();
             fileInfo->contentChar = putPayload.at(0);
+            fileInfo->contents.clear();
         } else {
             // Assume that the file is filled with the same character
             fileInfo = remoteRootFileInfo.create(fileName, putPayload.size(), putPayload.at(0));
@@ -422,7 +457,7 @@ public:
             abort();
             return;
         }
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        respondLater(this);
     }
 
     Q_INVOKABLE void respond() {
@@ -459,7 +494,7 @@ public:
             abort();
             return;
         }
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        respondLater(this);
     }
 
     Q_INVOKABLE void respond() {
@@ -487,7 +522,7 @@ public:
         QString fileName = getFilePathFromUrl(request.url());
         Q_ASSERT(!fileName.isEmpty());
         remoteRootFileInfo.remove(fileName);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        respondLater(this);
     }
 
     Q_INVOKABLE void respond() {
@@ -516,7 +551,7 @@ public:
         QString dest = getFilePathFromUrl(QUrl::fromEncoded(request.rawHeader("Destination")));
         Q_ASSERT(!dest.isEmpty());
         remoteRootFileInfo.rename(fileName, dest);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        respondLater(this);
     }
 
     Q_INVOKABLE void respond() {
@@ -535,11 +570,15 @@ class FakeGetReply : public QNetworkReply
 public:
     const FileInfo *fileInfo;
     char payload;
+    QByteArray contents;
     int size;
+    int pos = 0;
     bool aborted = false;
+    qint64 *servedBytes;
 
-    FakeGetReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
-    : QNetworkReply{parent} {
+    FakeGetReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent,
+                 qint64 *servedBytes = nullptr)
+    : QNetworkReply{parent}, servedBytes{servedBytes} {
         setRequest(request);
         setUrl(request.url());
         setOperation(op);
@@ -548,7 +587,7 @@ public:
         QString fileName = getFilePathFromUrl(request.url());
         Q_ASSERT(!fileName.isEmpty());
         fileInfo = remoteRootFileInfo.find(fileName);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        respondLater(this);
     }
 
     Q_INVOKABLE void respond() {
@@ -559,9 +598,21 @@ public:
             return;
         }
         payload = fileInfo->contentChar;
+        contents = fileInfo->contents;
         size = fileInfo->size;
+        // Serve ranges like a real server
+        QRegExp rangeRx("bytes=(\\d+)-(\\d*)");
+        if (rangeRx.exactMatch(QString::fromLatin1(request().rawHeader("Range")))) {
+            int start = rangeRx.cap(1).toInt();
+            int end = rangeRx.cap(2).isEmpty() ? size - 1 : qMin(rangeRx.cap(2).toInt(), size - 1);
+            setRawHeader("Content-Range", QString("bytes %1-%2/%3").arg(start).arg(end).arg(size).toLatin1());
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 206);
+            size = qMax(0, end - start + 1);
+            pos = start;
+        } else {
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        }
         setHeader(QNetworkRequest::ContentLengthHeader, size);
-        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
         setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
         setRawHeader("ETag", fileInfo->etag.toLatin1());
         setRawHeader("OC-FileId", fileInfo->fileId);
@@ -582,8 +633,65 @@ public:
 
     qint64 readData(char *data, qint64 maxlen) override {
         qint64 len = std::min(qint64{size}, maxlen);
-        std::fill_n(data, len, payload);
+        if (contents.isEmpty())
+            std::fill_n(data, len, payload);
+        else
+            std::copy_n(contents.constData() + pos, len, data);
+        pos += len;
         size -= len;
+        if (servedBytes)
+            *servedBytes += len;
+        return len;
+    }
+};
+
+// The block checksums of a file, as a server would compute them
+class FakeBlockMapReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    static const int blockSize = 64 * 1024;
+    QByteArray payload;
+
+    FakeBlockMapReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+    : QNetworkReply{parent} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        const FileInfo *fileInfo = remoteRootFileInfo.find(getFilePathFromUrl(request.url()));
+        Q_ASSERT(fileInfo);
+        const QByteArray contents = fileInfo->contents.isEmpty()
+            ? QByteArray(fileInfo->size, fileInfo->contentChar) : fileInfo->contents;
+        QStringList blocks;
+        for (int pos = 0; pos < contents.size(); pos += blockSize) {
+            blocks.append('"' + QCryptographicHash::hash(contents.mid(pos, blockSize), QCryptographicHash::Sha1).toHex() + '"');
+        }
+        QCryptographicHash whole(QCryptographicHash::Sha1);
+        whole.addData(contents);
+        payload = QString("{ \"size\": %1, \"blockSize\": %2, \"checksum\": \"SHA1:%3\", \"blocks\": [%4] }")
+            .arg(fileInfo->size).arg(blockSize).arg(QString(whole.result().toHex())).arg(blocks.join(",")).toUtf8();
+        setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
+        setRawHeader("ETag", fileInfo->etag.toLatin1());
+        respondLater(this);
+    }
+
+    Q_INVOKABLE void respond() {
+        setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        emit metaDataChanged();
+        emit readyRead();
+        setFinished(true);
+        emit finished();
+    }
+
+    void abort() override { }
+    qint64 bytesAvailable() const override { return payload.size() + QIODevice::bytesAvailable(); }
+    qint64 readData(char *data, qint64 maxlen) override {
+        qint64 len = std::min(qint64{payload.size()}, maxlen);
+        std::copy(payload.cbegin(), payload.cbegin() + len, data);
+        payload.remove(0, static_cast<int>(len));
         return len;
     }
 };
@@ -651,7 +759,7 @@ public:
             abort();
             return;
         }
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        respondLater(this);
     }
 
     Q_INVOKABLE void respond() {
@@ -686,12 +794,17 @@ public:
         setUrl(request.url());
         setOperation(op);
         open(QIODevice::ReadOnly);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        respondLater(this);
     }
 
     Q_INVOKABLE void respond() {
-        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, _httpErrorCode);
-        setError(InternalServerError, "Internal Server Fake Error");
+        if (_httpErrorCode) {
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, _httpErrorCode);
+            setError(InternalServerError, "Internal Server Fake Error");
+        } else {
+            // No response at all
+            setError(UnknownNetworkError, "Fake Network Error");
+        }
         emit metaDataChanged();
         emit finished();
     }
@@ -708,16 +821,32 @@ class FakeQNAM : public QNetworkAccessManager
     FileInfo _uploadFileInfo;
     // maps a path to an HTTP error
     QHash<QString, int> _errorPaths;
+    // the bytes of file content that were sent by GET
+    qint64 _downloadedBytes = 0;
+public:
+    // Sees every request first, replies in place of the fake server if it returns a reply
+    using Override = std::function<QNetworkReply *(Operation, const QNetworkRequest &)>;
+private:
+    Override _override;
 public:
     FakeQNAM(FileInfo initialRoot) : _remoteRootFileInfo{std::move(initialRoot)} { }
     FileInfo &currentRemoteState() { return _remoteRootFileInfo; }
     FileInfo &uploadState() { return _uploadFileInfo; }
+    qint64 &downloadedBytes() { return _downloadedBytes; }
 
     QHash<QString, int> &errorPaths() { return _errorPaths; }
 
+    // Latency of the server: every reply comes after msec milliseconds
+    void setResponseDelay(int msec) { setProperty("responseDelay", msec); }
+    void setOverride(const Override &override) { _override = override; }
+
 protected:
     QNetworkReply *createRequest(Operation op, const QNetworkRequest &request,
                                          QIODevice *outgoingData = 0) {
+        if (_override) {
+            if (auto reply = _override(op, request))
+                return reply;
+        }
         const QString fileName = getFilePathFromUrl(request.url());
         Q_ASSERT(!fileName.isNull());
         if (_errorPaths.contains(fileName))
@@ -730,10 +859,19 @@ protected:
         if (verb == QLatin1String("PROPFIND"))
             // Ignore outgoingData always returning somethign good enough, works for now.
             return new FakePropfindReply{info, op, request, this};
+        else if ((verb == QLatin1String("GET") || op == QNetworkAccessManager::GetOperation)
+                 && QUrlQuery(request.url()).hasQueryItem(QStringLiteral("blockmap")))
+            return new FakeBlockMapReply{info, op, request, this};
         else if (verb == QLatin1String("GET") || op == QNetworkAccessManager::GetOperation)
-            return new FakeGetReply{info, op, request, this};
-        else if (verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation)
-            return new FakePutReply{info, op, request, outgoingData->readAll(), this};
+            return new FakeGetReply{info, op, request, this, &_downloadedBytes};
+        else if (verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation) {
+            const qint64 size = outgoingData->size();
+            const QByteArray payload = outgoingData->readAll();
+            // Like QNAM, fails the request when the data could not be read
+            if (payload.size() != size)
+                return new FakeErrorReply{op, request, this, 0};
+            return new FakePutReply{info, op, request, payload, this};
+        }
         else if (verb == QLatin1String("MKCOL"))
             return new FakeMkcolReply{info, op, request, this};
         else if (verb == QLatin1String("DELETE") || op == QNetworkAccessManager::DeleteOperation)
@@ -815,6 +953,9 @@ public:
 
     FileInfo currentRemoteState() { return _fakeQnam->currentRemoteState(); }
     FileInfo &uploadState() { return _fakeQnam->uploadState(); }
+    qint64 &downloadedBytes() { return _fakeQnam->downloadedBytes(); }
+    void setResponseDelay(int msec) { _fakeQnam->setResponseDelay(msec); }
+    void setServerOverride(const FakeQNAM::Override &override) { _fakeQnam->setOverride(override); }
 
     struct ErrorList {
         FakeQNAM *_qnam;
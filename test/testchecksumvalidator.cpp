@@ -150,6 +150,61 @@ using namespace OCC;
 #endif
     }
 
+    void testChecksumStream() {
+        QFile file(_testfile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const QByteArray data = file.readAll();
+        QVERIFY(data.size() > 3000);
+
+        ChecksumStream stream(QList<QByteArray>() << checkSumSHA1C << checkSumMD5C << "Klaas32");
+        stream.addData(0, data.constData(), 1000);
+        // Data that is not next in the file is ignored
+        stream.addData(2000, data.constData() + 2000, 500);
+        QCOMPARE(stream.position(), qint64(1000));
+        // Data hashed already is skipped
+        stream.addData(500, data.constData() + 500, 1500);
+        QCOMPARE(stream.position(), qint64(2000));
+        QVERIFY(stream.addFromFile(_testfile, 3000));
+        QCOMPARE(stream.position(), qint64(3000));
+        stream.addData(3000, data.constData() + 3000, data.size() - 3000);
+        QVERIFY(!stream.addFromFile(_testfile, data.size() + 1));
+
+        QCOMPARE(stream.result(checkSumSHA1C), FileSystem::calcSha1(_testfile));
+        QCOMPARE(stream.result(checkSumMD5C), FileSystem::calcMd5(_testfile));
+        QVERIFY(stream.result("Klaas32").isEmpty());
+    }
+
+    void testDownloadChecksumStream() {
+        QFile file(_testfile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const QByteArray data = file.readAll();
+
+        ChecksumStream stream(QList<QByteArray>() << checkSumSHA1C);
+        stream.addData(0, data.constData(), 100);
+        // A download that restarts from scratch
+        stream.reset();
+        QCOMPARE(stream.position(), qint64(0));
+        stream.addData(0, data.constData(), data.size());
+
+        // The streamed checksum is used, the file is not read
+        const QString missingFile = _root + "/doesNotExist";
+        _successDown = false;
+        ValidateChecksumHeader vali;
+        connect(&vali, SIGNAL(validated(QByteArray,QByteArray)), this, SLOT(slotDownValidated()));
+        connect(&vali, SIGNAL(validationFailed(QString)), this, SLOT(slotDownError(QString)));
+        vali.start(missingFile, makeChecksumHeader(checkSumSHA1C, FileSystem::calcSha1(_testfile)), stream);
+        QVERIFY(_successDown);
+
+        _expectedError = QLatin1String("The downloaded file does not match the checksum, it will be resumed.");
+        _errorSeen = false;
+        vali.start(missingFile, "SHA1:543345", stream);
+        QVERIFY(_errorSeen);
+
+        // A type that was not streamed is computed from the file
+        _successDown = false;
+        vali.start(_testfile, makeChecksumHeader(checkSumMD5C, FileSystem::calcMd5(_testfile)), stream);
+        QTRY_VERIFY(_successDown);
+    }
 
     void cleanupTestCase() {
     }
@@ -8,6 +8,8 @@
 #include <QtTest>
 #include "syncenginetestutils.h"
 #include <syncengine.h>
+#include <chunksizecontroller.h>
+#include <syncjournalfilerecord.h>
 
 using namespace OCC;
 
@@ -36,8 +38,11 @@ static void partialUpload(FakeFolder &fakeFolder, const QString &name, int size)
 
     QCOMPARE(fakeFolder.uploadState().children.count(), 1); // the transfer was done with chunking
     auto upStateChildren = fakeFolder.uploadState().children.first().children;
-    QCOMPARE(sizeWhenAbort, std::accumulate(upStateChildren.cbegin(), upStateChildren.cend(), 0,
-                                            [](int s, const FileInfo &i) { return s + i.size; }));
+    // The chunks uploaded in parallel may have reached the server before their reply came back
+    int sizeOnServer = std::accumulate(upStateChildren.cbegin(), upStateChildren.cend(), 0,
+                                       [](int s, const FileInfo &i) { return s + i.size; });
+    QVERIFY(sizeWhenAbort <= sizeOnServer);
+    QVERIFY(sizeOnServer < size);
 }
 
 
@@ -56,6 +61,9 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
         QCOMPARE(fakeFolder.uploadState().children.count(), 1); // the transfer was done with chunking
         QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+        // The checksum was computed while the file was uploaded
+        QCOMPARE(fakeFolder.syncEngine().journal()->getFileRecord("A/a0")._contentChecksum,
+                 FileSystem::calcSha1(fakeFolder.localPath() + "A/a0"));
 
         // Check that another upload of the same file also work.
         fakeFolder.localModifier().appendByte("A/a0");
@@ -216,6 +224,70 @@ private slots:
     }
 
 
+    void testParallelUpload() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        const int size = 100 * 1000 * 1000; // 100 MB
+        fakeFolder.localModifier().insert("A/a0", size);
+
+        // When the first chunk is acknowledged, the next ones are already being uploaded
+        int chunksAtFirstProgress = -1;
+        auto con = QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress,
+                                    [&](const ProgressInfo &progress) {
+                if (chunksAtFirstProgress < 0 && progress.completedSize() > 0
+                        && fakeFolder.uploadState().children.count() == 1) {
+                    chunksAtFirstProgress = fakeFolder.uploadState().children.first().children.count();
+                }
+        });
+        QVERIFY(fakeFolder.syncOnce());
+        QObject::disconnect(con);
+        QVERIFY(chunksAtFirstProgress > 1);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+
+        // The same with parallel chunks disabled by the server
+        const QString firstUpload = fakeFolder.uploadState().children.first().name;
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{
+            {"chunking", "1.0"}, {"chunkingParallelUploadDisabled", true} } } });
+        fakeFolder.localModifier().appendByte("A/a0");
+        chunksAtFirstProgress = -1;
+        con = QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress,
+                               [&](const ProgressInfo &progress) {
+                if (chunksAtFirstProgress < 0 && progress.completedSize() > 0
+                        && fakeFolder.uploadState().children.count() == 2) {
+                    for (const auto &upload : fakeFolder.uploadState().children) {
+                        if (upload.name != firstUpload)
+                            chunksAtFirstProgress = upload.children.count();
+                    }
+                }
+        });
+        QVERIFY(fakeFolder.syncOnce());
+        QObject::disconnect(con);
+        QCOMPARE(chunksAtFirstProgress, 1);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size + 1);
+    }
+
+    // A chunk in the middle of an interrupted parallel upload did not make it to the server
+    void testResumeWithHole() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        const int size = 300 * 1000 * 1000; // 300 MB
+        partialUpload(fakeFolder, "A/a0", size);
+        QCOMPARE(fakeFolder.uploadState().children.count(), 1);
+        auto chunkingId = fakeFolder.uploadState().children.first().name;
+        auto &chunks = fakeFolder.uploadState().children.first().children;
+        QVERIFY(chunks.count() > 2);
+        chunks.remove(QString::number(1).rightJustified(8, '0'));
+
+        // The chunks after the hole are uploaded again, the MOVE checks there are no holes left
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+        QCOMPARE(fakeFolder.uploadState().children.count(), 1);
+        QCOMPARE(fakeFolder.uploadState().children.first().name, chunkingId);
+    }
+
     void testResumeServerDeletedChunks() {
 
         FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
@@ -237,6 +309,41 @@ private slots:
         QVERIFY(fakeFolder.uploadState().children.first().name != chunkingId);
     }
 
+    void testAdaptiveChunkSize() {
+        ChunkSizeController fixed(10 * 1000 * 1000);
+        fixed.chunkUploaded(10 * 1000 * 1000, 1);
+        fixed.chunkFailed();
+        QCOMPARE(fixed.chunkSize(), quint64(10 * 1000 * 1000));
+
+        ChunkSizeController controller(10 * 1000 * 1000, 1000 * 1000, 50 * 1000 * 1000, 1000);
+        controller.chunkUploaded(10 * 1000 * 1000, 500); // twice as fast as the target
+        QCOMPARE(controller.chunkSize(), quint64(15 * 1000 * 1000));
+        controller.chunkUploaded(1000, 500); // end of a file, ignored
+        QCOMPARE(controller.chunkSize(), quint64(15 * 1000 * 1000));
+        controller.chunkUploaded(15 * 1000 * 1000, 1);
+        QCOMPARE(controller.chunkSize(), quint64(50 * 1000 * 1000));
+        for (int i = 0; i < 10; ++i)
+            controller.chunkFailed();
+        QCOMPARE(controller.chunkSize(), quint64(1000 * 1000));
+
+        // The fake server answers at once: the chunks grow to the maximum
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        SyncOptions options;
+        options._maxChunkSize = 50 * 1000 * 1000;
+        options._targetChunkUploadDuration = 1000;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        const int size = 300 * 1000 * 1000; // 300 MB
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.uploadState().children.count(), 1);
+        auto chunks = fakeFolder.uploadState().children.first().children;
+        QVERIFY(chunks.count() < 30); // less than with 10 MB chunks
+        QVERIFY(std::any_of(chunks.cbegin(), chunks.cend(),
+                            [](const FileInfo &i) { return i.size == 50 * 1000 * 1000; }));
+    }
+
 };
 
 QTEST_GUILESS_MAIN(TestChunkingNG)
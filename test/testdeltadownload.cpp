@@ -0,0 +1,170 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+static void enableDeltaDownload(FakeFolder &fakeFolder)
+{
+    fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"blockMap", true} } } });
+    SyncOptions options;
+    options._minDeltaDownloadSize = 1000 * 1000;
+    fakeFolder.syncEngine().setSyncOptions(options);
+}
+
+// One block of contents per letter, the blocks differ from each other and
+// the bytes within a block differ as well
+static QByteArray blocks(const QByteArray &letters)
+{
+    QByteArray contents;
+    for (char letter : letters) {
+        QByteArray block;
+        for (int i = 0; block.size() < FakeBlockMapReply::blockSize; ++i)
+            block += letter + QByteArray::number(i) + ' ';
+        block.truncate(FakeBlockMapReply::blockSize);
+        contents += block;
+    }
+    return contents;
+}
+
+static QByteArray localContents(FakeFolder &fakeFolder, const QString &path)
+{
+    QFile file(fakeFolder.localPath() + path);
+    file.open(QFile::ReadOnly);
+    return file.readAll();
+}
+
+class TestDeltaDownload : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    void testAppendedFile() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableDeltaDownload(fakeFolder);
+        const int size = 20 * 1000 * 1000; // 20 MB
+        fakeFolder.remoteModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // There was nothing to reuse
+        QCOMPARE(fakeFolder.downloadedBytes(), qint64(size));
+
+        fakeFolder.downloadedBytes() = 0;
+        fakeFolder.remoteModifier().appendByte("A/a0");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // Only the last block changed
+        QVERIFY(fakeFolder.downloadedBytes() > 0);
+        QVERIFY(fakeFolder.downloadedBytes() <= FakeBlockMapReply::blockSize);
+    }
+
+    void testChangedContent() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableDeltaDownload(fakeFolder);
+        const int size = 5 * 1000 * 1000;
+        fakeFolder.remoteModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+
+        // All the blocks differ: the whole file is fetched
+        fakeFolder.downloadedBytes() = 0;
+        fakeFolder.remoteModifier().setContents("A/a0", 'X');
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.downloadedBytes(), qint64(size));
+    }
+
+    void testChangedAndRelocatedBlocks() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableDeltaDownload(fakeFolder);
+        const qint64 blockSize = FakeBlockMapReply::blockSize;
+        fakeFolder.remoteModifier().insert("A/a0");
+        fakeFolder.remoteModifier().setContentBytes("A/a0", blocks("abcdefghijklmnop"));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(localContents(fakeFolder, "A/a0"), blocks("abcdefghijklmnop"));
+
+        // One block changed in the middle
+        fakeFolder.downloadedBytes() = 0;
+        fakeFolder.remoteModifier().setContentBytes("A/a0", blocks("abcdefgXijklmnop"));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(localContents(fakeFolder, "A/a0"), blocks("abcdefgXijklmnop"));
+        QCOMPARE(fakeFolder.downloadedBytes(), blockSize);
+
+        // Two blocks apart changed: two ranges
+        fakeFolder.downloadedBytes() = 0;
+        fakeFolder.remoteModifier().setContentBytes("A/a0", blocks("abcYefgXijklmZop"));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(localContents(fakeFolder, "A/a0"), blocks("abcYefgXijklmZop"));
+        QCOMPARE(fakeFolder.downloadedBytes(), 2 * blockSize);
+
+        // A block inserted at the start shifts all the others
+        fakeFolder.downloadedBytes() = 0;
+        fakeFolder.remoteModifier().setContentBytes("A/a0", blocks("VabcYefgXijklmZop"));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(localContents(fakeFolder, "A/a0"), blocks("VabcYefgXijklmZop"));
+        QCOMPARE(fakeFolder.downloadedBytes(), blockSize);
+
+        // Reordered blocks are all found locally
+        fakeFolder.downloadedBytes() = 0;
+        fakeFolder.remoteModifier().setContentBytes("A/a0", blocks("poZmlkjiXgfeYcbaV"));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(localContents(fakeFolder, "A/a0"), blocks("poZmlkjiXgfeYcbaV"));
+        QCOMPARE(fakeFolder.downloadedBytes(), qint64(0));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testTemporaryFileRemovedOnFailure() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableDeltaDownload(fakeFolder);
+        fakeFolder.remoteModifier().insert("A/a0");
+        fakeFolder.remoteModifier().setContentBytes("A/a0", blocks("abcdefghijklmnop"));
+        QVERIFY(fakeFolder.syncOnce());
+
+        // The local file changes while the missing block is fetched: the
+        // assembled file must not replace it
+        fakeFolder.remoteModifier().setContentBytes("A/a0", blocks("abcdefgXijklmnop"));
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation, const QNetworkRequest &request) -> QNetworkReply * {
+            if (request.hasRawHeader("Range"))
+                fakeFolder.localModifier().appendByte("A/a0");
+            return nullptr;
+        });
+        fakeFolder.syncOnce();
+        QCOMPARE(localContents(fakeFolder, "A/a0").left(16 * FakeBlockMapReply::blockSize), blocks("abcdefghijklmnop"));
+        QVERIFY(QDir(fakeFolder.localPath() + "A").entryList(QStringList("*.~*"), QDir::Files | QDir::Hidden).isEmpty());
+    }
+
+    void testSmallFileOrNoServerSupport() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableDeltaDownload(fakeFolder);
+        fakeFolder.remoteModifier().insert("A/small", 1000);
+        QVERIFY(fakeFolder.syncOnce());
+
+        // Below the minimum size
+        fakeFolder.downloadedBytes() = 0;
+        fakeFolder.remoteModifier().appendByte("A/small");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.downloadedBytes(), qint64(1001));
+
+        // Without the capability
+        const int size = 5 * 1000 * 1000;
+        fakeFolder.remoteModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        fakeFolder.syncEngine().account()->setCapabilities({});
+        fakeFolder.downloadedBytes() = 0;
+        fakeFolder.remoteModifier().appendByte("A/a0");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.downloadedBytes(), qint64(size + 1));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestDeltaDownload)
+#include "testdeltadownload.moc"
@@ -145,6 +145,15 @@ private slots:
         QVERIFY(waitForPathChanged(file));
     }
 
+    void testCreateAFileInANewDir() {
+        QString dir(_rootPath+"/a2/new_dir");
+        QString file(dir+"/new_file");
+        mkdir(dir);
+        QVERIFY(waitForPathChanged(dir));
+        touch(file);
+        QVERIFY(waitForPathChanged(file));
+    }
+
     void testRemoveADir() {
         QString file(_rootPath+"/a1/b3/c3");
         rmdir(file);
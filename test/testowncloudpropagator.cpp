@@ -9,6 +9,7 @@
 
 #include "propagatedownload.h"
 #include "owncloudpropagator_p.h"
+#include "concurrencycontroller.h"
 
 using namespace OCC;
 namespace OCC {
@@ -76,6 +77,50 @@ private slots:
             QCOMPARE(parseEtag(test.first), QByteArray(test.second));
         }
     }
+
+    void testConcurrencyController()
+    {
+        ConcurrencyController controller(3, 1, 6);
+        QCOMPARE(controller.concurrency(), 3);
+
+        // Small requests that stay as fast as the fastest ones: more in parallel
+        controller.jobFinished(100, 50); // starts the clock
+        for (int i = 0; i < 2 * 3; ++i) {
+            controller.jobFinished(100, 50);
+        }
+        QCOMPARE(controller.concurrency(), 4);
+        for (int i = 0; i < 2 * 4; ++i) {
+            controller.jobFinished(100, 50);
+        }
+        QCOMPARE(controller.concurrency(), 5);
+
+        // A timeout halves it, the other failures of the burst do not
+        controller.jobFailed();
+        QCOMPARE(controller.concurrency(), 2);
+        controller.jobFailed();
+        controller.jobFailed();
+        QCOMPARE(controller.concurrency(), 2);
+
+        // The round of the failure does not increase it, the next failure halves it again
+        for (int i = 0; i < 2 * 2; ++i) {
+            controller.jobFinished(100, 50);
+        }
+        QCOMPARE(controller.concurrency(), 2);
+        controller.jobFailed();
+        QCOMPARE(controller.concurrency(), 1);
+
+        // It never goes above the maximum
+        for (int i = 0; i < 100; ++i) {
+            controller.jobFinished(100, 50);
+        }
+        QCOMPARE(controller.concurrency(), 6);
+
+        // A fixed concurrency
+        ConcurrencyController fixed(2, 2, 2);
+        fixed.jobFinished(100, 50);
+        fixed.jobFailed();
+        QCOMPARE(fixed.concurrency(), 2);
+    }
 };
 
 QTEST_APPLESS_MAIN(TestOwncloudPropagator)
@@ -11,6 +11,20 @@
 
 using namespace OCC;
 
+// Counts the queued calls, like the ones of QTimer::singleShot(0, ...), that reach a class
+class QueuedCallCounter : public QObject
+{
+    const char *_className;
+public:
+    int count = 0;
+    QueuedCallCounter(const char *className) : _className(className) {}
+    bool eventFilter(QObject *watched, QEvent *event) Q_DECL_OVERRIDE {
+        if (event->type() == QEvent::MetaCall && watched->inherits(_className))
+            count++;
+        return false;
+    }
+};
+
 bool itemDidComplete(const QSignalSpy &spy, const QString &path)
 {
     for(const QList<QVariant> &args : spy) {
@@ -121,6 +135,99 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    void testSchedulerIdleWhileSlotsBusy() {
+        FakeFolder fakeFolder{FileInfo{}};
+        // Small downloads are likely finished quickly, so they take all the slots
+        for (int i = 0; i < 12; ++i)
+            fakeFolder.remoteModifier().insert(QString("file%1").arg(i), 1);
+        fakeFolder.setResponseDelay(500);
+
+        // Waking up for the started and finished jobs is fine, spinning until
+        // a slot becomes free is not
+        QueuedCallCounter counter("OCC::OwncloudPropagator");
+        qApp->installEventFilter(&counter);
+        QVERIFY(fakeFolder.syncOnce());
+        qApp->removeEventFilter(&counter);
+        QVERIFY(counter.count < 200);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testLocalDiscoveryFromJournal() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        fakeFolder.localModifier().insert("A/a0");
+        fakeFolder.localModifier().insert("B/b0");
+        fakeFolder.localModifier().mkdir("C/Y");
+        fakeFolder.localModifier().insert("C/Y/c0");
+        fakeFolder.remoteModifier().insert("B/b3");
+
+        // Only A/a0 and C/Y were reported: B is taken from the journal
+        QSet<QString> paths;
+        paths << "A/a0" << "C/Y";
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(true, paths);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/a0"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "C/Y/c0"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "B/b3"));
+        QVERIFY(!itemDidComplete(completeSpy, "B/b0"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("B/b0"));
+
+        // A full local discovery finds it
+        completeSpy.clear();
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(false);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "B/b0"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testRemoteDiscoveryPrefetch() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        SyncOptions options;
+        options._remoteDiscoveryJobs = 3;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        // A new tree, and changes deep below the existing directories
+        fakeFolder.remoteModifier().mkdir("N");
+        for (int i = 0; i < 6; ++i) {
+            QString dir = QString("N/%1").arg(i);
+            fakeFolder.remoteModifier().mkdir(dir);
+            fakeFolder.remoteModifier().mkdir(dir + "/deep");
+            fakeFolder.remoteModifier().insert(dir + "/deep/n0");
+        }
+        fakeFolder.remoteModifier().mkdir("A/Y");
+        fakeFolder.remoteModifier().insert("A/Y/a0");
+        fakeFolder.remoteModifier().insert("B/b3");
+        fakeFolder.remoteModifier().appendByte("C/c1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // An error for a directory that was listed ahead of time is reported for it,
+        // and directories excluded by the selective sync are not entered
+        fakeFolder.remoteModifier().insert("N/2/deep/n1");
+        fakeFolder.remoteModifier().insert("N/4/deep/n1");
+        fakeFolder.remoteModifier().insert("S/s3");
+        fakeFolder.serverErrorPaths().append("N/2/deep", 403);
+        fakeFolder.syncEngine().journal()->setSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList,
+                                                                {"S/"});
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        fakeFolder.syncOnce();
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "N/4/deep/n1"));
+        QVERIFY(!fakeFolder.currentLocalState().find("N/2/deep/n1"));
+        QVERIFY(!fakeFolder.currentLocalState().find("S/s3"));
+    }
+
+    void testLocalDiscoveryKeepsIgnoredFiles() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        // Hidden files are ignored; the watcher does not report ignored files
+        fakeFolder.localModifier().insert("B/.hidden");
+        fakeFolder.remoteModifier().remove("B");
+
+        // B is taken from the journal, but its ignored file is on disk
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(true);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(QFileInfo(fakeFolder.localPath() + "B/.hidden").exists());
+    }
+
     void testRemoteChangeInMovedFolder() {
         // issue #5192
         FakeFolder fakeFolder{FileInfo{ QString(), {
@@ -225,6 +332,114 @@ private slots:
         QCOMPARE(finishedSpy.first().first().toBool(), false);
     }
 
+    void testDirectoryBeforeContent() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.localModifier().mkdir("Y");
+        fakeFolder.localModifier().mkdir("Y/Z");
+        fakeFolder.localModifier().insert("Y/y0");
+        fakeFolder.remoteModifier().mkdir("W");
+        fakeFolder.remoteModifier().mkdir("W/X");
+        for (int i = 0; i < 10; ++i) {
+            fakeFolder.localModifier().insert("Y/Z/z" + QString::number(i));
+            fakeFolder.remoteModifier().insert("W/X/x" + QString::number(i));
+        }
+
+        QSet<QString> completed;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&](const SyncFileItemPtr &item) {
+            completed.insert(item->destination());
+        });
+        // No request inside a directory before the directory was created
+        int checked = 0;
+        bool ordered = true;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation, const QNetworkRequest &request) -> QNetworkReply * {
+            const QString path = getFilePathFromUrl(request.url());
+            const QByteArray verb = request.attribute(QNetworkRequest::CustomVerbAttribute).toByteArray();
+            // The discovery runs before the propagation
+            if (verb != "PROPFIND" && (path.startsWith("Y/") || path.startsWith("W/"))) {
+                for (int slash = path.indexOf('/'); slash > 0; slash = path.indexOf('/', slash + 1)) {
+                    ordered = ordered && completed.contains(path.left(slash));
+                }
+                checked++;
+            }
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(ordered);
+        QCOMPARE(checked, 22); // MKCOL Y/Z, PUT Y/y0, 10 PUT Y/Z/z*, 10 GET W/X/x*
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testWaitForFinished() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        // The move of a directory lets no other job start until it is done
+        fakeFolder.localModifier().rename("A", "A2");
+        fakeFolder.localModifier().insert("B/b0");
+        fakeFolder.localModifier().insert("C/c0");
+        fakeFolder.remoteModifier().insert("S/s0");
+
+        QSet<QString> completed;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&](const SyncFileItemPtr &item) {
+            completed.insert(item->destination());
+        });
+        bool moveStarted = false;
+        int afterMove = 0;
+        bool waited = true;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation, const QNetworkRequest &request) -> QNetworkReply * {
+            const QString path = getFilePathFromUrl(request.url());
+            const QByteArray verb = request.attribute(QNetworkRequest::CustomVerbAttribute).toByteArray();
+            if (verb == "MOVE" && path == "A") {
+                moveStarted = true;
+            } else if (moveStarted) {
+                waited = waited && completed.contains("A2");
+                afterMove++;
+            }
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(moveStarted);
+        QVERIFY(afterMove > 0);
+        QVERIFY(waited);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testLocalChangeDuringUpload() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.localModifier().insert("A/a0");
+
+        // The file grows once its upload started
+        bool changed = false;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            const QByteArray verb = request.attribute(QNetworkRequest::CustomVerbAttribute).toByteArray();
+            if ((verb == "PUT" || op == QNetworkAccessManager::PutOperation)
+                    && getFilePathFromUrl(request.url()) == "A/a0" && !changed) {
+                changed = true;
+                fakeFolder.localModifier().appendByte("A/a0");
+            }
+            return nullptr;
+        });
+
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        fakeFolder.syncOnce();
+        QVERIFY(changed);
+        SyncFileItem::Status status = SyncFileItem::NoStatus;
+        for (const QList<QVariant> &args : completeSpy) {
+            auto item = args[0].value<SyncFileItemPtr>();
+            if (item->destination() == "A/a0")
+                status = item->_status;
+        }
+        // Not uploaded, not a fatal error, and tried again
+        QCOMPARE(status, SyncFileItem::SoftError);
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/a0"));
+        QVERIFY(fakeFolder.syncEngine().isAnotherSyncNeeded() != NoFollowUpSync);
+
+        completeSpy.clear();
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/a0"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     void testDirDownloadWithError() {
         FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
         QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
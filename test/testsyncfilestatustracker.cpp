@@ -438,6 +438,33 @@ private slots:
 
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
+
+    void cachedStatusFollowsChanges() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        SyncFileStatusTracker &tracker = fakeFolder.syncEngine().syncFileStatusTracker();
+        QCOMPARE(tracker.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("A/a0"), SyncFileStatus(SyncFileStatus::StatusNone));
+        QCOMPARE(tracker.fileStatus("S/s1").sharedWithMe(), true);
+
+        // New and removed records are seen
+        fakeFolder.remoteModifier().insert("A/a0");
+        fakeFolder.localModifier().remove("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(tracker.fileStatus("A/a0"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusNone));
+
+        // So are the records below a renamed directory
+        fakeFolder.localModifier().rename("B", "B2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(tracker.fileStatus("B/b1"), SyncFileStatus(SyncFileStatus::StatusNone));
+        QCOMPARE(tracker.fileStatus("B2/b1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+
+        // And new exclude patterns
+        fakeFolder.syncEngine().excludedFiles().addExcludeExpr("A/a2");
+        QCOMPARE(tracker.fileStatus("A/a2"), SyncFileStatus(SyncFileStatus::StatusWarning));
+        fakeFolder.syncEngine().excludedFiles().reloadExcludes();
+        QCOMPARE(tracker.fileStatus("A/a2"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncFileStatusTracker)
@@ -28,6 +28,21 @@ public:
         return Utility::qDateTimeFromTime_t(Utility::qDateTimeToTime_t(time));
     }
 
+    int pragmaValue(const char *pragma)
+    {
+        sqlite3 *db = 0;
+        sqlite3_stmt *stmt = 0;
+        int value = -1;
+        if (sqlite3_open_v2(_db.databaseFilePath().toUtf8().constData(), &db, SQLITE_OPEN_READONLY, 0) == SQLITE_OK
+                && sqlite3_prepare_v2(db, pragma, -1, &stmt, 0) == SQLITE_OK
+                && sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return value;
+    }
+
 private slots:
 
     void initTestCase()
@@ -164,6 +179,104 @@ private slots:
         QVERIFY(!wipedRecord._valid);
     }
 
+    void testCleanShutdownMarker()
+    {
+        // The marker is unset while the journal is open
+        QVERIFY(_db.isConnected());
+        QCOMPARE(pragmaValue("PRAGMA user_version;"), 0);
+
+        _db.close();
+        int schemaVersion = pragmaValue("PRAGMA schema_version;");
+        QVERIFY(schemaVersion > 0);
+        QCOMPARE(pragmaValue("PRAGMA user_version;"), schemaVersion);
+
+        // A requested check runs on open and keeps the contents of a healthy journal
+        _db.requestIntegrityCheck();
+        QVERIFY(_db.getFileRecord("foo-checksum").isValid());
+        _db.close();
+        QCOMPARE(pragmaValue("PRAGMA user_version;"), schemaVersion);
+    }
+
+    void testWriteBehind()
+    {
+        _db.startWriteBehind();
+
+        // More records than the queue takes
+        SyncJournalFileRecord record;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._remotePerm = "744";
+        for (int i = 0; i < 3000; ++i) {
+            record._path = QString("writebehind/file%1").arg(i);
+            record._etag = "first";
+            QVERIFY(_db.setFileRecord(record));
+        }
+        record._path = "writebehind/file2999";
+        record._etag = "second";
+        QVERIFY(_db.setFileRecord(record));
+
+        // The latest record is seen, whether or not it was written yet
+        QCOMPARE(_db.getFileRecord("writebehind/file2999")._etag, QByteArray("second"));
+        QCOMPARE(_db.getFileRecord("writebehind/file0")._etag, QByteArray("first"));
+
+        // The metadata update keeps the checksum of the queued record
+        record._path = "writebehind/file1";
+        record._contentChecksum = "mychecksum";
+        record._contentChecksumType = "MD5";
+        QVERIFY(_db.setFileRecord(record));
+        record._contentChecksum.clear();
+        record._contentChecksumType.clear();
+        record._etag = "third";
+        QVERIFY(_db.setFileRecordMetadata(record));
+        SyncJournalFileRecord storedRecord = _db.getFileRecord("writebehind/file1");
+        QCOMPARE(storedRecord._etag, QByteArray("third"));
+        QCOMPARE(storedRecord._contentChecksum, QByteArray("mychecksum"));
+
+        // A deletion comes after the queued records
+        QVERIFY(_db.deleteFileRecord("writebehind/file2"));
+        QVERIFY(!_db.getFileRecord("writebehind/file2").isValid());
+
+        // Once finished, the records are committed
+        QVERIFY(_db.finishWriteBehind());
+        // Without a write-behind there is nothing that could have failed
+        QVERIFY(_db.finishWriteBehind());
+        QCOMPARE(pragmaValue("SELECT COUNT(*) FROM metadata WHERE path LIKE 'writebehind/%';"), 2999);
+        QCOMPARE(_db.getFileRecord("writebehind/file2999")._etag, QByteArray("second"));
+        QCOMPARE(_db.getFileRecord("writebehind/file1")._contentChecksumType, QByteArray("MD5"));
+
+        QVERIFY(_db.deleteFileRecord("writebehind", true));
+        QCOMPARE(_db.getFileRecordCount(), 2);
+    }
+
+    void testChildRecords()
+    {
+        SyncJournalFileRecord record;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        foreach (const QString &path, QStringList() << "children" << "children/a" << "children/b"
+                     << "children/sub" << "children/sub/c" << "children/sub/d" << "childrenX") {
+            record._path = path;
+            QVERIFY(_db.setFileRecord(record));
+        }
+
+        // Only the direct children, not the grandchildren or the paths that share the prefix
+        bool ok = false;
+        QStringList paths;
+        foreach (const SyncJournalFileRecord &child, _db.getChildRecords("children", &ok)) {
+            paths.append(child._path);
+        }
+        QVERIFY(ok);
+        paths.sort();
+        QCOMPARE(paths, QStringList() << "children/a" << "children/b" << "children/sub");
+
+        foreach (const SyncJournalFileRecord &child, _db.getChildRecords(QString(), &ok)) {
+            QVERIFY(!child._path.contains('/'));
+        }
+        QVERIFY(ok);
+
+        QVERIFY(_db.deleteFileRecord("children", true));
+        QVERIFY(_db.deleteFileRecord("childrenX"));
+        QCOMPARE(_db.getFileRecordCount(), 2);
+    }
+
 private:
     SyncJournalDb _db;
 };
@@ -10,6 +10,23 @@
 
 using namespace OCC;
 
+class EntryRecorder : public LsColEntryHandler
+{
+public:
+    QStringList hrefs;
+    QList<QStringList> values;
+
+    void listingEntry(const QString &href, const QString *v) Q_DECL_OVERRIDE
+    {
+        hrefs.append(href);
+        QStringList list;
+        for (int i = 0; i < PropertyCount; ++i) {
+            list.append(v[i]);
+        }
+        values.append(list);
+    }
+};
+
 class TestXmlParse : public QObject
 {
     Q_OBJECT
@@ -18,6 +35,7 @@ private:
   bool _success;
   QStringList _subdirs;
   QStringList _items;
+  QMap<QString, QString> _lastProperties;
 
 public slots:
   void slotDirectoryListingSubFolders(const QStringList& list)
@@ -26,10 +44,11 @@ public slots:
      _subdirs.append(list);
   }
 
-  void slotDirectoryListingIterated(const QString& item, const QMap<QString,QString>& )
+  void slotDirectoryListingIterated(const QString& item, const QMap<QString,QString>& properties)
   {
     qDebug() << "     item: " << item;
     _items.append(item);
+    _lastProperties = properties;
   }
 
   void slotFinishedSuccessfully()
@@ -439,6 +458,150 @@ private slots:
         QVERIFY(_subdirs.size() == 1);
     }
 
+    void testParserIncremental() {
+        const QByteArray firstResponse = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:permissions>RDNVCK</oc:permissions>"
+              "<oc:size>121780</oc:size>"
+              "<d:resourcetype>"
+              "<d:collection/>"
+              "</d:resourcetype>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>";
+        const QByteArray rest =
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/\xc3\xa4.pdf</d:href>" // a-umlaut utf8, split below
+              "<d:propstat>"
+              "<d:prop>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
+                 this, SLOT(slotDirectoryListingSubFolders(const QStringList&)) );
+        connect( &parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
+                 this, SLOT(slotDirectoryListingIterated(const QString&, const QMap<QString,QString>&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        QHash <QString, qint64> sizes;
+        parser.begin(&sizes, "/oc/remote.php/webdav/sharefolder");
+
+        // A response is emitted as soon as it is complete
+        for (int i = 0; i < firstResponse.size(); i += 3) {
+            QVERIFY(parser.addData(firstResponse.mid(i, 3)));
+        }
+        QCOMPARE(_items, QStringList("/oc/remote.php/webdav/sharefolder"));
+        QVERIFY(!_success);
+
+        for (int i = 0; i < rest.size(); i += 3) {
+            QVERIFY(parser.addData(rest.mid(i, 3)));
+        }
+        QVERIFY(parser.end());
+        QVERIFY(_success);
+
+        QCOMPARE(_items.size(), 2);
+        QCOMPARE(_items.at(1), QString::fromUtf8("/oc/remote.php/webdav/sharefolder/ä.pdf"));
+        QCOMPARE(_lastProperties.value("getetag"), QString("\"2fa2f0d9ed49ea0c3e409d49e652dea0\""));
+        QCOMPARE(_lastProperties.value("getcontentlength"), QString("121780"));
+        QCOMPARE(sizes.value("/oc/remote.php/webdav/sharefolder/"), qint64(121780));
+        QCOMPARE(_subdirs, QStringList("/oc/remote.php/webdav/sharefolder/"));
+
+        // A document that stops in the middle is an error
+        parser.begin(&sizes, "/oc/remote.php/webdav/sharefolder");
+        QVERIFY(parser.addData(firstResponse));
+        QVERIFY(!parser.end());
+    }
+
+    void testParserEntryHandler() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:permissions>RDNVCK</oc:permissions>"
+              "<oc:size>121780</oc:size>"
+              "<d:resourcetype>"
+              "<d:collection/>"
+              "</d:resourcetype>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/quitte.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<oc:permissions/>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "<oc:unknown>ignored</oc:unknown>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:downloadURL>not found</oc:downloadURL>"
+              "<oc:dDC/>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 404 Not Found</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
+                 this, SLOT(slotDirectoryListingSubFolders(const QStringList&)) );
+        connect( &parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
+                 this, SLOT(slotDirectoryListingIterated(const QString&, const QMap<QString,QString>&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+        EntryRecorder recorder;
+        parser.setEntryHandler(&recorder);
+
+        QHash <QString, qint64> sizes;
+        QVERIFY(parser.parse( testXml, &sizes, "/oc/remote.php/webdav/sharefolder" ));
+        QVERIFY(_success);
+        QVERIFY(_items.isEmpty()); // the handler gets the entries instead
+        QCOMPARE(sizes.value("/oc/remote.php/webdav/sharefolder/"), qint64(121780));
+        QCOMPARE(_subdirs, QStringList("/oc/remote.php/webdav/sharefolder/"));
+
+        QCOMPARE(recorder.hrefs, QStringList() << "/oc/remote.php/webdav/sharefolder"
+                                               << "/oc/remote.php/webdav/sharefolder/quitte.pdf");
+        const QStringList &dir = recorder.values.at(0);
+        QCOMPARE(dir.at(LsColEntryHandler::Permissions), QString("RDNVCK"));
+        QVERIFY(dir.at(LsColEntryHandler::ResourceType).contains("collection"));
+        QVERIFY(dir.at(LsColEntryHandler::GetETag).isNull());
+
+        const QStringList &file = recorder.values.at(1);
+        QCOMPARE(file.at(LsColEntryHandler::Id), QString("00004215ocobzus5kn6s"));
+        QCOMPARE(file.at(LsColEntryHandler::GetETag), QString("\"2fa2f0d9ed49ea0c3e409d49e652dea0\""));
+        QCOMPARE(file.at(LsColEntryHandler::GetContentLength), QString("121780"));
+        // Present but empty is not the same as missing
+        QVERIFY(!file.at(LsColEntryHandler::Permissions).isNull());
+        QVERIFY(file.at(LsColEntryHandler::Permissions).isEmpty());
+        QVERIFY(!file.at(LsColEntryHandler::ResourceType).isNull());
+        // The properties of the 404 propstat are missing
+        QVERIFY(file.at(LsColEntryHandler::DownloadURL).isNull());
+        QVERIFY(file.at(LsColEntryHandler::DDC).isNull());
+        QVERIFY(file.at(LsColEntryHandler::Size).isNull());
+    }
+
 };
 
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)